@@ -148,3 +148,146 @@ xor ebx, ebx
 int 80h
 
 
+
+
+section .spasm_cnt
+spasm_cnt:
+; inc dword [counter] in the SIB form NASM only emits for 64 bit code.
+; commands64.asm uses the same encoding so the counter address is
+; replaced at the same offset on both targets.
+db 0xff, 0x04, 0x25
+dd 0
+
+
+
+section .spasm_jnz
+spasm_jnz:
+; Inverted JIN used by the block layout. Same layout as spasm_jin.
+pop eax
+and eax, eax
+jnz 0xDEADBEAF
+
+
+
+section .spasm_rmw_inc
+spasm_rmw_inc:
+; In-place variable updates fused from LA/LV/LC/<op>/LA/STR. All of
+; them use the SIB absolute form like spasm_cnt, the variable address is
+; replaced at offset 3, the immediate follows it at offset 7.
+db 0xff, 0x04, 0x25
+dd 0
+
+
+
+section .spasm_rmw_dec
+spasm_rmw_dec:
+db 0xff, 0x0c, 0x25
+dd 0
+
+
+
+section .spasm_rmw_add8
+spasm_rmw_add8:
+db 0x83, 0x04, 0x25
+dd 0
+db 0
+
+
+
+section .spasm_rmw_add32
+spasm_rmw_add32:
+db 0x81, 0x04, 0x25
+dd 0
+dd 0
+
+
+
+section .spasm_rmw_sub8
+spasm_rmw_sub8:
+db 0x83, 0x2c, 0x25
+dd 0
+db 0
+
+
+
+section .spasm_rmw_sub32
+spasm_rmw_sub32:
+db 0x81, 0x2c, 0x25
+dd 0
+dd 0
+
+
+
+section .spasm_rmw_mul8
+spasm_rmw_mul8:
+; imul eax, [variable], imm8 / mov [variable], eax
+db 0x6b, 0x04, 0x25
+dd 0
+db 0
+db 0x89, 0x04, 0x25
+dd 0
+
+
+
+section .spasm_rmw_mul32
+spasm_rmw_mul32:
+db 0x69, 0x04, 0x25
+dd 0
+dd 0
+db 0x89, 0x04, 0x25
+dd 0
+
+
+
+section .spasm_dup
+spasm_dup:
+; Copy of a value further down the stack, created by the value numbering.
+; The displacement is replaced with the distance in bytes from the top.
+push dword [esp+0xDEADBEAF]
+
+
+
+section .spasm_cpy
+spasm_cpy:
+; Copies the words in ascending order like a loop of LV/STR would,
+; the direction flag is clear at process start and in the host.
+; Counts of zero or below copy nothing.
+pop ecx
+pop edi
+pop esi
+test ecx, ecx
+jle .done
+shl edi, 2
+shl esi, 2
+rep movsd
+.done:
+
+
+
+section .spasm_fil
+spasm_fil:
+pop ecx
+pop edi
+pop eax
+test ecx, ecx
+jle .done
+shl edi, 2
+rep stosd
+.done:
+
+
+
+section .spasm_lvx
+spasm_lvx:
+; Indexed LV and STR fused by --indexed. The array address is replaced
+; at the disp32 of the SIB form, the index comes from the stack.
+pop eax
+push dword [eax*4+0xDEADBEAF]
+
+
+
+section .spasm_stx
+spasm_stx:
+pop eax
+pop ebx
+mov [eax*4+0xDEADBEAF], ebx
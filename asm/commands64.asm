@@ -0,0 +1,272 @@
+bits 64
+
+; x86_64 implementations of the SPASM commands. Every stack slot is
+; 8 bytes wide but only the lower 32 bits carry the SPASM value so all
+; arithmetic is done on the 32 bit registers. Relocated operands are kept
+; at the same offsets as in commands.asm.
+
+section .spasm64_add
+spasm64_add:
+pop rbx
+pop rax
+add eax, ebx
+push rax
+
+
+section .spasm64_mul
+spasm64_mul:
+pop rbx
+pop rax
+imul eax, ebx
+push rax
+
+
+section .spasm64_sub
+spasm64_sub:
+pop rbx
+pop rax
+sub eax, ebx
+push rax
+
+
+section .spasm64_div
+spasm64_div:
+pop rbx
+pop rax
+xor edx, edx
+idiv ebx ; idiv edx:eax, ebx
+push rax
+
+
+section .spasm64_les
+spasm64_les:
+pop rbx
+pop rax
+cmp eax, ebx
+jl .less
+push qword 0
+jmp .done
+.less:
+push qword 1
+.done:
+
+
+section .spasm64_and
+spasm64_and:
+pop rbx
+pop rax
+and eax, ebx
+push rax
+
+
+section .spasm64_equ
+spasm64_equ:
+pop rbx
+pop rax
+cmp eax, ebx
+je .equal
+push qword 0
+jmp .done
+.equal:
+push qword 1
+.done:
+
+
+section .spasm64_not ; logical !0 == 1
+spasm64_not:
+pop rax
+xor eax, 1
+push rax
+
+
+section .spasm64_la
+spasm64_la:
+; Real memory location divided by 4 to enable
+; int32 aligned address arithmetic in the
+; client application. Requires storage location
+; to be 4 byte aligned and below 2GB.
+
+push qword 0xFFFFFFFFDEADBEAF
+
+
+section .spasm64_lc
+spasm64_lc:
+push qword 0xFFFFFFFFDEADBEAF
+
+
+section .spasm64_lv
+spasm64_lv:
+pop rax
+; Real memory location was divided by 4 to enable
+; int32 aligned address arithmetic in the
+; client application. Multiply it by 4 to get actual
+; location. The 32 bit shift clears the upper half.
+shl eax, 2
+mov eax, [rax] ; push qword [rax] could read beyond the segment
+push rax
+
+
+section .spasm64_str
+spasm64_str:
+pop rax
+; Real memory location was divided by 4 to enable
+; int32 aligned address arithmetic in the
+; client application. Multiply it by 4 to get actual
+; location
+shl eax, 2
+pop rbx
+mov [rax], ebx
+
+
+section .spasm64_pri
+spasm64_pri:
+pop rax
+call 0xDEADBEAF
+
+
+section .spasm64_rea
+spasm64_rea:
+call 0xDEADBEAF
+push rax
+
+
+section .spasm64_jmp
+spasm64_jmp:
+jmp 0xDEADBEAF
+
+
+section .spasm64_jin
+spasm64_jin:
+pop rax
+and eax, eax
+jz 0xDEADBEAF
+
+
+section .spasm64_nop
+spasm64_nop:
+nop
+
+
+section .spasm64_stp
+spasm64_stp:
+mov eax, 60 ; sys_exit
+xor edi, edi
+syscall
+
+
+
+section .spasm64_cnt
+spasm64_cnt:
+inc dword [abs 0]
+
+
+
+section .spasm64_jnz
+spasm64_jnz:
+pop rax
+and eax, eax
+jnz 0xDEADBEAF
+
+
+
+section .spasm64_rmw_inc
+spasm64_rmw_inc:
+inc dword [abs 0]
+
+
+
+section .spasm64_rmw_dec
+spasm64_rmw_dec:
+dec dword [abs 0]
+
+
+
+section .spasm64_rmw_add8
+spasm64_rmw_add8:
+add dword [abs 0], byte 0
+
+
+
+section .spasm64_rmw_add32
+spasm64_rmw_add32:
+add dword [abs 0], strict dword 0
+
+
+
+section .spasm64_rmw_sub8
+spasm64_rmw_sub8:
+sub dword [abs 0], byte 0
+
+
+
+section .spasm64_rmw_sub32
+spasm64_rmw_sub32:
+sub dword [abs 0], strict dword 0
+
+
+
+section .spasm64_rmw_mul8
+spasm64_rmw_mul8:
+imul eax, [abs 0], byte 0
+mov [abs 0], eax
+
+
+
+section .spasm64_rmw_mul32
+spasm64_rmw_mul32:
+imul eax, [abs 0], strict dword 0
+mov [abs 0], eax
+
+
+
+section .spasm64_dup
+spasm64_dup:
+push qword [rsp+0xDEADBEAF]
+
+
+
+section .spasm64_cpy
+spasm64_cpy:
+; The counts are 32 bit values, the 64 bit rep uses all of rcx.
+pop rcx
+pop rdi
+pop rsi
+mov ecx, ecx
+test ecx, ecx
+jle .done
+shl edi, 2
+shl esi, 2
+rep movsd
+.done:
+
+
+
+section .spasm64_fil
+spasm64_fil:
+pop rcx
+pop rdi
+pop rax
+mov ecx, ecx
+test ecx, ecx
+jle .done
+shl edi, 2
+rep stosd
+.done:
+
+
+
+section .spasm64_lvx
+spasm64_lvx:
+; The address size prefix wraps the element address at 32 bit like the
+; shl of LV, so an index below the array addresses the same memory.
+pop rax
+mov eax, [eax*4+0xDEADBEAF]
+push rax
+
+
+
+section .spasm64_stx
+spasm64_stx:
+pop rax
+pop rbx
+mov [eax*4+0xDEADBEAF], ebx
@@ -0,0 +1,41 @@
+bits 32
+
+; Exit sequence of binaries written with --instrument. STP commands jump
+; here instead of exiting directly. The block table and the block counters
+; are written to the profile file before the program exits.
+
+section .rodata
+path: db "spasm.prof", 0
+
+table: dd 0 ; magic, block count, source line per block
+.len: equ $-table
+
+section .bss
+counters: resd 1
+.len: equ $-counters
+
+section .spasm_dump
+spasm_dump:
+mov eax, 5 ; sys_open
+mov ebx, path
+mov ecx, 0x241 ; O_WRONLY | O_CREAT | O_TRUNC
+mov edx, 0x1a4 ; 0644
+int 80h
+
+mov ebx, eax ; Failed opens make the writes fail as well
+mov eax, 4 ; sys_write
+mov ecx, table
+mov edx, table.len
+int 80h
+
+mov eax, 4 ; sys_write
+mov ecx, counters
+mov edx, counters.len
+int 80h
+
+mov eax, 6 ; sys_close
+int 80h
+
+mov eax, 1 ; sys_exit
+xor ebx, ebx
+int 80h
@@ -0,0 +1,40 @@
+bits 64
+
+; x86_64 port of instrument.asm. Relocated values are kept at the same
+; offsets as in instrument.asm.
+
+section .rodata
+path: db "spasm.prof", 0
+
+table: dd 0 ; magic, block count, source line per block
+.len: equ $-table
+
+section .bss
+counters: resd 1
+.len: equ $-counters
+
+section .spasm64_dump
+spasm64_dump:
+mov eax, 2 ; sys_open
+mov edi, path
+mov esi, 0x241 ; O_WRONLY | O_CREAT | O_TRUNC
+mov edx, 0x1a4 ; 0644
+syscall
+
+mov edi, eax ; Failed opens make the writes fail as well
+mov eax, 1 ; sys_write
+mov esi, table
+mov edx, table.len
+syscall
+
+mov eax, 1 ; sys_write
+mov esi, counters
+mov edx, counters.len
+syscall
+
+mov eax, 3 ; sys_close
+syscall
+
+mov eax, 60 ; sys_exit
+xor edi, edi
+syscall
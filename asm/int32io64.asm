@@ -0,0 +1,157 @@
+bits 64
+
+; x86_64 port of int32io.asm. Uses the syscall instruction instead of
+; int 80h. All buffers have to be located below 4GB as they are addressed
+; through 32 bit registers.
+
+section .rodata
+prompt:	db "> "
+.len: equ $-prompt
+
+nanm: db "Invalid input. Please enter an integer.", 10
+.len: equ $-nanm
+
+ofm: db "Number too large. Must be between -/+ (2 ^ 31 - 1).", 10
+.len: equ $-ofm
+
+section .bss
+strbuf: resb 255
+.len: equ $-strbuf
+
+section .spasm64_readint32
+
+; Function for reading a 32bit integer value from stdin.
+; Used registers: rax, rbx, rcx, rdx, rsi, rdi, r11
+; Return value: eax
+
+readint32:
+
+; Output prompt
+mov eax, 1 ; sys_write
+mov edi, 1 ; stdout
+mov esi, prompt
+mov edx, prompt.len
+syscall
+
+; Read input from stdin
+mov eax, 0 ; sys_read
+mov edi, 0 ; stdin
+mov esi, strbuf
+mov edx, strbuf.len
+syscall
+; eax contains number of characters in strbuf
+
+cmp eax, 1
+je readint32
+
+mov esi, strbuf
+add eax, esi
+
+; Determine sign
+xor edi, edi
+cmp byte [rsi], '-'
+jne .positive
+inc esi
+not edi
+.positive:
+
+xor eax, eax ; Number will be parsed into this register
+xor ebx, ebx ; We will only write to the lower byte of ebx
+
+.parse:
+mov bl, byte [rsi]
+
+cmp bl, 10 ; Return
+je .done
+cmp bl, '0'
+jl .errnan
+cmp bl, '9'
+jg .errnan
+
+sub bl, '0'
+
+imul eax, 10
+jo .overflow
+add eax, ebx
+jo .overflow
+
+inc esi
+jmp .parse
+
+.overflow:
+mov eax, 1
+mov edi, 1
+mov esi, ofm
+mov edx, ofm.len
+syscall
+
+jmp readint32
+
+.errnan:
+mov eax, 1
+mov edi, 1
+mov esi, nanm
+mov edx, nanm.len
+syscall
+
+jmp readint32
+
+.done:
+
+; Apply sign
+and edi, edi
+jz .notnegative
+neg eax ; Value should be negative so negate it
+.notnegative:
+
+ret
+
+section .spasm64_writeint32
+; Function for writing a 32bit integer to stdout.
+; Parameter: eax - Value to write to stdout
+; Used registers: rax, rbx, rcx, rdx, rsi, rdi, r11
+writeunsigned:
+mov esi, strbuf + strbuf.len - 1 ; Use esi as pointer to current string position (writing back to front)
+mov ebx, 10
+
+mov [rsi], byte 10 ; Newline at end of number
+dec esi
+
+xor edi, edi
+cmp eax, 0
+jge .notnegative
+not edi
+neg eax
+.notnegative:
+
+.generate:
+xor edx, edx
+div ebx ; div edx:eax, 10
+
+; Store remainder in string
+add edx, '0'
+mov [rsi], dl
+
+dec esi
+
+cmp eax, 0
+jnz .generate
+
+; Add minus sign if needed
+and edi, edi
+jz .nominusadd
+mov byte [rsi], '-'
+dec esi
+
+.nominusadd:
+
+inc esi
+
+; Output result (esi already holds the buffer argument)
+mov eax, 1
+mov edi, 1
+mov edx, strbuf + strbuf.len
+sub edx, esi
+syscall
+
+ret
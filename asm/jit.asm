@@ -0,0 +1,28 @@
+bits 32
+
+; Entry and exit sequences framing a program run in-process by spasm --run.
+; spasm_jit_enter is placed right in front of the first command, stores the
+; host stack pointer and falls through into the program. STP commands jump
+; to spasm_jit_leave which restores the host stack and returns 0 to the host.
+
+section .bss
+host_stack: resd 1
+
+section .spasm_jit_enter
+spasm_jit_enter:
+push ebx
+push esi
+push edi
+push ebp
+mov [host_stack], esp
+
+
+section .spasm_jit_leave
+spasm_jit_leave:
+mov esp, [host_stack]
+pop ebp
+pop edi
+pop esi
+pop ebx
+xor eax, eax
+ret
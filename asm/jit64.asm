@@ -0,0 +1,30 @@
+bits 64
+
+; x86_64 port of jit.asm. host_stack has to be located below 2GB as it is
+; addressed through an absolute 32 bit displacement.
+
+section .bss
+host_stack: resq 1
+
+section .spasm64_jit_enter
+spasm64_jit_enter:
+push rbx
+push rbp
+push r12
+push r13
+push r14
+push r15
+mov [abs host_stack], rsp
+
+
+section .spasm64_jit_leave
+spasm64_jit_leave:
+mov rsp, [abs host_stack]
+pop r15
+pop r14
+pop r13
+pop r12
+pop rbp
+pop rbx
+xor eax, eax
+ret
@@ -0,0 +1,770 @@
+/*
+ * Copyright (C) 2011, Stefan Hacker <dd0t@users.sourceforge.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#define _GNU_SOURCE /* syscall */
+
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <math.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../spasm_stats.h"
+
+#define BENCH_MAX_VARIANTS 16
+#define BENCH_MAX_ARGS 64 /* spasm arguments including the flags of a variant */
+#define BENCH_NAME_LENGTH 256
+#define BENCH_DEFAULT_REPEAT 5
+#define BENCH_DEFAULT_TIMEOUT 60 /* seconds a single run may take */
+
+
+/**
+ * @brief Hardware events counted for every run.
+ */
+typedef enum BenchCounter
+{
+    BENCH_CYCLES,
+    BENCH_INSTRUCTIONS,
+    BENCH_BRANCH_MISSES,
+    BENCH_CACHE_MISSES,
+
+    BENCH_COUNTER_COUNT
+} BenchCounter;
+
+/**
+ * @brief JSON keys of the counters, index equals BenchCounter.
+ */
+const char BENCH_COUNTER_NAMES[][16] = {
+        "cycles", "instructions", "branch_misses", "cache_misses" };
+
+/**
+ * @brief perf_event_attr.config of the counters, index equals BenchCounter.
+ */
+const uint32_t BENCH_COUNTER_CONFIGS[] = {
+        PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_BRANCH_MISSES, PERF_COUNT_HW_CACHE_MISSES };
+
+
+typedef struct BenchResult BenchResult;
+
+/**
+ * @brief Measurements of a program built with one variant.
+ */
+struct BenchResult
+{
+    char name[BENCH_NAME_LENGTH]; /* program file name without extension */
+    const char *variant; /* spasm flags the program was built with */
+
+    int assembled; /* spasm succeeded */
+    int exit_code; /* exit code of the last run, 128 + signal if killed */
+
+    double seconds; /* median wall time of a run */
+    uint64_t counters[BENCH_COUNTER_COUNT]; /* median count of a run */
+    int counted[BENCH_COUNTER_COUNT]; /* counter was available */
+
+    const BenchResult *baseline; /* same program and variant in the baseline, 0 if none */
+};
+
+
+typedef struct BenchBaseline BenchBaseline;
+
+/**
+ * @brief Results of an earlier run of the suite. Counts are kept as double,
+ *        they are only used for ratios.
+ */
+struct BenchBaseline
+{
+    BenchResult *results;
+    double (*counters)[BENCH_COUNTER_COUNT];
+    char (*variants)[BENCH_NAME_LENGTH];
+    size_t count;
+};
+
+
+typedef struct BenchOptions BenchOptions;
+
+/**
+ * @brief Options of the runner.
+ */
+struct BenchOptions
+{
+    const char *spasm; /* spasm binary */
+    const char *input; /* stdin of programs without <name>.in */
+    const char *baseline; /* baseline file, 0 for none */
+    const char *output; /* JSON file, 0 for stdout */
+    const char *variants[BENCH_MAX_VARIANTS];
+    size_t variant_count;
+    unsigned repeat;
+    unsigned timeout;
+};
+
+
+/**
+ * @brief Wrapper for the perf_event_open system call, glibc has none.
+ */
+int open_counter(const BenchCounter counter, const pid_t pid)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = BENCH_COUNTER_CONFIGS[counter];
+    attr.disabled = 1;
+    attr.enable_on_exec = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    return (int)syscall(__NR_perf_event_open, &attr, pid, -1, -1, 0);
+}
+
+
+/**
+ * @brief Wall clock in seconds.
+ */
+double now(void)
+{
+    struct timespec time;
+
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (double)time.tv_sec + (double)time.tv_nsec / 1e9;
+}
+
+
+/**
+ * @brief Exit code of a waited for child, 128 + signal if it was killed.
+ */
+int exit_code_of(const int status)
+{
+    if (WIFEXITED(status))
+        return WEXITSTATUS(status);
+
+    return WIFSIGNALED(status) ? 128 + WTERMSIG(status) : -1;
+}
+
+
+/**
+ * @brief Builds a program with spasm.
+ * @param options Runner options
+ * @param source Program to build
+ * @param variant Space separated spasm flags
+ * @param target Binary to create
+ * @return Non-zero on success.
+ */
+int assemble(const BenchOptions *options, const char *source, const char *variant, const char *target)
+{
+    char flags[BENCH_NAME_LENGTH];
+    char *argv[BENCH_MAX_ARGS + 1];
+    size_t argc = 0;
+    char *flag;
+    int status;
+    int null_fd;
+    pid_t pid;
+
+    strncpy(flags, variant, sizeof(flags) - 1);
+    flags[sizeof(flags) - 1] = 0;
+
+    argv[argc++] = (char*)options->spasm;
+    argv[argc++] = (char*)source;
+    argv[argc++] = (char*)target;
+    for (flag = strtok(flags, " "); flag && argc < BENCH_MAX_ARGS; flag = strtok(0, " "))
+        argv[argc++] = flag;
+    argv[argc] = 0;
+
+    pid = fork();
+    if (pid < 0)
+        return 0;
+
+    if (pid == 0)
+    {
+        null_fd = open("/dev/null", O_WRONLY);
+        dup2(null_fd, STDOUT_FILENO);
+        dup2(null_fd, STDERR_FILENO);
+        execv(options->spasm, argv);
+        _exit(127);
+    }
+
+    return waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+
+/**
+ * @brief Runs a binary once with counters attached.
+ * @param options Runner options
+ * @param target Binary to run
+ * @param input File to use as stdin
+ * @param seconds Set to the wall time of the run
+ * @param counters Set to the counts, entries of unavailable counters stay untouched
+ * @param counted Set per counter whether it was available
+ * @return Exit code of the run, -1 if it couldn't be started.
+ */
+int run_once(const BenchOptions *options, const char *target, const char *input,
+        double *seconds, uint64_t *counters, int *counted)
+{
+    int fds[BENCH_COUNTER_COUNT];
+    int go[2];
+    int input_fd;
+    int null_fd;
+    int status = 0;
+    char byte = 0;
+    double start;
+    uint64_t value;
+    pid_t pid;
+    size_t i;
+
+    if (pipe(go) != 0)
+        return -1;
+
+    pid = fork();
+    if (pid < 0)
+    {
+        close(go[0]);
+        close(go[1]);
+        return -1;
+    }
+
+    if (pid == 0)
+    {
+        /* Wait until the counters are attached, they start counting at exec */
+        close(go[1]);
+        input_fd = open(input, O_RDONLY);
+        null_fd = open("/dev/null", O_WRONLY);
+        dup2(input_fd, STDIN_FILENO);
+        dup2(null_fd, STDOUT_FILENO);
+        dup2(null_fd, STDERR_FILENO);
+        if (read(go[0], &byte, 1) != 1)
+            _exit(126);
+
+        /* Pending alarms survive exec and stop runaway programs */
+        alarm(options->timeout);
+        execl(target, target, (char*)0);
+        _exit(127);
+    }
+
+    close(go[0]);
+    for (i = 0; i < BENCH_COUNTER_COUNT; ++i)
+        fds[i] = open_counter((BenchCounter)i, pid);
+
+    start = now();
+    if (write(go[1], &byte, 1) != 1)
+        kill(pid, SIGKILL);
+    close(go[1]);
+    waitpid(pid, &status, 0);
+    *seconds = now() - start;
+
+    for (i = 0; i < BENCH_COUNTER_COUNT; ++i)
+    {
+        counted[i] = fds[i] >= 0 && read(fds[i], &value, sizeof(value)) == sizeof(value);
+        if (counted[i])
+            counters[i] = value;
+        if (fds[i] >= 0)
+            close(fds[i]);
+    }
+
+    return exit_code_of(status);
+}
+
+
+/**
+ * @brief qsort comparator for doubles.
+ */
+int compare_doubles(const void *a, const void *b)
+{
+    const double first = *(const double*)a;
+    const double second = *(const double*)b;
+
+    return first < second ? -1 : first > second;
+}
+
+
+/**
+ * @brief Builds and runs a program options->repeat times and keeps the medians.
+ */
+void measure(const BenchOptions *options, const char *source, const char *target, BenchResult *result)
+{
+    char input[BENCH_NAME_LENGTH + 8];
+    double *samples = (double*)calloc(options->repeat * (BENCH_COUNTER_COUNT + 1), sizeof(double));
+    uint64_t counters[BENCH_COUNTER_COUNT];
+    int counted[BENCH_COUNTER_COUNT];
+    size_t length = strlen(source);
+    unsigned run;
+    size_t i;
+
+    /* Programs read <name>.in if present */
+    if (length > 6 && strcmp(source + length - 6, ".spasm") == 0 && length - 6 + 4 < sizeof(input))
+    {
+        memcpy(input, source, length - 6);
+        strcpy(input + length - 6, ".in");
+    }
+    if (length <= 6 || access(input, R_OK) != 0)
+    {
+        strncpy(input, options->input, sizeof(input) - 1);
+        input[sizeof(input) - 1] = 0;
+    }
+
+    result->assembled = samples && assemble(options, source, result->variant, target);
+    if (!result->assembled)
+    {
+        free(samples);
+        return;
+    }
+
+    for (i = 0; i < BENCH_COUNTER_COUNT; ++i)
+        result->counted[i] = 1;
+
+    for (run = 0; run < options->repeat; ++run)
+    {
+        memset(counted, 0, sizeof(counted));
+        result->exit_code = run_once(options, target, input, &samples[run], counters, counted);
+        for (i = 0; i < BENCH_COUNTER_COUNT; ++i)
+        {
+            result->counted[i] &= counted[i];
+            samples[(i + 1) * options->repeat + run] = counted[i] ? (double)counters[i] : 0.0;
+        }
+    }
+
+    for (i = 0; i <= BENCH_COUNTER_COUNT; ++i)
+        qsort(&samples[i * options->repeat], options->repeat, sizeof(double), compare_doubles);
+
+    result->seconds = samples[options->repeat / 2];
+    for (i = 0; i < BENCH_COUNTER_COUNT; ++i)
+        result->counters[i] = (uint64_t)samples[(i + 1) * options->repeat + options->repeat / 2];
+
+    free(samples);
+    unlink(target);
+}
+
+
+/**
+ * @brief Prints a 64 bit count without relying on C99 printf formats.
+ */
+void print_count(FILE *out, uint64_t count)
+{
+    char digits[21];
+    char *position = digits + sizeof(digits) - 1;
+
+    *position = 0;
+    do
+    {
+        *--position = '0' + (char)(count % 10);
+        count /= 10;
+    }
+    while (count);
+
+    fputs(position, out);
+}
+
+
+/**
+ * @brief Reads a JSON string starting behind its opening quote.
+ * @return Non-zero on success.
+ */
+int read_string(const char *json, char *string, const size_t size)
+{
+    size_t length = 0;
+
+    for (; *json && *json != '"'; ++json)
+    {
+        if (*json == '\\' && json[1])
+            ++json;
+        if (length + 1 < size)
+            string[length++] = *json;
+    }
+
+    string[length] = 0;
+    return *json == '"';
+}
+
+
+/**
+ * @brief Finds the numeric value of a key in a single line JSON object.
+ * @return Non-zero if the key holds a number.
+ */
+int read_number(const char *line, const char *key, double *value)
+{
+    char pattern[BENCH_NAME_LENGTH];
+    const char *position;
+    char *end;
+
+    sprintf(pattern, "\"%s\": ", key);
+    position = strstr(line, pattern);
+    if (!position)
+        return 0;
+
+    *value = strtod(position + strlen(pattern), &end);
+    return end != position + strlen(pattern);
+}
+
+
+/**
+ * @brief Loads the results of an earlier run. Results are written one per line.
+ * @return Non-zero on success.
+ */
+int load_baseline(const char *path, BenchBaseline *baseline)
+{
+    FILE *file = fopen(path, "r");
+    char line[4096];
+    const char *position;
+    BenchResult *result;
+    double value;
+    size_t capacity = 0;
+    size_t i;
+
+    memset(baseline, 0, sizeof(BenchBaseline));
+    if (!file)
+        return 0;
+
+    while (fgets(line, sizeof(line), file))
+    {
+        position = strstr(line, "{\"name\": \"");
+        if (!position)
+            continue;
+
+        if (baseline->count == capacity)
+        {
+            capacity = capacity ? 2 * capacity : 32;
+            baseline->results = (BenchResult*)realloc(baseline->results, capacity * sizeof(BenchResult));
+            baseline->counters = (double(*)[BENCH_COUNTER_COUNT])realloc(baseline->counters,
+                    capacity * sizeof(*baseline->counters));
+            baseline->variants = (char(*)[BENCH_NAME_LENGTH])realloc(baseline->variants,
+                    capacity * sizeof(*baseline->variants));
+            if (!baseline->results || !baseline->counters || !baseline->variants)
+            {
+                fclose(file);
+                return 0;
+            }
+        }
+
+        result = &baseline->results[baseline->count];
+        memset(result, 0, sizeof(BenchResult));
+        read_string(position + strlen("{\"name\": \""), result->name, sizeof(result->name));
+
+        baseline->variants[baseline->count][0] = 0;
+        position = strstr(line, "\"variant\": \"");
+        if (position)
+            read_string(position + strlen("\"variant\": \""), baseline->variants[baseline->count], BENCH_NAME_LENGTH);
+        result->variant = baseline->variants[baseline->count];
+
+        result->assembled = read_number(line, "seconds", &result->seconds);
+        if (read_number(line, "exit_code", &value))
+            result->exit_code = (int)value;
+
+        for (i = 0; i < BENCH_COUNTER_COUNT; ++i)
+        {
+            result->counted[i] = read_number(line, BENCH_COUNTER_NAMES[i], &baseline->counters[baseline->count][i]);
+        }
+
+        ++baseline->count;
+    }
+
+    fclose(file);
+    return 1;
+}
+
+
+/**
+ * @brief Prints current / reference - 1 for a measurement, null if either is missing.
+ */
+void print_change(FILE *out, const int available, const double current, const double reference)
+{
+    if (available && reference > 0.0)
+        fprintf(out, "%.4f", current / reference - 1.0);
+    else
+        fprintf(out, "null");
+}
+
+
+/**
+ * @brief Prints the changes of a result relative to a reference result.
+ */
+void print_changes(FILE *out, const BenchResult *result, const BenchResult *reference, const double *reference_counters)
+{
+    size_t i;
+
+    fprintf(out, "{\"seconds\": ");
+    print_change(out, reference->assembled, result->seconds, reference->seconds);
+    for (i = 0; i < BENCH_COUNTER_COUNT; ++i)
+    {
+        fprintf(out, ", \"%s\": ", BENCH_COUNTER_NAMES[i]);
+        print_change(out, result->counted[i] && reference->counted[i],
+                (double)result->counters[i], reference_counters[i]);
+    }
+    fprintf(out, "}");
+}
+
+
+/**
+ * @brief Prints a result as a single line JSON object. The measurements
+ *        come first so the line can be read back as a baseline.
+ */
+void print_result(FILE *out, const BenchResult *result, const BenchResult *first, const BenchBaseline *baseline)
+{
+    double counters[BENCH_COUNTER_COUNT];
+    size_t i;
+
+    fprintf(out, "    {\"name\": ");
+    write_json_string(out, result->name);
+    fprintf(out, ", \"variant\": ");
+    write_json_string(out, result->variant);
+    fprintf(out, ", \"assembled\": %s", result->assembled ? "true" : "false");
+    if (!result->assembled)
+    {
+        fprintf(out, "}");
+        return;
+    }
+
+    fprintf(out, ", \"exit_code\": %d, \"seconds\": %.6f", result->exit_code, result->seconds);
+    for (i = 0; i < BENCH_COUNTER_COUNT; ++i)
+    {
+        fprintf(out, ", \"%s\": ", BENCH_COUNTER_NAMES[i]);
+        if (result->counted[i])
+            print_count(out, result->counters[i]);
+        else
+            fprintf(out, "null");
+    }
+
+    if (first != result && first->assembled)
+    {
+        for (i = 0; i < BENCH_COUNTER_COUNT; ++i)
+            counters[i] = (double)first->counters[i];
+        fprintf(out, ", \"vs_first_variant\": ");
+        print_changes(out, result, first, counters);
+    }
+
+    if (result->baseline)
+    {
+        fprintf(out, ", \"vs_baseline\": ");
+        print_changes(out, result, result->baseline, baseline->counters[result->baseline - baseline->results]);
+    }
+
+    fprintf(out, "}");
+}
+
+
+/**
+ * @brief Prints the geometric mean of the changes against the baseline per variant.
+ */
+void print_summary(FILE *out, const BenchOptions *options, const BenchResult *results,
+        const size_t count, const BenchBaseline *baseline)
+{
+    const BenchResult *reference;
+    double log_sum;
+    double current;
+    double previous;
+    size_t compared;
+    size_t v;
+    size_t i;
+    int counter;
+
+    fprintf(out, "  \"summary\": [\n");
+    for (v = 0; v < options->variant_count; ++v)
+    {
+        fprintf(out, "    {\"variant\": ");
+        write_json_string(out, options->variants[v]);
+        for (counter = -1; counter < BENCH_COUNTER_COUNT; ++counter)
+        {
+            log_sum = 0.0;
+            compared = 0;
+            for (i = v; i < count; i += options->variant_count)
+            {
+                reference = results[i].baseline;
+                if (!results[i].assembled || !reference || !reference->assembled)
+                    continue;
+
+                if (counter < 0)
+                {
+                    current = results[i].seconds;
+                    previous = reference->seconds;
+                }
+                else if (results[i].counted[counter] && reference->counted[counter])
+                {
+                    current = (double)results[i].counters[counter];
+                    previous = baseline->counters[reference - baseline->results][counter];
+                }
+                else
+                {
+                    continue;
+                }
+
+                if (current > 0.0 && previous > 0.0)
+                {
+                    log_sum += log(current / previous);
+                    ++compared;
+                }
+            }
+
+            fprintf(out, ", \"%s\": ", counter < 0 ? "seconds" : BENCH_COUNTER_NAMES[counter]);
+            print_change(out, compared > 0, exp(compared ? log_sum / (double)compared : 0.0), 1.0);
+        }
+        fprintf(out, "}%s\n", v + 1 < options->variant_count ? "," : "");
+    }
+    fprintf(out, "  ]");
+}
+
+
+void print_usage(const char *name)
+{
+    fprintf(stderr, "Usage:\n"
+           "    %s [--spasm=<binary>] [--input=<file>] [--baseline=<file>] [--output=<file>]\n"
+           "        [--repeat=<n>] [--timeout=<seconds>] [--variant=<spasm flags>]... <source>...\n",
+           name);
+}
+
+
+int main(int argn, char **argv)
+{
+    BenchOptions options;
+    BenchBaseline baseline;
+    BenchResult *results;
+    FILE *out = stdout;
+    char target[64];
+    const char **sources;
+    const char *name;
+    size_t source_count = 0;
+    size_t count;
+    size_t length;
+    size_t i;
+    size_t j;
+    int counters = 0;
+
+    memset(&options, 0, sizeof(BenchOptions));
+    memset(&baseline, 0, sizeof(BenchBaseline));
+    options.spasm = "./spasm";
+    options.input = "/dev/null";
+    options.repeat = BENCH_DEFAULT_REPEAT;
+    options.timeout = BENCH_DEFAULT_TIMEOUT;
+
+    sources = (const char**)malloc(argn * sizeof(const char*));
+    if (!sources)
+        return EXIT_FAILURE;
+
+    for (i = 1; i < (size_t)argn; ++i)
+    {
+        if (strncmp(argv[i], "--spasm=", 8) == 0)
+            options.spasm = argv[i] + 8;
+        else if (strncmp(argv[i], "--input=", 8) == 0)
+            options.input = argv[i] + 8;
+        else if (strncmp(argv[i], "--baseline=", 11) == 0)
+            options.baseline = argv[i] + 11;
+        else if (strncmp(argv[i], "--output=", 9) == 0)
+            options.output = argv[i] + 9;
+        else if (strncmp(argv[i], "--repeat=", 9) == 0)
+            options.repeat = (unsigned)strtoul(argv[i] + 9, 0, 10);
+        else if (strncmp(argv[i], "--timeout=", 10) == 0)
+            options.timeout = (unsigned)strtoul(argv[i] + 10, 0, 10);
+        else if (strncmp(argv[i], "--variant=", 10) == 0 && options.variant_count < BENCH_MAX_VARIANTS)
+            options.variants[options.variant_count++] = argv[i] + 10;
+        else if (strncmp(argv[i], "--", 2) != 0)
+            sources[source_count++] = argv[i];
+        else
+            break;
+    }
+
+    if (i < (size_t)argn || !source_count || !options.repeat || !options.timeout)
+    {
+        print_usage(argv[0]);
+        free(sources);
+        return EXIT_FAILURE;
+    }
+
+    if (!options.variant_count)
+        options.variants[options.variant_count++] = "";
+
+    if (options.baseline && !load_baseline(options.baseline, &baseline))
+        fprintf(stderr, "No baseline in \"%s\", reporting without comparison\n", options.baseline);
+
+    count = source_count * options.variant_count;
+    results = (BenchResult*)calloc(count, sizeof(BenchResult));
+    if (!results)
+    {
+        free(sources);
+        return EXIT_FAILURE;
+    }
+
+    sprintf(target, "/tmp/spasm_bench_%ld", (long)getpid());
+
+    for (i = 0; i < count; ++i)
+    {
+        name = strrchr(sources[i / options.variant_count], '/');
+        name = name ? name + 1 : sources[i / options.variant_count];
+        strncpy(results[i].name, name, sizeof(results[i].name) - 1);
+        length = strlen(results[i].name);
+        if (length > 6 && strcmp(results[i].name + length - 6, ".spasm") == 0)
+            results[i].name[length - 6] = 0;
+        results[i].variant = options.variants[i % options.variant_count];
+
+        fprintf(stderr, "%-16s %-24s ", results[i].name, results[i].variant);
+        measure(&options, sources[i / options.variant_count], target, &results[i]);
+        if (results[i].assembled)
+            fprintf(stderr, "%10.6f s  exit %d\n", results[i].seconds, results[i].exit_code);
+        else
+            fprintf(stderr, "assembling FAILED\n");
+
+        counters |= results[i].counted[BENCH_CYCLES];
+        for (j = 0; j < baseline.count; ++j)
+        {
+            if (strcmp(baseline.results[j].name, results[i].name) == 0
+                    && strcmp(baseline.results[j].variant, results[i].variant) == 0)
+                results[i].baseline = &baseline.results[j];
+        }
+    }
+
+    if (options.output)
+    {
+        out = fopen(options.output, "w");
+        if (!out)
+        {
+            fprintf(stderr, "Failed to open output file \"%s\"\n", options.output);
+            return EXIT_FAILURE;
+        }
+    }
+
+    /* perf_event_open is unavailable without a PMU (e.g. in most VMs), wall time is always reported */
+    fprintf(out, "{\n  \"repeat\": %u,\n  \"counters\": %s,\n  \"results\": [\n",
+            options.repeat, counters ? "true" : "false");
+    for (i = 0; i < count; ++i)
+    {
+        print_result(out, &results[i], &results[i - i % options.variant_count], &baseline);
+        fprintf(out, "%s\n", i + 1 < count ? "," : "");
+    }
+    fprintf(out, "  ],\n");
+    print_summary(out, &options, results, count, &baseline);
+    fprintf(out, "\n}\n");
+
+    if (out != stdout)
+        fclose(out);
+
+    free(sources);
+    free(results);
+    free(baseline.results);
+    free(baseline.counters);
+    free(baseline.variants);
+
+    return EXIT_SUCCESS;
+}
@@ -20,11 +20,17 @@
  * DEALINGS IN THE SOFTWARE.
  */
 
+#define _POSIX_C_SOURCE 200112L /* fileno, ftruncate, posix_fallocate */
+
 #include "elfwrite.h"
 
 #include <elf.h>
+#include <fcntl.h>
 #include <memory.h>
+#include <stdlib.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/types.h>
 
 
 /**
@@ -49,33 +55,232 @@ uint32_t padding_for(const uint32_t addr, const uint32_t reference, const uint32
 
 
 /**
- * @brief Writes size bytes of padding to the given file
- * @param size Number of 0 bytes to write
- * @file File to write to
+ * @brief Return the first page boundary at or behind the given addr.
+ * @param addr Addr. to align
+ */
+uint32_t page_after(const uint32_t addr)
+{
+    return (addr + 0xfff) & ~(uint32_t)0xfff;
+}
+
+
+/**
+ * @brief Part of an ELF image placed at a fixed file offset.
  */
-size_t write_padding(const size_t size, FILE *file)
+typedef struct ElfChunk
 {
-    const char zero[0x100] = {0};
-    size_t result = 0;
-    uint32_t iterations = size / sizeof(zero);
-    const size_t left = size % sizeof(zero);
+    size_t offset; /* File offset */
+    const void *content;
+    size_t size;
+} ElfChunk;
+
 
-    while (iterations)
+/**
+ * @brief Writes the ELF image made of the given chunks to the given file.
+ *
+ * The file is sized once and mapped, chunks are copied into the mapping.
+ * Gaps between the chunks are never written and stay sparse holes. If the
+ * file can not be mapped (e.g. a pipe) the image is assembled in memory
+ * and written with a single write instead.
+ *
+ * @param file File to write to
+ * @param chunks Chunks making up the image
+ * @param chunk_count Number of chunks
+ * @param image_size Size of the whole image
+ * @return 0 on success, -1 on failure
+ */
+int write_image(FILE *file, const ElfChunk *chunks, const size_t chunk_count, const size_t image_size)
+{
+    const int fd = fileno(file);
+    off_t start;
+    unsigned char *image = MAP_FAILED;
+    size_t written = 0;
+    ssize_t result;
+    size_t i;
+
+    /* Buffered output not yet written moves the position, so it is read
+     * only after flushing. */
+    if (fflush(file) != 0)
+        return -1;
+
+    start = lseek(fd, 0, SEEK_CUR);
+    if (start == 0 && ftruncate(fd, image_size) == 0)
     {
-        result += fwrite(zero, sizeof(zero), 1, file);
-        --iterations;
+        /* Stores into unallocated blocks of a full file system raise SIGBUS,
+         * so the blocks of the chunks are allocated up front. Gaps stay holes. */
+        for (i = 0; i < chunk_count; ++i)
+        {
+            if (chunks[i].size && posix_fallocate(fd, chunks[i].offset, chunks[i].size) != 0)
+                return -1;
+        }
+
+        image = mmap(0, image_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
     }
 
-    if (left)
+    if (image != MAP_FAILED)
     {
-        result += fwrite(zero, left, 1, file);
+        for (i = 0; i < chunk_count; ++i)
+            memcpy(image + chunks[i].offset, chunks[i].content, chunks[i].size);
+
+        if (munmap(image, image_size) != 0)
+            return -1;
+
+        return lseek(fd, image_size, SEEK_SET) == (off_t)-1 ? -1 : 0;
     }
 
-    return result;
+    image = calloc(1, image_size);
+    if (!image)
+        return -1;
+
+    for (i = 0; i < chunk_count; ++i)
+        memcpy(image + chunks[i].offset, chunks[i].content, chunks[i].size);
+
+    while (written < image_size)
+    {
+        result = write(fd, image + written, image_size - written);
+        if (result <= 0)
+            break;
+
+        written += result;
+    }
+
+    free(image);
+    return written == image_size ? 0 : -1;
+}
+
+
+/**
+ * @brief Append a chunk to the given chunk list.
+ */
+void add_chunk(ElfChunk *chunks, size_t *chunk_count, const size_t offset, const void *content, const size_t size)
+{
+    chunks[*chunk_count].offset = offset;
+    chunks[*chunk_count].content = content;
+    chunks[*chunk_count].size = size;
+    ++*chunk_count;
+}
+
+
+#define ELF_MAX_SEGMENTS 4
+#define ELF_MAX_SECTIONS 6
+#define ELF_MAX_CHUNKS 7 /* header, program headers, section headers and 4 contents */
+
+
+/**
+ * @brief Program header independent of the ELF class.
+ */
+typedef struct ElfSegment
+{
+    uint32_t type;
+    uint32_t flags;
+    uint32_t offset; /* File offset */
+    uint32_t vaddr;
+    uint32_t filesz;
+    uint32_t memsz;
+    uint32_t align;
+} ElfSegment;
+
+
+/**
+ * @brief Section header independent of the ELF class.
+ */
+typedef struct ElfSection
+{
+    uint32_t name; /* Offset into ELF_SECTION_NAMES */
+    uint32_t type;
+    uint32_t flags;
+    uint32_t addr;
+    uint32_t offset; /* File offset */
+    uint32_t size;
+    uint32_t addralign;
+} ElfSection;
+
+
+/**
+ * @brief Layout of an ELF image shared by the ELF32 and ELF64 writers.
+ *
+ * Everything but the headers themselves, which only differ in the size
+ * of their fields, is computed once by layout_image or
+ * layout_compact_image.
+ */
+typedef struct ElfImage
+{
+    uint32_t entry;
+    uint32_t phdr_offset;
+    size_t segment_count;
+    ElfSegment segments[ELF_MAX_SEGMENTS];
+    uint32_t shdr_offset; /* 0 without section headers */
+    size_t section_count;
+    ElfSection sections[ELF_MAX_SECTIONS];
+    ElfChunk chunks[ELF_MAX_CHUNKS]; /* Contents, the headers are added when writing */
+    size_t chunk_count;
+    size_t size; /* Size of the whole image */
+} ElfImage;
+
+
+/**
+ * @brief Names of the sections written by elf_write and elf64_write.
+ */
+const char ELF_SECTION_NAMES[] = "\0"
+                                 ".shstrtab\0"
+                                 ".text\0"
+                                 ".rodata\0"
+                                 ".data\0"
+                                 ".bss";
+
+#define ELF_NAME_SHSTRTAB 1
+#define ELF_NAME_TEXT 11
+#define ELF_NAME_RODATA 17
+#define ELF_NAME_DATA 25
+#define ELF_NAME_BSS 31
+
+
+/**
+ * @brief Append a segment to the image.
+ */
+void add_segment(ElfImage *image, const uint32_t type, const uint32_t flags, const uint32_t offset,
+        const uint32_t vaddr, const uint32_t filesz, const uint32_t memsz, const uint32_t align)
+{
+    ElfSegment *segment = &image->segments[image->segment_count++];
+
+    segment->type = type;
+    segment->flags = flags;
+    segment->offset = offset;
+    segment->vaddr = vaddr;
+    segment->filesz = filesz;
+    segment->memsz = memsz;
+    segment->align = align;
+}
+
+
+/**
+ * @brief Append a section to the image.
+ */
+void add_section(ElfImage *image, const uint32_t name, const uint32_t type, const uint32_t flags,
+        const uint32_t addr, const uint32_t offset, const uint32_t size, const uint32_t addralign)
+{
+    ElfSection *section = &image->sections[image->section_count++];
+
+    section->name = name;
+    section->type = type;
+    section->flags = flags;
+    section->addr = addr;
+    section->offset = offset;
+    section->size = size;
+    section->addralign = addralign;
 }
 
 
-void elf_write(FILE *file,
+/**
+ * @brief Lays out an image with one page aligned segment per section and
+ *        section headers, @see elf_write
+ * @param image Image to lay out
+ * @param ehdr_size Size of the ELF header of the class
+ * @param phdr_size Size of a program header of the class
+ * @param shdr_size Size of a section header of the class
+ */
+void layout_image(ElfImage *image,
+        const size_t ehdr_size, const size_t phdr_size, const size_t shdr_size,
         uint32_t entry_point,
         uint32_t text_vaddr,
         const unsigned char *text, size_t text_size,
@@ -91,77 +296,133 @@ void elf_write(FILE *file,
      *  .text | .rodata | .data | .bss
      *  ------ --------- --------
      *  PF_X/R    PF_R     PF_W
+     *
+     *  File layout
+     *  elfhdr | elfphdr... | text | rodata | data | strtab | shdr...
      */
 
-    const char strtab[] = "\0"
-                          ".shstrtab\0"
-                          ".text\0"
-                          ".rodata\0"
-                          ".data\0"
-                          ".bss";
-
-    const uint32_t strtab_shstrtab_index = 1;
-    const uint32_t strtab_text_index = 11;
-    const uint32_t strtab_rodata_index = 17;
-    const uint32_t strtab_data_index = 25;
-    const uint32_t strtab_bss_index = 31;
-
-    const uint32_t strtab_size = sizeof(strtab);
-
-    /*
-     * Layout in file
-     */
-    const uint32_t phdr_count = 4;
-    const uint32_t phdr_offset              = sizeof(Elf32_Ehdr);
-    const uint32_t phdr_offset_end          = phdr_offset + phdr_count * sizeof(Elf32_Phdr);
+    const uint32_t strtab_size              = sizeof(ELF_SECTION_NAMES);
 
-    const uint32_t content_offset           = phdr_offset_end;
+    const uint32_t phdr_count               = 4;
+    const uint32_t phdr_offset              = ehdr_size;
+    const uint32_t content_offset           = phdr_offset + phdr_count * phdr_size;
 
     const uint32_t text_alignment           = 1<<12;
-    const uint32_t text_padding_prefix      = padding_for(content_offset, text_vaddr, text_alignment);
-    const uint32_t text_offset              = content_offset + text_padding_prefix;
+    const uint32_t text_offset              = content_offset + padding_for(content_offset, text_vaddr, text_alignment);
     const uint32_t text_end                 = text_offset + text_size;
 
     const uint32_t rodata_alignment         = 1<<12;
-    const uint32_t rodata_padding_prefix    = padding_for(text_end, rodata_vaddr, rodata_alignment);
-    const uint32_t rodata_offset            = text_end + rodata_padding_prefix;
+    const uint32_t rodata_offset            = text_end + padding_for(text_end, rodata_vaddr, rodata_alignment);
     const uint32_t rodata_end               = rodata_offset + rodata_size;
 
     const uint32_t data_alignment           = 1<<12;
-    const uint32_t data_padding_prefix      = padding_for(rodata_end, data_vaddr, data_alignment);
-    const uint32_t data_offset              = rodata_end + data_padding_prefix;
+    const uint32_t data_offset              = rodata_end + padding_for(rodata_end, data_vaddr, data_alignment);
     const uint32_t data_end                 = data_offset + data_size;
 
     const uint32_t bss_alignment            = 1<<12;
 
-    const uint32_t strtab_alignment         = 0;
-    const uint32_t strtab_padding_prefix    = 0;
-    const uint32_t strtab_offset            = data_end + strtab_padding_prefix;
-    const uint32_t strtab_end               = strtab_offset + strtab_size;
+    const uint32_t strtab_offset            = data_end;
+    const uint32_t shdr_offset              = strtab_offset + strtab_size;
+
+    memset(image, 0, sizeof(ElfImage));
+
+    image->entry = entry_point;
+    image->phdr_offset = phdr_offset;
+    image->shdr_offset = shdr_offset;
+
+    add_segment(image, PT_LOAD, PF_X | PF_R, text_offset, text_vaddr, text_size, text_size, text_alignment);
+    add_segment(image, PT_LOAD, PF_R, rodata_offset, rodata_vaddr, rodata_size, rodata_size, rodata_alignment);
+    add_segment(image, PT_LOAD, PF_R | PF_W, data_offset, data_vaddr, data_size, data_size, data_alignment);
+    add_segment(image, PT_LOAD, PF_R | PF_W, 0, bss_vaddr, 0, bss_size, bss_alignment);
+
+    add_section(image, 0, SHT_NULL, 0, 0, 0, 0, 0);
+    add_section(image, ELF_NAME_SHSTRTAB, SHT_STRTAB, 0, 0, strtab_offset, strtab_size, 0);
+    add_section(image, ELF_NAME_TEXT, SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR,
+            text_vaddr, text_offset, text_size, text_alignment);
+    add_section(image, ELF_NAME_RODATA, SHT_PROGBITS, SHF_ALLOC,
+            rodata_vaddr, rodata_offset, rodata_size, rodata_alignment);
+    add_section(image, ELF_NAME_DATA, SHT_PROGBITS, SHF_ALLOC | SHF_WRITE,
+            data_vaddr, data_offset, data_size, data_alignment);
+    add_section(image, ELF_NAME_BSS, SHT_NOBITS, SHF_ALLOC | SHF_WRITE,
+            bss_vaddr, 0, bss_size, bss_alignment);
+
+    add_chunk(image->chunks, &image->chunk_count, text_offset, text, text_size);
+    add_chunk(image->chunks, &image->chunk_count, rodata_offset, rodata, rodata_size);
+    add_chunk(image->chunks, &image->chunk_count, data_offset, data, data_size);
+    add_chunk(image->chunks, &image->chunk_count, strtab_offset, ELF_SECTION_NAMES, strtab_size);
+
+    image->size = shdr_offset + image->section_count * shdr_size;
+}
 
 
-    const uint32_t content_offset_end       = strtab_end;
+/**
+ * @brief Lays out an image with two segments and no section headers,
+ *        @see elf_write_compact
+ * @param image Image to lay out
+ * @param ehdr_size Size of the ELF header of the class
+ * @param phdr_size Size of a program header of the class
+ */
+void layout_compact_image(ElfImage *image,
+        const size_t ehdr_size, const size_t phdr_size,
+        uint32_t entry_point,
+        uint32_t text_vaddr,
+        const unsigned char *text, size_t text_size,
+        const unsigned char *rodata, size_t rodata_size,
+        uint32_t data_vaddr,
+        const unsigned char *data, size_t data_size,
+        uint32_t bss_vaddr,
+        size_t bss_size)
+{
+    /*
+     *  Memory layout
+     *  elfhdr | elfphdr... | .text | .rodata   .data | .bss
+     *  ------------------------------------   ------------
+     *                PF_X/R                       PF_W
+     *
+     *  The first segment maps the headers, .text and .rodata, the second
+     *  .data and .bss. Both are laid out back to back in the file, the
+     *  vaddrs of elf_compact_alignment keep every file offset congruent to
+     *  its vaddr modulo the page size.
+     */
+
+    const uint32_t text_offset = ehdr_size + 2 * phdr_size;
+    const uint32_t data_offset = text_offset + text_size + rodata_size;
+
+    memset(image, 0, sizeof(ElfImage));
+
+    image->entry = entry_point;
+    image->phdr_offset = ehdr_size;
 
-    const uint32_t shdr_count               = 6;
-    const uint32_t shdr_offset              = content_offset_end;
+    /* Headers, .text and .rodata */
+    add_segment(image, PT_LOAD, PF_X | PF_R, 0, text_vaddr - text_offset, data_offset, data_offset, 1<<12);
+    /* .data and .bss, the loader zeroes the memory behind the file content */
+    add_segment(image, PT_LOAD, PF_R | PF_W, data_offset, data_vaddr,
+            data_size, bss_vaddr + bss_size - data_vaddr, 1<<12);
+
+    add_chunk(image->chunks, &image->chunk_count, text_offset, text, text_size);
+    add_chunk(image->chunks, &image->chunk_count, text_offset + text_size, rodata, rodata_size);
+    add_chunk(image->chunks, &image->chunk_count, data_offset, data, data_size);
+
+    image->size = data_offset + data_size;
+}
 
+
+/**
+ * @brief Fills the ELF32 headers of a laid out image and writes it.
+ * @param file File to write to
+ * @param image Laid out image, its chunks are extended by the headers
+ * @return 0 on success, -1 on failure
+ */
+int write_elf32_image(FILE *file, ElfImage *image)
+{
     Elf32_Ehdr ehdr;
-    Elf32_Phdr phdr_text;
-    Elf32_Phdr phdr_rodata;
-    Elf32_Phdr phdr_data;
-    Elf32_Phdr phdr_bss;
-
-    Elf32_Shdr shdr_null;
-    Elf32_Shdr shdr_strtab;
-    Elf32_Shdr shdr_text;
-    Elf32_Shdr shdr_rodata;
-    Elf32_Shdr shdr_data;
-    Elf32_Shdr shdr_bss;
+    Elf32_Phdr phdrs[ELF_MAX_SEGMENTS];
+    Elf32_Shdr shdrs[ELF_MAX_SECTIONS];
+    size_t i;
 
-    /*
-     * Elf-header
-     */
     memset(&ehdr, 0, sizeof(Elf32_Ehdr));
+    memset(phdrs, 0, sizeof(phdrs));
+    memset(shdrs, 0, sizeof(shdrs));
 
     ehdr.e_ident[EI_MAG0]       = ELFMAG0;         /* Magic bytes */
     ehdr.e_ident[EI_MAG1]       = ELFMAG1;
@@ -175,180 +436,251 @@ void elf_write(FILE *file,
     ehdr.e_type                 = ET_EXEC;         /* Executable file */
     ehdr.e_machine              = EM_386;          /* i386 arch */
     ehdr.e_version              = EV_CURRENT;
-    ehdr.e_entry                = entry_point;      /* Entry point (virtual addr.) */
-    ehdr.e_phoff                = phdr_offset;     /* Program header table offset (file offset) */
-    ehdr.e_shoff                = shdr_offset;     /* Section header table offset (file offset) */
+    ehdr.e_entry                = image->entry;    /* Entry point (virtual addr.) */
+    ehdr.e_phoff                = image->phdr_offset; /* Program header table offset (file offset) */
+    ehdr.e_shoff                = image->shdr_offset; /* Section header table offset (file offset) */
     ehdr.e_ehsize               = sizeof(Elf32_Ehdr);
     ehdr.e_phentsize            = sizeof(Elf32_Phdr);
-    ehdr.e_phnum                = phdr_count;
-    ehdr.e_shentsize            = sizeof(Elf32_Shdr);
-    ehdr.e_shnum                = shdr_count;
-    ehdr.e_shstrndx             = 1;               /* Section header index of string table */
-
-    /*
-     * Elf program headers
-     */
-
-    /* .text segment program header */
-
-    memset(&phdr_text, 0, sizeof(Elf32_Phdr));
-
-    phdr_text.p_type            = PT_LOAD;
-    phdr_text.p_offset          = text_offset; /* Offset to first byte of segment (file offset) */
-    phdr_text.p_vaddr           = text_vaddr;  /* Virtual address */
-    phdr_text.p_paddr           = 0;
-    phdr_text.p_align           = text_alignment;
-    phdr_text.p_filesz          = text_size; /* Size in file image */
-    phdr_text.p_memsz           = text_size; /* Size in memory image */
-    phdr_text.p_flags           = PF_X | PF_R; /* Executable & Readable */
-
-    /* .rodata segment program header */
-
-    memset(&phdr_rodata, 0, sizeof(Elf32_Phdr));
-
-    phdr_rodata.p_type          = PT_LOAD;
-    phdr_rodata.p_offset        = rodata_offset; /* Offset to first byte of segment (file offset) */
-    phdr_rodata.p_vaddr         = rodata_vaddr;  /* Virtual address */
-    phdr_rodata.p_paddr         = 0;
-    phdr_rodata.p_align         = rodata_alignment;
-    phdr_rodata.p_filesz        = rodata_size; /* Size in file image */
-    phdr_rodata.p_memsz         = rodata_size; /* Size in memory image */
-    phdr_rodata.p_flags         = PF_R; /* Read-only */
+    ehdr.e_phnum                = image->segment_count;
+    ehdr.e_shentsize            = image->section_count ? sizeof(Elf32_Shdr) : 0;
+    ehdr.e_shnum                = image->section_count;
+    ehdr.e_shstrndx             = image->section_count ? 1 : SHN_UNDEF; /* Section header index of string table */
 
-    /* .data segment program header */
-
-    memset(&phdr_data, 0, sizeof(Elf32_Phdr));
-
-    phdr_data.p_type            = PT_LOAD;
-    phdr_data.p_offset          = data_offset; /* Offset to first byte of segment (file offset) */
-    phdr_data.p_vaddr           = data_vaddr;  /* Virtual address */
-    phdr_data.p_paddr           = 0;
-    phdr_data.p_align           = data_alignment;
-    phdr_data.p_filesz          = data_size; /* Size in file image */
-    phdr_data.p_memsz           = data_size; /* Size in memory image */
-    phdr_data.p_flags           = PF_R | PF_W; /* Read & Write */
-
-    /* .bss segment program header */
+    for (i = 0; i < image->segment_count; ++i)
+    {
+        phdrs[i].p_type         = image->segments[i].type;
+        phdrs[i].p_offset       = image->segments[i].offset;
+        phdrs[i].p_vaddr        = image->segments[i].vaddr;
+        phdrs[i].p_align        = image->segments[i].align;
+        phdrs[i].p_filesz       = image->segments[i].filesz;
+        phdrs[i].p_memsz        = image->segments[i].memsz;
+        phdrs[i].p_flags        = image->segments[i].flags;
+    }
 
-    memset(&phdr_bss, 0, sizeof(Elf32_Phdr));
+    for (i = 0; i < image->section_count; ++i)
+    {
+        shdrs[i].sh_name        = image->sections[i].name;
+        shdrs[i].sh_type        = image->sections[i].type;
+        shdrs[i].sh_flags       = image->sections[i].flags;
+        shdrs[i].sh_addr        = image->sections[i].addr;
+        shdrs[i].sh_addralign   = image->sections[i].addralign;
+        shdrs[i].sh_offset      = image->sections[i].offset;
+        shdrs[i].sh_size        = image->sections[i].size;
+    }
 
-    phdr_bss.p_type             = PT_LOAD;
-    phdr_bss.p_offset           = 0; /* Offset to first byte of segment (file offset) */
-    phdr_bss.p_vaddr            = bss_vaddr;  /* Virtual address */
-    phdr_bss.p_paddr            = 0;
-    phdr_bss.p_align            = bss_alignment;
-    phdr_bss.p_filesz           = 0; /* Size in file image */
-    phdr_bss.p_memsz            = bss_size; /* Size in memory image */
-    phdr_bss.p_flags            = PF_R | PF_W; /* Read & Write */
+    add_chunk(image->chunks, &image->chunk_count, 0, &ehdr, sizeof(ehdr));
+    add_chunk(image->chunks, &image->chunk_count, image->phdr_offset, phdrs, image->segment_count * sizeof(phdrs[0]));
+    add_chunk(image->chunks, &image->chunk_count, image->shdr_offset, shdrs, image->section_count * sizeof(shdrs[0]));
 
-    /*
-     * Elf segment headers
-     */
+    return write_image(file, image->chunks, image->chunk_count, image->size);
+}
 
-    /* Empty section header */
 
-    memset(&shdr_null, 0, sizeof(Elf32_Shdr));
+/**
+ * @brief Fills the ELF64 headers of a laid out image and writes it.
+ * @param file File to write to
+ * @param image Laid out image, its chunks are extended by the headers
+ * @return 0 on success, -1 on failure
+ */
+int write_elf64_image(FILE *file, ElfImage *image)
+{
+    Elf64_Ehdr ehdr;
+    Elf64_Phdr phdrs[ELF_MAX_SEGMENTS];
+    Elf64_Shdr shdrs[ELF_MAX_SECTIONS];
+    size_t i;
 
-    /* .strtab (String table) */
+    memset(&ehdr, 0, sizeof(Elf64_Ehdr));
+    memset(phdrs, 0, sizeof(phdrs));
+    memset(shdrs, 0, sizeof(shdrs));
 
-    memset(&shdr_strtab, 0, sizeof(Elf32_Shdr));
+    ehdr.e_ident[EI_MAG0]       = ELFMAG0;         /* Magic bytes */
+    ehdr.e_ident[EI_MAG1]       = ELFMAG1;
+    ehdr.e_ident[EI_MAG2]       = ELFMAG2;
+    ehdr.e_ident[EI_MAG3]       = ELFMAG3;
+    ehdr.e_ident[EI_CLASS]      = ELFCLASS64;      /* 64bit application */
+    ehdr.e_ident[EI_DATA]       = ELFDATA2LSB;     /* Two's complement, little-endian */
+    ehdr.e_ident[EI_VERSION]    = EV_CURRENT;
+    ehdr.e_ident[EI_OSABI]      = ELFOSABI_LINUX;  /* Linux target */
 
-    shdr_strtab.sh_name         = strtab_shstrtab_index; /* Offset into naming table*/
-    shdr_strtab.sh_type         = SHT_STRTAB;
-    shdr_strtab.sh_flags        = 0;
-    shdr_strtab.sh_addr         = 0; /* Not loaded into virtual space*/
-    shdr_strtab.sh_addralign    = strtab_alignment;
-    shdr_strtab.sh_offset       = strtab_offset;
-    shdr_strtab.sh_size         = strtab_size;
+    ehdr.e_type                 = ET_EXEC;         /* Executable file */
+    ehdr.e_machine              = EM_X86_64;       /* x86_64 arch */
+    ehdr.e_version              = EV_CURRENT;
+    ehdr.e_entry                = image->entry;    /* Entry point (virtual addr.) */
+    ehdr.e_phoff                = image->phdr_offset; /* Program header table offset (file offset) */
+    ehdr.e_shoff                = image->shdr_offset; /* Section header table offset (file offset) */
+    ehdr.e_ehsize               = sizeof(Elf64_Ehdr);
+    ehdr.e_phentsize            = sizeof(Elf64_Phdr);
+    ehdr.e_phnum                = image->segment_count;
+    ehdr.e_shentsize            = image->section_count ? sizeof(Elf64_Shdr) : 0;
+    ehdr.e_shnum                = image->section_count;
+    ehdr.e_shstrndx             = image->section_count ? 1 : SHN_UNDEF; /* Section header index of string table */
+
+    for (i = 0; i < image->segment_count; ++i)
+    {
+        phdrs[i].p_type         = image->segments[i].type;
+        phdrs[i].p_offset       = image->segments[i].offset;
+        phdrs[i].p_vaddr        = image->segments[i].vaddr;
+        phdrs[i].p_align        = image->segments[i].align;
+        phdrs[i].p_filesz       = image->segments[i].filesz;
+        phdrs[i].p_memsz        = image->segments[i].memsz;
+        phdrs[i].p_flags        = image->segments[i].flags;
+    }
 
-    /* .text (Code segment)*/
+    for (i = 0; i < image->section_count; ++i)
+    {
+        shdrs[i].sh_name        = image->sections[i].name;
+        shdrs[i].sh_type        = image->sections[i].type;
+        shdrs[i].sh_flags       = image->sections[i].flags;
+        shdrs[i].sh_addr        = image->sections[i].addr;
+        shdrs[i].sh_addralign   = image->sections[i].addralign;
+        shdrs[i].sh_offset      = image->sections[i].offset;
+        shdrs[i].sh_size        = image->sections[i].size;
+    }
 
-    memset(&shdr_text, 0, sizeof(Elf32_Shdr));
+    add_chunk(image->chunks, &image->chunk_count, 0, &ehdr, sizeof(ehdr));
+    add_chunk(image->chunks, &image->chunk_count, image->phdr_offset, phdrs, image->segment_count * sizeof(phdrs[0]));
+    add_chunk(image->chunks, &image->chunk_count, image->shdr_offset, shdrs, image->section_count * sizeof(shdrs[0]));
 
-    shdr_text.sh_name           = strtab_text_index; /* Offset into naming table*/
-    shdr_text.sh_type           = SHT_PROGBITS;
-    shdr_text.sh_flags          = SHF_ALLOC | SHF_EXECINSTR;
-    shdr_text.sh_addr           = text_vaddr;
-    shdr_text.sh_addralign      = text_alignment;
-    shdr_text.sh_offset         = text_offset;
-    shdr_text.sh_size           = text_size;
+    return write_image(file, image->chunks, image->chunk_count, image->size);
+}
 
-    /* .rodata (Read only data segment)*/
 
-    memset(&shdr_rodata, 0, sizeof(Elf32_Shdr));
+int elf_write(FILE *file,
+        uint32_t entry_point,
+        uint32_t text_vaddr,
+        const unsigned char *text, size_t text_size,
+        uint32_t rodata_vaddr,
+        const unsigned char *rodata, size_t rodata_size,
+        uint32_t data_vaddr,
+        const unsigned char *data, size_t data_size,
+        uint32_t bss_vaddr,
+        size_t bss_size)
+{
+    ElfImage image;
 
-    shdr_rodata.sh_name         = strtab_rodata_index; /* Offset into naming table*/
-    shdr_rodata.sh_type         = SHT_PROGBITS;
-    shdr_rodata.sh_flags        = SHF_ALLOC;
-    shdr_rodata.sh_addr         = rodata_vaddr;
-    shdr_rodata.sh_addralign    = rodata_alignment;
-    shdr_rodata.sh_offset       = rodata_offset;
-    shdr_rodata.sh_size         = rodata_size;
+    layout_image(&image, sizeof(Elf32_Ehdr), sizeof(Elf32_Phdr), sizeof(Elf32_Shdr), entry_point,
+            text_vaddr, text, text_size, rodata_vaddr, rodata, rodata_size,
+            data_vaddr, data, data_size, bss_vaddr, bss_size);
 
-    /* .data (Writable data segment) */
+    return write_elf32_image(file, &image);
+}
 
-    memset(&shdr_data, 0, sizeof(Elf32_Shdr));
+int elf64_write(FILE *file,
+        uint32_t entry_point,
+        uint32_t text_vaddr,
+        const unsigned char *text, size_t text_size,
+        uint32_t rodata_vaddr,
+        const unsigned char *rodata, size_t rodata_size,
+        uint32_t data_vaddr,
+        const unsigned char *data, size_t data_size,
+        uint32_t bss_vaddr,
+        size_t bss_size)
+{
+    ElfImage image;
 
-    shdr_data.sh_name           = strtab_data_index; /* Offset into naming table*/
-    shdr_data.sh_type           = SHT_PROGBITS;
-    shdr_data.sh_flags          = SHF_ALLOC | SHF_WRITE;
-    shdr_data.sh_addr           = data_vaddr;
-    shdr_data.sh_addralign      = data_alignment;
-    shdr_data.sh_offset         = data_offset;
-    shdr_data.sh_size           = data_size;
+    layout_image(&image, sizeof(Elf64_Ehdr), sizeof(Elf64_Phdr), sizeof(Elf64_Shdr), entry_point,
+            text_vaddr, text, text_size, rodata_vaddr, rodata, rodata_size,
+            data_vaddr, data, data_size, bss_vaddr, bss_size);
 
-    /* .bss (Zero initialized variables) */
+    return write_elf64_image(file, &image);
+}
 
-    memset(&shdr_bss, 0, sizeof(Elf32_Shdr));
+void elf_optimize_alignment(
+        uint32_t base_vaddr,
+        uint32_t text_size,
+        uint32_t rodata_size,
+        uint32_t data_size,
+        uint32_t *text_vaddr,
+        uint32_t *rodata_vaddr,
+        uint32_t *data_vaddr,
+        uint32_t *bss_vaddr)
+{
+    const uint32_t text_file_offset = sizeof(Elf32_Ehdr) + 4 * sizeof(Elf32_Phdr);
+    const uint32_t rodata_file_offset = text_file_offset + text_size;
+    const uint32_t data_file_offset = rodata_file_offset + rodata_size;
 
-    shdr_bss.sh_name            = strtab_bss_index; /* Offset into naming table*/
-    shdr_bss.sh_type            = SHT_NOBITS;
-    shdr_bss.sh_flags           = SHF_ALLOC | SHF_WRITE;
-    shdr_bss.sh_addr            = bss_vaddr;
-    shdr_bss.sh_addralign       = bss_alignment;
-    shdr_bss.sh_offset          = 0;
-    shdr_bss.sh_size            = bss_size;
+    *text_vaddr = base_vaddr + padding_for(base_vaddr, text_file_offset, 0x1000);
+    *rodata_vaddr = *text_vaddr + text_size + padding_for(*text_vaddr + text_size, rodata_file_offset, 0x1000);
+    *data_vaddr = *rodata_vaddr + rodata_size + padding_for(*rodata_vaddr + rodata_size, data_file_offset, 0x1000);
+    *bss_vaddr = *data_vaddr + data_size + padding_for(*data_vaddr + data_size, 0, 0x1000);
+}
 
+void elf64_optimize_alignment(
+        uint32_t base_vaddr,
+        uint32_t text_size,
+        uint32_t rodata_size,
+        uint32_t data_size,
+        uint32_t *text_vaddr,
+        uint32_t *rodata_vaddr,
+        uint32_t *data_vaddr,
+        uint32_t *bss_vaddr)
+{
+    const uint32_t text_file_offset = sizeof(Elf64_Ehdr) + 4 * sizeof(Elf64_Phdr);
+    const uint32_t rodata_file_offset = text_file_offset + text_size;
+    const uint32_t data_file_offset = rodata_file_offset + rodata_size;
 
     /*
-     * Write to file
+     * Unlike i386 binaries x86_64 ones are not loaded with READ_IMPLIES_EXEC
+     * so every segment has to start on a page of its own to keep the loader
+     * from mapping .rodata over the executable .text page.
      */
+    *text_vaddr = base_vaddr + padding_for(base_vaddr, text_file_offset, 0x1000);
+    *rodata_vaddr = page_after(*text_vaddr + text_size) + padding_for(0, rodata_file_offset, 0x1000);
+    *data_vaddr = page_after(*rodata_vaddr + rodata_size) + padding_for(0, data_file_offset, 0x1000);
+    *bss_vaddr = page_after(*data_vaddr + data_size);
+}
 
-    /*
-     * File layout
-     *
-     * elfhdr | elfphdr... | text | rodata | data | strtab | shdr strings | shdr...
-     */
 
-    fwrite(&ehdr, sizeof(ehdr), 1, file);
+int elf_write_compact(FILE *file,
+        uint32_t entry_point,
+        uint32_t text_vaddr,
+        const unsigned char *text, size_t text_size,
+        uint32_t rodata_vaddr,
+        const unsigned char *rodata, size_t rodata_size,
+        uint32_t data_vaddr,
+        const unsigned char *data, size_t data_size,
+        uint32_t bss_vaddr,
+        size_t bss_size)
+{
+    ElfImage image;
+
+    (void)rodata_vaddr;
 
-    fwrite(&phdr_text, sizeof(phdr_text), 1, file);
-    fwrite(&phdr_rodata, sizeof(phdr_rodata), 1, file);
-    fwrite(&phdr_data, sizeof(phdr_data), 1, file);
-    fwrite(&phdr_bss, sizeof(phdr_bss), 1, file);
+    layout_compact_image(&image, sizeof(Elf32_Ehdr), sizeof(Elf32_Phdr), entry_point,
+            text_vaddr, text, text_size, rodata, rodata_size,
+            data_vaddr, data, data_size, bss_vaddr, bss_size);
 
-    write_padding(text_padding_prefix, file);
-    fwrite(text, text_size, 1, file);
+    return write_elf32_image(file, &image);
+}
 
-    write_padding(rodata_padding_prefix, file);
-    fwrite(rodata, rodata_size, 1, file);
+int elf64_write_compact(FILE *file,
+        uint32_t entry_point,
+        uint32_t text_vaddr,
+        const unsigned char *text, size_t text_size,
+        uint32_t rodata_vaddr,
+        const unsigned char *rodata, size_t rodata_size,
+        uint32_t data_vaddr,
+        const unsigned char *data, size_t data_size,
+        uint32_t bss_vaddr,
+        size_t bss_size)
+{
+    ElfImage image;
 
-    write_padding(data_padding_prefix, file);
-    fwrite(data, data_size, 1, file);
+    (void)rodata_vaddr;
 
-    write_padding(strtab_padding_prefix, file);
-    fwrite(strtab, strtab_size, 1, file);
+    layout_compact_image(&image, sizeof(Elf64_Ehdr), sizeof(Elf64_Phdr), entry_point,
+            text_vaddr, text, text_size, rodata, rodata_size,
+            data_vaddr, data, data_size, bss_vaddr, bss_size);
 
-    fwrite(&shdr_null, sizeof(shdr_null), 1, file);
-    fwrite(&shdr_strtab, sizeof(shdr_strtab), 1, file);
-    fwrite(&shdr_text, sizeof(shdr_text), 1, file);
-    fwrite(&shdr_rodata, sizeof(shdr_rodata), 1, file);
-    fwrite(&shdr_data, sizeof(shdr_data), 1, file);
-    fwrite(&shdr_bss, sizeof(shdr_bss), 1, file);
+    return write_elf64_image(file, &image);
 }
 
-void elf_optimize_alignment(
+/**
+ * @brief Compact layout addresses for the given size of the ELF and program headers.
+ */
+void compact_alignment(
         uint32_t base_vaddr,
+        uint32_t headers_size,
         uint32_t text_size,
         uint32_t rodata_size,
         uint32_t data_size,
@@ -357,13 +689,39 @@ void elf_optimize_alignment(
         uint32_t *data_vaddr,
         uint32_t *bss_vaddr)
 {
-    const uint32_t text_file_offset = sizeof(Elf32_Ehdr) + 4 * sizeof(Elf32_Phdr);
-    const uint32_t rodata_file_offset = text_file_offset + text_size;
-    const uint32_t data_file_offset = rodata_file_offset + rodata_size;
+    const uint32_t data_file_offset = headers_size + text_size + rodata_size;
 
-    *text_vaddr = base_vaddr + padding_for(base_vaddr, text_file_offset, 0x1000);
-    *rodata_vaddr = *text_vaddr + text_size + padding_for(*text_vaddr + text_size, rodata_file_offset, 0x1000);
-    *data_vaddr = *rodata_vaddr + rodata_size + padding_for(*rodata_vaddr + rodata_size, data_file_offset, 0x1000);
-    *bss_vaddr = *data_vaddr + data_size + padding_for(*data_vaddr + data_size, 0, 0x1000);
+    /* The writable segment starts on the page behind the read only one at its file offset */
+    *text_vaddr = page_after(base_vaddr) + headers_size;
+    *rodata_vaddr = *text_vaddr + text_size;
+    *data_vaddr = page_after(*rodata_vaddr + rodata_size) + (data_file_offset & 0xfff);
+    *bss_vaddr = *data_vaddr + data_size + padding_for(*data_vaddr + data_size, 0, ELF_COMPACT_BSS_ALIGNMENT);
+}
+
+void elf_compact_alignment(
+        uint32_t base_vaddr,
+        uint32_t text_size,
+        uint32_t rodata_size,
+        uint32_t data_size,
+        uint32_t *text_vaddr,
+        uint32_t *rodata_vaddr,
+        uint32_t *data_vaddr,
+        uint32_t *bss_vaddr)
+{
+    compact_alignment(base_vaddr, sizeof(Elf32_Ehdr) + 2 * sizeof(Elf32_Phdr), text_size, rodata_size, data_size,
+            text_vaddr, rodata_vaddr, data_vaddr, bss_vaddr);
 }
 
+void elf64_compact_alignment(
+        uint32_t base_vaddr,
+        uint32_t text_size,
+        uint32_t rodata_size,
+        uint32_t data_size,
+        uint32_t *text_vaddr,
+        uint32_t *rodata_vaddr,
+        uint32_t *data_vaddr,
+        uint32_t *bss_vaddr)
+{
+    compact_alignment(base_vaddr, sizeof(Elf64_Ehdr) + 2 * sizeof(Elf64_Phdr), text_size, rodata_size, data_size,
+            text_vaddr, rodata_vaddr, data_vaddr, bss_vaddr);
+}
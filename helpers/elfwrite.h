@@ -26,6 +26,23 @@
 #include <stdio.h>
 #include <stdint.h>
 
+#define ELF_COMPACT_BSS_ALIGNMENT 64 /* bss alignment of the compact layout, a cache line */
+
+/**
+ *  @brief Return the first page boundary at or behind the given addr.
+ *  @param addr Addr. to align
+ */
+uint32_t page_after(uint32_t addr);
+
+/**
+ *  @brief Return the number of bytes to add to addr to make it congruent
+ *         to reference modulo alignment.
+ *  @param addr Addr. to align
+ *  @param reference Addr. with the desired offset
+ *  @param alignment Power of two alignment
+ */
+uint32_t padding_for(const uint32_t addr, const uint32_t reference, const uint32_t alignment);
+
 /**
  *  @brief Writes an ELF executable with the given parameters to the given file.
  *  @param file File to write to
@@ -41,8 +58,38 @@
  *  @param data_size Size of the given writable data
  *  @param bss_vaddr Address to put the zero initialized writable segment at (== 0 initialized variables)
  *  @param bss_size Size to reserve for the zero initialized data
+ *  @return 0 on success, -1 if the file could not be written
  */
-void elf_write(FILE *file,
+int elf_write(FILE *file,
+        uint32_t entry_point,
+        uint32_t text_vaddr,
+        const unsigned char *text, size_t text_size,
+        uint32_t rodata_vaddr,
+        const unsigned char *rodata, size_t rodata_size,
+        uint32_t data_vaddr,
+        const unsigned char *data, size_t data_size,
+        uint32_t bss_vaddr,
+        size_t bss_size);
+
+/**
+ *  @brief Writes an ELF64 (x86_64) executable with the given parameters to the given file.
+ *  @note Same segment layout as elf_write.
+ *  @param file File to write to
+ *  @param entry_point Virtual address of entry point
+ *  @param text_vaddr Address to load .text segment to
+ *  @param text Code to write
+ *  @param text_size Size of the given code
+ *  @param rodata_vaddr Address to load .rodata segment to
+ *  @param rodata Read only data to write
+ *  @param rodata_size Size of the given read only data
+ *  @param data_vaddr Address to load .data segment to
+ *  @param data Writable data to write (== initialized variables)
+ *  @param data_size Size of the given writable data
+ *  @param bss_vaddr Address to put the zero initialized writable segment at (== 0 initialized variables)
+ *  @param bss_size Size to reserve for the zero initialized data
+ *  @return 0 on success, -1 if the file could not be written
+ */
+int elf64_write(FILE *file,
         uint32_t entry_point,
         uint32_t text_vaddr,
         const unsigned char *text, size_t text_size,
@@ -76,4 +123,116 @@ void elf_optimize_alignment(
         uint32_t *data_vaddr,
         uint32_t *bss_vaddr);
 
+/**
+ *  @brief Return a set of addresses for the required sizes that prevent
+ *         padding from being required in files written with elf64_write.
+ *
+ *  @param base_vaddr Lowest vaddr to consider.
+ *  @param text_size Size of text segment
+ *  @param rodata_size Size of rodata segment
+ *  @param data_size Size of data segment
+ *  @param text_vaddr Target variable for optimal text vaddr.
+ *  @param rodata_vaddr Target variable for optimal rodata vaddr.
+ *  @param data_vaddr Target variable for optimal data vaddr.
+ *  @param bss_vaddr Target variable for optimal bss vaddr.
+ */
+void elf64_optimize_alignment(
+        uint32_t base_vaddr,
+        uint32_t text_size,
+        uint32_t rodata_size,
+        uint32_t data_size,
+        uint32_t *text_vaddr,
+        uint32_t *rodata_vaddr,
+        uint32_t *data_vaddr,
+        uint32_t *bss_vaddr);
+
+/**
+ *  @brief Writes a compact ELF executable with the given parameters to the given file.
+ *
+ *  Instead of one page aligned segment per section the image has two
+ *  segments, .text and .rodata readable and executable, .data and .bss
+ *  writable, and no section headers. The file holds no padding at all.
+ *  The addresses have to come from elf_compact_alignment.
+ *
+ *  @param file File to write to
+ *  @param entry_point Virtual address of entry point
+ *  @param text_vaddr Address to load .text segment to
+ *  @param text Code to write
+ *  @param text_size Size of the given code
+ *  @param rodata_vaddr Address to load .rodata to, directly behind .text
+ *  @param rodata Read only data to write
+ *  @param rodata_size Size of the given read only data
+ *  @param data_vaddr Address to load .data segment to
+ *  @param data Writable data to write (== initialized variables)
+ *  @param data_size Size of the given writable data
+ *  @param bss_vaddr Address to put the zero initialized data at, behind .data
+ *  @param bss_size Size to reserve for the zero initialized data
+ *  @return 0 on success, -1 if the file could not be written
+ */
+int elf_write_compact(FILE *file,
+        uint32_t entry_point,
+        uint32_t text_vaddr,
+        const unsigned char *text, size_t text_size,
+        uint32_t rodata_vaddr,
+        const unsigned char *rodata, size_t rodata_size,
+        uint32_t data_vaddr,
+        const unsigned char *data, size_t data_size,
+        uint32_t bss_vaddr,
+        size_t bss_size);
+
+/**
+ *  @brief Writes a compact ELF64 (x86_64) executable with the given parameters to the given file.
+ *  @note Same segment layout as elf_write_compact, the addresses have to
+ *        come from elf64_compact_alignment.
+ *  @return 0 on success, -1 if the file could not be written
+ */
+int elf64_write_compact(FILE *file,
+        uint32_t entry_point,
+        uint32_t text_vaddr,
+        const unsigned char *text, size_t text_size,
+        uint32_t rodata_vaddr,
+        const unsigned char *rodata, size_t rodata_size,
+        uint32_t data_vaddr,
+        const unsigned char *data, size_t data_size,
+        uint32_t bss_vaddr,
+        size_t bss_size);
+
+/**
+ *  @brief Return the addresses of the sections in files written with
+ *         elf_write_compact. The .data and .bss segment starts on the page
+ *         behind .rodata, .bss is ELF_COMPACT_BSS_ALIGNMENT aligned.
+ *
+ *  @param base_vaddr Lowest vaddr to consider.
+ *  @param text_size Size of text segment
+ *  @param rodata_size Size of rodata segment
+ *  @param data_size Size of data segment
+ *  @param text_vaddr Target variable for text vaddr.
+ *  @param rodata_vaddr Target variable for rodata vaddr.
+ *  @param data_vaddr Target variable for data vaddr.
+ *  @param bss_vaddr Target variable for bss vaddr.
+ */
+void elf_compact_alignment(
+        uint32_t base_vaddr,
+        uint32_t text_size,
+        uint32_t rodata_size,
+        uint32_t data_size,
+        uint32_t *text_vaddr,
+        uint32_t *rodata_vaddr,
+        uint32_t *data_vaddr,
+        uint32_t *bss_vaddr);
+
+/**
+ *  @brief Return the addresses of the sections in files written with
+ *         elf64_write_compact, @see elf_compact_alignment.
+ */
+void elf64_compact_alignment(
+        uint32_t base_vaddr,
+        uint32_t text_size,
+        uint32_t rodata_size,
+        uint32_t data_size,
+        uint32_t *text_vaddr,
+        uint32_t *rodata_vaddr,
+        uint32_t *data_vaddr,
+        uint32_t *bss_vaddr);
+
 #endif /* ELFWRITE_H_ */
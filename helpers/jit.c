@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2011, Stefan Hacker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#define _GNU_SOURCE /* MAP_ANONYMOUS, MAP_32BIT */
+
+#include "jit.h"
+
+#include <memory.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+
+
+/**
+ * @brief Signature of the code generated for a program run in-process.
+ */
+typedef int (*JitEntry)(void);
+
+
+unsigned char *jit_alloc(size_t size)
+{
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+    void *memory;
+
+#ifdef MAP_32BIT
+    flags |= MAP_32BIT;
+#endif
+
+    memory = mmap(0, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (memory == MAP_FAILED)
+        return 0;
+
+    return (unsigned char*)memory;
+}
+
+
+int jit_protect(unsigned char *memory, size_t size, int executable)
+{
+    return mprotect(memory, size, executable ? PROT_READ | PROT_EXEC : PROT_READ);
+}
+
+
+void jit_free(unsigned char *memory, size_t size)
+{
+    munmap(memory, size);
+}
+
+
+int jit_call(const unsigned char *entry)
+{
+    JitEntry function;
+
+    /* ISO C does not allow casting object pointers to function pointers */
+    memcpy(&function, &entry, sizeof(function));
+
+    return function();
+}
+
+
+FILE *jit_open_perf_map(void)
+{
+    char name[64];
+
+    sprintf(name, "/tmp/perf-%ld.map", (long)getpid());
+    return fopen(name, "w");
+}
+
+
+void jit_add_perf_symbol(FILE *map, uint32_t start, size_t size, const char *name)
+{
+    fprintf(map, "%x %lx %s\n", start, (unsigned long)size, name);
+}
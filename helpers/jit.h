@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2011, Stefan Hacker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef JIT_H_
+#define JIT_H_
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ *  @brief Maps read/write memory for a program run in-process.
+ *  @note On x86_64 the memory is located in the lowest 2GB so it can be
+ *        addressed through absolute 32 bit displacements.
+ *  @param size Number of bytes to map. Has to be a multiple of the page size.
+ *  @return Mapped memory or 0 on failure.
+ */
+unsigned char *jit_alloc(size_t size);
+
+/**
+ *  @brief Changes a range of mapped memory to be read-only.
+ *  @param memory Page aligned start of the range
+ *  @param size Size of the range
+ *  @param executable 1 to allow executing the range
+ *  @return 0 on success, -1 on failure
+ */
+int jit_protect(unsigned char *memory, size_t size, int executable);
+
+/**
+ *  @brief Unmaps memory returned by jit_alloc.
+ *  @param memory Memory to unmap
+ *  @param size Size passed to jit_alloc
+ */
+void jit_free(unsigned char *memory, size_t size);
+
+/**
+ *  @brief Calls the code at the given address as int(void) function.
+ *  @param entry Code to call
+ *  @return Value returned by the code
+ */
+int jit_call(const unsigned char *entry);
+
+/**
+ *  @brief Opens the perf map (/tmp/perf-<pid>.map) of this process so
+ *         perf can symbolize code generated at runtime.
+ *  @return Opened file or 0 on failure.
+ */
+FILE *jit_open_perf_map(void);
+
+/**
+ *  @brief Adds a symbol to a perf map.
+ *  @param map Map opened with jit_open_perf_map
+ *  @param start Address of the symbol
+ *  @param size Size of the symbol
+ *  @param name Name of the symbol
+ */
+void jit_add_perf_symbol(FILE *map, uint32_t start, size_t size, const char *name);
+
+#endif /* JIT_H_ */
@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2011, Stefan Hacker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include "parallel.h"
+
+#include <stdlib.h>
+#include <pthread.h>
+
+
+typedef struct ParallelThread ParallelThread;
+
+/**
+ * @brief Arguments of a single thread started by run_parallel.
+ */
+struct ParallelThread
+{
+    ParallelTask task;
+    void *context;
+    size_t index;
+    size_t count;
+    pthread_t thread;
+    int started;
+};
+
+
+/**
+ * @brief pthread entry point running a single task index.
+ */
+void *parallel_thread(void *argument)
+{
+    ParallelThread *thread = (ParallelThread*)argument;
+
+    thread->task(thread->context, thread->index, thread->count);
+
+    return 0;
+}
+
+
+int run_parallel(ParallelTask task, void *context, size_t count)
+{
+    ParallelThread *threads = (ParallelThread*)calloc(count, sizeof(ParallelThread));
+    int result = 0;
+    size_t i;
+
+    if (!threads)
+    {
+        for (i = 0; i < count; ++i)
+            task(context, i, count);
+
+        return -1;
+    }
+
+    for (i = 1; i < count; ++i)
+    {
+        threads[i].task = task;
+        threads[i].context = context;
+        threads[i].index = i;
+        threads[i].count = count;
+        threads[i].started = pthread_create(&threads[i].thread, 0, parallel_thread, &threads[i]) == 0;
+    }
+
+    task(context, 0, count);
+
+    for (i = 1; i < count; ++i)
+    {
+        if (threads[i].started)
+        {
+            pthread_join(threads[i].thread, 0);
+        }
+        else
+        {
+            /* Keep going on the calling thread */
+            task(context, i, count);
+            result = -1;
+        }
+    }
+
+    free(threads);
+
+    return result;
+}
+
+
+size_t parallel_range_start(size_t items, size_t index, size_t count)
+{
+    const size_t remainder = items % count;
+
+    /* The first remainder ranges get one item more */
+    return index * (items / count) + (index < remainder ? index : remainder);
+}
@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2011, Stefan Hacker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef PARALLEL_H_
+#define PARALLEL_H_
+
+#include <stddef.h>
+
+/**
+ *  @brief Work function run by every thread of run_parallel.
+ *  @param context Context passed to run_parallel
+ *  @param index Index of the calling thread, 0 to count - 1
+ *  @param count Number of threads
+ */
+typedef void (*ParallelTask)(void *context, size_t index, size_t count);
+
+/**
+ *  @brief Runs the task on the given number of threads and waits for all
+ *         of them to finish. The calling thread runs index 0 itself.
+ *  @param task Task to run
+ *  @param context Context passed to the task
+ *  @param count Number of threads
+ *  @return 0 on success, -1 if threads could not be created. The task
+ *          has run for every index either way.
+ */
+int run_parallel(ParallelTask task, void *context, size_t count);
+
+/**
+ *  @brief Returns the first item of a range of items split evenly between threads.
+ *  @param items Number of items
+ *  @param index Index of the thread, the range of the thread ends at the first item of index + 1
+ *  @param count Number of threads
+ */
+size_t parallel_range_start(size_t items, size_t index, size_t count);
+
+#endif /* PARALLEL_H_ */
@@ -0,0 +1,147 @@
+/*
+ * Copyright (C) 2011, Stefan Hacker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "sha256.h"
+
+#include <string.h>
+
+
+/**
+ * @brief Round constants, the first 32 bits of the fractional parts of the
+ *        cube roots of the first 64 primes.
+ */
+const uint32_t SHA256_K[64] = {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2 };
+
+#define SHA256_ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+
+/**
+ * @brief Processes one 64 byte block.
+ */
+void sha256_block(Sha256 *hash, const unsigned char *block)
+{
+    uint32_t w[64];
+    uint32_t v[8];
+    uint32_t t1;
+    uint32_t t2;
+    int i;
+
+    for (i = 0; i < 16; ++i)
+        w[i] = (uint32_t)block[4 * i] << 24 | (uint32_t)block[4 * i + 1] << 16
+                | (uint32_t)block[4 * i + 2] << 8 | (uint32_t)block[4 * i + 3];
+
+    for (i = 16; i < 64; ++i)
+        w[i] = (SHA256_ROTR(w[i - 2], 17) ^ SHA256_ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10)) + w[i - 7]
+                + (SHA256_ROTR(w[i - 15], 7) ^ SHA256_ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3)) + w[i - 16];
+
+    memcpy(v, hash->state, sizeof(v));
+
+    for (i = 0; i < 64; ++i)
+    {
+        t1 = v[7] + (SHA256_ROTR(v[4], 6) ^ SHA256_ROTR(v[4], 11) ^ SHA256_ROTR(v[4], 25))
+                + ((v[4] & v[5]) ^ (~v[4] & v[6])) + SHA256_K[i] + w[i];
+        t2 = (SHA256_ROTR(v[0], 2) ^ SHA256_ROTR(v[0], 13) ^ SHA256_ROTR(v[0], 22))
+                + ((v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]));
+
+        memmove(v + 1, v, 7 * sizeof(uint32_t));
+        v[4] += t1;
+        v[0] = t1 + t2;
+    }
+
+    for (i = 0; i < 8; ++i)
+        hash->state[i] += v[i];
+}
+
+
+void sha256_init(Sha256 *hash)
+{
+    const uint32_t initial[8] = {
+            0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+
+    memset(hash, 0, sizeof(Sha256));
+    memcpy(hash->state, initial, sizeof(initial));
+}
+
+
+void sha256_update(Sha256 *hash, const void *data, size_t size)
+{
+    const unsigned char *bytes = (const unsigned char*)data;
+    size_t chunk;
+
+    hash->length_low += (uint32_t)size;
+    if (hash->length_low < (uint32_t)size)
+        ++hash->length_high;
+
+    while (size > 0)
+    {
+        chunk = sizeof(hash->block) - hash->used < size ? sizeof(hash->block) - hash->used : size;
+        memcpy(hash->block + hash->used, bytes, chunk);
+        hash->used += chunk;
+        bytes += chunk;
+        size -= chunk;
+
+        if (hash->used == sizeof(hash->block))
+        {
+            sha256_block(hash, hash->block);
+            hash->used = 0;
+        }
+    }
+}
+
+
+void sha256_final(Sha256 *hash, unsigned char digest[SHA256_DIGEST_SIZE])
+{
+    const uint32_t bits_high = hash->length_high << 3 | hash->length_low >> 29;
+    const uint32_t bits_low = hash->length_low << 3;
+    unsigned char length[8];
+    int i;
+
+    for (i = 0; i < 4; ++i)
+    {
+        length[i] = (unsigned char)(bits_high >> (24 - 8 * i));
+        length[i + 4] = (unsigned char)(bits_low >> (24 - 8 * i));
+    }
+
+    /* 0x80, zeros up to 56 bytes in the last block and the length in bits */
+    hash->block[hash->used++] = 0x80;
+    if (hash->used > 56)
+    {
+        memset(hash->block + hash->used, 0, sizeof(hash->block) - hash->used);
+        sha256_block(hash, hash->block);
+        hash->used = 0;
+    }
+
+    memset(hash->block + hash->used, 0, 56 - hash->used);
+    memcpy(hash->block + 56, length, sizeof(length));
+    sha256_block(hash, hash->block);
+
+    for (i = 0; i < 32; ++i)
+        digest[i] = (unsigned char)(hash->state[i / 4] >> (24 - 8 * (i % 4)));
+}
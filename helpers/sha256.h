@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2011, Stefan Hacker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef SHA256_H_
+#define SHA256_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA256_DIGEST_SIZE 32
+
+typedef struct Sha256 Sha256;
+
+/**
+ *  @brief State of an incremental SHA-256 computation (FIPS 180-4).
+ */
+struct Sha256
+{
+    uint32_t state[8];
+    uint32_t length_low; /* message length in bytes */
+    uint32_t length_high;
+    unsigned char block[64]; /* pending input */
+    size_t used; /* bytes pending in block */
+};
+
+/**
+ *  @brief Starts a new hash.
+ */
+void sha256_init(Sha256 *hash);
+
+/**
+ *  @brief Adds the given bytes to the hashed message.
+ */
+void sha256_update(Sha256 *hash, const void *data, size_t size);
+
+/**
+ *  @brief Finishes the hash.
+ *  @param hash Hash to finish, has to be initialized again for reuse
+ *  @param digest Set to the digest
+ */
+void sha256_final(Sha256 *hash, unsigned char digest[SHA256_DIGEST_SIZE]);
+
+#endif /* SHA256_H_ */
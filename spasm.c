@@ -27,117 +27,430 @@
 
 #include "spasm_parser.h"
 #include "spasm_writer.h"
+#include "spasm_interpreter.h"
+#include "spasm_instrument.h"
+#include "spasm_vectorizer.h"
+#include "spasm_layout.h"
+#include "spasm_passes.h"
+#include "spasm_cache.h"
+#include "spasm_listing.h"
 #include "helpers/elfwrite.h"
 
-void print_cmd(Command *cmd)
+void print_usage(const char *name)
+{
+    fprintf(stderr, "Usage:\n"
+           "    %s <source> <target> [-i/--info] [-O0|-O1|-O2] [--arch=i386|x86_64] [--compact] [--vectorize]\n"
+           "        [--fuse] [--indexed] [--loop-invariants] [--value-numbering] [--data-layout]\n"
+           "        [--instrument[=<file>]] [--profile-use=<file>] [--align-loops[=<bytes>]] [--threads=<n>]\n"
+           "        [--relocations=<file>] [--map=<file>] [--stats] [--stats-json=<file>]\n"
+           "        [--cache-dir=<dir>] [--cache-size=<MiB>] [--module]\n",
+           name);
+    fprintf(stderr,
+           "    %s --run <source> [-i/--info] [-O0|-O1|-O2] [--vectorize] [--fuse] [--indexed] [--data-layout]\n"
+           "        [--loop-invariants] [--value-numbering] [--perf-map] [--profile-use=<file>]\n"
+           "        [--align-loops[=<bytes>]] [--threads=<n>] [--relocations=<file>] [--map=<file>] [--stats]\n"
+           "        [--stats-json=<file>]\n"
+           "    %s --interpret <source> [-i/--info] [-O0|-O1|-O2] [--vectorize] [--loop-invariants]\n"
+           "        [--profile=<file>] [--stats] [--stats-json=<file>]\n",
+           name, name);
+    fprintf(stderr,
+           "    %s link <module>... -o <target> [--compact] [--relocations=<file>]\n",
+           name);
+}
+
+
+/**
+ * @brief Creates the target file.
+ * @param name Name of the target
+ * @param executable Set 755 permissions for binaries
+ * @return Handle to write the target to or 0 on failure.
+ */
+FILE *open_target(const char *name, const int executable)
 {
-    printf("0x%x l.%u ", cmd->vaddr, cmd->source_line);
+    FILE *target = fopen(name, "wb");
 
-    if (cmd->label)
+    if (!target)
     {
-        printf("#%s ", cmd->label->name);
+        fprintf(stderr, "Failed to open target file \"%s\"\n", name);
+        return 0;
     }
 
-    printf("%s", SPASM_MNEMONICS[cmd->type]);
-
-    switch (cmd->type)
+    /* Set 755 permissions on target file */
+    if(executable && chmod(name, S_IXUSR | S_IRUSR | S_IWUSR |
+                   S_IXGRP | S_IRGRP |
+                   S_IXOTH | S_IROTH) != 0)
     {
-    case SPASM_LC:
-        printf(" %d", cmd->argument.constant_arg);
-        break;
-    case SPASM_JMP:
-    case SPASM_JIN:
-        printf(" #%s -> [", cmd->argument.label_arg->name);
-        print_cmd(cmd->argument.label_arg->command);
-        printf("]");
-        break;
-    case SPASM_LA:
-        printf(" $%s [0x%x]",
-                cmd->argument.memory_arg->name,
-                cmd->argument.memory_arg->vaddr);
-        break;
-    default: break;
+        fprintf(stderr, "Failed to set executable flag on target file.\n");
     }
+
+    return target;
 }
 
 
-void print_info(const ParserState *parser)
+/**
+ * @brief Links modules built with --module into a binary.
+ * @return Exit code of spasm
+ */
+int link_program(int argn, char **argv)
 {
-    Command *cmd;
-    MemoryLocation *mem;
-    Label *lbl;
+    const char *target_name = 0;
+    char symbol[MAX_SYMBOL_NAME_LENGTH];
+    FILE **modules = (FILE**)calloc(argn, sizeof(FILE*));
+    FILE *target;
+    WriterOptions options;
+    Errc result;
+    size_t count = 0;
+    size_t j;
+    int exit_code = EXIT_FAILURE;
+    int i;
+
+    if (!modules)
+        return EXIT_FAILURE;
 
-    printf("===INFO===\n");
-    printf("Variables:\n");
-    mem = parser->memory_location_first;
-    while (mem)
+    init_writer_options(&options);
+    symbol[0] = '\0';
+
+    for (i = 2; i < argn; ++i)
     {
-        printf("0x%x - 0x%x l.%u $%s (%i bytes)\n", mem->vaddr, mem->vaddr + mem->size - 1, mem->source_line, mem->name, mem->size);
-        mem = mem->next;
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argn)
+        {
+            target_name = argv[++i];
+        }
+        else if (strcmp(argv[i], "--compact") == 0)
+        {
+            options.compact = 1;
+        }
+        else if (strncmp(argv[i], "--relocations=", 14) == 0 && !options.relocations)
+        {
+            options.relocations = fopen(argv[i] + 14, "w");
+            if (!options.relocations)
+            {
+                fprintf(stderr, "Failed to open relocations file \"%s\"\n", argv[i] + 14);
+                goto cleanup;
+            }
+        }
+        else if (argv[i][0] != '-')
+        {
+            modules[count] = fopen(argv[i], "rb");
+            if (!modules[count])
+            {
+                fprintf(stderr, "Failed to open module file \"%s\"\n", argv[i]);
+                goto cleanup;
+            }
+            ++count;
+        }
+        else
+        {
+            print_usage(argv[0]);
+            goto cleanup;
+        }
     }
-    printf("\nCommands:\n");
-    cmd = parser->command_first;
-    while (cmd)
+
+    if (!target_name || !count)
     {
-        print_cmd(cmd);
-        printf("\n");
-        cmd = cmd->next;
+        print_usage(argv[0]);
+        goto cleanup;
     }
 
-    printf("\nLabels:\n");
-    lbl = parser->label_first;
-    while (lbl)
+    printf("Linking %lu modules [%s]....", (unsigned long)count, target_name);
+    target = open_target(target_name, 1);
+    if (!target)
     {
-        printf("l.%u #%s -> ", lbl->command->source_line, lbl->name);
-        print_cmd(lbl->command);
-        printf("\n");
-        lbl = lbl->next;
+        printf("FAILED\n");
+        goto cleanup;
     }
-    printf("===ENDOFINFO===\n\n");
-}
 
-void print_usage(const char *name)
-{
-    fprintf(stderr, "Usage:\n"
-           "    %s <source> <target> [-i/--info]\n", name);
+    result = link_modules(modules, count, target, &options, symbol);
+    fclose(target);
+    if (result != ERR_SUCCESS)
+    {
+        /* Don't leave an empty executable behind */
+        remove(target_name);
+        printf("FAILED\n");
+        fprintf(stderr, "Failed to link modules, reason: %s%s%s\n", SPASM_ERR_STR[result],
+                symbol[0] ? " " : "", symbol);
+        goto cleanup;
+    }
+
+    printf("DONE\n");
+    exit_code = EXIT_SUCCESS;
+
+    cleanup: for (j = 0; j < count; ++j)
+        fclose(modules[j]);
+    free(modules);
+    if (options.relocations)
+        fclose(options.relocations);
+
+    return exit_code;
 }
 
 int main(int argn, char **argv)
 {
     FILE *source;
     FILE *target;
+    FILE *progress = stdout;
+    const char *source_name;
+    const char *target_name = 0;
+    const char *profile_name = 0;
+    const char *layout_name = 0;
+    const char *relocations_name = 0;
+    const char *map_name = 0;
+    const char *stats_name = 0;
+    const char *cache_name = 0;
+    char *instrument_name = 0;
+    char cache_options[128];
+    unsigned long cache_size = CACHE_DEFAULT_SIZE;
+    BuildCache cache;
+    BlockCounts block_counts;
+    PassOptions passes;
+    PassManager manager;
+    FILE *profile;
+    FILE *stats_file;
+    Interpreter interpreter;
     ParserState parser;
     Errc result;
+    WriterOptions options;
+    SpasmStats stats;
+    SpasmStats *collect = 0;
     int verbose = 0;
+    int module = 0;
+    int run = 0;
+    int interpret = 0;
+    int exit_code = EXIT_SUCCESS;
+    int i;
+
+    if (argn >= 2 && strcmp(argv[1], "link") == 0)
+        return link_program(argn, argv);
 
     if (argn < 3)
     {
         print_usage(argv[0]);
         return EXIT_FAILURE;
     }
-    else if (argn == 4)
+
+    init_writer_options(&options);
+    memset(&passes, 0, sizeof(PassOptions));
+
+    if (strcmp(argv[1], "--run") == 0 || strcmp(argv[1], "--interpret") == 0)
+    {
+        /* Keep stdout to the program */
+        run = argv[1][2] == 'r';
+        interpret = !run;
+        passes.interpret = interpret;
+        progress = stderr;
+        source_name = argv[2];
+    }
+    else
+    {
+        source_name = argv[1];
+        target_name = argv[2];
+    }
+
+    for (i = 3; i < argn; ++i)
     {
-        verbose = strcmp(argv[3], "--info") == 0 || strcmp(argv[3], "-i") == 0;
-        if (!verbose)
+        if (strcmp(argv[i], "--info") == 0 || strcmp(argv[i], "-i") == 0)
+        {
+            verbose = 1;
+        }
+        else if (strcmp(argv[i], "--arch=i386") == 0 && !run && !interpret)
+        {
+            options.arch = SPASM_ARCH_I386;
+        }
+        else if (strcmp(argv[i], "--arch=x86_64") == 0 && !run && !interpret)
+        {
+            options.arch = SPASM_ARCH_X86_64;
+        }
+        else if (strcmp(argv[i], "--compact") == 0 && !run && !interpret)
+        {
+            options.compact = 1;
+        }
+        else if (strcmp(argv[i], "--module") == 0 && !run && !interpret)
+        {
+            module = 1;
+        }
+        else if (argv[i][0] == '-' && argv[i][1] == 'O' && argv[i][2] >= '0'
+                && argv[i][2] <= '0' + PASS_MAX_LEVEL && !argv[i][3])
+        {
+            passes.level = (unsigned)(argv[i][2] - '0');
+        }
+        else if (strcmp(argv[i], "--vectorize") == 0)
+        {
+            passes.requested |= 1u << PASS_VECTORIZE;
+        }
+        else if (strcmp(argv[i], "--fuse") == 0 && !interpret)
+        {
+            passes.requested |= 1u << PASS_FUSE;
+        }
+        else if (strcmp(argv[i], "--indexed") == 0 && !interpret)
+        {
+            passes.requested |= 1u << PASS_INDEXED;
+        }
+        else if (strcmp(argv[i], "--loop-invariants") == 0)
+        {
+            passes.requested |= 1u << PASS_LOOP_INVARIANTS;
+        }
+        else if (strcmp(argv[i], "--value-numbering") == 0 && !interpret)
+        {
+            passes.requested |= 1u << PASS_VALUE_NUMBERING;
+        }
+        else if (strcmp(argv[i], "--data-layout") == 0 && !interpret)
+        {
+            passes.requested |= 1u << PASS_DATA_LAYOUT;
+        }
+        else if (strcmp(argv[i], "--perf-map") == 0 && run)
+        {
+            options.perf_map = 1;
+        }
+        else if (strncmp(argv[i], "--profile=", 10) == 0 && interpret)
+        {
+            profile_name = argv[i] + 10;
+        }
+        else if (strncmp(argv[i], "--profile-use=", 14) == 0 && !interpret)
+        {
+            layout_name = argv[i] + 14;
+        }
+        else if ((strcmp(argv[i], "--align-loops") == 0 || strncmp(argv[i], "--align-loops=", 14) == 0)
+                && !interpret)
+        {
+            passes.alignment = argv[i][13] ? (uint32_t)strtoul(argv[i] + 14, 0, 10) : PASS_DEFAULT_ALIGNMENT;
+            passes.requested |= 1u << PASS_ALIGN_LOOPS;
+            /* Power of two up to the size of a cache line */
+            if (passes.alignment < 2 || passes.alignment > 64 || (passes.alignment & (passes.alignment - 1)) != 0)
+            {
+                print_usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+        }
+        else if (strncmp(argv[i], "--threads=", 10) == 0 && !interpret)
+        {
+            options.threads = strtoul(argv[i] + 10, 0, 10);
+            if (options.threads < 1 || options.threads > 256)
+            {
+                print_usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+        }
+        else if (strncmp(argv[i], "--cache-dir=", 12) == 0 && argv[i][12] && !run && !interpret)
+        {
+            cache_name = argv[i] + 12;
+        }
+        else if (strncmp(argv[i], "--cache-size=", 13) == 0 && !run && !interpret)
+        {
+            cache_size = strtoul(argv[i] + 13, 0, 10);
+            if (cache_size > 1024 * 1024)
+            {
+                print_usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+        }
+        else if (strncmp(argv[i], "--relocations=", 14) == 0 && !interpret)
+        {
+            relocations_name = argv[i] + 14;
+        }
+        else if (strncmp(argv[i], "--map=", 6) == 0 && !interpret)
+        {
+            map_name = argv[i] + 6;
+        }
+        else if (strcmp(argv[i], "--stats") == 0)
+        {
+            collect = &stats;
+        }
+        else if (strncmp(argv[i], "--stats-json=", 13) == 0)
+        {
+            collect = &stats;
+            stats_name = argv[i] + 13;
+        }
+        else if ((strcmp(argv[i], "--instrument") == 0 || strncmp(argv[i], "--instrument=", 13) == 0)
+                && !run && !interpret)
+        {
+            profile_name = argv[i][12] ? argv[i] + 13 : 0;
+            free(instrument_name);
+            instrument_name = malloc(strlen(profile_name ? profile_name : target_name) + 6);
+            if (!instrument_name)
+                return EXIT_FAILURE;
+
+            if (profile_name)
+                strcpy(instrument_name, profile_name);
+            else
+                sprintf(instrument_name, "%s.prof", target_name);
+        }
+        else
         {
             print_usage(argv[0]);
             return EXIT_FAILURE;
         }
     }
 
-    source = fopen(argv[1], "r");
+    /* The passes need the whole program and its final addresses */
+    if (module && (passes.level || passes.requested || instrument_name || layout_name || relocations_name || map_name))
+    {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    source = fopen(source_name, "r");
     if (!source)
     {
-        fprintf(stderr, "Failed to open source file \"%s\"\n", argv[1]);
+        fprintf(stderr, "Failed to open source file \"%s\"\n", source_name);
         return EXIT_FAILURE;
     }
 
-    printf("Parsing input [%s]...", argv[1]);
+    /* The parsed program and the side outputs only exist when building */
+    if (verbose || collect || instrument_name || relocations_name || map_name)
+        cache_name = 0;
+
+    if (cache_name)
+    {
+        fprintf(progress, "Looking up cache [%s]...", cache_name);
+        sprintf(cache_options, "arch=%d compact=%d level=%u passes=%x alignment=%u module=%d",
+                (int)options.arch, options.compact, passes.level, passes.requested, (unsigned)passes.alignment,
+                module);
+
+        result = open_build_cache(&cache, cache_name, cache_size * 1024 * 1024);
+        profile = layout_name ? fopen(layout_name, "rb") : 0;
+        if (result == ERR_SUCCESS && layout_name && !profile)
+            result = ERR_IO;
+        if (result == ERR_SUCCESS)
+            result = compute_cache_key(&cache, source, cache_options, profile);
+        if (profile)
+            fclose(profile);
+        rewind(source);
+
+        if (result != ERR_SUCCESS)
+        {
+            /* Build without the cache, the parser reports broken sources */
+            fprintf(progress, "FAILED\n");
+            fprintf(stderr, "Failed to use cache \"%s\", reason: %s\n", cache_name, SPASM_ERR_STR[result]);
+            close_build_cache(&cache);
+            cache_name = 0;
+        }
+        else if (fetch_cached_binary(&cache, target_name))
+        {
+            fprintf(progress, "HIT (%lu hits, %lu misses)\n", cache.hits, cache.misses);
+            fclose(source);
+            init_parser(&parser);
+            goto report;
+        }
+        else
+        {
+            fprintf(progress, "MISS (%lu hits, %lu misses)\n", cache.hits, cache.misses);
+        }
+    }
+
+    if (collect)
+    {
+        init_stats(collect);
+        options.stats = collect;
+    }
+
+    fprintf(progress, "Parsing input [%s]...", source_name);
     init_parser(&parser);
+    parser.stats = collect;
+    parser.module = module;
     result = parse_file(&parser, source);
     if (result != ERR_SUCCESS)
     {
-        printf("FAILED\n");
+        fprintf(progress, "FAILED\n");
         fprintf(stderr, "Failed to parse source file, reason: %s line %u\n",
                 SPASM_ERR_STR[result], parser.last_line);
 
@@ -146,48 +459,203 @@ int main(int argn, char **argv)
     }
 
     fclose(source);
-    printf("DONE\n");
+    fprintf(progress, "DONE\n");
 
-    printf("Writing binary [%s]....", argv[2]);
-    target = fopen(argv[2], "wb");
-    if (!target)
+    memset(&block_counts, 0, sizeof(BlockCounts));
+    if (layout_name)
     {
-        printf("FAILED\n");
-        fprintf(stderr, "Failed to open target file \"%s\"\n", argv[2]);
-        return EXIT_FAILURE;
+        source = fopen(layout_name, "rb");
+        result = source ? read_block_profile(source, &block_counts) : ERR_IO;
+        if (source)
+            fclose(source);
+
+        if (result != ERR_SUCCESS)
+        {
+            fprintf(stderr, "Failed to read profile \"%s\", reason: %s\n", layout_name, SPASM_ERR_STR[result]);
+            cleanup_block_counts(&block_counts);
+            cleanup_parser(&parser);
+            free(instrument_name);
+            return EXIT_FAILURE;
+        }
+
+        passes.counts = &block_counts;
+        passes.profile_path = layout_name;
+        passes.requested |= 1u << PASS_BLOCK_LAYOUT;
     }
 
-    /* Set 755 permissions on target file */
-    if(chmod(argv[2], S_IXUSR | S_IRUSR | S_IWUSR |
-    				  S_IXGRP | S_IRGRP |
-    				  S_IXOTH | S_IROTH) != 0)
+    if (instrument_name)
     {
-    	fprintf(stderr, "Failed to set executable flag on target file.\n");
+        passes.instrument = instrument_name;
+        passes.requested |= 1u << PASS_INSTRUMENT;
     }
 
-    result = write_program(&parser, target);
+    init_pass_manager(&manager, &parser, &passes);
+    result = run_passes(&manager, progress);
+    cleanup_pass_manager(&manager);
+    cleanup_block_counts(&block_counts);
     if (result != ERR_SUCCESS)
     {
-        printf("FAILED\n");
-        fprintf(stderr, "Failed to write program file, reason: %s", SPASM_ERR_STR[result]);
+        fprintf(stderr, "Failed to run pass %s, reason: %s\n", manager.failed->name, SPASM_ERR_STR[result]);
         cleanup_parser(&parser);
-        fclose(target);
+        free(instrument_name);
         return EXIT_FAILURE;
     }
 
-    fclose(target);
-    printf("DONE\n");
+    if (instrument_name)
+        options.profile = &manager.profile;
+
+    if (relocations_name)
+    {
+        options.relocations = fopen(relocations_name, "w");
+        if (!options.relocations)
+        {
+            fprintf(stderr, "Failed to open relocations file \"%s\"\n", relocations_name);
+            cleanup_parser(&parser);
+            free(instrument_name);
+            return EXIT_FAILURE;
+        }
+    }
 
+    if (map_name)
+    {
+        options.map = fopen(map_name, "w");
+        if (!options.map)
+        {
+            fprintf(stderr, "Failed to open map file \"%s\"\n", map_name);
+            cleanup_parser(&parser);
+            free(instrument_name);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (interpret)
+    {
+        fprintf(progress, "Interpreting [%s]...\n", source_name);
+        result = init_interpreter(&interpreter, &parser);
+        if (result == ERR_SUCCESS)
+            result = run_interpreter(&interpreter, &exit_code);
+
+        if (result != ERR_SUCCESS)
+        {
+            if (result == ERR_RUNTIME)
+                fprintf(stderr, "Program failed, reason: %s line %u\n",
+                        interpreter.error, interpreter.error_line);
+            else
+                fprintf(stderr, "Failed to interpret program, reason: %s\n", SPASM_ERR_STR[result]);
+
+            exit_code = EXIT_FAILURE;
+        }
+
+        if (result == ERR_SUCCESS || result == ERR_RUNTIME)
+        {
+            profile = profile_name ? fopen(profile_name, "w") : stderr;
+            source = fopen(source_name, "r");
+            if (profile)
+            {
+                write_profile(&interpreter, &parser, source, profile);
+                if (profile != stderr)
+                    fclose(profile);
+            }
+            else
+            {
+                fprintf(stderr, "Failed to open profile file \"%s\"\n", profile_name);
+            }
+
+            if (source)
+                fclose(source);
+        }
+
+        cleanup_interpreter(&interpreter);
+    }
+    else if (run)
+    {
+        fprintf(progress, "Running [%s]...\n", source_name);
+        result = run_program(&parser, &options, &exit_code);
+        if (result != ERR_SUCCESS)
+        {
+            fprintf(stderr, "Failed to run program, reason: %s\n", SPASM_ERR_STR[result]);
+            cleanup_parser(&parser);
+            return EXIT_FAILURE;
+        }
+    }
+    else
+    {
+        printf(module ? "Writing module [%s]...." : "Writing binary [%s]....", target_name);
+        target = open_target(target_name, !module);
+        if (!target)
+        {
+            printf("FAILED\n");
+            return EXIT_FAILURE;
+        }
+
+        result = module ? write_module(&parser, target, &options) : write_program(&parser, target, &options);
+        if (result != ERR_SUCCESS)
+        {
+            printf("FAILED\n");
+            fprintf(stderr, "Failed to write program file, reason: %s", SPASM_ERR_STR[result]);
+            cleanup_parser(&parser);
+            fclose(target);
+            return EXIT_FAILURE;
+        }
+
+        if (collect)
+            collect->file_size = ftell(target);
+
+        fclose(target);
+        printf("DONE\n");
+
+        if (cache_name)
+        {
+            printf("Storing in cache [%s]...", cache_name);
+            result = store_cached_binary(&cache, target_name);
+            if (result == ERR_SUCCESS)
+                printf("DONE (%lu entries, %lu KiB, %lu evictions)\n", cache.entries, cache.size / 1024, cache.evictions);
+            else
+                printf("FAILED\n");
+        }
+    }
+
+report:
     if (verbose)
     {
         printf("\n");
-        print_info(&parser);
+        write_info(stdout, &parser);
         printf("\n");
     }
 
-    printf("Cleanup...");
+    if (collect)
+    {
+        finish_stats(collect);
+        write_stats(progress, collect);
+        fprintf(progress, "\n");
+    }
+
+    if (stats_name)
+    {
+        /* One line per run, so runs can be collected in a single file */
+        stats_file = fopen(stats_name, "a");
+        if (stats_file)
+        {
+            write_stats_json(stats_file, collect, source_name);
+            fclose(stats_file);
+        }
+        else
+        {
+            fprintf(stderr, "Failed to open stats file \"%s\"\n", stats_name);
+            exit_code = EXIT_FAILURE;
+        }
+    }
+
+    fprintf(progress, "Cleanup...");
+    if (options.relocations)
+        fclose(options.relocations);
+    if (options.map)
+        fclose(options.map);
+    if (cache_name)
+        close_build_cache(&cache);
     cleanup_parser(&parser);
-    printf("DONE\n");
+    free(instrument_name);
+    fprintf(progress, "DONE\n");
 
-    return EXIT_SUCCESS;
+    return exit_code;
 }
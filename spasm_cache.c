@@ -0,0 +1,497 @@
+/*
+ * Copyright (C) 2011, Stefan Hacker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#define _POSIX_C_SOURCE 200112L /* fcntl locks, fchmod */
+
+#include "spasm_cache.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <utime.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#ifdef __linux__
+#include <linux/fs.h> /* FICLONE */
+#endif
+
+#define CACHE_ENTRY_SUFFIX ".elf"
+#define CACHE_TEMPORARY_SUFFIX ".tmp"
+#define CACHE_STALE_SECONDS 3600 /* temporary files of crashed builds are removed after this time */
+
+
+
+typedef struct CacheEntry CacheEntry;
+
+/**
+ * @brief Binary in the cache directory considered for eviction.
+ */
+struct CacheEntry
+{
+    char name[2 * SHA256_DIGEST_SIZE + sizeof(CACHE_ENTRY_SUFFIX)];
+    time_t used; /* modification time, set on every hit */
+    unsigned long size;
+};
+
+
+/**
+ * @brief Returns the newly allocated path of a file in the cache directory.
+ * @return Path or 0 on allocation failure.
+ */
+char *cache_path(const BuildCache *cache, const char *name, const char *suffix)
+{
+    char *path = (char*)malloc(strlen(cache->directory) + strlen(name) + strlen(suffix) + 2);
+
+    if (path)
+        sprintf(path, "%s/%s%s", cache->directory, name, suffix);
+
+    return path;
+}
+
+
+/**
+ * @brief Takes or releases the lock of the cache directory.
+ * @param cache Cache to lock
+ * @param type F_WRLCK to take the lock, F_UNLCK to release it
+ * @return 0 on success.
+ */
+int lock_cache(const BuildCache *cache, const short type)
+{
+    struct flock lock;
+
+    if (cache->lock < 0)
+        return -1;
+
+    memset(&lock, 0, sizeof(lock));
+    lock.l_type = type;
+    lock.l_whence = SEEK_SET;
+
+    while (fcntl(cache->lock, F_SETLKW, &lock) != 0)
+    {
+        if (errno != EINTR)
+            return -1;
+    }
+
+    return 0;
+}
+
+
+/**
+ * @brief Copies a file, sharing its blocks if the file system supports reflinks.
+ * @param from File to copy
+ * @param to File to create or replace
+ * @param mode Permissions of the copy
+ * @return 0 on success.
+ */
+int copy_file(const char *from, const char *to, const mode_t mode)
+{
+    char buffer[16384];
+    const int in = open(from, O_RDONLY);
+    int out;
+    ssize_t size = 0;
+    ssize_t written;
+    ssize_t offset;
+
+    if (in < 0)
+        return -1;
+
+    out = open(to, O_WRONLY | O_CREAT | O_TRUNC, mode);
+    if (out < 0)
+    {
+        close(in);
+        return -1;
+    }
+
+#ifdef FICLONE
+    if (ioctl(out, FICLONE, in) == 0)
+        size = -2;
+#endif
+
+    while (size != -2 && (size = read(in, buffer, sizeof(buffer))) > 0)
+    {
+        for (offset = 0; offset < size; offset += written)
+        {
+            written = write(out, buffer + offset, size - offset);
+            if (written <= 0)
+                break;
+        }
+
+        if (offset < size)
+        {
+            size = -1;
+            break;
+        }
+    }
+
+    /* The mode of an existing file is kept by open */
+    if (fchmod(out, mode) != 0)
+        size = -1;
+
+    close(in);
+    if (close(out) != 0)
+        size = -1;
+
+    return size == 0 || size == -2 ? 0 : -1;
+}
+
+
+/**
+ * @brief Adds to the statistics file of the directory and reads back the totals.
+ * @note The caller has to hold the lock.
+ */
+void update_cache_stats(BuildCache *cache, const unsigned long hits, const unsigned long misses,
+        const unsigned long stores, const unsigned long evictions)
+{
+    char *path = cache_path(cache, "stats", "");
+    FILE *file = path ? fopen(path, "r") : 0;
+
+    cache->hits = cache->misses = cache->stores = cache->evictions = 0;
+    if (file)
+    {
+        if (fscanf(file, "hits %lu misses %lu stores %lu evictions %lu",
+                &cache->hits, &cache->misses, &cache->stores, &cache->evictions) != 4)
+            cache->hits = cache->misses = cache->stores = cache->evictions = 0;
+        fclose(file);
+    }
+
+    cache->hits += hits;
+    cache->misses += misses;
+    cache->stores += stores;
+    cache->evictions += evictions;
+
+    file = path ? fopen(path, "w") : 0;
+    if (file)
+    {
+        fprintf(file, "hits %lu\nmisses %lu\nstores %lu\nevictions %lu\n",
+                cache->hits, cache->misses, cache->stores, cache->evictions);
+        fclose(file);
+    }
+
+    free(path);
+}
+
+
+/**
+ * @brief qsort comparator ordering entries from least to most recently used.
+ */
+int compare_cache_entries(const void *a, const void *b)
+{
+    const time_t first = ((const CacheEntry*)a)->used;
+    const time_t second = ((const CacheEntry*)b)->used;
+
+    return first < second ? -1 : first > second;
+}
+
+
+/**
+ * @brief Removes the least recently used entries until the binaries fit
+ *        into the size limit and temporary files left by crashed builds.
+ * @note The caller has to hold the lock.
+ * @return Number of removed entries.
+ */
+unsigned long evict_cache_entries(BuildCache *cache)
+{
+    const size_t entry_length = 2 * SHA256_DIGEST_SIZE + strlen(CACHE_ENTRY_SUFFIX);
+    const size_t temporary_length = strlen(CACHE_TEMPORARY_SUFFIX);
+    DIR *directory = opendir(cache->directory);
+    CacheEntry *entries = 0;
+    CacheEntry *grown;
+    struct dirent *file;
+    struct stat status;
+    unsigned long evicted = 0;
+    size_t capacity = 0;
+    size_t count = 0;
+    size_t length;
+    size_t i;
+    char *path;
+
+    cache->entries = 0;
+    cache->size = 0;
+    if (!directory)
+        return 0;
+
+    while ((file = readdir(directory)) != 0)
+    {
+        length = strlen(file->d_name);
+        path = cache_path(cache, file->d_name, "");
+        if (!path || stat(path, &status) != 0)
+        {
+            free(path);
+            continue;
+        }
+
+        if (length > temporary_length && strcmp(file->d_name + length - temporary_length, CACHE_TEMPORARY_SUFFIX) == 0
+                && status.st_mtime + CACHE_STALE_SECONDS < time(0))
+            unlink(path);
+        free(path);
+
+        if (length != entry_length || strcmp(file->d_name + length - strlen(CACHE_ENTRY_SUFFIX), CACHE_ENTRY_SUFFIX) != 0)
+            continue;
+
+        if (count == capacity)
+        {
+            capacity = capacity ? 2 * capacity : 64;
+            grown = (CacheEntry*)realloc(entries, capacity * sizeof(CacheEntry));
+            if (!grown)
+                break;
+            entries = grown;
+        }
+
+        strcpy(entries[count].name, file->d_name);
+        entries[count].used = status.st_mtime;
+        entries[count].size = (unsigned long)status.st_size;
+        cache->size += entries[count].size;
+        ++count;
+    }
+
+    closedir(directory);
+    qsort(entries, count, sizeof(CacheEntry), compare_cache_entries);
+
+    /* The binary just stored stays even if it exceeds the limit on its own */
+    for (i = 0; i < count && cache->max_size && cache->size > cache->max_size; ++i)
+    {
+        if (strncmp(entries[i].name, cache->key, 2 * SHA256_DIGEST_SIZE) == 0)
+            continue;
+
+        path = cache_path(cache, entries[i].name, "");
+        if (path && unlink(path) == 0)
+        {
+            cache->size -= entries[i].size;
+            entries[i].size = 0;
+            ++evicted;
+        }
+        free(path);
+    }
+
+    for (i = 0; i < count; ++i)
+        cache->entries += entries[i].size || strncmp(entries[i].name, cache->key, 2 * SHA256_DIGEST_SIZE) == 0;
+
+    free(entries);
+    return evicted;
+}
+
+
+/**
+ * @brief Adds a source to the hash leaving out everything the parser ignores.
+ * @return ERR_SUCCESS on success, ERR_LINE_TO_LONG for lines the parser rejects.
+ */
+Errc hash_normalized_source(Sha256 *hash, FILE *source)
+{
+    char line[MAX_LINE_LENGTH + 2];
+    size_t length = 0; /* normalized characters in line */
+    size_t raw = 0; /* characters of the line in the source */
+    int comment = 0;
+    int space = 0;
+    int chr;
+
+    while ((chr = fgetc(source)) != EOF)
+    {
+        /* Only \r\n ends a line, a single \r is a syntax error. The parser counts the \r in the line length. */
+        if (chr == '\r')
+        {
+            chr = fgetc(source);
+            if (chr != '\n')
+            {
+                if (chr != EOF)
+                    ungetc(chr, source);
+                chr = '\r';
+            }
+            else if (++raw > MAX_LINE_LENGTH)
+            {
+                return ERR_LINE_TO_LONG;
+            }
+        }
+
+        if (chr == '\n')
+        {
+            if (length)
+            {
+                line[length++] = '\n';
+                sha256_update(hash, line, length);
+            }
+
+            length = raw = 0;
+            comment = space = 0;
+            continue;
+        }
+
+        if (++raw > MAX_LINE_LENGTH)
+            return ERR_LINE_TO_LONG;
+
+        if (comment || (chr == ';' && (comment = 1)))
+            continue;
+
+        if (chr == ' ' || chr == '\t')
+        {
+            space = length > 0;
+            continue;
+        }
+
+        if (space)
+            line[length++] = ' ';
+        line[length++] = (char)chr;
+        space = 0;
+    }
+
+    if (length)
+    {
+        line[length++] = '\n';
+        sha256_update(hash, line, length);
+    }
+
+    return ferror(source) ? ERR_IO : ERR_SUCCESS;
+}
+
+
+Errc open_build_cache(BuildCache *cache, const char *directory, const unsigned long max_size)
+{
+    char *path;
+
+    memset(cache, 0, sizeof(BuildCache));
+    cache->directory = directory;
+    cache->max_size = max_size;
+    cache->lock = -1;
+
+    if (mkdir(directory, 0777) != 0 && errno != EEXIST)
+        return ERR_IO;
+
+    path = cache_path(cache, "lock", "");
+    if (!path)
+        return ERR_ALLOC;
+
+    cache->lock = open(path, O_RDWR | O_CREAT, 0666);
+    free(path);
+
+    return cache->lock < 0 ? ERR_IO : ERR_SUCCESS;
+}
+
+
+Errc compute_cache_key(BuildCache *cache, FILE *source, const char *options, FILE *profile)
+{
+    const char hex[] = "0123456789abcdef";
+    unsigned char digest[SHA256_DIGEST_SIZE];
+    unsigned char buffer[4096];
+    char stamp[64];
+    Sha256 hash;
+    size_t size;
+    Errc result;
+    int i;
+
+    sha256_init(&hash);
+    /* Every build of spasm may generate different code, so its build time is part of the key */
+    sprintf(stamp, "spasm cache %d %s %s\n", CACHE_VERSION, __DATE__, __TIME__);
+    sha256_update(&hash, stamp, strlen(stamp));
+    sha256_update(&hash, options, strlen(options) + 1);
+
+    result = hash_normalized_source(&hash, source);
+    if (result != ERR_SUCCESS)
+        return result;
+
+    if (profile)
+    {
+        sha256_update(&hash, "profile\n", 8);
+        while ((size = fread(buffer, 1, sizeof(buffer), profile)) > 0)
+            sha256_update(&hash, buffer, size);
+
+        if (ferror(profile))
+            return ERR_IO;
+    }
+
+    sha256_final(&hash, digest);
+    for (i = 0; i < SHA256_DIGEST_SIZE; ++i)
+    {
+        cache->key[2 * i] = hex[digest[i] >> 4];
+        cache->key[2 * i + 1] = hex[digest[i] & 0xf];
+    }
+    cache->key[2 * SHA256_DIGEST_SIZE] = '\0';
+
+    free(cache->entry);
+    cache->entry = cache_path(cache, cache->key, CACHE_ENTRY_SUFFIX);
+
+    return cache->entry ? ERR_SUCCESS : ERR_ALLOC;
+}
+
+
+int fetch_cached_binary(BuildCache *cache, const char *target)
+{
+    /* Entries only appear by rename, an existing one is complete */
+    const int hit = copy_file(cache->entry, target, 0755) == 0;
+
+    /* Recently used entries are evicted last */
+    if (hit)
+        utime(cache->entry, 0);
+
+    if (lock_cache(cache, F_WRLCK) == 0)
+    {
+        update_cache_stats(cache, hit, !hit, 0, 0);
+        lock_cache(cache, F_UNLCK);
+    }
+
+    return hit;
+}
+
+
+Errc store_cached_binary(BuildCache *cache, const char *target)
+{
+    char suffix[32];
+    char *temporary;
+    unsigned long evicted;
+    int failed;
+
+    /* Parallel builds of the same key write their own file, the last rename wins */
+    sprintf(suffix, ".%ld%s", (long)getpid(), CACHE_TEMPORARY_SUFFIX);
+    temporary = cache_path(cache, cache->key, suffix);
+    if (!temporary)
+        return ERR_ALLOC;
+
+    failed = copy_file(target, temporary, 0644) != 0 || rename(temporary, cache->entry) != 0;
+    if (failed)
+        unlink(temporary);
+    free(temporary);
+
+    if (failed)
+        return ERR_IO;
+
+    if (lock_cache(cache, F_WRLCK) != 0)
+        return ERR_IO;
+
+    evicted = evict_cache_entries(cache);
+    update_cache_stats(cache, 0, 0, 1, evicted);
+    lock_cache(cache, F_UNLCK);
+
+    return ERR_SUCCESS;
+}
+
+
+void close_build_cache(BuildCache *cache)
+{
+    if (cache->lock >= 0)
+        close(cache->lock);
+
+    free(cache->entry);
+    cache->entry = 0;
+    cache->lock = -1;
+}
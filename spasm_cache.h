@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2011, Stefan Hacker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+
+#include "spasm_types.h"
+#include "helpers/sha256.h"
+
+#ifndef SPASM_CACHE_H_
+#define SPASM_CACHE_H_
+
+#define CACHE_VERSION 1 /* Increment when equal inputs produce different binaries */
+#define CACHE_DEFAULT_SIZE 256 /* MiB of binaries kept in a cache directory by default */
+
+typedef struct BuildCache BuildCache;
+
+/**
+ * @brief Directory of binaries named by the hash of everything they were built from.
+ *
+ * Entries are written to a temporary file and renamed, so readers only
+ * ever see complete binaries. Eviction and the statistics file are
+ * serialized between processes with a lock on the lock file of the
+ * directory. A hit sets the modification time of the entry, eviction
+ * removes the entries with the oldest times first.
+ */
+struct BuildCache
+{
+    const char *directory;
+    unsigned long max_size; /* bytes of binaries kept, 0 for no limit */
+    int lock; /* descriptor of the lock file, -1 if none */
+
+    char key[2 * SHA256_DIGEST_SIZE + 1]; /* hex digest of the build inputs */
+    char *entry; /* path of the binary for key */
+
+    /* Totals of the directory, updated by fetch_cached_binary and store_cached_binary */
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long stores;
+    unsigned long evictions;
+
+    /* Contents of the directory after the last store_cached_binary */
+    unsigned long entries;
+    unsigned long size;
+};
+
+/**
+ * @brief Opens the cache in the given directory, creating the directory if necessary.
+ * @param cache Cache to initialize
+ * @param directory Cache directory, has to outlive the cache
+ * @param max_size Bytes of binaries kept, 0 for no limit
+ * @return ERR_SUCCESS on success.
+ */
+Errc open_build_cache(BuildCache *cache, const char *directory, const unsigned long max_size);
+
+/**
+ * @brief Hashes the build inputs into the key of the binary.
+ *
+ * The source is hashed without comments, empty lines and leading,
+ * trailing and repeated spaces, all of which the parser ignores.
+ *
+ * @param cache Cache to set the key of
+ * @param source Source file, read to its end
+ * @param options Description of every option changing the generated code
+ * @param profile Profile used for the build, 0 for none
+ * @return ERR_SUCCESS on success, ERR_LINE_TO_LONG if the source won't parse.
+ */
+Errc compute_cache_key(BuildCache *cache, FILE *source, const char *options, FILE *profile);
+
+/**
+ * @brief Copies the binary for the key to the target if the cache has it.
+ * @param cache Cache with key set
+ * @param target Name of the binary to create
+ * @return Non-zero on a hit.
+ */
+int fetch_cached_binary(BuildCache *cache, const char *target);
+
+/**
+ * @brief Adds a binary built for the key to the cache and evicts the least
+ *        recently used binaries beyond the size limit.
+ * @param cache Cache with key set
+ * @param target Name of the built binary
+ * @return ERR_SUCCESS on success.
+ */
+Errc store_cached_binary(BuildCache *cache, const char *target);
+
+/**
+ * @brief Releases the resources held by the cache.
+ */
+void close_build_cache(BuildCache *cache);
+
+#endif /* SPASM_CACHE_H_ */
@@ -259,3 +259,142 @@ const unsigned char spasm_rodata[94] =
 
 const uint32_t spasm_bss_usage = 256;
 
+
+const unsigned char spasm_jit_enter[10] = {
+                                        /* spasm_jit_enter: */
+    0x53,                               /* push   ebx */
+    0x56,                               /* push   esi */
+    0x57,                               /* push   edi */
+    0x55,                               /* push   ebp */
+    0x89, 0x25, 0x0, 0x0, 0x0, 0x0,     /* mov    DWORD PTR ds:0x0,esp */
+};
+
+const unsigned char spasm_jit_leave[13] = {
+                                        /* spasm_jit_leave: */
+    0x8b, 0x25, 0x0, 0x0, 0x0, 0x0,     /* mov    esp,DWORD PTR ds:0x0 */
+    0x5d,                               /* pop    ebp */
+    0x5f,                               /* pop    edi */
+    0x5e,                               /* pop    esi */
+    0x5b,                               /* pop    ebx */
+    0x31, 0xc0,                         /* xor    eax,eax */
+    0xc3,                               /* ret */
+};
+
+
+const unsigned char spasm_cnt[7] = {
+                                        /* spasm_cnt: */
+    0xff, 0x4, 0x25, 0x0, 0x0, 0x0, 0x0, /* inc    DWORD PTR [eiz*1+0x0] */
+};
+
+const unsigned char spasm_dump[74] = {
+                                        /* spasm_dump: */
+    0xb8, 0x5, 0x0, 0x0, 0x0,           /* mov    eax,0x5 */
+    0xbb, 0x0, 0x0, 0x0, 0x0,           /* mov    ebx,0x0 */
+    0xb9, 0x41, 0x2, 0x0, 0x0,          /* mov    ecx,0x241 */
+    0xba, 0xa4, 0x1, 0x0, 0x0,          /* mov    edx,0x1a4 */
+    0xcd, 0x80,                         /* int    0x80 */
+    0x89, 0xc3,                         /* mov    ebx,eax */
+    0xb8, 0x4, 0x0, 0x0, 0x0,           /* mov    eax,0x4 */
+    0xb9, 0x0, 0x0, 0x0, 0x0,           /* mov    ecx,0x0 */
+    0xba, 0x0, 0x0, 0x0, 0x0,           /* mov    edx,0x0 */
+    0xcd, 0x80,                         /* int    0x80 */
+    0xb8, 0x4, 0x0, 0x0, 0x0,           /* mov    eax,0x4 */
+    0xb9, 0x0, 0x0, 0x0, 0x0,           /* mov    ecx,0x0 */
+    0xba, 0x0, 0x0, 0x0, 0x0,           /* mov    edx,0x0 */
+    0xcd, 0x80,                         /* int    0x80 */
+    0xb8, 0x6, 0x0, 0x0, 0x0,           /* mov    eax,0x6 */
+    0xcd, 0x80,                         /* int    0x80 */
+    0xb8, 0x1, 0x0, 0x0, 0x0,           /* mov    eax,0x1 */
+    0x31, 0xdb,                         /* xor    ebx,ebx */
+    0xcd, 0x80,                         /* int    0x80 */
+};
+
+const unsigned char spasm_jnz[9] = {
+                                        /* spasm_jnz: */
+    0x58,                               /* pop    eax */
+    0x21, 0xc0,                         /* and    eax,eax */
+    0xf, 0x85, 0xc2, 0x3d, 0xa9, 0xd6,  /* jne    deadbeaf <_end+0xd6a92db7> */
+};
+
+const unsigned char spasm_rmw_inc[7] = {
+                                        /* spasm_rmw_inc: */
+    0xff, 0x4, 0x25, 0x0, 0x0, 0x0, 0x0, /* inc    DWORD PTR [eiz*1+0x0] */
+};
+
+const unsigned char spasm_rmw_dec[7] = {
+                                        /* spasm_rmw_dec: */
+    0xff, 0xc, 0x25, 0x0, 0x0, 0x0, 0x0, /* dec    DWORD PTR [eiz*1+0x0] */
+};
+
+const unsigned char spasm_rmw_add8[8] = {
+                                        /* spasm_rmw_add8: */
+    0x83, 0x4, 0x25, 0x0, 0x0, 0x0, 0x0, 0x0, /* add    DWORD PTR [eiz*1+0x0],0x0 */
+};
+
+const unsigned char spasm_rmw_add32[11] = {
+                                        /* spasm_rmw_add32: */
+    0x81, 0x4, 0x25, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, /* add    DWORD PTR [eiz*1+0x0],0x0 */
+};
+
+const unsigned char spasm_rmw_sub8[8] = {
+                                        /* spasm_rmw_sub8: */
+    0x83, 0x2c, 0x25, 0x0, 0x0, 0x0, 0x0, 0x0, /* sub    DWORD PTR [eiz*1+0x0],0x0 */
+};
+
+const unsigned char spasm_rmw_sub32[11] = {
+                                        /* spasm_rmw_sub32: */
+    0x81, 0x2c, 0x25, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, /* sub    DWORD PTR [eiz*1+0x0],0x0 */
+};
+
+const unsigned char spasm_rmw_mul8[15] = {
+                                        /* spasm_rmw_mul8: */
+    0x6b, 0x4, 0x25, 0x0, 0x0, 0x0, 0x0, 0x0, /* imul   eax,DWORD PTR [eiz*1+0x0],0x0 */
+    0x89, 0x4, 0x25, 0x0, 0x0, 0x0, 0x0, /* mov    DWORD PTR [eiz*1+0x0],eax */
+};
+
+const unsigned char spasm_rmw_mul32[18] = {
+                                        /* spasm_rmw_mul32: */
+    0x69, 0x4, 0x25, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, /* imul   eax,DWORD PTR [eiz*1+0x0],0x0 */
+    0x89, 0x4, 0x25, 0x0, 0x0, 0x0, 0x0, /* mov    DWORD PTR [eiz*1+0x0],eax */
+};
+
+const unsigned char spasm_dup[7] = {
+                                        /* spasm_dup: */
+    0xff, 0xb4, 0x24, 0xaf, 0xbe, 0xad, 0xde, /* push   DWORD PTR [esp-0x21524151] */
+};
+
+const unsigned char spasm_cpy[15] = {
+                                        /* spasm_cpy: */
+    0x59,                               /* pop    ecx */
+    0x5f,                               /* pop    edi */
+    0x5e,                               /* pop    esi */
+    0x85, 0xc9,                         /* test   ecx,ecx */
+    0x7e, 0x8,                          /* jle    f <spasm_cpy.done> */
+    0xc1, 0xe7, 0x2,                    /* shl    edi,0x2 */
+    0xc1, 0xe6, 0x2,                    /* shl    esi,0x2 */
+    0xf3, 0xa5,                         /* rep movs DWORD PTR es:[edi],DWORD PTR ds:[esi] */
+};
+
+const unsigned char spasm_fil[12] = {
+                                        /* spasm_fil: */
+    0x59,                               /* pop    ecx */
+    0x5f,                               /* pop    edi */
+    0x58,                               /* pop    eax */
+    0x85, 0xc9,                         /* test   ecx,ecx */
+    0x7e, 0x5,                          /* jle    c <spasm_fil.done> */
+    0xc1, 0xe7, 0x2,                    /* shl    edi,0x2 */
+    0xf3, 0xab,                         /* rep stos DWORD PTR es:[edi],eax */
+};
+
+const unsigned char spasm_lvx[8] = {
+                                        /* spasm_lvx: */
+    0x58,                               /* pop    eax */
+    0xff, 0x34, 0x85, 0xaf, 0xbe, 0xad, 0xde, /* push   DWORD PTR [eax*4-0x21524151] */
+};
+
+const unsigned char spasm_stx[9] = {
+                                        /* spasm_stx: */
+    0x58,                               /* pop    eax */
+    0x5b,                               /* pop    ebx */
+    0x89, 0x1c, 0x85, 0xaf, 0xbe, 0xad, 0xde, /* mov    DWORD PTR [eax*4-0x21524151],ebx */
+};
@@ -50,5 +50,30 @@ extern const unsigned char spasm_rodata[94];
 
 extern const uint32_t spasm_bss_usage;
 
+extern const unsigned char spasm_jit_enter[10];
+extern const unsigned char spasm_jit_leave[13];
+
+extern const unsigned char spasm_cnt[7];
+extern const unsigned char spasm_dump[74];
+
+extern const unsigned char spasm_jnz[9];
+
+extern const unsigned char spasm_rmw_inc[7];
+extern const unsigned char spasm_rmw_dec[7];
+extern const unsigned char spasm_rmw_add8[8];
+extern const unsigned char spasm_rmw_add32[11];
+extern const unsigned char spasm_rmw_sub8[8];
+extern const unsigned char spasm_rmw_sub32[11];
+extern const unsigned char spasm_rmw_mul8[15];
+extern const unsigned char spasm_rmw_mul32[18];
+
+extern const unsigned char spasm_dup[7];
+
+extern const unsigned char spasm_cpy[15];
+extern const unsigned char spasm_fil[12];
+
+extern const unsigned char spasm_lvx[8];
+extern const unsigned char spasm_stx[9];
+
 #endif
 
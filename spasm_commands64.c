@@ -0,0 +1,399 @@
+/*
+ * Copyright (C) 2011, Stefan Hacker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "spasm_commands64.h"
+
+const unsigned char spasm64_add[5] = {
+                                        /* spasm64_add: */
+    0x5b,                               /* pop    rbx */
+    0x58,                               /* pop    rax */
+    0x1, 0xd8,                          /* add    eax,ebx */
+    0x50,                               /* push   rax */
+};
+
+const unsigned char spasm64_mul[6] = {
+                                        /* spasm64_mul: */
+    0x5b,                               /* pop    rbx */
+    0x58,                               /* pop    rax */
+    0xf, 0xaf, 0xc3,                    /* imul   eax,ebx */
+    0x50,                               /* push   rax */
+};
+
+const unsigned char spasm64_sub[5] = {
+                                        /* spasm64_sub: */
+    0x5b,                               /* pop    rbx */
+    0x58,                               /* pop    rax */
+    0x29, 0xd8,                         /* sub    eax,ebx */
+    0x50,                               /* push   rax */
+};
+
+const unsigned char spasm64_div[7] = {
+                                        /* spasm64_div: */
+    0x5b,                               /* pop    rbx */
+    0x58,                               /* pop    rax */
+    0x31, 0xd2,                         /* xor    edx,edx */
+    0xf7, 0xfb,                         /* idiv   ebx */
+    0x50,                               /* push   rax */
+};
+
+const unsigned char spasm64_les[12] = {
+                                        /* spasm64_les: */
+    0x5b,                               /* pop    rbx */
+    0x58,                               /* pop    rax */
+    0x39, 0xd8,                         /* cmp    eax,ebx */
+    0x7c, 0x4,                          /* jl     a <spasm64_les.less> */
+    0x6a, 0x0,                          /* push   0x0 */
+    0xeb, 0x2,                          /* jmp    c <spasm64_les.done> */
+                                        /* spasm64_les.less: */
+    0x6a, 0x1,                          /* push   0x1 */
+};
+
+const unsigned char spasm64_and[5] = {
+                                        /* spasm64_and: */
+    0x5b,                               /* pop    rbx */
+    0x58,                               /* pop    rax */
+    0x21, 0xd8,                         /* and    eax,ebx */
+    0x50,                               /* push   rax */
+};
+
+const unsigned char spasm64_equ[12] = {
+                                        /* spasm64_equ: */
+    0x5b,                               /* pop    rbx */
+    0x58,                               /* pop    rax */
+    0x39, 0xd8,                         /* cmp    eax,ebx */
+    0x74, 0x4,                          /* je     a <spasm64_equ.equal> */
+    0x6a, 0x0,                          /* push   0x0 */
+    0xeb, 0x2,                          /* jmp    c <spasm64_equ.done> */
+                                        /* spasm64_equ.equal: */
+    0x6a, 0x1,                          /* push   0x1 */
+};
+
+const unsigned char spasm64_not[5] = {
+                                        /* spasm64_not: */
+    0x58,                               /* pop    rax */
+    0x83, 0xf0, 0x1,                    /* xor    eax,0x1 */
+    0x50,                               /* push   rax */
+};
+
+const unsigned char spasm64_la[5] = {
+                                        /* spasm64_la: */
+    0x68, 0xaf, 0xbe, 0xad, 0xde,       /* push   0xffffffffdeadbeaf */
+};
+
+const unsigned char spasm64_lc[5] = {
+                                        /* spasm64_lc: */
+    0x68, 0xaf, 0xbe, 0xad, 0xde,       /* push   0xffffffffdeadbeaf */
+};
+
+const unsigned char spasm64_lv[7] = {
+                                        /* spasm64_lv: */
+    0x58,                               /* pop    rax */
+    0xc1, 0xe0, 0x2,                    /* shl    eax,0x2 */
+    0x8b, 0x0,                          /* mov    eax,DWORD PTR [rax] */
+    0x50,                               /* push   rax */
+};
+
+const unsigned char spasm64_str[7] = {
+                                        /* spasm64_str: */
+    0x58,                               /* pop    rax */
+    0xc1, 0xe0, 0x2,                    /* shl    eax,0x2 */
+    0x5b,                               /* pop    rbx */
+    0x89, 0x18,                         /* mov    DWORD PTR [rax],ebx */
+};
+
+const unsigned char spasm64_pri[6] = {
+                                        /* spasm64_pri: */
+    0x58,                               /* pop    rax */
+    0xe8, 0xaf, 0xbe, 0xad, 0xde,       /* call   deadbeaf */
+};
+
+const unsigned char spasm64_rea[6] = {
+                                        /* spasm64_rea: */
+    0xe8, 0xaf, 0xbe, 0xad, 0xde,       /* call   deadbeaf */
+    0x50,                               /* push   rax */
+};
+
+const unsigned char spasm64_jmp[5] = {
+                                        /* spasm64_jmp: */
+    0xe9, 0xaf, 0xbe, 0xad, 0xde,       /* jmp    deadbeaf */
+};
+
+const unsigned char spasm64_jin[9] = {
+                                        /* spasm64_jin: */
+    0x58,                               /* pop    rax */
+    0x21, 0xc0,                         /* and    eax,eax */
+    0xf, 0x84, 0xaf, 0xbe, 0xad, 0xde,  /* je     deadbeaf */
+};
+
+const unsigned char spasm64_nop[1] = {
+                                        /* spasm64_nop: */
+    0x90,                               /* nop */
+};
+
+const unsigned char spasm64_stp[9] = {
+                                        /* spasm64_stp: */
+    0xb8, 0x3c, 0x0, 0x0, 0x0,          /* mov    eax,0x3c */
+    0x31, 0xff,                         /* xor    edi,edi */
+    0xf, 0x5,                           /* syscall */
+};
+
+const unsigned char spasm64_readint32[162] = {
+                                        /* readint32: */
+    0xb8, 0x1, 0x0, 0x0, 0x0,           /* mov    eax,0x1 */
+    0xbf, 0x1, 0x0, 0x0, 0x0,           /* mov    edi,0x1 */
+    0xbe, 0x0, 0x0, 0x0, 0x15,          /* mov    esi,0x15000000 */
+    0xba, 0x2, 0x0, 0x0, 0x0,           /* mov    edx,0x2 */
+    0xf, 0x5,                           /* syscall */
+    0xb8, 0x0, 0x0, 0x0, 0x0,           /* mov    eax,0x0 */
+    0xbf, 0x0, 0x0, 0x0, 0x0,           /* mov    edi,0x0 */
+    0xbe, 0x0, 0x0, 0x0, 0x25,          /* mov    esi,0x25000000 */
+    0xba, 0xff, 0x0, 0x0, 0x0,          /* mov    edx,0xff */
+    0xf, 0x5,                           /* syscall */
+    0x83, 0xf8, 0x1,                    /* cmp    eax,0x1 */
+    0x74, 0xcf,                         /* je     0 <readint32> */
+    0xbe, 0x0, 0x0, 0x0, 0x25,          /* mov    esi,0x25000000 */
+    0x1, 0xf0,                          /* add    eax,esi */
+    0x31, 0xff,                         /* xor    edi,edi */
+    0x80, 0x3e, 0x2d,                   /* cmp    BYTE PTR [rsi],0x2d */
+    0x75, 0x4,                          /* jne    43 <readint32.positive> */
+    0xff, 0xc6,                         /* inc    esi */
+    0xf7, 0xd7,                         /* not    edi */
+                                        /* readint32.positive: */
+    0x31, 0xc0,                         /* xor    eax,eax */
+    0x31, 0xdb,                         /* xor    ebx,ebx */
+                                        /* readint32.parse: */
+    0x8a, 0x1e,                         /* mov    bl,BYTE PTR [rsi] */
+    0x80, 0xfb, 0xa,                    /* cmp    bl,0xa */
+    0x74, 0x4d,                         /* je     9b <readint32.done> */
+    0x80, 0xfb, 0x30,                   /* cmp    bl,0x30 */
+    0x7c, 0x2d,                         /* jl     80 <readint32.errnan> */
+    0x80, 0xfb, 0x39,                   /* cmp    bl,0x39 */
+    0x7f, 0x28,                         /* jg     80 <readint32.errnan> */
+    0x80, 0xeb, 0x30,                   /* sub    bl,0x30 */
+    0x6b, 0xc0, 0xa,                    /* imul   eax,eax,0xa */
+    0x70, 0x8,                          /* jo     68 <readint32.overflow> */
+    0x1, 0xd8,                          /* add    eax,ebx */
+    0x70, 0x4,                          /* jo     68 <readint32.overflow> */
+    0xff, 0xc6,                         /* inc    esi */
+    0xeb, 0xdf,                         /* jmp    47 <readint32.parse> */
+                                        /* readint32.overflow: */
+    0xb8, 0x1, 0x0, 0x0, 0x0,           /* mov    eax,0x1 */
+    0xbf, 0x1, 0x0, 0x0, 0x0,           /* mov    edi,0x1 */
+    0xbe, 0x2a, 0x0, 0x0, 0x15,         /* mov    esi,0x1500002a */
+    0xba, 0x34, 0x0, 0x0, 0x0,          /* mov    edx,0x34 */
+    0xf, 0x5,                           /* syscall */
+    0xeb, 0x80,                         /* jmp    0 <readint32> */
+                                        /* readint32.errnan: */
+    0xb8, 0x1, 0x0, 0x0, 0x0,           /* mov    eax,0x1 */
+    0xbf, 0x1, 0x0, 0x0, 0x0,           /* mov    edi,0x1 */
+    0xbe, 0x2, 0x0, 0x0, 0x15,          /* mov    esi,0x15000002 */
+    0xba, 0x28, 0x0, 0x0, 0x0,          /* mov    edx,0x28 */
+    0xf, 0x5,                           /* syscall */
+    0xe9, 0x65, 0xff, 0xff, 0xff,       /* jmp    0 <readint32> */
+                                        /* readint32.done: */
+    0x21, 0xff,                         /* and    edi,edi */
+    0x74, 0x2,                          /* je     a1 <readint32.notnegative> */
+    0xf7, 0xd8,                         /* neg    eax */
+                                        /* readint32.notnegative: */
+    0xc3,                               /* ret */
+};
+
+const unsigned char spasm64_writeint32[73] = {
+                                        /* writeunsigned: */
+    0xbe, 0xfe, 0x0, 0x0, 0x25,         /* mov    esi,0x250000fe */
+    0xbb, 0xa, 0x0, 0x0, 0x0,           /* mov    ebx,0xa */
+    0xc6, 0x6, 0xa,                     /* mov    BYTE PTR [rsi],0xa */
+    0xff, 0xce,                         /* dec    esi */
+    0x31, 0xff,                         /* xor    edi,edi */
+    0x83, 0xf8, 0x0,                    /* cmp    eax,0x0 */
+    0x7d, 0x4,                          /* jge    1a <writeunsigned.generate> */
+    0xf7, 0xd7,                         /* not    edi */
+    0xf7, 0xd8,                         /* neg    eax */
+                                        /* writeunsigned.generate: */
+    0x31, 0xd2,                         /* xor    edx,edx */
+    0xf7, 0xf3,                         /* div    ebx */
+    0x83, 0xc2, 0x30,                   /* add    edx,0x30 */
+    0x88, 0x16,                         /* mov    BYTE PTR [rsi],dl */
+    0xff, 0xce,                         /* dec    esi */
+    0x83, 0xf8, 0x0,                    /* cmp    eax,0x0 */
+    0x75, 0xf0,                         /* jne    1a <writeunsigned.generate> */
+    0x21, 0xff,                         /* and    edi,edi */
+    0x74, 0x5,                          /* je     33 <writeunsigned.nominusadd> */
+    0xc6, 0x6, 0x2d,                    /* mov    BYTE PTR [rsi],0x2d */
+    0xff, 0xce,                         /* dec    esi */
+                                        /* writeunsigned.nominusadd: */
+    0xff, 0xc6,                         /* inc    esi */
+    0xb8, 0x1, 0x0, 0x0, 0x0,           /* mov    eax,0x1 */
+    0xbf, 0x1, 0x0, 0x0, 0x0,           /* mov    edi,0x1 */
+    0xba, 0xff, 0x0, 0x0, 0x25,         /* mov    edx,0x250000ff */
+    0x29, 0xf2,                         /* sub    edx,esi */
+    0xf, 0x5,                           /* syscall */
+    0xc3,                               /* ret */
+};
+
+
+const unsigned char spasm64_jit_enter[18] = {
+                                        /* spasm64_jit_enter: */
+    0x53,                               /* push   rbx */
+    0x55,                               /* push   rbp */
+    0x41, 0x54,                         /* push   r12 */
+    0x41, 0x55,                         /* push   r13 */
+    0x41, 0x56,                         /* push   r14 */
+    0x41, 0x57,                         /* push   r15 */
+    0x48, 0x89, 0x24, 0x25, 0x0, 0x0, 0x0, 0x0, /* mov    QWORD PTR ds:0x0,rsp */
+};
+
+const unsigned char spasm64_jit_leave[21] = {
+                                        /* spasm64_jit_leave: */
+    0x48, 0x8b, 0x24, 0x25, 0x0, 0x0, 0x0, 0x0, /* mov    rsp,QWORD PTR ds:0x0 */
+    0x41, 0x5f,                         /* pop    r15 */
+    0x41, 0x5e,                         /* pop    r14 */
+    0x41, 0x5d,                         /* pop    r13 */
+    0x41, 0x5c,                         /* pop    r12 */
+    0x5d,                               /* pop    rbp */
+    0x5b,                               /* pop    rbx */
+    0x31, 0xc0,                         /* xor    eax,eax */
+    0xc3,                               /* ret */
+};
+
+
+const unsigned char spasm64_cnt[7] = {
+                                        /* spasm64_cnt: */
+    0xff, 0x4, 0x25, 0x0, 0x0, 0x0, 0x0, /* inc    DWORD PTR ds:0x0 */
+};
+
+const unsigned char spasm64_dump[74] = {
+                                        /* spasm64_dump: */
+    0xb8, 0x2, 0x0, 0x0, 0x0,           /* mov    eax,0x2 */
+    0xbf, 0x0, 0x0, 0x0, 0x0,           /* mov    edi,0x0 */
+    0xbe, 0x41, 0x2, 0x0, 0x0,          /* mov    esi,0x241 */
+    0xba, 0xa4, 0x1, 0x0, 0x0,          /* mov    edx,0x1a4 */
+    0xf, 0x5,                           /* syscall */
+    0x89, 0xc7,                         /* mov    edi,eax */
+    0xb8, 0x1, 0x0, 0x0, 0x0,           /* mov    eax,0x1 */
+    0xbe, 0x0, 0x0, 0x0, 0x0,           /* mov    esi,0x0 */
+    0xba, 0x0, 0x0, 0x0, 0x0,           /* mov    edx,0x0 */
+    0xf, 0x5,                           /* syscall */
+    0xb8, 0x1, 0x0, 0x0, 0x0,           /* mov    eax,0x1 */
+    0xbe, 0x0, 0x0, 0x0, 0x0,           /* mov    esi,0x0 */
+    0xba, 0x0, 0x0, 0x0, 0x0,           /* mov    edx,0x0 */
+    0xf, 0x5,                           /* syscall */
+    0xb8, 0x3, 0x0, 0x0, 0x0,           /* mov    eax,0x3 */
+    0xf, 0x5,                           /* syscall */
+    0xb8, 0x3c, 0x0, 0x0, 0x0,          /* mov    eax,0x3c */
+    0x31, 0xff,                         /* xor    edi,edi */
+    0xf, 0x5,                           /* syscall */
+};
+
+const unsigned char spasm64_jnz[9] = {
+                                        /* spasm64_jnz: */
+    0x58,                               /* pop    rax */
+    0x21, 0xc0,                         /* and    eax,eax */
+    0xf, 0x85, 0xaf, 0xbe, 0xad, 0xde,  /* jne    deadbeaf */
+};
+
+const unsigned char spasm64_rmw_inc[7] = {
+                                        /* spasm64_rmw_inc: */
+    0xff, 0x4, 0x25, 0x0, 0x0, 0x0, 0x0, /* inc    DWORD PTR ds:0x0 */
+};
+
+const unsigned char spasm64_rmw_dec[7] = {
+                                        /* spasm64_rmw_dec: */
+    0xff, 0xc, 0x25, 0x0, 0x0, 0x0, 0x0, /* dec    DWORD PTR ds:0x0 */
+};
+
+const unsigned char spasm64_rmw_add8[8] = {
+                                        /* spasm64_rmw_add8: */
+    0x83, 0x4, 0x25, 0x0, 0x0, 0x0, 0x0, 0x0, /* add    DWORD PTR ds:0x0,0x0 */
+};
+
+const unsigned char spasm64_rmw_add32[11] = {
+                                        /* spasm64_rmw_add32: */
+    0x81, 0x4, 0x25, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, /* add    DWORD PTR ds:0x0,0x0 */
+};
+
+const unsigned char spasm64_rmw_sub8[8] = {
+                                        /* spasm64_rmw_sub8: */
+    0x83, 0x2c, 0x25, 0x0, 0x0, 0x0, 0x0, 0x0, /* sub    DWORD PTR ds:0x0,0x0 */
+};
+
+const unsigned char spasm64_rmw_sub32[11] = {
+                                        /* spasm64_rmw_sub32: */
+    0x81, 0x2c, 0x25, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, /* sub    DWORD PTR ds:0x0,0x0 */
+};
+
+const unsigned char spasm64_rmw_mul8[15] = {
+                                        /* spasm64_rmw_mul8: */
+    0x6b, 0x4, 0x25, 0x0, 0x0, 0x0, 0x0, 0x0, /* imul   eax,DWORD PTR ds:0x0,0x0 */
+    0x89, 0x4, 0x25, 0x0, 0x0, 0x0, 0x0, /* mov    DWORD PTR ds:0x0,eax */
+};
+
+const unsigned char spasm64_rmw_mul32[18] = {
+                                        /* spasm64_rmw_mul32: */
+    0x69, 0x4, 0x25, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, /* imul   eax,DWORD PTR ds:0x0,0x0 */
+    0x89, 0x4, 0x25, 0x0, 0x0, 0x0, 0x0, /* mov    DWORD PTR ds:0x0,eax */
+};
+
+const unsigned char spasm64_dup[7] = {
+                                        /* spasm64_dup: */
+    0xff, 0xb4, 0x24, 0xaf, 0xbe, 0xad, 0xde, /* push   QWORD PTR [rsp-0x21524151] */
+};
+
+const unsigned char spasm64_cpy[17] = {
+                                        /* spasm64_cpy: */
+    0x59,                               /* pop    rcx */
+    0x5f,                               /* pop    rdi */
+    0x5e,                               /* pop    rsi */
+    0x89, 0xc9,                         /* mov    ecx,ecx */
+    0x85, 0xc9,                         /* test   ecx,ecx */
+    0x7e, 0x8,                          /* jle    11 <spasm64_cpy.done> */
+    0xc1, 0xe7, 0x2,                    /* shl    edi,0x2 */
+    0xc1, 0xe6, 0x2,                    /* shl    esi,0x2 */
+    0xf3, 0xa5,                         /* rep movs DWORD PTR es:[rdi],DWORD PTR ds:[rsi] */
+};
+
+const unsigned char spasm64_fil[14] = {
+                                        /* spasm64_fil: */
+    0x59,                               /* pop    rcx */
+    0x5f,                               /* pop    rdi */
+    0x58,                               /* pop    rax */
+    0x89, 0xc9,                         /* mov    ecx,ecx */
+    0x85, 0xc9,                         /* test   ecx,ecx */
+    0x7e, 0x5,                          /* jle    e <spasm64_fil.done> */
+    0xc1, 0xe7, 0x2,                    /* shl    edi,0x2 */
+    0xf3, 0xab,                         /* rep stos DWORD PTR es:[rdi],eax */
+};
+
+const unsigned char spasm64_lvx[10] = {
+                                        /* spasm64_lvx: */
+    0x58,                               /* pop    rax */
+    0x67, 0x8b, 0x4, 0x85, 0xaf, 0xbe, 0xad, 0xde, /* mov    eax,DWORD PTR [eax*4-0x21524151] */
+    0x50,                               /* push   rax */
+};
+
+const unsigned char spasm64_stx[10] = {
+                                        /* spasm64_stx: */
+    0x58,                               /* pop    rax */
+    0x5b,                               /* pop    rbx */
+    0x67, 0x89, 0x1c, 0x85, 0xaf, 0xbe, 0xad, 0xde, /* mov    DWORD PTR [eax*4-0x21524151],ebx */
+};
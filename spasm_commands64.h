@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2011, Stefan Hacker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef SPASM_COMMANDS64
+#define SPASM_COMMANDS64
+
+#include <stdint.h>
+
+extern const unsigned char spasm64_add[5];
+extern const unsigned char spasm64_mul[6];
+extern const unsigned char spasm64_sub[5];
+extern const unsigned char spasm64_div[7];
+extern const unsigned char spasm64_les[12];
+extern const unsigned char spasm64_and[5];
+extern const unsigned char spasm64_equ[12];
+extern const unsigned char spasm64_not[5];
+extern const unsigned char spasm64_la[5];
+extern const unsigned char spasm64_lc[5];
+extern const unsigned char spasm64_lv[7];
+extern const unsigned char spasm64_str[7];
+extern const unsigned char spasm64_pri[6];
+extern const unsigned char spasm64_rea[6];
+extern const unsigned char spasm64_jmp[5];
+extern const unsigned char spasm64_jin[9];
+extern const unsigned char spasm64_nop[1];
+extern const unsigned char spasm64_stp[9];
+
+extern const unsigned char spasm64_readint32[162];
+extern const unsigned char spasm64_writeint32[73];
+
+extern const unsigned char spasm64_jit_enter[18];
+extern const unsigned char spasm64_jit_leave[21];
+
+extern const unsigned char spasm64_cnt[7];
+extern const unsigned char spasm64_dump[74];
+
+extern const unsigned char spasm64_jnz[9];
+
+extern const unsigned char spasm64_rmw_inc[7];
+extern const unsigned char spasm64_rmw_dec[7];
+extern const unsigned char spasm64_rmw_add8[8];
+extern const unsigned char spasm64_rmw_add32[11];
+extern const unsigned char spasm64_rmw_sub8[8];
+extern const unsigned char spasm64_rmw_sub32[11];
+extern const unsigned char spasm64_rmw_mul8[15];
+extern const unsigned char spasm64_rmw_mul32[18];
+
+extern const unsigned char spasm64_dup[7];
+
+extern const unsigned char spasm64_cpy[17];
+extern const unsigned char spasm64_fil[14];
+
+extern const unsigned char spasm64_lvx[10];
+extern const unsigned char spasm64_stx[10];
+
+#endif
@@ -0,0 +1,457 @@
+/*
+ * Copyright (C) 2011, Stefan Hacker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#include "spasm_datalayout.h"
+#include "spasm_commands.h"
+#include "spasm_vectorizer.h"
+#include "helpers/elfwrite.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Upper bound of the variables a single command references */
+#define DATA_MAX_REFERENCES (VECTOR_MAX_OPS + VECTOR_MAX_REDUCTIONS + VECTOR_MAX_INDUCTIONS + 1)
+
+
+/**
+ * @brief Placement groups of the data layout in placement order.
+ */
+typedef enum DataClass
+{
+    DATA_HOT_SCALAR,  /* accessed variables of a single word */
+    DATA_SMALL_ARRAY, /* accessed arrays smaller than a cache line */
+    DATA_LARGE_ARRAY, /* arrays of at least a cache line */
+    DATA_COLD         /* never accessed scalars and small arrays */
+} DataClass;
+
+
+typedef struct DataSlot DataSlot;
+
+/**
+ * @brief BSS variable while laying out the data.
+ */
+struct DataSlot
+{
+    MemoryLocation *location;
+    DataClass group;
+    uint32_t index; /* declaration order */
+    uint32_t offset; /* bss segment offset */
+    uint32_t large_index; /* row in the loop access table of large arrays */
+};
+
+
+/**
+ * @brief Collects the variables a command references.
+ * @param command Command to inspect
+ * @param locations Set to the referenced variables, DATA_MAX_REFERENCES entries
+ * @return Number of referenced variables.
+ */
+uint32_t command_locations(const Command *command, MemoryLocation **locations)
+{
+    const VectorLoop *loop;
+    uint32_t count = 0;
+    uint32_t i;
+
+    switch (command->type)
+    {
+    case SPASM_LA:
+    case SPASM_CNT:
+    case SPASM_LVX:
+    case SPASM_STX:
+        locations[count++] = command->argument.memory_arg;
+        break;
+    case SPASM_RMW:
+        locations[count++] = command->argument.update_arg->memory;
+        break;
+    case SPASM_VEC:
+        loop = command->argument.vector_arg;
+        locations[count++] = loop->counter;
+        for (i = 0; i < loop->op_count; ++i)
+        {
+            if (loop->ops[i].memory)
+                locations[count++] = loop->ops[i].memory;
+        }
+        for (i = 0; i < loop->reduction_count; ++i)
+            locations[count++] = loop->reductions[i];
+        for (i = 0; i < loop->induction_count; ++i)
+            locations[count++] = loop->inductions[i];
+        break;
+    default:
+        break;
+    }
+
+    return count;
+}
+
+
+/**
+ * @brief Orders slots by placement group, weight and declaration.
+ */
+int compare_slots(const void *a, const void *b)
+{
+    const DataSlot *first = (const DataSlot*)a;
+    const DataSlot *second = (const DataSlot*)b;
+
+    if (first->group != second->group)
+        return first->group < second->group ? -1 : 1;
+
+    if (first->group != DATA_COLD && first->location->accesses != second->location->accesses)
+        return first->location->accesses > second->location->accesses ? -1 : 1;
+
+    return first->index < second->index ? -1 : (first->index > second->index);
+}
+
+
+/**
+ * @brief Adds the weight of a command to the variables it references.
+ */
+void count_accesses(const Command *command, const uint32_t weight)
+{
+    MemoryLocation *locations[DATA_MAX_REFERENCES];
+    const uint32_t count = command_locations(command, locations);
+    uint32_t i;
+
+    for (i = 0; i < count; ++i)
+    {
+        if (locations[i]->type != SPASM_BSS)
+            continue;
+
+        locations[i]->accesses = locations[i]->accesses > UINT32_MAX - weight
+                ? UINT32_MAX : locations[i]->accesses + weight;
+    }
+}
+
+
+/**
+ * @brief Weighs all variables by their accesses.
+ * @note Commands carry their index in vaddr.
+ * @param parser State
+ * @param counts Block counts, 0 to weigh by loop depth
+ * @param command_count Number of commands
+ * @return ERR_SUCCESS on success, ERR_PROFILE if the counts don't match the program
+ */
+Errc weigh_variables(ParserState *parser, const BlockCounts *counts, const uint32_t command_count)
+{
+    Command *prev = 0;
+    Command *cur;
+    Command *target;
+    int32_t *depth_change;
+    int32_t depth = 0;
+    uint32_t block = 0;
+    uint32_t weight;
+    int32_t i;
+
+    if (counts)
+    {
+        for (cur = parser->command_first; cur; prev = cur, cur = cur->next)
+        {
+            if (is_block_leader(prev, cur))
+            {
+                if (block == counts->block_count || cur->source_line != counts->lines[block])
+                    return ERR_PROFILE;
+                ++block;
+            }
+        }
+
+        if (block != counts->block_count)
+            return ERR_PROFILE;
+
+        block = 0;
+        prev = 0;
+        for (cur = parser->command_first; cur; prev = cur, cur = cur->next)
+        {
+            if (is_block_leader(prev, cur))
+                ++block;
+            count_accesses(cur, counts->counts[block - 1]);
+        }
+
+        return ERR_SUCCESS;
+    }
+
+    /* Loops span from the target of a backward jump to the jump */
+    depth_change = (int32_t*)calloc(command_count + 1, sizeof(int32_t));
+    if (!depth_change)
+        return ERR_ALLOC;
+
+    for (cur = parser->command_first; cur; cur = cur->next)
+    {
+        if (cur->type != SPASM_JMP && cur->type != SPASM_JIN && cur->type != SPASM_JNZ)
+            continue;
+
+        target = cur->argument.label_arg->command;
+        if (target->vaddr <= cur->vaddr)
+        {
+            ++depth_change[target->vaddr];
+            --depth_change[cur->vaddr + 1];
+        }
+    }
+
+    for (cur = parser->command_first; cur; cur = cur->next)
+    {
+        depth += depth_change[cur->vaddr];
+        for (i = 0, weight = 1; i < depth && i < DATA_MAX_LOOP_DEPTH; ++i)
+            weight *= DATA_LOOP_WEIGHT;
+        count_accesses(cur, weight);
+    }
+
+    free(depth_change);
+
+    return ERR_SUCCESS;
+}
+
+
+/**
+ * @brief Marks the loops each large array is referenced in.
+ * @note Commands carry their index in vaddr.
+ * @param commands Commands of the program by index
+ * @param large Slots of the large arrays
+ * @param large_count Number of large arrays
+ * @param command_count Number of commands
+ * @param loop_access Set to large_count rows of a flag per loop
+ * @param loop_count Set to the number of loops
+ * @return ERR_SUCCESS on success.
+ */
+Errc find_loop_accesses(Command **commands, DataSlot **large, const uint32_t large_count,
+        const uint32_t command_count, unsigned char **loop_access, uint32_t *loop_count)
+{
+    MemoryLocation *locations[DATA_MAX_REFERENCES];
+    const Command *target;
+    uint32_t loop = 0;
+    uint32_t count;
+    uint32_t i;
+    uint32_t j;
+    uint32_t k;
+    uint32_t l;
+
+    *loop_count = 0;
+    for (i = 0; i < command_count; ++i)
+    {
+        if ((commands[i]->type == SPASM_JMP || commands[i]->type == SPASM_JIN || commands[i]->type == SPASM_JNZ)
+                && commands[i]->argument.label_arg->command->vaddr <= i)
+            ++*loop_count;
+    }
+
+    *loop_access = (unsigned char*)calloc((size_t)large_count * *loop_count + 1, 1);
+    if (!*loop_access)
+        return ERR_ALLOC;
+
+    for (i = 0; i < command_count; ++i)
+    {
+        if (commands[i]->type != SPASM_JMP && commands[i]->type != SPASM_JIN && commands[i]->type != SPASM_JNZ)
+            continue;
+
+        target = commands[i]->argument.label_arg->command;
+        if (target->vaddr > i)
+            continue;
+
+        for (j = target->vaddr; j <= i; ++j)
+        {
+            count = command_locations(commands[j], locations);
+            for (k = 0; k < count; ++k)
+            {
+                for (l = 0; l < large_count; ++l)
+                {
+                    if (large[l]->location == locations[k])
+                        (*loop_access)[l * *loop_count + loop] = 1;
+                }
+            }
+        }
+
+        ++loop;
+    }
+
+    return ERR_SUCCESS;
+}
+
+
+/**
+ * @brief Checks whether a large array would start at the same page offset
+ *        as an array placed before it that is referenced in the same loop.
+ */
+int aliases(DataSlot **large, const uint32_t index, const uint32_t offset,
+        const unsigned char *loop_access, const uint32_t loop_count)
+{
+    uint32_t i;
+    uint32_t loop;
+
+    for (i = 0; i < index; ++i)
+    {
+        if (large[i]->offset % DATA_PAGE_SIZE != offset % DATA_PAGE_SIZE)
+            continue;
+
+        for (loop = 0; loop < loop_count; ++loop)
+        {
+            if (loop_access[index * loop_count + loop] && loop_access[i * loop_count + loop])
+                return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+Errc layout_data(ParserState *parser, const BlockCounts *counts, DataLayout *layout)
+{
+    MemoryLocation *location;
+    MemoryLocation *last = 0;
+    Command *cur;
+    Command **commands = 0;
+    DataSlot *slots = 0;
+    DataSlot **large = 0;
+    unsigned char *loop_access = 0;
+    uint32_t command_count = 0;
+    uint32_t slot_count = 0;
+    uint32_t large_count = 0;
+    uint32_t loop_count = 0;
+    uint32_t offset = spasm_bss_usage;
+    uint32_t scalars_end = spasm_bss_usage;
+    uint32_t tries;
+    uint32_t i;
+    Errc result;
+
+    memset(layout, 0, sizeof(DataLayout));
+
+    for (cur = parser->command_first; cur; cur = cur->next)
+        cur->vaddr = command_count++;
+
+    for (location = parser->memory_location_first; location; location = location->next)
+    {
+        location->accesses = 0;
+        location->padding = 0;
+        if (location->type == SPASM_BSS)
+            ++slot_count;
+    }
+
+    result = weigh_variables(parser, counts, command_count);
+    if (result != ERR_SUCCESS)
+        return result;
+
+    commands = (Command**)malloc((command_count + 1) * sizeof(Command*));
+    slots = (DataSlot*)calloc(slot_count + 1, sizeof(DataSlot));
+    large = (DataSlot**)calloc(slot_count + 1, sizeof(DataSlot*));
+    if (!commands || !slots || !large)
+    {
+        result = ERR_ALLOC;
+        goto cleanup;
+    }
+
+    for (cur = parser->command_first; cur; cur = cur->next)
+        commands[cur->vaddr] = cur;
+
+    i = 0;
+    for (location = parser->memory_location_first; location; location = location->next)
+    {
+        if (location->type != SPASM_BSS)
+            continue;
+
+        slots[i].location = location;
+        slots[i].index = i;
+        if (location->size >= DATA_CACHE_LINE)
+            slots[i].group = DATA_LARGE_ARRAY;
+        else if (!location->accesses)
+            slots[i].group = DATA_COLD;
+        else
+            slots[i].group = location->size <= sizeof(uint32_t) ? DATA_HOT_SCALAR : DATA_SMALL_ARRAY;
+        ++i;
+    }
+
+    qsort(slots, slot_count, sizeof(DataSlot), compare_slots);
+
+    for (i = 0; i < slot_count; ++i)
+    {
+        if (slots[i].group == DATA_LARGE_ARRAY)
+            large[large_count++] = &slots[i];
+    }
+
+    result = find_loop_accesses(commands, large, large_count, command_count, &loop_access, &loop_count);
+    if (result != ERR_SUCCESS)
+        goto cleanup;
+
+    for (i = 0, large_count = 0; i < slot_count; ++i)
+    {
+        location = slots[i].location;
+        switch (slots[i].group)
+        {
+        case DATA_HOT_SCALAR:
+            ++layout->hot_scalars;
+            scalars_end = offset + location->size;
+            break;
+        case DATA_SMALL_ARRAY:
+            /* Keep arrays fitting a cache line within one */
+            if (offset % DATA_CACHE_LINE + location->size > DATA_CACHE_LINE)
+                location->padding = padding_for(offset, 0, DATA_CACHE_LINE);
+            break;
+        case DATA_LARGE_ARRAY:
+            location->padding = padding_for(offset, 0, DATA_CACHE_LINE);
+            for (tries = 0; tries < DATA_PAGE_SIZE / DATA_CACHE_LINE
+                    && aliases(large, large_count, offset + location->padding, loop_access, loop_count); ++tries)
+                location->padding += DATA_CACHE_LINE;
+
+            ++layout->aligned_arrays;
+            ++large_count;
+            break;
+        default:
+            break;
+        }
+
+        slots[i].offset = offset + location->padding;
+        offset = slots[i].offset + location->size;
+        layout->padding += location->padding;
+    }
+
+    layout->scalar_lines = (scalars_end - spasm_bss_usage + DATA_CACHE_LINE - 1) / DATA_CACHE_LINE;
+    parser->bss_used += layout->padding;
+
+    /* Other locations keep their order, the bss variables follow them in layout order */
+    location = parser->memory_location_first;
+    parser->memory_location_first = 0;
+    for (; location; location = location->next)
+    {
+        if (location->type == SPASM_BSS)
+            continue;
+
+        if (last)
+            last->next = location;
+        else
+            parser->memory_location_first = location;
+        last = location;
+    }
+
+    for (i = 0; i < slot_count; ++i)
+    {
+        if (last)
+            last->next = slots[i].location;
+        else
+            parser->memory_location_first = slots[i].location;
+        last = slots[i].location;
+    }
+
+    if (last)
+        last->next = 0;
+    parser->memory_location_last = last;
+
+    cleanup: free(commands);
+    free(slots);
+    free(large);
+    free(loop_access);
+
+    return result;
+}
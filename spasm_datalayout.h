@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2011, Stefan Hacker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#include "spasm_types.h"
+#include "spasm_instrument.h"
+
+#ifndef SPASM_DATALAYOUT_H_
+#define SPASM_DATALAYOUT_H_
+
+#define DATA_CACHE_LINE 64 /* bytes per cache line */
+#define DATA_PAGE_SIZE 4096 /* loads and stores alias if their addresses match modulo this size */
+#define DATA_LOOP_WEIGHT 8 /* static accesses count this many times more per enclosing loop */
+#define DATA_MAX_LOOP_DEPTH 5 /* deeper loops weigh like loops of this depth */
+
+typedef struct DataLayout DataLayout;
+
+/**
+ * @brief Summary of the layout chosen by layout_data.
+ */
+struct DataLayout
+{
+    uint32_t hot_scalars; /* accessed scalars packed in front of the variables */
+    uint32_t scalar_lines; /* cache lines holding the hot scalars */
+    uint32_t aligned_arrays; /* arrays of at least a cache line starting on a cache line */
+    uint32_t padding; /* bytes of padding added to the bss segment */
+};
+
+
+/**
+ * @brief Reorders and pads the BSS variables for cache efficiency.
+ *
+ * Every variable is weighed by its accesses, either the number of
+ * commands referencing it (DATA_LOOP_WEIGHT times more per enclosing
+ * loop) or, given block counts, the number of times these commands
+ * executed. Accessed scalars are packed into the first cache lines by
+ * descending weight, followed by smaller arrays which are kept within a
+ * single cache line. Arrays of at least a cache line start on a cache
+ * line boundary; arrays referenced in the same loop are moved apart so
+ * they don't start at the same offset in a page (4K aliasing). Variables
+ * that are never accessed follow in declaration order.
+ *
+ * Padding is stored in the variables and accounted for in bss_used.
+ * The layout relies on the variables starting spasm_bss_usage bytes
+ * into a page aligned bss segment.
+ *
+ * @param parser State to update
+ * @param counts Block counts of an instrumented run of the same program, 0 to weigh statically
+ * @param layout Set to a summary of the chosen layout
+ * @return ERR_SUCCESS on success, ERR_PROFILE if the counts belong to a different program
+ */
+Errc layout_data(ParserState *parser, const BlockCounts *counts, DataLayout *layout);
+
+#endif /* SPASM_DATALAYOUT_H_ */
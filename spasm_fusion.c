@@ -0,0 +1,117 @@
+/*
+ * Copyright (C) 2011, Stefan Hacker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#include "spasm_fusion.h"
+
+#include <stdlib.h>
+
+
+const UpdatePattern SPASM_UPDATE_PATTERNS[] = {
+        { { SPASM_LA, SPASM_LV, SPASM_LC, SPASM_ADD, SPASM_LA, SPASM_STR }, 6, SPASM_ADD },
+        { { SPASM_LC, SPASM_LA, SPASM_LV, SPASM_ADD, SPASM_LA, SPASM_STR }, 6, SPASM_ADD },
+        { { SPASM_LA, SPASM_LV, SPASM_LC, SPASM_SUB, SPASM_LA, SPASM_STR }, 6, SPASM_SUB },
+        { { SPASM_LA, SPASM_LV, SPASM_LC, SPASM_MUL, SPASM_LA, SPASM_STR }, 6, SPASM_MUL },
+        { { SPASM_LC, SPASM_LA, SPASM_LV, SPASM_MUL, SPASM_LA, SPASM_STR }, 6, SPASM_MUL } };
+
+const uint32_t SPASM_UPDATE_PATTERN_COUNT = sizeof(SPASM_UPDATE_PATTERNS) / sizeof(UpdatePattern);
+
+
+/**
+ * @brief Matches a pattern against the commands starting at a given command.
+ * @param pattern Pattern to match
+ * @param command First command of the sequence
+ * @param update Set to the update of a matching sequence
+ * @return Non-zero if the sequence matches
+ */
+int match_update(const UpdatePattern *pattern, const Command *command, MemoryUpdate *update)
+{
+    uint32_t i;
+
+    update->memory = 0;
+    update->operation = pattern->operation;
+    update->constant = 0;
+
+    for (i = 0; i < pattern->length; ++i, command = command->next)
+    {
+        if (!command || command->type != pattern->types[i] || (i && command->label))
+            return 0;
+
+        if (command->type == SPASM_LC)
+        {
+            update->constant = command->argument.constant_arg;
+        }
+        else if (command->type == SPASM_LA)
+        {
+            if (update->memory && update->memory != command->argument.memory_arg)
+                return 0;
+            update->memory = command->argument.memory_arg;
+        }
+    }
+
+    return update->memory && update->memory->type != SPASM_RODATA;
+}
+
+
+Errc fuse_updates(ParserState *parser, uint32_t *fused)
+{
+    Command *cur;
+    Command *next;
+    Command *del;
+    MemoryUpdate update;
+    uint32_t i;
+    uint32_t j;
+
+    *fused = 0;
+
+    for (cur = parser->command_first; cur; cur = cur->next)
+    {
+        for (i = 0; i < SPASM_UPDATE_PATTERN_COUNT; ++i)
+        {
+            if (match_update(&SPASM_UPDATE_PATTERNS[i], cur, &update))
+                break;
+        }
+
+        if (i == SPASM_UPDATE_PATTERN_COUNT)
+            continue;
+
+        cur->argument.update_arg = (MemoryUpdate*)malloc(sizeof(MemoryUpdate));
+        if (!cur->argument.update_arg)
+            return ERR_ALLOC;
+
+        *cur->argument.update_arg = update;
+        cur->type = SPASM_RMW;
+
+        next = cur->next;
+        for (j = 1; j < SPASM_UPDATE_PATTERNS[i].length; ++j)
+        {
+            del = next;
+            next = next->next;
+            if (del == parser->command_last)
+                parser->command_last = cur;
+            free(del);
+        }
+        cur->next = next;
+
+        ++*fused;
+    }
+
+    return ERR_SUCCESS;
+}
@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2011, Stefan Hacker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#include "spasm_types.h"
+
+#ifndef SPASM_FUSION_H_
+#define SPASM_FUSION_H_
+
+#define UPDATE_PATTERN_MAX_LENGTH 8
+
+typedef struct UpdatePattern UpdatePattern;
+
+/**
+ * @brief Command sequence updating a variable in place.
+ *
+ * All LA commands of a pattern have to load the same variable, the single
+ * LC command provides the constant of the update.
+ */
+struct UpdatePattern
+{
+    CommandType types[UPDATE_PATTERN_MAX_LENGTH];
+    uint32_t length;
+    CommandType operation; /* SPASM_ADD, SPASM_SUB or SPASM_MUL */
+};
+
+
+/**
+ * @brief Patterns replaced by fuse_updates, index order is match order.
+ */
+extern const UpdatePattern SPASM_UPDATE_PATTERNS[];
+extern const uint32_t SPASM_UPDATE_PATTERN_COUNT;
+
+
+/**
+ * @brief Replaces read-modify-write sequences of a variable with a single
+ *        RMW command, e.g.
+ *     LA $x / LV / LC 1 / ADD / LA $x / STR
+ * becomes an in-place increment of $x.
+ *
+ * Sequences are only fused if no label points into them behind their
+ * first command. The RMW command takes over the label and source line
+ * of the first command. Read-only variables are left alone.
+ *
+ * @param parser State to update
+ * @param fused Set to the number of fused sequences
+ * @return ERR_SUCCESS on success
+ */
+Errc fuse_updates(ParserState *parser, uint32_t *fused);
+
+#endif /* SPASM_FUSION_H_ */
@@ -0,0 +1,223 @@
+/*
+ * Copyright (C) 2011, Stefan Hacker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "spasm_instrument.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+
+/**
+ * @brief Append a new memory location to the given state.
+ * @param parser State
+ * @param type Type of location
+ * @param name Name of the location. Has to start with '_' to not clash with variables.
+ * @param size Size in bytes
+ * @param line_num Source line the location belongs to
+ * @return Newly created location or 0 on allocation failure.
+ */
+MemoryLocation *add_profile_location(ParserState *parser, const enum MemoryLocationType type,
+        const char *name, const uint32_t size, const uint32_t line_num)
+{
+    MemoryLocation *mem = (MemoryLocation*)calloc(1, sizeof(MemoryLocation));
+
+    if (!mem)
+        return 0;
+
+    if (type != SPASM_BSS)
+    {
+        mem->content = (unsigned char*)calloc(1, size);
+        if (!mem->content)
+        {
+            free(mem);
+            return 0;
+        }
+    }
+
+    strncpy(mem->name, name, MAX_SYMBOL_NAME_LENGTH - 1);
+    mem->size = size;
+    mem->type = type;
+    mem->source_line = line_num;
+
+    if (parser->memory_location_first == 0)
+        parser->memory_location_first = mem;
+    else
+        parser->memory_location_last->next = mem;
+
+    parser->memory_location_last = mem;
+
+    if (type == SPASM_BSS)
+        parser->bss_used += size;
+    else if (type == SPASM_RODATA)
+        parser->rodata_used += size;
+    else
+        parser->data_used += size;
+
+    return mem;
+}
+
+
+/**
+ * @brief Store a little endian uint32_t.
+ */
+void store_uint32(unsigned char *buffer, const uint32_t value)
+{
+    buffer[0] = value & 0xff;
+    buffer[1] = (value >> 8) & 0xff;
+    buffer[2] = (value >> 16) & 0xff;
+    buffer[3] = (value >> 24) & 0xff;
+}
+
+
+/**
+ * @brief Load a little endian uint32_t.
+ */
+uint32_t load_uint32(const unsigned char *buffer)
+{
+    return (uint32_t)buffer[0] | ((uint32_t)buffer[1] << 8)
+            | ((uint32_t)buffer[2] << 16) | ((uint32_t)buffer[3] << 24);
+}
+
+
+int is_block_leader(const Command *previous, const Command *command)
+{
+    return !previous || command->label || previous->type == SPASM_JMP
+            || previous->type == SPASM_JIN || previous->type == SPASM_JNZ;
+}
+
+
+Errc instrument_blocks(ParserState *parser, const char *path, BlockProfile *profile)
+{
+    Command *prev = 0;
+    Command *cur = parser->command_first;
+    Command *counter;
+    MemoryLocation *location;
+    char name[32];
+    uint32_t i;
+
+    memset(profile, 0, sizeof(BlockProfile));
+
+    while (cur)
+    {
+        if (is_block_leader(prev, cur))
+        {
+            sprintf(name, "_bb%u", profile->block_count);
+            location = add_profile_location(parser, SPASM_BSS, name, sizeof(uint32_t), cur->source_line);
+            counter = (Command*)calloc(1, sizeof(Command));
+            if (!location || !counter)
+            {
+                free(counter);
+                return ERR_ALLOC;
+            }
+
+            if (!profile->first_counter)
+                profile->first_counter = location;
+
+            counter->type = SPASM_CNT;
+            counter->argument.memory_arg = location;
+            counter->source_line = cur->source_line;
+
+            /* Jumps to the block have to pass the counter */
+            counter->label = cur->label;
+            if (cur->label)
+                cur->label->command = counter;
+            cur->label = 0;
+
+            counter->next = cur;
+            if (prev)
+                prev->next = counter;
+            else
+                parser->command_first = counter;
+
+            ++profile->block_count;
+        }
+
+        prev = cur;
+        cur = cur->next;
+    }
+
+    profile->path = add_profile_location(parser, SPASM_RODATA, "_profile_path", strlen(path) + 1, INVALID_LINE);
+    profile->table = add_profile_location(parser, SPASM_RODATA, "_profile_table",
+            BLOCK_PROFILE_MAGIC_LENGTH + (profile->block_count + 1) * sizeof(uint32_t), INVALID_LINE);
+    if (!profile->path || !profile->table)
+        return ERR_ALLOC;
+
+    memcpy(profile->path->content, path, profile->path->size);
+
+    memcpy(profile->table->content, BLOCK_PROFILE_MAGIC, BLOCK_PROFILE_MAGIC_LENGTH);
+    store_uint32(profile->table->content + BLOCK_PROFILE_MAGIC_LENGTH, profile->block_count);
+
+    location = profile->first_counter;
+    for (i = 0; i < profile->block_count; ++i)
+    {
+        store_uint32(profile->table->content + BLOCK_PROFILE_MAGIC_LENGTH + (i + 1) * sizeof(uint32_t),
+                location->source_line);
+        location = location->next;
+    }
+
+    return ERR_SUCCESS;
+}
+
+
+Errc read_block_profile(FILE *file, BlockCounts *counts)
+{
+    unsigned char header[BLOCK_PROFILE_MAGIC_LENGTH + sizeof(uint32_t)];
+    unsigned char value[sizeof(uint32_t)];
+    uint32_t i;
+
+    memset(counts, 0, sizeof(BlockCounts));
+
+    if (fread(header, sizeof(header), 1, file) != 1
+            || memcmp(header, BLOCK_PROFILE_MAGIC, BLOCK_PROFILE_MAGIC_LENGTH) != 0)
+        return ERR_PROFILE;
+
+    counts->block_count = load_uint32(header + BLOCK_PROFILE_MAGIC_LENGTH);
+    if (counts->block_count == 0 || counts->block_count > 0xffffffffu / sizeof(uint32_t))
+        return ERR_PROFILE;
+
+    counts->lines = (uint32_t*)malloc(counts->block_count * sizeof(uint32_t));
+    counts->counts = (uint32_t*)malloc(counts->block_count * sizeof(uint32_t));
+    if (!counts->lines || !counts->counts)
+        return ERR_ALLOC;
+
+    for (i = 0; i < 2 * counts->block_count; ++i)
+    {
+        if (fread(value, sizeof(value), 1, file) != 1)
+            return ERR_PROFILE;
+
+        if (i < counts->block_count)
+            counts->lines[i] = load_uint32(value);
+        else
+            counts->counts[i - counts->block_count] = load_uint32(value);
+    }
+
+    return ERR_SUCCESS;
+}
+
+
+void cleanup_block_counts(BlockCounts *counts)
+{
+    free(counts->lines);
+    free(counts->counts);
+    memset(counts, 0, sizeof(BlockCounts));
+}
@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2011, Stefan Hacker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+
+#include "spasm_types.h"
+
+#ifndef SPASM_INSTRUMENT_H_
+#define SPASM_INSTRUMENT_H_
+
+#define BLOCK_PROFILE_MAGIC "SPASMBB1"
+#define BLOCK_PROFILE_MAGIC_LENGTH 8
+
+typedef struct BlockProfile BlockProfile;
+typedef struct BlockCounts BlockCounts;
+
+/**
+ * @brief Memory locations making up the block profile of an instrumented program.
+ *
+ * The profile file written at STP consists of the table followed by the counters:
+ *     char magic[8] = "SPASMBB1"
+ *     uint32_t block_count
+ *     uint32_t source_line[block_count] (line of the first command of each block)
+ *     uint32_t count[block_count]
+ * All values are little endian.
+ */
+struct BlockProfile
+{
+    MemoryLocation *path; /* rodata, NUL terminated profile file path */
+    MemoryLocation *table; /* rodata, magic, block count and source lines */
+    MemoryLocation *first_counter; /* bss, block counters are consecutive */
+    uint32_t block_count;
+};
+
+/**
+ * @brief Block counts read back from a profile file.
+ */
+struct BlockCounts
+{
+    uint32_t block_count;
+    uint32_t *lines; /* source line of the first command of each block */
+    uint32_t *counts; /* number of times each block was entered */
+};
+
+/**
+ * @brief Checks whether a command starts a basic block.
+ * @param previous Command in front of command, 0 for the first command
+ * @param command Command to check
+ * @return Non-zero if command is the first command of a basic block
+ */
+int is_block_leader(const Command *previous, const Command *command);
+
+/**
+ * @brief Inserts a CNT command at the start of every basic block.
+ *
+ * Blocks start at the first command, at labeled commands and behind JMP and
+ * JIN. Labels are moved to the CNT commands so jumps are counted as well.
+ *
+ * @param parser State to update
+ * @param path Path of the profile file the program writes at STP
+ * @param profile Set to the memory locations of the profile
+ * @return ERR_SUCCESS on success
+ */
+Errc instrument_blocks(ParserState *parser, const char *path, BlockProfile *profile);
+
+/**
+ * @brief Reads a profile file written by an instrumented program.
+ * @note Release the counts using cleanup_block_counts even if reading failed.
+ * @param file File to read
+ * @param counts Set to the block counts of the file
+ * @return ERR_SUCCESS on success, ERR_PROFILE for malformed files
+ */
+Errc read_block_profile(FILE *file, BlockCounts *counts);
+
+/**
+ * @brief Releases the memory held by the given counts.
+ * @param counts Counts to release
+ */
+void cleanup_block_counts(BlockCounts *counts);
+
+#endif /* SPASM_INSTRUMENT_H_ */
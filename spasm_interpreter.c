@@ -0,0 +1,573 @@
+/*
+ * Copyright (C) 2011, Stefan Hacker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#define _POSIX_C_SOURCE 200112L /* read */
+
+#include "spasm_interpreter.h"
+#include "spasm_commands.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__GNUC__) && !defined(SPASM_NO_COMPUTED_GOTO)
+/* Labels as values are a GNU extension */
+#pragma GCC diagnostic ignored "-Wpedantic"
+#define SPASM_COMPUTED_GOTO
+#endif
+
+#define INTERPRETER_MEMORY_BASE 0x10000 /* vaddr of the first memory location */
+#define INTERPRETER_STACK_SIZE 1024 /* initial stack capacity in values */
+
+#define STRBUF_LENGTH 255 /* strbuf.len of int32io.asm */
+#define PROMPT_OFFSET 0
+#define PROMPT_LENGTH 2
+#define NANM_OFFSET 2
+#define NANM_LENGTH 40
+#define OFM_OFFSET 42
+#define OFM_LENGTH 52
+
+
+Errc init_interpreter(Interpreter *interpreter, ParserState *parser)
+{
+    MemoryLocation *location;
+    Command *command;
+    InterpreterOp *op;
+    uint32_t vaddr = INTERPRETER_MEMORY_BASE;
+    uint32_t index = 0;
+
+    memset(interpreter, 0, sizeof(Interpreter));
+
+    for (location = parser->memory_location_first; location; location = location->next)
+    {
+        location->vaddr = vaddr;
+        vaddr += (location->size + 3) & ~(uint32_t)3;
+    }
+
+    for (command = parser->command_first; command; command = command->next)
+    {
+        /* Vectorized loops are executed by their scalar loop */
+        if (command->type == SPASM_VEC)
+            continue;
+
+        if (command->type >= SPASM_RUNTIME_COMMAND_COUNT)
+            return ERR_INTERNAL;
+
+        command->vaddr = index++;
+    }
+
+    interpreter->op_count = index;
+    interpreter->memory_words = (vaddr - INTERPRETER_MEMORY_BASE) / 4;
+
+    interpreter->ops = (InterpreterOp*)malloc((index + 1) * sizeof(InterpreterOp));
+    interpreter->lines = (uint32_t*)malloc((index + 1) * sizeof(uint32_t));
+    interpreter->counts = (uint64_t*)calloc(index + 1, sizeof(uint64_t));
+    interpreter->memory = (uint32_t*)calloc(interpreter->memory_words + 1, sizeof(uint32_t));
+    if (!interpreter->ops || !interpreter->lines || !interpreter->counts || !interpreter->memory)
+    {
+        cleanup_interpreter(interpreter);
+        return ERR_ALLOC;
+    }
+
+    for (location = parser->memory_location_first; location; location = location->next)
+    {
+        if (location->content)
+        {
+            memcpy((unsigned char*)interpreter->memory + (location->vaddr - INTERPRETER_MEMORY_BASE),
+                    location->content, location->size);
+        }
+    }
+
+    op = interpreter->ops;
+    for (command = parser->command_first; command; command = command->next)
+    {
+        if (command->type == SPASM_VEC)
+            continue;
+
+        op->type = command->type;
+        interpreter->lines[op - interpreter->ops] = command->source_line;
+        switch (command->type)
+        {
+        case SPASM_LC:
+            op->operand = command->argument.constant_arg;
+            break;
+        case SPASM_LA:
+            op->operand = command->argument.memory_arg->vaddr / 4;
+            break;
+        case SPASM_JMP:
+        case SPASM_JIN:
+            op->operand = command->argument.label_arg->command->vaddr;
+            break;
+        default:
+            op->operand = 0;
+            break;
+        }
+
+        ++op;
+    }
+
+    /* Running past the last command ends the program */
+    op->type = SPASM_STP;
+    op->operand = 0;
+    interpreter->lines[index] = INVALID_LINE;
+
+    return ERR_SUCCESS;
+}
+
+
+/**
+ * @brief Emulates the writeint32 builtin.
+ */
+void interpreter_write(Interpreter *interpreter, const uint32_t value)
+{
+    unsigned char *position = interpreter->strbuf + STRBUF_LENGTH - 1;
+    uint32_t magnitude = value;
+    const int negative = (int32_t)value < 0;
+
+    *position-- = '\n';
+
+    if (negative)
+        magnitude = 0 - magnitude;
+
+    do
+    {
+        *position-- = '0' + magnitude % 10;
+        magnitude /= 10;
+    }
+    while (magnitude);
+
+    if (negative)
+        *position-- = '-';
+
+    ++position;
+    fwrite(position, interpreter->strbuf + STRBUF_LENGTH - position, 1, stdout);
+}
+
+
+/**
+ * @brief Emulates the readint32 builtin.
+ */
+uint32_t interpreter_read(Interpreter *interpreter)
+{
+    const unsigned char *strbuf = interpreter->strbuf;
+    const unsigned char *position;
+    ssize_t count;
+    uint32_t value;
+    uint32_t digit;
+
+    for (;;)
+    {
+        fwrite(spasm_rodata + PROMPT_OFFSET, PROMPT_LENGTH, 1, stdout);
+        fflush(stdout);
+
+        count = read(0, interpreter->strbuf, STRBUF_LENGTH);
+        if (count == 1)
+            continue;
+
+        position = strbuf;
+        if (*position == '-')
+            ++position;
+
+        value = 0;
+        for (;;)
+        {
+            /* The builtin would continue into the variables behind strbuf */
+            if (position == strbuf + sizeof(interpreter->strbuf) || *position < '0' || *position > '9')
+            {
+                if (position != strbuf + sizeof(interpreter->strbuf) && *position == '\n')
+                    return *strbuf == '-' ? 0 - value : value;
+
+                fwrite(spasm_rodata + NANM_OFFSET, NANM_LENGTH, 1, stdout);
+                break;
+            }
+
+            digit = *position - '0';
+            if (value > 0x7fffffff / 10 || value * 10 > 0x7fffffff - digit)
+            {
+                fwrite(spasm_rodata + OFM_OFFSET, OFM_LENGTH, 1, stdout);
+                break;
+            }
+
+            value = value * 10 + digit;
+            ++position;
+        }
+    }
+}
+
+
+/**
+ * @brief Doubles the capacity of the interpreter stack.
+ * @return 1 on success, 0 on allocation failure
+ */
+int grow_stack(uint32_t **stack, uint32_t **sp, uint32_t **stack_end)
+{
+    const size_t size = *stack_end - *stack;
+    const size_t used = *sp - *stack;
+    uint32_t *grown = (uint32_t*)realloc(*stack, 2 * size * sizeof(uint32_t));
+
+    if (!grown)
+        return 0;
+
+    *sp = grown + used;
+    *stack = grown;
+    *stack_end = grown + 2 * size;
+
+    return 1;
+}
+
+
+Errc run_interpreter(Interpreter *interpreter, int *exit_code)
+{
+#ifdef SPASM_COMPUTED_GOTO
+    /* Indexed by CommandType */
+    static const void *DISPATCH_TABLE[SPASM_RUNTIME_COMMAND_COUNT] = {
+            &&op_SPASM_ADD, &&op_SPASM_MUL, &&op_SPASM_SUB, &&op_SPASM_DIV,
+            &&op_SPASM_LES, &&op_SPASM_AND, &&op_SPASM_EQU, &&op_SPASM_NOT,
+            &&op_SPASM_LA, &&op_SPASM_LC, &&op_SPASM_LV, &&op_SPASM_STR,
+            &&op_SPASM_CPY, &&op_SPASM_FIL,
+            &&op_SPASM_PRI, &&op_SPASM_REA,
+            &&op_SPASM_JMP, &&op_SPASM_JIN, &&op_SPASM_NOP, &&op_SPASM_STP };
+#define DISPATCH_BEGIN DISPATCH();
+#define DISPATCH_END
+#define DISPATCH() do { ++counts[pc]; goto *DISPATCH_TABLE[ops[pc].type]; } while (0)
+#define TARGET(type) op_##type
+#else
+#define DISPATCH_BEGIN for (;;) { ++counts[pc]; switch (ops[pc].type) {
+#define DISPATCH_END default: goto internal_error; } }
+#define DISPATCH() continue
+#define TARGET(type) case type
+#endif
+
+#define POP(value) do { if (sp == stack) goto stack_underflow; value = *--sp; } while (0)
+#define PUSH(value) do { if (sp == stack_end && !grow_stack(&stack, &sp, &stack_end)) goto alloc_error; \
+                         *sp++ = (value); } while (0)
+#define ADDRESS(address, index) do { index = (address) - INTERPRETER_MEMORY_BASE / 4; \
+                                     if (index >= memory_words) goto memory_error; } while (0)
+
+    const InterpreterOp *ops = interpreter->ops;
+    uint64_t *counts = interpreter->counts;
+    uint32_t *memory = interpreter->memory;
+    const uint32_t memory_words = interpreter->memory_words;
+    uint32_t pc = 0;
+    uint32_t *stack = (uint32_t*)malloc(INTERPRETER_STACK_SIZE * sizeof(uint32_t));
+    uint32_t *sp = stack;
+    uint32_t *stack_end = stack + INTERPRETER_STACK_SIZE;
+    uint32_t a;
+    uint32_t b;
+    uint32_t q;
+    uint32_t index;
+    uint32_t source;
+    uint32_t count;
+    Errc result = ERR_SUCCESS;
+
+    interpreter->error = 0;
+    memset(counts, 0, (interpreter->op_count + 1) * sizeof(uint64_t));
+
+    if (!stack)
+        return ERR_ALLOC;
+
+    DISPATCH_BEGIN
+
+    TARGET(SPASM_ADD):
+        POP(b); POP(a); PUSH(a + b); ++pc; DISPATCH();
+    TARGET(SPASM_MUL):
+        POP(b); POP(a); PUSH(a * b); ++pc; DISPATCH();
+    TARGET(SPASM_SUB):
+        POP(b); POP(a); PUSH(a - b); ++pc; DISPATCH();
+    TARGET(SPASM_DIV):
+        /* The generated code zeroes edx before idiv, so the dividend is the
+         * unsigned value of a and quotients outside of int32_t fault */
+        POP(b); POP(a);
+        if (b & 0x80000000)
+        {
+            q = a / (0 - b);
+            if (q > 0x80000000)
+                goto division_error;
+            q = 0 - q;
+        }
+        else
+        {
+            if (b == 0 || a / b > 0x7fffffff)
+                goto division_error;
+            q = a / b;
+        }
+        PUSH(q); ++pc; DISPATCH();
+    TARGET(SPASM_LES):
+        POP(b); POP(a); PUSH((int32_t)a < (int32_t)b); ++pc; DISPATCH();
+    TARGET(SPASM_AND):
+        POP(b); POP(a); PUSH(a & b); ++pc; DISPATCH();
+    TARGET(SPASM_EQU):
+        POP(b); POP(a); PUSH(a == b); ++pc; DISPATCH();
+    TARGET(SPASM_NOT):
+        POP(a); PUSH(a ^ 1); ++pc; DISPATCH();
+    TARGET(SPASM_LA):
+    TARGET(SPASM_LC):
+        PUSH(ops[pc].operand); ++pc; DISPATCH();
+    TARGET(SPASM_LV):
+        POP(a); ADDRESS(a, index); PUSH(memory[index]); ++pc; DISPATCH();
+    TARGET(SPASM_STR):
+        POP(a); POP(b); ADDRESS(a, index); memory[index] = b; ++pc; DISPATCH();
+    TARGET(SPASM_CPY):
+        /* Counts of zero or below copy nothing like the generated code */
+        POP(count); POP(a); POP(b);
+        if (count && !(count & 0x80000000))
+        {
+            ADDRESS(a, index); ADDRESS(b, source);
+            if (count > memory_words - index || count > memory_words - source)
+                goto memory_error;
+            /* Ascending like the generated rep movsd, overlapping ranges repeat the pattern */
+            for (; count; --count)
+                memory[index++] = memory[source++];
+        }
+        ++pc; DISPATCH();
+    TARGET(SPASM_FIL):
+        POP(count); POP(a); POP(b);
+        if (count && !(count & 0x80000000))
+        {
+            ADDRESS(a, index);
+            if (count > memory_words - index)
+                goto memory_error;
+            for (; count; --count)
+                memory[index++] = b;
+        }
+        ++pc; DISPATCH();
+    TARGET(SPASM_PRI):
+        POP(a); interpreter_write(interpreter, a); ++pc; DISPATCH();
+    TARGET(SPASM_REA):
+        a = interpreter_read(interpreter); PUSH(a); ++pc; DISPATCH();
+    TARGET(SPASM_JMP):
+        pc = ops[pc].operand; DISPATCH();
+    TARGET(SPASM_JIN):
+        POP(a); pc = a ? pc + 1 : ops[pc].operand; DISPATCH();
+    TARGET(SPASM_NOP):
+        ++pc; DISPATCH();
+    TARGET(SPASM_STP):
+        *exit_code = 0;
+        goto done;
+
+    DISPATCH_END
+
+#ifndef SPASM_COMPUTED_GOTO
+internal_error:
+    result = ERR_INTERNAL;
+    goto done;
+#endif
+
+stack_underflow:
+    interpreter->error = "stack underflow";
+    goto runtime_error;
+memory_error:
+    interpreter->error = "memory access outside of all variables";
+    goto runtime_error;
+division_error:
+    interpreter->error = "division overflow or by zero";
+    goto runtime_error;
+alloc_error:
+    result = ERR_ALLOC;
+    goto done;
+
+runtime_error:
+    interpreter->error_line = interpreter->lines[pc];
+    result = ERR_RUNTIME;
+
+done:
+    /* The terminating STP is no command of the program */
+    counts[interpreter->op_count] = 0;
+
+    fflush(stdout);
+    free(stack);
+    return result;
+
+#undef DISPATCH_BEGIN
+#undef DISPATCH_END
+#undef DISPATCH
+#undef TARGET
+#undef POP
+#undef PUSH
+#undef ADDRESS
+}
+
+
+/**
+ * @brief Prints a right aligned 64 bit count without relying on C99 printf formats.
+ */
+void print_count(FILE *out, uint64_t count, const int width)
+{
+    char digits[21];
+    char *position = digits + sizeof(digits) - 1;
+
+    *position = 0;
+    do
+    {
+        *--position = '0' + (char)(count % 10);
+        count /= 10;
+    }
+    while (count);
+
+    fprintf(out, "%*s", width, position);
+}
+
+
+/**
+ * @brief Prints a count followed by its share of the total.
+ */
+void print_share(FILE *out, const uint64_t count, const uint64_t total)
+{
+    print_count(out, count, 14);
+    fprintf(out, " %6.2f%% ", total ? 100.0 * (double)count / (double)total : 0.0);
+}
+
+
+/**
+ * @brief Prints the count of a label region. Commands in front of the first label
+ *        form the entry region.
+ */
+void print_region(FILE *out, const Label *label, const uint64_t count, const uint64_t total)
+{
+    print_share(out, count, total);
+
+    if (label)
+        fprintf(out, "#%s l.%u\n", label->name, label->command->source_line);
+    else
+        fprintf(out, "(entry)\n");
+}
+
+
+void write_profile(const Interpreter *interpreter, const ParserState *parser, FILE *source, FILE *out)
+{
+    uint64_t type_counts[SPASM_RUNTIME_COMMAND_COUNT];
+    uint64_t *line_counts;
+    uint64_t total = 0;
+    uint64_t region = 0;
+    uint32_t max_line = 0;
+    uint32_t line_num;
+    const Command *command;
+    const Label *label = 0;
+    char line[MAX_LINE_LENGTH + 2];
+    size_t length;
+    int i;
+
+    memset(type_counts, 0, sizeof(type_counts));
+
+    for (command = parser->command_first; command; command = command->next)
+    {
+        if (command->type == SPASM_VEC)
+            continue;
+
+        total += interpreter->counts[command->vaddr];
+        type_counts[command->type] += interpreter->counts[command->vaddr];
+        if (command->source_line > max_line)
+            max_line = command->source_line;
+    }
+
+    line_counts = (uint64_t*)calloc(max_line + 1, sizeof(uint64_t));
+
+    fprintf(out, "===PROFILE===\n");
+    fprintf(out, "Executed commands: ");
+    print_count(out, total, 0);
+    fprintf(out, "\n\nLines:\n");
+
+    if (line_counts)
+    {
+        for (command = parser->command_first; command; command = command->next)
+        {
+            if (command->type != SPASM_VEC)
+                line_counts[command->source_line] += interpreter->counts[command->vaddr];
+        }
+    }
+
+    if (source && line_counts && fseek(source, 0, SEEK_SET) == 0)
+    {
+        /* Annotate every source line */
+        for (line_num = 1; fgets(line, sizeof(line), source); ++line_num)
+        {
+            length = strlen(line);
+            if (length && line[length - 1] == '\n')
+                line[--length] = 0;
+
+            if (line_num <= max_line && line_counts[line_num])
+                print_share(out, line_counts[line_num], total);
+            else
+                fprintf(out, "%*s", 24, "");
+
+            fprintf(out, "l.%-5u| %s\n", line_num, line);
+        }
+    }
+    else
+    {
+        for (command = parser->command_first; command; command = command->next)
+        {
+            if (command->type == SPASM_VEC)
+                continue;
+
+            print_share(out, interpreter->counts[command->vaddr], total);
+            fprintf(out, "l.%-5u| %s\n", command->source_line, SPASM_MNEMONICS[command->type]);
+        }
+    }
+
+    /* Label regions range from a label to the next labeled command */
+    fprintf(out, "\nLabels:\n");
+    for (command = parser->command_first; command; command = command->next)
+    {
+        if (command->label && command != parser->command_first)
+        {
+            print_region(out, label, region, total);
+            region = 0;
+        }
+
+        if (command->label)
+            label = command->label;
+
+        if (command->type != SPASM_VEC)
+            region += interpreter->counts[command->vaddr];
+    }
+
+    print_region(out, label, region, total);
+
+    fprintf(out, "\nCommand types:\n");
+    for (i = 0; i < SPASM_RUNTIME_COMMAND_COUNT; ++i)
+    {
+        if (!type_counts[i])
+            continue;
+
+        print_share(out, type_counts[i], total);
+        fprintf(out, "%s\n", SPASM_MNEMONICS[i]);
+    }
+
+    fprintf(out, "===ENDOFPROFILE===\n");
+
+    free(line_counts);
+}
+
+
+void cleanup_interpreter(Interpreter *interpreter)
+{
+    free(interpreter->ops);
+    free(interpreter->lines);
+    free(interpreter->counts);
+    free(interpreter->memory);
+
+    interpreter->ops = 0;
+    interpreter->lines = 0;
+    interpreter->counts = 0;
+    interpreter->memory = 0;
+}
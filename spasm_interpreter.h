@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2011, Stefan Hacker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+
+#include "spasm_types.h"
+
+#ifndef SPASM_INTERPRETER_H_
+#define SPASM_INTERPRETER_H_
+
+typedef struct InterpreterOp InterpreterOp;
+typedef struct Interpreter Interpreter;
+
+/**
+ * @brief Single command of the compact representation run by the interpreter.
+ */
+struct InterpreterOp
+{
+    CommandType type;
+    uint32_t operand; /* LC constant, LA word address or JMP/JIN target index */
+};
+
+
+/**
+ * @brief State of a program run by the interpreter.
+ */
+struct Interpreter
+{
+    InterpreterOp *ops; /* commands in program order, terminated by STP */
+    uint32_t op_count; /* number of commands without the terminating STP */
+    uint32_t *lines; /* source line per op */
+
+    uint32_t *memory; /* all memory locations */
+    uint32_t memory_words;
+
+    uint64_t *counts; /* number of executions per op */
+
+    unsigned char strbuf[256]; /* string buffer shared by the builtins */
+
+    uint32_t error_line; /* source line of a failing command */
+    const char *error; /* runtime error description, 0 if none */
+};
+
+
+/**
+ * @brief Prepares the program contained in the ParserState for interpretation.
+ *
+ * Memory locations are laid out consecutively and commands get their op index
+ * assigned as vaddr so -i output refers to the interpreted program.
+ *
+ * @param interpreter Interpreter to initialize
+ * @param parser Parsed program
+ * @return ERR_SUCCESS on success
+ */
+Errc init_interpreter(Interpreter *interpreter, ParserState *parser);
+
+/**
+ * @brief Runs the program until STP or its last command.
+ *
+ * Behaves like the generated code including the prompts and messages of the
+ * builtins. DIV divides the unsigned dividend by the signed divisor like the
+ * idiv of the generated code. Accesses outside the memory locations, stack
+ * underflows and divisions idiv faults on (by zero or with a quotient outside
+ * of int32_t) end the run with ERR_RUNTIME and set error and error_line.
+ *
+ * @param interpreter Initialized interpreter
+ * @param exit_code Set to the exit code of the program
+ * @return ERR_SUCCESS on success
+ */
+Errc run_interpreter(Interpreter *interpreter, int *exit_code);
+
+/**
+ * @brief Writes the execution counts per source line, label region and command
+ *        type of the last run.
+ * @param interpreter Interpreter after a run
+ * @param parser Program the interpreter was initialized with
+ * @param source Source file to annotate, 0 to only list lines with commands
+ * @param out File to write the report to
+ */
+void write_profile(const Interpreter *interpreter, const ParserState *parser, FILE *source, FILE *out);
+
+/**
+ * @brief Frees all resources held by the interpreter.
+ */
+void cleanup_interpreter(Interpreter *interpreter);
+
+#endif /* SPASM_INTERPRETER_H_ */
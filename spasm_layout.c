@@ -0,0 +1,380 @@
+/*
+ * Copyright (C) 2011, Stefan Hacker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "spasm_layout.h"
+#include "spasm_parser.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+
+typedef struct LayoutBlock LayoutBlock;
+
+/**
+ * @brief Basic block of the program while reordering.
+ */
+struct LayoutBlock
+{
+    Command *first;
+    Command *last;
+    uint32_t count; /* number of times the block was entered */
+    int placed;
+};
+
+
+/**
+ * @brief Checks whether the block continues with the next block in source order.
+ */
+int falls_through(const LayoutBlock *block)
+{
+    return block->last->type != SPASM_JMP && block->last->type != SPASM_STP;
+}
+
+
+/**
+ * @brief Returns the block a block ending in a jump jumps to, 0 if it doesn't end in one.
+ * @note Commands starting a block carry their block index in vaddr while reordering.
+ */
+LayoutBlock *jump_target(LayoutBlock *blocks, const LayoutBlock *block)
+{
+    switch (block->last->type)
+    {
+    case SPASM_JMP:
+    case SPASM_JIN:
+    case SPASM_JNZ:
+        return &blocks[block->last->argument.label_arg->command->vaddr];
+    default:
+        return 0;
+    }
+}
+
+
+/**
+ * @brief Returns the label of the block, creating one if necessary.
+ * @param parser State
+ * @param block Block to label
+ * @param label_count Counter for naming created labels
+ * @return Label or 0 on allocation failure.
+ */
+Label *block_label(ParserState *parser, LayoutBlock *block, uint32_t *label_count)
+{
+    char name[32];
+
+    if (!block->first->label)
+    {
+        /* Parsed labels are alphanumeric, so the name can't clash */
+        sprintf(name, "_l%u", (*label_count)++);
+        block->first->label = get_or_insert_label(parser, name, strlen(name));
+        if (block->first->label)
+            block->first->label->command = block->first;
+    }
+
+    return block->first->label;
+}
+
+
+/**
+ * @brief Appends a JMP to the given target to the block.
+ * @return ERR_SUCCESS on success.
+ */
+Errc append_jump(ParserState *parser, LayoutBlock *block, LayoutBlock *target, uint32_t *label_count)
+{
+    Command *jump = (Command*)calloc(1, sizeof(Command));
+
+    if (!jump)
+        return ERR_ALLOC;
+
+    jump->type = SPASM_JMP;
+    jump->source_line = block->last->source_line;
+    jump->argument.label_arg = block_label(parser, target, label_count);
+    if (!jump->argument.label_arg)
+    {
+        free(jump);
+        return ERR_ALLOC;
+    }
+
+    block->last->next = jump;
+    block->last = jump;
+
+    return ERR_SUCCESS;
+}
+
+
+/**
+ * @brief Removes the JMP ending the given block.
+ */
+void remove_jump(LayoutBlock *block)
+{
+    Command *command = block->first;
+
+    while (command->next != block->last)
+        command = command->next;
+
+    free(block->last);
+    block->last = command;
+}
+
+
+/**
+ * @brief Chooses the block to place behind the given block.
+ *
+ * Prefers the more frequently entered of the unplaced fall through and jump
+ * target blocks, then the first unplaced block that was entered at all and
+ * finally the first unplaced block. The block falling off the end of the
+ * program, if any, stays last.
+ *
+ * @param blocks Blocks of the program
+ * @param block_count Number of blocks
+ * @param current Block placed last
+ * @return Block to place next
+ */
+LayoutBlock *next_block(LayoutBlock *blocks, const uint32_t block_count, LayoutBlock *current)
+{
+    LayoutBlock *last = falls_through(&blocks[block_count - 1]) ? &blocks[block_count - 1] : 0;
+    LayoutBlock *best = 0;
+    LayoutBlock *candidate;
+    uint32_t i;
+
+    if (falls_through(current) && current != &blocks[block_count - 1])
+    {
+        candidate = current + 1;
+        if (!candidate->placed && candidate->count > 0 && candidate != last)
+            best = candidate;
+    }
+
+    candidate = jump_target(blocks, current);
+    if (candidate && !candidate->placed && candidate->count > 0 && candidate != last
+            && (!best || candidate->count > best->count))
+        best = candidate;
+
+    if (best)
+        return best;
+
+    for (i = 0; i < block_count; ++i)
+    {
+        if (!blocks[i].placed && blocks[i].count > 0 && &blocks[i] != last)
+            return &blocks[i];
+    }
+
+    for (i = 0; i < block_count; ++i)
+    {
+        if (!blocks[i].placed && &blocks[i] != last)
+            return &blocks[i];
+    }
+
+    return last;
+}
+
+
+/**
+ * @brief Restores source order fall through and removes jumps to the next block.
+ * @param parser State
+ * @param blocks Blocks of the program
+ * @param block_count Number of blocks
+ * @param block Block to fix up
+ * @param next Block placed behind block, 0 if it is the last one
+ * @param label_count Counter for naming created labels
+ * @return ERR_SUCCESS on success.
+ */
+Errc link_block(ParserState *parser, LayoutBlock *blocks, const uint32_t block_count,
+        LayoutBlock *block, LayoutBlock *next, uint32_t *label_count)
+{
+    LayoutBlock *source_next = block != &blocks[block_count - 1] ? block + 1 : 0;
+    LayoutBlock *target = jump_target(blocks, block);
+
+    if (block->last->type == SPASM_JMP)
+    {
+        if (target == next && block->last != block->first)
+            remove_jump(block);
+    }
+    else if (falls_through(block) && source_next && source_next != next)
+    {
+        if (target == next && block->last->type == SPASM_JIN)
+        {
+            block->last->type = SPASM_JNZ;
+            block->last->argument.label_arg = block_label(parser, source_next, label_count);
+            if (!block->last->argument.label_arg)
+                return ERR_ALLOC;
+        }
+        else if (target == next && block->last->type == SPASM_JNZ)
+        {
+            block->last->type = SPASM_JIN;
+            block->last->argument.label_arg = block_label(parser, source_next, label_count);
+            if (!block->last->argument.label_arg)
+                return ERR_ALLOC;
+        }
+        else if (append_jump(parser, block, source_next, label_count) != ERR_SUCCESS)
+        {
+            return ERR_ALLOC;
+        }
+    }
+
+    block->last->next = next ? next->first : 0;
+    if (!next)
+        parser->command_last = block->last;
+
+    return ERR_SUCCESS;
+}
+
+
+Errc layout_blocks(ParserState *parser, const BlockCounts *counts, uint32_t *moved)
+{
+    LayoutBlock *blocks;
+    LayoutBlock **order;
+    Command *prev = 0;
+    Command *cur;
+    uint32_t block_count = 0;
+    uint32_t label_count = 0;
+    uint32_t i;
+    Errc result = ERR_SUCCESS;
+
+    *moved = 0;
+
+    for (cur = parser->command_first; cur; prev = cur, cur = cur->next)
+    {
+        if (is_block_leader(prev, cur))
+            ++block_count;
+    }
+
+    if (block_count != counts->block_count)
+        return ERR_PROFILE;
+
+    blocks = (LayoutBlock*)calloc(block_count, sizeof(LayoutBlock));
+    order = (LayoutBlock**)calloc(block_count, sizeof(LayoutBlock*));
+    if (!blocks || !order)
+    {
+        free(blocks);
+        free(order);
+        return ERR_ALLOC;
+    }
+
+    /* Split into blocks. The block index is kept in the vaddr of the
+     * first command until the writer assigns the actual addresses. */
+    block_count = 0;
+    prev = 0;
+    for (cur = parser->command_first; cur; prev = cur, cur = cur->next)
+    {
+        if (is_block_leader(prev, cur))
+        {
+            if (cur->source_line != counts->lines[block_count])
+            {
+                result = ERR_PROFILE;
+                goto cleanup;
+            }
+
+            cur->vaddr = block_count;
+            blocks[block_count].first = cur;
+            blocks[block_count].count = counts->counts[block_count];
+            ++block_count;
+        }
+
+        blocks[block_count - 1].last = cur;
+    }
+
+    /* The program entry stays first */
+    order[0] = &blocks[0];
+    order[0]->placed = 1;
+    for (i = 1; i < block_count; ++i)
+    {
+        order[i] = next_block(blocks, block_count, order[i - 1]);
+        order[i]->placed = 1;
+    }
+
+    for (i = 0; i < block_count; ++i)
+    {
+        if (i > 0 && order[i] != order[i - 1] + 1)
+            ++*moved;
+
+        result = link_block(parser, blocks, block_count, order[i],
+                i + 1 < block_count ? order[i + 1] : 0, &label_count);
+        if (result != ERR_SUCCESS)
+            goto cleanup;
+    }
+
+    parser->command_first = order[0]->first;
+
+    cleanup: free(order);
+    free(blocks);
+
+    return result;
+}
+
+
+Errc align_loops(ParserState *parser, const uint32_t boundary, uint32_t *aligned)
+{
+    Command *prev = 0;
+    Command *cur;
+    Command *padding;
+    Command *target;
+    unsigned char *loop_head;
+    uint32_t command_count = 0;
+
+    *aligned = 0;
+
+    /* Number the commands to tell backward from forward jumps */
+    for (cur = parser->command_first; cur; cur = cur->next)
+        cur->vaddr = command_count++;
+
+    loop_head = (unsigned char*)calloc(command_count, 1);
+    if (!loop_head)
+        return ERR_ALLOC;
+
+    for (cur = parser->command_first; cur; cur = cur->next)
+    {
+        if (cur->type != SPASM_JMP && cur->type != SPASM_JIN && cur->type != SPASM_JNZ)
+            continue;
+
+        target = cur->argument.label_arg->command;
+        if (target->vaddr <= cur->vaddr)
+            loop_head[target->vaddr] = 1;
+    }
+
+    for (cur = parser->command_first; cur; prev = cur, cur = cur->next)
+    {
+        if (!loop_head[cur->vaddr] || (prev && prev->type == SPASM_ALN))
+            continue;
+
+        padding = (Command*)calloc(1, sizeof(Command));
+        if (!padding)
+        {
+            free(loop_head);
+            return ERR_ALLOC;
+        }
+
+        padding->type = SPASM_ALN;
+        padding->argument.constant_arg = boundary;
+        padding->source_line = cur->source_line;
+        padding->next = cur;
+
+        if (prev)
+            prev->next = padding;
+        else
+            parser->command_first = padding;
+
+        ++*aligned;
+    }
+
+    free(loop_head);
+
+    return ERR_SUCCESS;
+}
@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) 2011, Stefan Hacker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "spasm_types.h"
+#include "spasm_instrument.h"
+
+#ifndef SPASM_LAYOUT_H_
+#define SPASM_LAYOUT_H_
+
+/**
+ * @brief Reorders the basic blocks of the program using block counts so
+ *        hot blocks fall through to their most frequent successor and
+ *        blocks that never executed are moved to the end of the program.
+ *
+ * Blocks are split like instrument_blocks does. JMP commands are
+ * inserted where a block no longer falls through to its source successor
+ * and removed where the jump target follows directly. A JIN followed by
+ * its jump target becomes a JNZ to the fall through block instead.
+ *
+ * @param parser State to update
+ * @param counts Block counts of an instrumented run of the same program
+ * @param moved Set to the number of blocks placed behind a different block than in the source
+ * @return ERR_SUCCESS on success, ERR_PROFILE if the counts belong to a different program
+ */
+Errc layout_blocks(ParserState *parser, const BlockCounts *counts, uint32_t *moved);
+
+/**
+ * @brief Inserts an ALN command in front of every loop head so it starts
+ *        at the given boundary.
+ *
+ * Loop heads are the targets of backward jumps. Jumps go to the loop head
+ * directly, only code falling through into the loop executes the padding.
+ *
+ * @param parser State to update
+ * @param boundary Power of two alignment in bytes
+ * @param aligned Set to the number of aligned loop heads
+ * @return ERR_SUCCESS on success
+ */
+Errc align_loops(ParserState *parser, const uint32_t boundary, uint32_t *aligned);
+
+#endif /* SPASM_LAYOUT_H_ */
@@ -0,0 +1,303 @@
+/*
+ * Copyright (C) 2011, Stefan Hacker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#include "spasm_listing.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "spasm_datalayout.h"
+#include "spasm_stats.h"
+#include "spasm_vectorizer.h"
+
+const char LISTING_HEX_DIGITS[] = "0123456789abcdef";
+
+
+void init_listing(Listing *listing, FILE *file)
+{
+    listing->file = file;
+    listing->size = 0;
+}
+
+
+void flush_listing(Listing *listing)
+{
+    if (listing->size)
+    {
+        fwrite(listing->text, 1, listing->size, listing->file);
+        listing->size = 0;
+    }
+}
+
+
+char *listing_reserve(Listing *listing, const size_t size)
+{
+    char *text;
+
+    if (listing->size + size > LISTING_BUFFER_SIZE)
+        flush_listing(listing);
+
+    text = listing->text + listing->size;
+    listing->size += size;
+    return text;
+}
+
+
+void listing_text(Listing *listing, const char *text)
+{
+    size_t length = strlen(text);
+    size_t chunk;
+
+    if (listing->size + length <= LISTING_BUFFER_SIZE)
+    {
+        memcpy(listing->text + listing->size, text, length);
+        listing->size += length;
+        return;
+    }
+
+    while (length)
+    {
+        if (listing->size == LISTING_BUFFER_SIZE)
+            flush_listing(listing);
+
+        chunk = LISTING_BUFFER_SIZE - listing->size;
+        if (chunk > length)
+            chunk = length;
+
+        memcpy(listing->text + listing->size, text, chunk);
+        listing->size += chunk;
+        text += chunk;
+        length -= chunk;
+    }
+}
+
+
+void listing_char(Listing *listing, const char c)
+{
+    if (listing->size == LISTING_BUFFER_SIZE)
+        flush_listing(listing);
+
+    listing->text[listing->size++] = c;
+}
+
+
+void listing_unsigned(Listing *listing, uint32_t value)
+{
+    char digits[10];
+    size_t count = 0;
+    char *text;
+
+    do
+    {
+        digits[count++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value);
+
+    text = listing_reserve(listing, count);
+    while (count)
+        *text++ = digits[--count];
+}
+
+
+void listing_signed(Listing *listing, const int32_t value)
+{
+    if (value < 0)
+    {
+        listing_char(listing, '-');
+        listing_unsigned(listing, (uint32_t)0 - (uint32_t)value);
+    }
+    else
+    {
+        listing_unsigned(listing, (uint32_t)value);
+    }
+}
+
+
+void listing_hex(Listing *listing, uint32_t value, const unsigned digits)
+{
+    char hex[8];
+    unsigned count = 0;
+    char *text;
+
+    do
+    {
+        hex[count++] = LISTING_HEX_DIGITS[value & 0xf];
+        value >>= 4;
+    } while (value || count < digits);
+
+    text = listing_reserve(listing, count + 2);
+    *text++ = '0';
+    *text++ = 'x';
+    while (count)
+        *text++ = hex[--count];
+}
+
+
+void listing_json_string(Listing *listing, const char *text)
+{
+    /* The shared escaper writes to the file, so the buffered text goes first */
+    flush_listing(listing);
+    write_json_string(listing->file, text);
+}
+
+
+void listing_command(Listing *listing, const Command *command, const int target)
+{
+    listing_hex(listing, command->vaddr, 1);
+    listing_text(listing, " l.");
+    listing_unsigned(listing, command->source_line);
+    listing_char(listing, ' ');
+
+    if (command->label)
+    {
+        listing_char(listing, '#');
+        listing_text(listing, command->label->name);
+        listing_char(listing, ' ');
+    }
+
+    listing_text(listing, SPASM_MNEMONICS[command->type]);
+
+    switch (command->type)
+    {
+    case SPASM_LC:
+    case SPASM_ALN:
+    case SPASM_DUP:
+        listing_char(listing, ' ');
+        listing_signed(listing, (int32_t)command->argument.constant_arg);
+        break;
+    case SPASM_JMP:
+    case SPASM_JIN:
+    case SPASM_JNZ:
+        listing_text(listing, " #");
+        listing_text(listing, command->argument.label_arg->name);
+        if (target)
+        {
+            /* A jump to itself or a jump chain must not be followed */
+            listing_text(listing, " -> [");
+            listing_command(listing, command->argument.label_arg->command, 0);
+            listing_char(listing, ']');
+        }
+        break;
+    case SPASM_LA:
+    case SPASM_CNT:
+    case SPASM_LVX:
+    case SPASM_STX:
+        listing_text(listing, " $");
+        listing_text(listing, command->argument.memory_arg->name);
+        listing_text(listing, " [");
+        listing_hex(listing, command->argument.memory_arg->vaddr, 1);
+        listing_char(listing, ']');
+        break;
+    case SPASM_VEC:
+        listing_text(listing, " $");
+        listing_text(listing, command->argument.vector_arg->counter->name);
+        listing_text(listing, " < ");
+        listing_unsigned(listing, command->argument.vector_arg->limit);
+        listing_text(listing, " (");
+        listing_unsigned(listing, command->argument.vector_arg->op_count);
+        listing_text(listing, " ops, ");
+        listing_unsigned(listing, command->argument.vector_arg->reduction_count);
+        listing_text(listing, " reductions, ");
+        listing_unsigned(listing, command->argument.vector_arg->induction_count);
+        listing_text(listing, " inductions)");
+        break;
+    case SPASM_RMW:
+        listing_text(listing, " $");
+        listing_text(listing, command->argument.update_arg->memory->name);
+        listing_text(listing, " [");
+        listing_hex(listing, command->argument.update_arg->memory->vaddr, 1);
+        listing_text(listing, "] ");
+        listing_text(listing, SPASM_MNEMONICS[command->argument.update_arg->operation]);
+        listing_char(listing, ' ');
+        listing_unsigned(listing, command->argument.update_arg->constant);
+        break;
+    default: break;
+    }
+}
+
+
+Errc write_info(FILE *file, const ParserState *parser)
+{
+    Listing *listing;
+    const Command *cmd;
+    const MemoryLocation *mem;
+    const Label *lbl;
+
+    listing = malloc(sizeof(Listing));
+    if (!listing)
+        return ERR_ALLOC;
+
+    init_listing(listing, file);
+
+    listing_text(listing, "===INFO===\nVariables:\n");
+    for (mem = parser->memory_location_first; mem; mem = mem->next)
+    {
+        listing_hex(listing, mem->vaddr, 1);
+        listing_text(listing, " - ");
+        listing_hex(listing, mem->vaddr + mem->size - 1, 1);
+        listing_text(listing, " l.");
+        listing_unsigned(listing, mem->source_line);
+        listing_text(listing, " $");
+        listing_text(listing, mem->name);
+        listing_text(listing, " (");
+        listing_signed(listing, (int32_t)mem->size);
+        listing_text(listing, " bytes)");
+
+        if (mem->accesses || mem->padding)
+        {
+            listing_text(listing, " [");
+            listing_unsigned(listing, mem->accesses);
+            listing_text(listing, " accesses, line ");
+            listing_hex(listing, mem->vaddr & ~(uint32_t)(DATA_CACHE_LINE - 1), 1);
+            listing_text(listing, ", page offset ");
+            listing_hex(listing, mem->vaddr % DATA_PAGE_SIZE, 3);
+            listing_text(listing, ", ");
+            listing_unsigned(listing, mem->padding);
+            listing_text(listing, " bytes padding]");
+        }
+        listing_char(listing, '\n');
+    }
+
+    listing_text(listing, "\nCommands:\n");
+    for (cmd = parser->command_first; cmd; cmd = cmd->next)
+    {
+        listing_command(listing, cmd, 1);
+        listing_char(listing, '\n');
+    }
+
+    listing_text(listing, "\nLabels:\n");
+    for (lbl = parser->label_first; lbl; lbl = lbl->next)
+    {
+        listing_text(listing, "l.");
+        listing_unsigned(listing, lbl->command->source_line);
+        listing_text(listing, " #");
+        listing_text(listing, lbl->name);
+        listing_text(listing, " -> ");
+        listing_command(listing, lbl->command, 1);
+        listing_char(listing, '\n');
+    }
+    listing_text(listing, "===ENDOFINFO===\n\n");
+
+    flush_listing(listing);
+    free(listing);
+
+    return ERR_SUCCESS;
+}
@@ -0,0 +1,119 @@
+/*
+ * Copyright (C) 2011, Stefan Hacker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+
+#include "spasm_types.h"
+
+#ifndef SPASM_LISTING_H_
+#define SPASM_LISTING_H_
+
+#define LISTING_BUFFER_SIZE 65536
+
+typedef struct Listing Listing;
+
+/**
+ * @brief Output buffer of the info listing and the map file.
+ *
+ * Numbers are formatted by hand and the text is written in blocks of
+ * LISTING_BUFFER_SIZE, as listings of large programs took longer to
+ * print with one printf per field than assembling the program.
+ */
+struct Listing
+{
+    FILE *file;
+    size_t size; /* bytes used in text */
+    char text[LISTING_BUFFER_SIZE];
+};
+
+/**
+ * @brief Starts an empty listing.
+ * @param listing Listing to initialize
+ * @param file File the listing is written to
+ */
+void init_listing(Listing *listing, FILE *file);
+
+/**
+ * @brief Writes the buffered text to the file of the listing.
+ */
+void flush_listing(Listing *listing);
+
+/**
+ * @brief Reserves space at the end of the listing, flushing it if full.
+ * @param listing Listing to append to
+ * @param size Bytes to reserve, at most LISTING_BUFFER_SIZE
+ * @return Start of the reserved text.
+ */
+char *listing_reserve(Listing *listing, const size_t size);
+
+/**
+ * @brief Appends a string of any length.
+ */
+void listing_text(Listing *listing, const char *text);
+
+/**
+ * @brief Appends a single character.
+ */
+void listing_char(Listing *listing, const char c);
+
+/**
+ * @brief Appends an unsigned decimal number.
+ */
+void listing_unsigned(Listing *listing, uint32_t value);
+
+/**
+ * @brief Appends a signed decimal number.
+ */
+void listing_signed(Listing *listing, const int32_t value);
+
+/**
+ * @brief Appends a hexadecimal number with 0x prefix.
+ * @param listing Listing to append to
+ * @param value Number to append
+ * @param digits Minimal number of digits, padded with zeros
+ */
+void listing_hex(Listing *listing, uint32_t value, const unsigned digits);
+
+/**
+ * @brief Appends a quoted and escaped JSON string, @see write_json_string
+ */
+void listing_json_string(Listing *listing, const char *text);
+
+/**
+ * @brief Appends a command as in the info output: vaddr, source line,
+ *        label, mnemonic and argument.
+ * @param listing Listing to append to
+ * @param command Command to append
+ * @param target Append the target command of jumps behind the label name
+ */
+void listing_command(Listing *listing, const Command *command, const int target);
+
+/**
+ * @brief Writes the variables, commands and labels of a program with
+ *        their virtual addresses.
+ * @param file File to write to
+ * @param parser Program to list
+ * @return ERR_SUCCESS or ERR_ALLOC if the listing buffer can't be allocated.
+ */
+Errc write_info(FILE *file, const ParserState *parser);
+
+#endif /* SPASM_LISTING_H_ */
@@ -21,6 +21,7 @@
  */
 
 #include "spasm_parser.h"
+#include "spasm_stats.h"
 
 #include <string.h>
 #include <stdint.h>
@@ -43,8 +44,14 @@ Label *get_label(ParserState *parser, const char *name, const size_t len)
 
     assert(len <= MAX_SYMBOL_NAME_LENGTH);
 
+    if (parser->stats)
+        ++parser->stats->label_lookups;
+
     while (cur)
     {
+        if (parser->stats)
+            ++parser->stats->label_probes;
+
         if (strlen(cur->name) == len && strncmp(cur->name, name, len) == 0)
             return cur;
 
@@ -73,6 +80,8 @@ Label *get_or_insert_label(ParserState *parser, const char *name, const size_t l
     if (!cur)
         return 0;
 
+    count_allocation(parser->stats, sizeof(Label));
+
     strncpy(cur->name, name, len);
 
     if (parser->label_first == 0)
@@ -87,21 +96,27 @@ Label *get_or_insert_label(ParserState *parser, const char *name, const size_t l
 
 
 /**
- * @brief Return bss memory location by name.
+ * @brief Return memory location of any segment by name.
  * @param parser State
  * @param name Variable name
  * @param len Length of name
  * @return *MemoryLocation or 0 if it could not be found.
  */
-MemoryLocation *get_bss_variable(ParserState *parser, const char *name, const size_t len)
+MemoryLocation *get_variable(ParserState *parser, const char *name, const size_t len)
 {
     MemoryLocation *cur = parser->memory_location_first;
 
     assert(len <= MAX_SYMBOL_NAME_LENGTH);
 
+    if (parser->stats)
+        ++parser->stats->variable_lookups;
+
     while (cur)
     {
-        if (cur->type == SPASM_BSS && strlen(cur->name) == len && strncmp(cur->name, name, len) == 0)
+        if (parser->stats)
+            ++parser->stats->variable_probes;
+
+        if (strlen(cur->name) == len && strncmp(cur->name, name, len) == 0)
             return cur;
 
         cur = cur->next;
@@ -111,26 +126,27 @@ MemoryLocation *get_bss_variable(ParserState *parser, const char *name, const si
 
 
 /**
- * @brief Create new bss memory location with given parameters.
+ * @brief Create new memory location with given parameters.
  * @param parser State
+ * @param type Segment of the location
  * @param name Name of variable/location to create.
  * @param len Length of name
- * @param size Size of variable/location in bytes.
  * @param line_num Source code reference line for this variable/location.
- * @return Newly created variable.
+ * @return Newly created, empty variable.
  */
-MemoryLocation *insert_bss_variable(ParserState *parser, const char *name, const size_t len, const uint32_t size, const uint32_t line_num)
+MemoryLocation *insert_variable(ParserState *parser, const enum MemoryLocationType type, const char *name,
+        const size_t len, const uint32_t line_num)
 {
     MemoryLocation *mem = (MemoryLocation*)calloc(1, sizeof(MemoryLocation));
 
-    assert(get_bss_variable(parser, name, len) == 0);
+    assert(get_variable(parser, name, len) == 0);
 
     if (!mem)
         return 0;
 
+    count_allocation(parser->stats, sizeof(MemoryLocation));
     strncpy(mem->name, name, len);
-    mem->size = size;
-    mem->type = SPASM_BSS;
+    mem->type = type;
     mem->source_line = line_num;
 
     if (parser->memory_location_first == 0)
@@ -140,6 +156,18 @@ MemoryLocation *insert_bss_variable(ParserState *parser, const char *name, const
 
     parser->memory_location_last = mem;
 
+    return mem;
+}
+
+
+MemoryLocation *insert_bss_variable(ParserState *parser, const char *name, const size_t len, const uint32_t size, const uint32_t line_num)
+{
+    MemoryLocation *mem = insert_variable(parser, SPASM_BSS, name, len, line_num);
+
+    if (!mem)
+        return 0;
+
+    mem->size = size;
     parser->bss_used += size;
 
     return mem;
@@ -154,6 +182,7 @@ MemoryLocation *insert_bss_variable(ParserState *parser, const char *name, const
 Errc check_result(ParserState *parser)
 {
     Command *cmd = parser->command_first;
+    Label *lbl = parser->label_first;
 
     /*
      * Check if empty
@@ -180,6 +209,18 @@ Errc check_result(ParserState *parser)
         cmd = cmd->next;
     }
 
+    /*
+     * Labels jumped to but never defined are imports of modules
+     */
+    while (lbl && !parser->module)
+    {
+        if (lbl->command == 0)
+        {
+            return ERR_UNDEFINED_LABEL;
+        }
+        lbl = lbl->next;
+    }
+
     return ERR_SUCCESS;
 }
 
@@ -243,6 +284,8 @@ Command* insert_command(ParserState *parser, CommandType type, uint32_t line_num
     if (!cmd)
         return 0;
 
+    count_allocation(parser->stats, sizeof(Command));
+
     if (label)
         label->command = cmd;
 
@@ -261,6 +304,105 @@ Command* insert_command(ParserState *parser, CommandType type, uint32_t line_num
 }
 
 
+/**
+ * @brief Parse the values of an initialized variable declaration:
+ *     DD $variablename 1 2 3
+ *     DC $variablename 4 5 6
+ * Repeating the directive for the variable declared last appends the values.
+ * @param parser State
+ * @param line_num Source code line number of this line.
+ * @param buffer Buffer behind the directive
+ * @param type SPASM_DATA for DD, SPASM_RODATA for DC
+ * @return ERR_SUCCESS on success
+ */
+Errc parse_initialized_variable(ParserState *parser, const uint32_t line_num, const char *buffer,
+        const enum MemoryLocationType type)
+{
+    const char *name;
+    const char *cur;
+    unsigned char *content;
+    unsigned long int value;
+    MemoryLocation *memory;
+    uint32_t count = 0;
+    uint32_t stored;
+    uint32_t size;
+
+    buffer = skip_spaces(buffer);
+    if (*(buffer++) != '$')
+        return ERR_SYNTAX;
+
+    name = buffer;
+    buffer = skip_alnums(buffer);
+
+    /* Validate and count the values first */
+    for (cur = skip_spaces(buffer); isdigit(*cur); cur = skip_spaces(cur))
+    {
+        errno = 0;
+        value = strtoul(cur, (char**)&cur, 10);
+        if (errno != 0)
+            return ERR_SYNTAX;
+
+        if (value > UINT_MAX)
+            return ERR_CONSTANT_RANGE;
+
+        ++count;
+    }
+
+    if (count == 0 || read_to_end_of_line(cur) != ERR_SUCCESS)
+        return ERR_SYNTAX;
+
+    memory = get_variable(parser, name, buffer - name);
+    if (memory && memory->imported)
+    {
+        /* Used by the module before its declaration */
+        memory->imported = 0;
+        memory->type = type;
+        memory->source_line = line_num;
+    }
+    else if (memory && (memory != parser->memory_location_last || memory->type != type))
+    {
+        return ERR_VARIABLE_REDEFINITION;
+    }
+    else if (!memory)
+    {
+        memory = insert_variable(parser, type, name, buffer - name, line_num);
+        if (!memory)
+            return ERR_ALLOC;
+    }
+
+    if (memory->size > UINT_MAX - count * sizeof(uint32_t))
+        return ERR_CONSTANT_RANGE;
+
+    size = memory->size + count * sizeof(uint32_t);
+    content = (unsigned char*)realloc(memory->content, size);
+    if (!content)
+        return ERR_ALLOC;
+
+    count_allocation(parser->stats, size);
+    memory->content = content;
+
+    /* Values are stored in the byte order of the target */
+    for (cur = skip_spaces(buffer); isdigit(*cur); cur = skip_spaces(cur))
+    {
+        stored = (uint32_t)strtoul(cur, (char**)&cur, 10);
+        memcpy(content + memory->size, &stored, sizeof(stored));
+        memory->size += sizeof(stored);
+    }
+
+    if (type == SPASM_DATA)
+    {
+        parser->data_used += count * sizeof(uint32_t);
+    }
+    else
+    {
+        parser->rodata_used += count * sizeof(uint32_t);
+        parser->rodata_words = 1;
+    }
+
+    return ERR_SUCCESS;
+}
+
+
 /**
  * @brief Parse a single command from given buffer.
  * @param parser State
@@ -297,7 +439,16 @@ Errc parse_command(ParserState *parser, const uint32_t line_num, const char *buf
                     return ERR_SYNTAX;
 
                 tmp = skip_alnums(buffer);
-                memory_arg = get_bss_variable(parser, buffer, tmp - buffer);
+                memory_arg = get_variable(parser, buffer, tmp - buffer);
+                if (!memory_arg && parser->module)
+                {
+                    /* Defined by another module or later in this one */
+                    memory_arg = insert_bss_variable(parser, buffer, tmp - buffer, 0, line_num);
+                    if (!memory_arg)
+                        return ERR_ALLOC;
+                    memory_arg->imported = 1;
+                }
+
                 if (!memory_arg)
                     return ERR_UNDEFINED_VARIABLE;
 
@@ -400,7 +551,10 @@ Errc parse_line(ParserState *parser, const uint32_t line_num, const char *line)
     const char *tmp_end;
     unsigned long int size;
     Label *label = 0;
+    MemoryLocation *memory;
     const size_t DS_LEN = strlen(SPASM_MNEMONICS[SPASM_DS]);
+    const size_t DD_LEN = strlen(SPASM_MNEMONICS[SPASM_DD]);
+    const size_t DC_LEN = strlen(SPASM_MNEMONICS[SPASM_DC]);
 
     cur = skip_spaces(cur);
 
@@ -423,7 +577,8 @@ Errc parse_line(ParserState *parser, const uint32_t line_num, const char *line)
 
         tmp = cur;
         cur = skip_alnums(cur);
-        if (get_bss_variable(parser, tmp, cur - tmp))
+        memory = get_variable(parser, tmp, cur - tmp);
+        if (memory && !memory->imported)
             return ERR_VARIABLE_REDEFINITION;
 
         tmp_end = cur;
@@ -443,12 +598,28 @@ Errc parse_line(ParserState *parser, const uint32_t line_num, const char *line)
         if (read_to_end_of_line(cur) != ERR_SUCCESS)
             return ERR_SYNTAX;
 
+        if (memory)
+        {
+            /* Used by the module before its declaration */
+            memory->imported = 0;
+            memory->size = (uint32_t) size * sizeof(int32_t);
+            memory->source_line = line_num;
+            parser->bss_used += memory->size;
+            return ERR_SUCCESS;
+        }
+
         if (insert_bss_variable(parser, tmp, tmp_end - tmp, (uint32_t) size * sizeof(int32_t), line_num) == 0)
             return ERR_ALLOC;
 
         return ERR_SUCCESS;
     }
 
+    if (strncmp(cur, SPASM_MNEMONICS[SPASM_DD], DD_LEN) == 0)
+        return parse_initialized_variable(parser, line_num, cur + DD_LEN, SPASM_DATA);
+
+    if (strncmp(cur, SPASM_MNEMONICS[SPASM_DC], DC_LEN) == 0)
+        return parse_initialized_variable(parser, line_num, cur + DC_LEN, SPASM_RODATA);
+
     if (*cur == '#')
     {
         /* Label */
@@ -474,8 +645,11 @@ Errc parse_file(ParserState *parser, FILE *file)
     const char *LAST = buffer + MAX_LINE_LENGTH;
     int chr;
     uint32_t line = 1;
+    StatsClock clock;
     Errc result;
 
+    start_phase(parser->stats, &clock);
+
     while ((chr = fgetc(file)) != EOF)
     {
         parser->last_line = line;
@@ -510,7 +684,13 @@ Errc parse_file(ParserState *parser, FILE *file)
             return result;
     }
 
-    return check_result(parser);
+    end_phase(parser->stats, STATS_PARSE, &clock);
+
+    start_phase(parser->stats, &clock);
+    result = check_result(parser);
+    end_phase(parser->stats, STATS_CHECK, &clock);
+
+    return result;
 }
 
 
@@ -534,6 +714,10 @@ void cleanup_parser(ParserState *parser)
     {
         cmd_del = cmd;
         cmd = cmd->next;
+        if (cmd_del->type == SPASM_VEC)
+            free(cmd_del->argument.vector_arg);
+        else if (cmd_del->type == SPASM_RMW)
+            free(cmd_del->argument.update_arg);
         free(cmd_del);
     }
 
@@ -43,6 +43,26 @@ void init_parser(ParserState *parser);
  */
 Errc parse_file(ParserState *parser, FILE *file);
 
+/**
+ * @brief Return existing or, alternatively, newly created label by name.
+ * @param parser State
+ * @param name Label name
+ * @param len Length of name
+ * @return *Label or 0 on allocation failure.
+ */
+Label *get_or_insert_label(ParserState *parser, const char *name, const size_t len);
+
+/**
+ * @brief Create new bss memory location with given parameters.
+ * @param parser State
+ * @param name Name of variable/location to create, mustn't exist yet.
+ * @param len Length of name
+ * @param size Size of variable/location in bytes.
+ * @param line_num Source code reference line for this variable/location.
+ * @return Newly created variable or 0 on allocation failure.
+ */
+MemoryLocation *insert_bss_variable(ParserState *parser, const char *name, const size_t len, const uint32_t size, const uint32_t line_num);
+
 /**
  * @brief Releases all memory held in the ParserState and resets it.
  * @parser ParserState to reset.
@@ -0,0 +1,2885 @@
+/*
+ * Copyright (C) 2011, Stefan Hacker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "spasm_passes.h"
+#include "spasm_vectorizer.h"
+#include "spasm_fusion.h"
+#include "spasm_layout.h"
+#include "spasm_parser.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+
+/**
+ * @brief Values a command pops, index equals CommandType.
+ */
+const int32_t SPASM_STACK_POPS[] = {
+        2, 2, 2, 2, /* ADD MUL SUB DIV */
+        2, 2, 2, 1, /* LES AND EQU NOT */
+        0, 0, 1, 2, /* LA LC LV STR */
+        3, 3, /* CPY FIL */
+        1, 0, /* PRI REA */
+        0, 1, 0, 0, /* JMP JIN NOP STP */
+        0, 0, 0, 0, /* SPASM_RUNTIME_COMMAND_COUNT DS DD DC */
+        0, 0, 1, 0, 0, 0, /* VEC CNT JNZ ALN RMW DUP */
+        1, 2 /* LVX STX */
+};
+
+/**
+ * @brief Values a command pushes, index equals CommandType.
+ */
+const int32_t SPASM_STACK_PUSHES[] = {
+        1, 1, 1, 1, /* ADD MUL SUB DIV */
+        1, 1, 1, 1, /* LES AND EQU NOT */
+        1, 1, 1, 0, /* LA LC LV STR */
+        0, 0, /* CPY FIL */
+        0, 1, /* PRI REA */
+        0, 0, 0, 0, /* JMP JIN NOP STP */
+        0, 0, 0, 0, /* SPASM_RUNTIME_COMMAND_COUNT DS DD DC */
+        0, 0, 0, 0, 0, 1, /* VEC CNT JNZ ALN RMW DUP */
+        1, 0 /* LVX STX */
+};
+
+
+/**
+ * @brief Checks whether a command jumps to its label argument.
+ */
+int is_jump(const Command *command)
+{
+    return command->type == SPASM_JMP || command->type == SPASM_JIN || command->type == SPASM_JNZ;
+}
+
+
+/**
+ * @brief Checks whether a command continues with the next command.
+ */
+int continues(const Command *command)
+{
+    return command->type != SPASM_JMP && command->type != SPASM_STP;
+}
+
+
+void cleanup_cfg(ControlFlowGraph *cfg)
+{
+    free(cfg->commands);
+    free(cfg->block_of);
+    free(cfg->blocks);
+    free(cfg->predecessors);
+    memset(cfg, 0, sizeof(ControlFlowGraph));
+}
+
+
+void cleanup_stack_depths(StackDepths *depths)
+{
+    free(depths->entry);
+    memset(depths, 0, sizeof(StackDepths));
+}
+
+
+void cleanup_liveness(Liveness *liveness)
+{
+    free(liveness->variables);
+    free(liveness->live_in);
+    free(liveness->live_out);
+    memset(liveness, 0, sizeof(Liveness));
+}
+
+
+void cleanup_loops(LoopForest *forest)
+{
+    free(forest->idom);
+    free(forest->loops);
+    free(forest->loop_of);
+    free(forest->blocks);
+    memset(forest, 0, sizeof(LoopForest));
+}
+
+
+/**
+ * @brief Drops the cached analyses except for the given ones. Analyses
+ *        depending on a dropped CFG are dropped as well.
+ */
+void invalidate_analyses(PassManager *manager, unsigned keep)
+{
+    if (!(keep & ANALYSIS_CFG))
+        keep = 0;
+
+    if (!(keep & ANALYSIS_CFG))
+        cleanup_cfg(&manager->cfg);
+    if (!(keep & ANALYSIS_STACK_DEPTH))
+        cleanup_stack_depths(&manager->depths);
+    if (!(keep & ANALYSIS_LIVENESS))
+        cleanup_liveness(&manager->liveness);
+    if (!(keep & ANALYSIS_LOOPS))
+        cleanup_loops(&manager->loops);
+
+    manager->valid &= keep;
+}
+
+
+/**
+ * @brief Splits the commands into basic blocks and links them.
+ * @note Commands carry their index in vaddr while building.
+ */
+Errc build_cfg(ParserState *parser, ControlFlowGraph *cfg)
+{
+    Command *cur;
+    FlowBlock *block;
+    uint32_t *stack;
+    uint32_t edges = 0;
+    uint32_t i;
+    uint32_t j;
+
+    memset(cfg, 0, sizeof(ControlFlowGraph));
+
+    for (cur = parser->command_first; cur; cur = cur->next)
+        cur->vaddr = cfg->command_count++;
+
+    cfg->commands = (Command**)malloc((cfg->command_count + 1) * sizeof(Command*));
+    cfg->block_of = (uint32_t*)malloc((cfg->command_count + 1) * sizeof(uint32_t));
+    cfg->blocks = (FlowBlock*)calloc(cfg->command_count + 1, sizeof(FlowBlock));
+    cfg->predecessors = (uint32_t*)malloc((2 * cfg->command_count + 1) * sizeof(uint32_t));
+    if (!cfg->commands || !cfg->block_of || !cfg->blocks || !cfg->predecessors)
+        return ERR_ALLOC;
+
+    for (cur = parser->command_first, i = 0; cur; cur = cur->next, ++i)
+    {
+        cfg->commands[i] = cur;
+        if (i == 0 || cur->label || !continues(cfg->commands[i - 1]) || is_jump(cfg->commands[i - 1]))
+        {
+            block = &cfg->blocks[cfg->block_count++];
+            block->first = i;
+        }
+
+        cfg->blocks[cfg->block_count - 1].last = i;
+        cfg->block_of[i] = cfg->block_count - 1;
+    }
+
+    for (i = 0; i < cfg->block_count; ++i)
+    {
+        block = &cfg->blocks[i];
+        cur = cfg->commands[block->last];
+        block->successors[0] = continues(cur) && i + 1 < cfg->block_count ? (int32_t)i + 1 : -1;
+        block->successors[1] = is_jump(cur) ? (int32_t)cfg->block_of[cur->argument.label_arg->command->vaddr] : -1;
+
+        if (block->successors[0] >= 0)
+            ++cfg->blocks[block->successors[0]].predecessor_count;
+        if (block->successors[1] >= 0 && block->successors[1] != block->successors[0])
+            ++cfg->blocks[block->successors[1]].predecessor_count;
+    }
+
+    for (i = 0; i < cfg->block_count; ++i)
+    {
+        cfg->blocks[i].predecessor_offset = edges;
+        edges += cfg->blocks[i].predecessor_count;
+        cfg->blocks[i].predecessor_count = 0;
+    }
+
+    for (i = 0; i < cfg->block_count; ++i)
+    {
+        for (j = 0; j < 2; ++j)
+        {
+            if (cfg->blocks[i].successors[j] < 0 || (j == 1 && cfg->blocks[i].successors[1] == cfg->blocks[i].successors[0]))
+                continue;
+
+            block = &cfg->blocks[cfg->blocks[i].successors[j]];
+            cfg->predecessors[block->predecessor_offset + block->predecessor_count++] = i;
+        }
+    }
+
+    /* Reachability from the entry, every block is pushed at most once */
+    stack = (uint32_t*)malloc((cfg->block_count + 1) * sizeof(uint32_t));
+    if (!stack)
+        return ERR_ALLOC;
+
+    if (cfg->block_count)
+    {
+        cfg->blocks[0].reachable = 1;
+        stack[0] = 0;
+        for (edges = 1; edges; )
+        {
+            block = &cfg->blocks[stack[--edges]];
+            for (j = 0; j < 2; ++j)
+            {
+                if (block->successors[j] >= 0 && !cfg->blocks[block->successors[j]].reachable)
+                {
+                    cfg->blocks[block->successors[j]].reachable = 1;
+                    stack[edges++] = (uint32_t)block->successors[j];
+                }
+            }
+        }
+    }
+
+    free(stack);
+
+    return ERR_SUCCESS;
+}
+
+
+/**
+ * @brief Computes the stack depth in front of every reachable command.
+ */
+Errc compute_stack_depths(const ControlFlowGraph *cfg, StackDepths *depths)
+{
+    const FlowBlock *block;
+    const Command *command;
+    int32_t *block_depth;
+    uint32_t *stack;
+    uint32_t count = 0;
+    int32_t depth;
+    uint32_t i;
+    int j;
+
+    memset(depths, 0, sizeof(StackDepths));
+    depths->consistent = 1;
+    depths->entry = (int32_t*)malloc((cfg->command_count + 1) * sizeof(int32_t));
+    block_depth = (int32_t*)malloc((cfg->block_count + 1) * sizeof(int32_t));
+    stack = (uint32_t*)malloc((cfg->block_count + 1) * sizeof(uint32_t));
+    if (!depths->entry || !block_depth || !stack)
+    {
+        free(block_depth);
+        free(stack);
+        return ERR_ALLOC;
+    }
+
+    for (i = 0; i < cfg->command_count; ++i)
+        depths->entry[i] = STACK_DEPTH_UNKNOWN;
+    for (i = 0; i < cfg->block_count; ++i)
+        block_depth[i] = STACK_DEPTH_UNKNOWN;
+
+    if (cfg->block_count)
+    {
+        block_depth[0] = 0;
+        stack[count++] = 0;
+    }
+
+    /* Every block is pushed once, when its depth becomes known */
+    while (count)
+    {
+        block = &cfg->blocks[stack[--count]];
+        depth = block_depth[stack[count]];
+
+        for (i = block->first; i <= block->last; ++i)
+        {
+            command = cfg->commands[i];
+            depths->entry[i] = depth;
+
+            if (depth < SPASM_STACK_POPS[command->type])
+            {
+                depths->consistent = 0;
+                depth = 0;
+            }
+            else
+            {
+                depth -= SPASM_STACK_POPS[command->type];
+            }
+
+            depth += SPASM_STACK_PUSHES[command->type];
+            if (depth > depths->max_depth)
+                depths->max_depth = depth;
+        }
+
+        for (j = 0; j < 2; ++j)
+        {
+            if (block->successors[j] < 0)
+                continue;
+
+            if (block_depth[block->successors[j]] == STACK_DEPTH_UNKNOWN)
+            {
+                block_depth[block->successors[j]] = depth;
+                stack[count++] = (uint32_t)block->successors[j];
+            }
+            else if (block_depth[block->successors[j]] != depth)
+            {
+                depths->consistent = 0;
+            }
+        }
+    }
+
+    free(block_depth);
+    free(stack);
+
+    return ERR_SUCCESS;
+}
+
+
+int32_t tracked_variable(const Liveness *liveness, const MemoryLocation *memory)
+{
+    if (memory->type != SPASM_BSS || memory->vaddr >= liveness->variable_count
+            || liveness->variables[memory->vaddr] != memory)
+        return -1;
+
+    return (int32_t)memory->vaddr;
+}
+
+
+/**
+ * @brief Adds all tracked variables to a set.
+ */
+void set_all_live(const Liveness *liveness, uint32_t *live)
+{
+    uint32_t i;
+
+    for (i = 0; i < liveness->variable_count; ++i)
+        live[i / 32] |= (uint32_t)1 << (i % 32);
+}
+
+
+void command_liveness(const PassManager *manager, const uint32_t index, uint32_t *live)
+{
+    const ControlFlowGraph *cfg = &manager->cfg;
+    const Liveness *liveness = &manager->liveness;
+    const Command *command = cfg->commands[index];
+    const Command *previous = index > cfg->blocks[cfg->block_of[index]].first ? cfg->commands[index - 1] : 0;
+    int32_t variable = -1;
+
+    if (previous && previous->type != SPASM_LA)
+        previous = 0;
+
+    switch (command->type)
+    {
+    case SPASM_LV:
+        if (!previous)
+        {
+            /* Loads from computed addresses may read any variable */
+            set_all_live(liveness, live);
+            break;
+        }
+
+        variable = tracked_variable(liveness, previous->argument.memory_arg);
+        if (variable >= 0)
+            live[variable / 32] |= (uint32_t)1 << (variable % 32);
+        break;
+    case SPASM_STR:
+        if (previous)
+            variable = tracked_variable(liveness, previous->argument.memory_arg);
+        if (variable >= 0)
+            live[variable / 32] &= ~((uint32_t)1 << (variable % 32));
+        break;
+    case SPASM_RMW:
+        variable = tracked_variable(liveness, command->argument.update_arg->memory);
+        if (variable >= 0)
+            live[variable / 32] |= (uint32_t)1 << (variable % 32);
+        break;
+    case SPASM_VEC:
+    case SPASM_CPY:
+        set_all_live(liveness, live);
+        break;
+    default:
+        break;
+    }
+}
+
+
+/**
+ * @brief Computes the live variables at the block boundaries.
+ * @note Tracked variables carry their index in vaddr.
+ */
+Errc compute_liveness(PassManager *manager)
+{
+    const ControlFlowGraph *cfg = &manager->cfg;
+    Liveness *liveness = &manager->liveness;
+    const FlowBlock *block;
+    MemoryLocation *memory;
+    uint32_t *live;
+    uint32_t *set;
+    uint32_t i;
+    uint32_t w;
+    int changed = 1;
+    int j;
+
+    memset(liveness, 0, sizeof(Liveness));
+
+    for (memory = manager->parser->memory_location_first; memory; memory = memory->next)
+    {
+        if (memory->type == SPASM_BSS && memory->size == 4)
+            ++liveness->variable_count;
+    }
+
+    liveness->words = liveness->variable_count / 32 + 1;
+    liveness->variables = (MemoryLocation**)malloc((liveness->variable_count + 1) * sizeof(MemoryLocation*));
+    liveness->live_in = (uint32_t*)calloc((size_t)cfg->block_count * liveness->words + 1, sizeof(uint32_t));
+    liveness->live_out = (uint32_t*)calloc((size_t)cfg->block_count * liveness->words + 1, sizeof(uint32_t));
+    live = (uint32_t*)malloc(liveness->words * sizeof(uint32_t));
+    if (!liveness->variables || !liveness->live_in || !liveness->live_out || !live)
+    {
+        free(live);
+        return ERR_ALLOC;
+    }
+
+    liveness->variable_count = 0;
+    for (memory = manager->parser->memory_location_first; memory; memory = memory->next)
+    {
+        if (memory->type == SPASM_BSS && memory->size == 4)
+        {
+            memory->vaddr = liveness->variable_count;
+            liveness->variables[liveness->variable_count++] = memory;
+        }
+    }
+
+    /* Backward data flow, iterating blocks from the end converges fast */
+    while (changed)
+    {
+        changed = 0;
+        for (i = cfg->block_count; i > 0; --i)
+        {
+            block = &cfg->blocks[i - 1];
+            set = &liveness->live_out[(i - 1) * liveness->words];
+
+            for (j = 0; j < 2; ++j)
+            {
+                if (block->successors[j] < 0)
+                    continue;
+
+                for (w = 0; w < liveness->words; ++w)
+                    set[w] |= liveness->live_in[block->successors[j] * liveness->words + w];
+            }
+
+            memcpy(live, set, liveness->words * sizeof(uint32_t));
+            for (w = block->last + 1; w > block->first; --w)
+                command_liveness(manager, w - 1, live);
+
+            set = &liveness->live_in[(i - 1) * liveness->words];
+            if (memcmp(live, set, liveness->words * sizeof(uint32_t)) != 0)
+            {
+                memcpy(set, live, liveness->words * sizeof(uint32_t));
+                changed = 1;
+            }
+        }
+    }
+
+    free(live);
+
+    return ERR_SUCCESS;
+}
+
+
+/* Postorder numbers of blocks that are on the DFS stack or weren't visited */
+#define POSTORDER_VISITING 0xfffffffeu
+#define POSTORDER_UNVISITED 0xffffffffu
+
+
+/**
+ * @brief Finds the nearest common dominator of two blocks.
+ */
+uint32_t common_dominator(const int32_t *idom, const uint32_t *number, uint32_t a, uint32_t b)
+{
+    while (a != b)
+    {
+        while (number[a] < number[b])
+            a = (uint32_t)idom[a];
+        while (number[b] < number[a])
+            b = (uint32_t)idom[b];
+    }
+
+    return a;
+}
+
+
+/**
+ * @brief Checks whether block a dominates block b.
+ */
+int dominates(const LoopForest *forest, const uint32_t a, const uint32_t b)
+{
+    int32_t cur = (int32_t)b;
+
+    while (cur >= 0 && (uint32_t)cur != a)
+        cur = forest->idom[cur];
+
+    return cur >= 0;
+}
+
+
+int loop_contains(const LoopForest *forest, const int32_t loop, const uint32_t block)
+{
+    int32_t cur = forest->loop_of[block];
+
+    while (cur > loop)
+        cur = forest->loops[cur].parent;
+
+    return cur == loop;
+}
+
+
+/**
+ * @brief Computes the dominator tree with the iterative algorithm of
+ *        Cooper, Harvey and Kennedy over the reverse postorder.
+ * @param cfg Control flow graph
+ * @param idom Immediate dominator per block to set
+ * @param number Postorder number per block to set, POSTORDER_UNVISITED for unreachable blocks
+ * @return ERR_SUCCESS on success.
+ */
+Errc compute_dominators(const ControlFlowGraph *cfg, int32_t *idom, uint32_t *number)
+{
+    uint32_t *order = (uint32_t*)malloc((cfg->block_count + 1) * sizeof(uint32_t));
+    uint32_t *stack = (uint32_t*)malloc((cfg->block_count + 1) * sizeof(uint32_t));
+    unsigned char *edge = (unsigned char*)malloc(cfg->block_count + 1);
+    const FlowBlock *block;
+    uint32_t count = 0;
+    uint32_t top = 0;
+    uint32_t dominator;
+    uint32_t b;
+    uint32_t k;
+    uint32_t p;
+    int32_t successor;
+    int changed = 1;
+
+    if (!order || !stack || !edge)
+    {
+        free(order);
+        free(stack);
+        free(edge);
+        return ERR_ALLOC;
+    }
+
+    for (b = 0; b < cfg->block_count; ++b)
+    {
+        idom[b] = -1;
+        number[b] = POSTORDER_UNVISITED;
+    }
+
+    if (cfg->block_count)
+    {
+        number[0] = POSTORDER_VISITING;
+        stack[top] = 0;
+        edge[top++] = 0;
+    }
+
+    while (top)
+    {
+        b = stack[top - 1];
+        if (edge[top - 1] < 2)
+        {
+            successor = cfg->blocks[b].successors[edge[top - 1]++];
+            if (successor >= 0 && number[successor] == POSTORDER_UNVISITED)
+            {
+                number[successor] = POSTORDER_VISITING;
+                stack[top] = (uint32_t)successor;
+                edge[top++] = 0;
+            }
+            continue;
+        }
+
+        number[b] = count;
+        order[count++] = b;
+        --top;
+    }
+
+    /* The entry dominates itself while iterating */
+    if (cfg->block_count)
+        idom[0] = 0;
+
+    while (changed)
+    {
+        changed = 0;
+        for (k = count; k > 0; --k)
+        {
+            b = order[k - 1];
+            if (b == 0)
+                continue;
+
+            block = &cfg->blocks[b];
+            dominator = POSTORDER_UNVISITED;
+            for (p = 0; p < block->predecessor_count; ++p)
+            {
+                successor = (int32_t)cfg->predecessors[block->predecessor_offset + p];
+                if (idom[successor] < 0)
+                    continue;
+
+                dominator = dominator == POSTORDER_UNVISITED ? (uint32_t)successor
+                        : common_dominator(idom, number, dominator, (uint32_t)successor);
+            }
+
+            if (idom[b] != (int32_t)dominator)
+            {
+                idom[b] = (int32_t)dominator;
+                changed = 1;
+            }
+        }
+    }
+
+    if (cfg->block_count)
+        idom[0] = -1;
+
+    free(order);
+    free(stack);
+    free(edge);
+
+    return ERR_SUCCESS;
+}
+
+
+/**
+ * @brief Orders loops by descending size, enclosing loops first.
+ */
+int compare_loops(const void *a, const void *b)
+{
+    const NaturalLoop *left = (const NaturalLoop*)a;
+    const NaturalLoop *right = (const NaturalLoop*)b;
+
+    if (left->block_count != right->block_count)
+        return left->block_count > right->block_count ? -1 : 1;
+
+    return left->header < right->header ? -1 : left->header > right->header;
+}
+
+
+/**
+ * @brief Computes the dominators and the natural loops of the CFG.
+ */
+Errc compute_loops(const ControlFlowGraph *cfg, LoopForest *forest)
+{
+    const FlowBlock *block;
+    NaturalLoop *loop;
+    uint32_t *number;
+    uint32_t *mark;
+    uint32_t *stack;
+    uint32_t *grown;
+    uint32_t capacity = cfg->block_count + 1;
+    uint32_t used = 0;
+    uint32_t latches;
+    uint32_t top;
+    uint32_t h;
+    uint32_t b;
+    uint32_t p;
+    uint32_t pred;
+    uint32_t i;
+    Errc result;
+
+    memset(forest, 0, sizeof(LoopForest));
+    forest->idom = (int32_t*)malloc((cfg->block_count + 1) * sizeof(int32_t));
+    forest->loop_of = (int32_t*)malloc((cfg->block_count + 1) * sizeof(int32_t));
+    forest->loops = (NaturalLoop*)malloc((cfg->block_count + 1) * sizeof(NaturalLoop));
+    forest->blocks = (uint32_t*)malloc(capacity * sizeof(uint32_t));
+    number = (uint32_t*)malloc((cfg->block_count + 1) * sizeof(uint32_t));
+    mark = (uint32_t*)calloc(cfg->block_count + 1, sizeof(uint32_t));
+    stack = (uint32_t*)malloc((cfg->block_count + 1) * sizeof(uint32_t));
+    if (!forest->idom || !forest->loop_of || !forest->loops || !forest->blocks || !number || !mark || !stack)
+    {
+        free(number);
+        free(mark);
+        free(stack);
+        return ERR_ALLOC;
+    }
+
+    result = compute_dominators(cfg, forest->idom, number);
+
+    for (h = 0; h < cfg->block_count && result == ERR_SUCCESS; ++h)
+    {
+        block = &cfg->blocks[h];
+        if (number[h] == POSTORDER_UNVISITED)
+            continue;
+
+        /* Blocks reaching a back edge without passing the header, marked with the header + 1 */
+        top = 0;
+        latches = 0;
+        mark[h] = h + 1;
+        for (p = 0; p < block->predecessor_count; ++p)
+        {
+            pred = cfg->predecessors[block->predecessor_offset + p];
+            if (number[pred] == POSTORDER_UNVISITED || !dominates(forest, h, pred))
+                continue;
+
+            ++latches;
+            if (mark[pred] != mark[h])
+            {
+                mark[pred] = mark[h];
+                stack[top++] = pred;
+            }
+        }
+
+        if (!latches)
+            continue;
+
+        loop = &forest->loops[forest->loop_count++];
+        loop->header = h;
+        loop->parent = -1;
+        loop->block_offset = used;
+        loop->block_count = 0;
+
+        if (used + cfg->block_count > capacity)
+        {
+            capacity = 2 * capacity + cfg->block_count;
+            grown = (uint32_t*)realloc(forest->blocks, capacity * sizeof(uint32_t));
+            if (!grown)
+            {
+                result = ERR_ALLOC;
+                break;
+            }
+            forest->blocks = grown;
+        }
+
+        forest->blocks[used++] = h;
+        while (top)
+        {
+            b = stack[--top];
+            forest->blocks[used++] = b;
+            for (p = 0; p < cfg->blocks[b].predecessor_count; ++p)
+            {
+                pred = cfg->predecessors[cfg->blocks[b].predecessor_offset + p];
+                if (number[pred] != POSTORDER_UNVISITED && mark[pred] != mark[h])
+                {
+                    mark[pred] = mark[h];
+                    stack[top++] = pred;
+                }
+            }
+        }
+        loop->block_count = used - loop->block_offset;
+    }
+
+    free(number);
+    free(mark);
+    free(stack);
+    if (result != ERR_SUCCESS)
+        return result;
+
+    /* Natural loops with different headers are nested or disjoint */
+    qsort(forest->loops, forest->loop_count, sizeof(NaturalLoop), compare_loops);
+    for (b = 0; b < cfg->block_count; ++b)
+        forest->loop_of[b] = -1;
+
+    for (i = 0; i < forest->loop_count; ++i)
+    {
+        loop = &forest->loops[i];
+        loop->parent = forest->loop_of[loop->header];
+        for (b = 0; b < loop->block_count; ++b)
+            forest->loop_of[forest->blocks[loop->block_offset + b]] = (int32_t)i;
+    }
+
+    return ERR_SUCCESS;
+}
+
+
+/**
+ * @brief Computes the given analyses unless they are cached.
+ */
+Errc require_analyses(PassManager *manager, unsigned analyses)
+{
+    StatsClock clock;
+    Errc result = ERR_SUCCESS;
+
+    if (analyses & (ANALYSIS_STACK_DEPTH | ANALYSIS_LIVENESS | ANALYSIS_LOOPS))
+        analyses |= ANALYSIS_CFG;
+
+    analyses &= ~manager->valid;
+    if (!analyses)
+        return ERR_SUCCESS;
+
+    start_phase(manager->stats, &clock);
+
+    if (analyses & ANALYSIS_CFG)
+    {
+        result = build_cfg(manager->parser, &manager->cfg);
+        if (result == ERR_SUCCESS)
+            manager->valid |= ANALYSIS_CFG;
+    }
+
+    if (result == ERR_SUCCESS && (analyses & ANALYSIS_STACK_DEPTH))
+    {
+        result = compute_stack_depths(&manager->cfg, &manager->depths);
+        if (result == ERR_SUCCESS)
+            manager->valid |= ANALYSIS_STACK_DEPTH;
+    }
+
+    if (result == ERR_SUCCESS && (analyses & ANALYSIS_LIVENESS))
+    {
+        result = compute_liveness(manager);
+        if (result == ERR_SUCCESS)
+            manager->valid |= ANALYSIS_LIVENESS;
+    }
+
+    if (result == ERR_SUCCESS && (analyses & ANALYSIS_LOOPS))
+    {
+        result = compute_loops(&manager->cfg, &manager->loops);
+        if (result == ERR_SUCCESS)
+            manager->valid |= ANALYSIS_LOOPS;
+    }
+
+    end_phase(manager->stats, STATS_ANALYSES, &clock);
+
+    return result;
+}
+
+
+/**
+ * @brief Removes the marked commands of the CFG from the program together
+ *        with the labels pointing to them.
+ * @param manager Pass manager with the CFG the marks refer to
+ * @param removed Per command index, non-zero to remove the command
+ * @return Number of removed commands.
+ */
+uint32_t remove_commands(PassManager *manager, const unsigned char *removed)
+{
+    ParserState *parser = manager->parser;
+    const ControlFlowGraph *cfg = &manager->cfg;
+    Command *last = 0;
+    Label *previous = 0;
+    Label *label;
+    Label *next;
+    uint32_t count = 0;
+    uint32_t i;
+
+    for (i = 0; i < cfg->command_count; ++i)
+    {
+        cfg->commands[i]->vaddr = i;
+        if (removed[i])
+            continue;
+
+        if (last)
+            last->next = cfg->commands[i];
+        else
+            parser->command_first = cfg->commands[i];
+        last = cfg->commands[i];
+    }
+
+    if (last)
+        last->next = 0;
+    else
+        parser->command_first = 0;
+    parser->command_last = last;
+
+    for (label = parser->label_first; label; label = next)
+    {
+        next = label->next;
+        if (!removed[label->command->vaddr])
+        {
+            previous = label;
+            continue;
+        }
+
+        if (previous)
+            previous->next = next;
+        else
+            parser->label_first = next;
+        if (parser->label_last == label)
+            parser->label_last = previous;
+        free(label);
+    }
+
+    for (i = 0; i < cfg->command_count; ++i)
+    {
+        if (!removed[i])
+            continue;
+
+        if (cfg->commands[i]->type == SPASM_VEC)
+            free(cfg->commands[i]->argument.vector_arg);
+        else if (cfg->commands[i]->type == SPASM_RMW)
+            free(cfg->commands[i]->argument.update_arg);
+        free(cfg->commands[i]);
+        ++count;
+    }
+
+    return count;
+}
+
+
+/**
+ * @brief Pass retargeting jumps to unconditional jumps at their final
+ *        target and removing unlabeled JMPs to the next command.
+ */
+Errc thread_jumps(PassManager *manager, uint32_t *changes, char *summary)
+{
+    const ControlFlowGraph *cfg = &manager->cfg;
+    unsigned char *removed = (unsigned char*)calloc(cfg->command_count + 1, 1);
+    Command *command;
+    Label *target;
+    uint32_t threaded = 0;
+    uint32_t dropped = 0;
+    uint32_t hops;
+    uint32_t i;
+
+    if (!removed)
+        return ERR_ALLOC;
+
+    for (i = 0; i < cfg->command_count; ++i)
+    {
+        command = cfg->commands[i];
+        if (!is_jump(command))
+            continue;
+
+        /* Chains of jumps may form a cycle */
+        target = command->argument.label_arg;
+        for (hops = 0; target->command->type == SPASM_JMP
+                && target->command->argument.label_arg != target && hops < cfg->command_count; ++hops)
+            target = target->command->argument.label_arg;
+
+        if (target != command->argument.label_arg)
+        {
+            command->argument.label_arg = target;
+            ++threaded;
+        }
+
+        if (command->type == SPASM_JMP && !command->label && i + 1 < cfg->command_count
+                && target->command == cfg->commands[i + 1])
+        {
+            removed[i] = 1;
+            ++dropped;
+        }
+    }
+
+    if (dropped)
+        remove_commands(manager, removed);
+    free(removed);
+
+    *changes = threaded + dropped;
+    sprintf(summary, "(%u threaded, %u removed)", threaded, dropped);
+
+    return ERR_SUCCESS;
+}
+
+
+/**
+ * @brief Pass removing the blocks that can't be reached from the program entry.
+ */
+Errc remove_unreachable(PassManager *manager, uint32_t *changes, char *summary)
+{
+    const ControlFlowGraph *cfg = &manager->cfg;
+    unsigned char *removed = (unsigned char*)calloc(cfg->command_count + 1, 1);
+    uint32_t i;
+
+    if (!removed)
+        return ERR_ALLOC;
+
+    for (i = 0; i < cfg->command_count; ++i)
+        removed[i] = !cfg->blocks[cfg->block_of[i]].reachable;
+
+    *changes = remove_commands(manager, removed);
+    free(removed);
+
+    sprintf(summary, "(%u commands)", *changes);
+
+    return ERR_SUCCESS;
+}
+
+
+/**
+ * @brief Checks whether a command can be dropped without changing the
+ *        behavior of the program, apart from its effect on the stack.
+ *        Division may trap, as may loads from computed addresses.
+ */
+int is_pure(const ControlFlowGraph *cfg, const uint32_t index)
+{
+    switch (cfg->commands[index]->type)
+    {
+    case SPASM_ADD:
+    case SPASM_MUL:
+    case SPASM_SUB:
+    case SPASM_LES:
+    case SPASM_AND:
+    case SPASM_EQU:
+    case SPASM_NOT:
+    case SPASM_LA:
+    case SPASM_LC:
+    case SPASM_NOP:
+        return 1;
+    case SPASM_LV:
+        return index > cfg->blocks[cfg->block_of[index]].first && cfg->commands[index - 1]->type == SPASM_LA;
+    default:
+        return 0;
+    }
+}
+
+
+/**
+ * @brief Finds the first command of the statement ending in a STR, i.e.
+ *        the command pushing the stored value onto the stack the STR leaves.
+ * @return Index of the first command, -1 if the statement isn't pure and
+ *         unlabeled within the block.
+ */
+int32_t statement_start(const PassManager *manager, const uint32_t store)
+{
+    const ControlFlowGraph *cfg = &manager->cfg;
+    const int32_t base = manager->depths.entry[store] - 2;
+    const uint32_t first = cfg->blocks[cfg->block_of[store]].first;
+    uint32_t i;
+
+    if (cfg->commands[store]->label)
+        return -1;
+
+    for (i = store; i > first; --i)
+    {
+        if (cfg->commands[i - 1]->label || !is_pure(cfg, i - 1) || manager->depths.entry[i - 1] < base)
+            return -1;
+
+        if (manager->depths.entry[i - 1] == base)
+            return (int32_t)i - 1;
+    }
+
+    return -1;
+}
+
+
+/**
+ * @brief Pass removing statements storing to variables that are dead behind the store.
+ */
+Errc remove_dead_stores(PassManager *manager, uint32_t *changes, char *summary)
+{
+    const ControlFlowGraph *cfg = &manager->cfg;
+    const Liveness *liveness = &manager->liveness;
+    const FlowBlock *block;
+    const Command *command;
+    unsigned char *removed;
+    uint32_t *live;
+    uint32_t statements = 0;
+    uint32_t b;
+    uint32_t i;
+    int32_t variable;
+    int32_t start;
+
+    *changes = 0;
+
+    /* Statement boundaries are only known if every path agrees on the depths */
+    if (!manager->depths.consistent)
+    {
+        sprintf(summary, "(skipped, inconsistent stack depths)");
+        return ERR_SUCCESS;
+    }
+
+    removed = (unsigned char*)calloc(cfg->command_count + 1, 1);
+    live = (uint32_t*)malloc(liveness->words * sizeof(uint32_t));
+    if (!removed || !live)
+    {
+        free(removed);
+        free(live);
+        return ERR_ALLOC;
+    }
+
+    for (b = 0; b < cfg->block_count; ++b)
+    {
+        block = &cfg->blocks[b];
+        if (!block->reachable)
+            continue;
+
+        memcpy(live, &liveness->live_out[b * liveness->words], liveness->words * sizeof(uint32_t));
+        for (i = block->last + 1; i > block->first; )
+        {
+            command = cfg->commands[--i];
+            variable = -1;
+            if (command->type == SPASM_STR && i > block->first && cfg->commands[i - 1]->type == SPASM_LA)
+                variable = tracked_variable(liveness, cfg->commands[i - 1]->argument.memory_arg);
+
+            start = variable >= 0 && !(live[variable / 32] & ((uint32_t)1 << (variable % 32)))
+                    ? statement_start(manager, i) : -1;
+            if (start < 0)
+            {
+                command_liveness(manager, i, live);
+                continue;
+            }
+
+            /* The removed commands don't read anything anymore */
+            for (; i > (uint32_t)start; --i)
+                removed[i] = 1;
+            removed[start] = 1;
+            ++statements;
+        }
+    }
+
+    if (statements)
+        *changes = remove_commands(manager, removed);
+
+    free(removed);
+    free(live);
+
+    sprintf(summary, "(%u)", statements);
+
+    return ERR_SUCCESS;
+}
+
+
+/**
+ * @brief Loop invariant value on the stack and the commands computing it.
+ */
+typedef struct InvariantValue InvariantValue;
+struct InvariantValue
+{
+    uint32_t start; /* index of the first command computing the value */
+    uint32_t end; /* index of the command pushing the value */
+    int invariant; /* computed from constants, addresses and variables the loop doesn't store */
+};
+
+/**
+ * @brief Range of loop invariant commands hoisted into the preheader of a loop.
+ */
+typedef struct Hoist Hoist;
+struct Hoist
+{
+    uint32_t loop; /* loop whose preheader computes the value */
+    uint32_t start; /* index of the first command of the range */
+    uint32_t length;
+    int32_t same; /* earlier hoist of the same commands to the same loop, -1 if none */
+    MemoryLocation *temporary; /* variable holding the value */
+};
+
+/**
+ * @brief Memory the commands of every loop may store to.
+ */
+typedef struct LoopStores LoopStores;
+struct LoopStores
+{
+    uint32_t words; /* uint32_t words per set of tracked variables */
+    uint32_t *variables; /* per loop set of stored tracked variables */
+    unsigned char *untracked; /* per loop, stores to locations that aren't tracked */
+    unsigned char *computed; /* per loop, stores to computed addresses or vectorized loops */
+};
+
+
+/**
+ * @brief Collects the variables the loops store to. Stores of nested loops
+ *        are stores of the enclosing loops as well.
+ */
+Errc collect_loop_stores(const PassManager *manager, LoopStores *stores)
+{
+    const ControlFlowGraph *cfg = &manager->cfg;
+    const LoopForest *forest = &manager->loops;
+    const Command *command;
+    const FlowBlock *block;
+    int32_t variable;
+    int32_t loop;
+    uint32_t b;
+    uint32_t i;
+    uint32_t w;
+
+    stores->words = manager->liveness.words;
+    stores->variables = (uint32_t*)calloc((size_t)forest->loop_count * stores->words + 1, sizeof(uint32_t));
+    stores->untracked = (unsigned char*)calloc(forest->loop_count + 1, 1);
+    stores->computed = (unsigned char*)calloc(forest->loop_count + 1, 1);
+    if (!stores->variables || !stores->untracked || !stores->computed)
+        return ERR_ALLOC;
+
+    for (b = 0; b < cfg->block_count; ++b)
+    {
+        loop = forest->loop_of[b];
+        if (loop < 0)
+            continue;
+
+        block = &cfg->blocks[b];
+        for (i = block->first; i <= block->last; ++i)
+        {
+            command = cfg->commands[i];
+            variable = -1;
+            if (command->type == SPASM_STR && i > block->first && cfg->commands[i - 1]->type == SPASM_LA)
+                variable = tracked_variable(&manager->liveness, cfg->commands[i - 1]->argument.memory_arg);
+            else if (command->type == SPASM_RMW)
+                variable = tracked_variable(&manager->liveness, command->argument.update_arg->memory);
+
+            if (variable >= 0)
+                stores->variables[loop * stores->words + variable / 32] |= (uint32_t)1 << (variable % 32);
+            else if (command->type == SPASM_RMW || command->type == SPASM_CNT
+                    || (command->type == SPASM_STR && i > block->first && cfg->commands[i - 1]->type == SPASM_LA))
+                stores->untracked[loop] = 1;
+            else if (command->type == SPASM_STR || command->type == SPASM_VEC
+                    || command->type == SPASM_CPY || command->type == SPASM_FIL)
+                stores->computed[loop] = 1;
+        }
+    }
+
+    /* Inner loops come behind the loops enclosing them */
+    for (b = forest->loop_count; b > 0; --b)
+    {
+        loop = forest->loops[b - 1].parent;
+        if (loop < 0)
+            continue;
+
+        for (w = 0; w < stores->words; ++w)
+            stores->variables[loop * stores->words + w] |= stores->variables[(b - 1) * stores->words + w];
+        stores->untracked[loop] |= stores->untracked[b - 1];
+        stores->computed[loop] |= stores->computed[b - 1];
+    }
+
+    return ERR_SUCCESS;
+}
+
+
+void cleanup_loop_stores(LoopStores *stores)
+{
+    free(stores->variables);
+    free(stores->untracked);
+    free(stores->computed);
+}
+
+
+/**
+ * @brief Checks whether the LV following an LA reads a location the loop doesn't store to.
+ */
+int invariant_load(const PassManager *manager, const LoopStores *stores, const uint32_t loop, const Command *address)
+{
+    const int32_t variable = tracked_variable(&manager->liveness, address->argument.memory_arg);
+
+    if (stores->computed[loop])
+        return 0;
+
+    if (variable < 0)
+        return !stores->untracked[loop];
+
+    return !(stores->variables[loop * stores->words + variable / 32] & ((uint32_t)1 << (variable % 32)));
+}
+
+
+/**
+ * @brief Checks whether a loop gets a preheader. The preheader is placed in
+ *        front of the header, which mustn't be entered by falling through
+ *        from within the loop.
+ */
+int has_preheader(const PassManager *manager, const uint32_t loop)
+{
+    const ControlFlowGraph *cfg = &manager->cfg;
+    const uint32_t first = cfg->blocks[manager->loops.loops[loop].header].first;
+
+    return first == 0 || !continues(cfg->commands[first - 1])
+            || !loop_contains(&manager->loops, (int32_t)loop, cfg->block_of[first - 1]);
+}
+
+
+/**
+ * @brief Checks whether two hoistable commands compute the same value.
+ */
+int same_command(const Command *a, const Command *b)
+{
+    if (a->type != b->type)
+        return 0;
+
+    if (a->type == SPASM_LC)
+        return a->argument.constant_arg == b->argument.constant_arg;
+    if (a->type == SPASM_LA)
+        return a->argument.memory_arg == b->argument.memory_arg;
+
+    return 1;
+}
+
+
+/**
+ * @brief Records the range computing an invariant value for hoisting into
+ *        the outermost loop with a preheader the range is invariant in.
+ */
+void add_hoist(const PassManager *manager, const LoopStores *stores, const InvariantValue *value,
+        const uint32_t block, Hoist *hoists, uint32_t *hoist_count)
+{
+    const ControlFlowGraph *cfg = &manager->cfg;
+    const LoopForest *forest = &manager->loops;
+    Hoist *hoist = &hoists[*hoist_count];
+    int32_t loop = forest->loop_of[block];
+    int32_t target = -1;
+    uint32_t i;
+    uint32_t j;
+
+    /* A single load is as expensive as loading the hoisted value */
+    if (!value->invariant || value->end - value->start < 2)
+        return;
+
+    for (; loop >= 0; loop = forest->loops[loop].parent)
+    {
+        for (i = value->start + 1; i <= value->end; ++i)
+        {
+            if (cfg->commands[i]->type == SPASM_LV
+                    && !invariant_load(manager, stores, (uint32_t)loop, cfg->commands[i - 1]))
+                break;
+        }
+
+        if (i <= value->end)
+            break;
+        if (has_preheader(manager, (uint32_t)loop))
+            target = loop;
+    }
+
+    if (target < 0)
+        return;
+
+    hoist->loop = (uint32_t)target;
+    hoist->start = value->start;
+    hoist->length = value->end - value->start + 1;
+    hoist->same = -1;
+    hoist->temporary = 0;
+
+    /* Equal ranges in the same loop share the variable */
+    for (i = 0; i < *hoist_count && hoist->same < 0; ++i)
+    {
+        if (hoists[i].same >= 0 || hoists[i].loop != hoist->loop || hoists[i].length != hoist->length)
+            continue;
+
+        for (j = 0; j < hoist->length; ++j)
+        {
+            if (!same_command(cfg->commands[hoists[i].start + j], cfg->commands[hoist->start + j]))
+                break;
+        }
+
+        if (j == hoist->length)
+            hoist->same = (int32_t)i;
+    }
+
+    ++*hoist_count;
+}
+
+
+/**
+ * @brief Finds the ranges of loop invariant commands of a block.
+ */
+void find_invariants(const PassManager *manager, const LoopStores *stores, const uint32_t b,
+        InvariantValue *stack, Hoist *hoists, uint32_t *hoist_count)
+{
+    const ControlFlowGraph *cfg = &manager->cfg;
+    const FlowBlock *block = &cfg->blocks[b];
+    const uint32_t loop = (uint32_t)manager->loops.loop_of[b];
+    const Command *command;
+    InvariantValue left;
+    InvariantValue right;
+    uint32_t depth = (uint32_t)manager->depths.entry[block->first];
+    uint32_t barrier = block->first; /* first command that may start an invariant range */
+    uint32_t i;
+    int32_t pops;
+
+    /* Values from other blocks aren't known */
+    for (i = 0; i < depth; ++i)
+        stack[i].invariant = 0;
+
+    for (i = block->first; i <= block->last; ++i)
+    {
+        command = cfg->commands[i];
+        switch (command->type)
+        {
+        case SPASM_LC:
+        case SPASM_LA:
+            stack[depth].start = i;
+            stack[depth].end = i;
+            stack[depth++].invariant = 1;
+            break;
+        case SPASM_LV:
+            /* Loads from computed addresses may fault if hoisted */
+            right = stack[depth - 1];
+            stack[depth - 1].end = i;
+            stack[depth - 1].invariant = right.invariant && right.start == i - 1
+                    && cfg->commands[i - 1]->type == SPASM_LA
+                    && invariant_load(manager, stores, loop, cfg->commands[i - 1]);
+            if (!stack[depth - 1].invariant)
+                add_hoist(manager, stores, &right, b, hoists, hoist_count);
+            break;
+        case SPASM_ADD:
+        case SPASM_MUL:
+        case SPASM_SUB:
+        case SPASM_LES:
+        case SPASM_AND:
+        case SPASM_EQU:
+            right = stack[--depth];
+            left = stack[depth - 1];
+            stack[depth - 1].end = i;
+            stack[depth - 1].invariant = left.invariant && right.invariant && left.start >= barrier;
+            if (!stack[depth - 1].invariant)
+            {
+                add_hoist(manager, stores, &left, b, hoists, hoist_count);
+                add_hoist(manager, stores, &right, b, hoists, hoist_count);
+            }
+            break;
+        case SPASM_NOT:
+            right = stack[depth - 1];
+            stack[depth - 1].end = i;
+            stack[depth - 1].invariant = right.invariant && right.start >= barrier;
+            if (!stack[depth - 1].invariant)
+                add_hoist(manager, stores, &right, b, hoists, hoist_count);
+            break;
+        default:
+            /* Divisions may trap if hoisted, everything else has side effects */
+            for (pops = SPASM_STACK_POPS[command->type]; pops > 0; --pops)
+                add_hoist(manager, stores, &stack[--depth], b, hoists, hoist_count);
+            if (SPASM_STACK_PUSHES[command->type])
+                stack[depth++].invariant = 0;
+            barrier = i + 1;
+            break;
+        }
+    }
+
+    /* Values used by the following blocks */
+    while (depth)
+        add_hoist(manager, stores, &stack[--depth], b, hoists, hoist_count);
+}
+
+
+/**
+ * @brief Creates a new command for a preheader.
+ * @return The command, 0 on allocation failure.
+ */
+Command* new_preheader_command(const CommandType type, const union CommandArgument *argument, const uint32_t line)
+{
+    Command *command = (Command*)calloc(1, sizeof(Command));
+
+    if (!command)
+        return 0;
+
+    command->type = type;
+    if (argument)
+        command->argument = *argument;
+    command->source_line = line;
+
+    return command;
+}
+
+
+/**
+ * @brief Appends the commands computing a hoisted value and storing it to
+ *        its variable to the preheader of the loop.
+ * @return ERR_SUCCESS on success.
+ */
+Errc append_hoist(const ControlFlowGraph *cfg, const Hoist *hoist, Command **first, Command **last)
+{
+    union CommandArgument address;
+    Command *command;
+    uint32_t i;
+
+    address.memory_arg = hoist->temporary;
+    for (i = 0; i < hoist->length + 2; ++i)
+    {
+        if (i < hoist->length)
+            command = new_preheader_command(cfg->commands[hoist->start + i]->type,
+                    &cfg->commands[hoist->start + i]->argument, cfg->commands[hoist->start + i]->source_line);
+        else
+            command = new_preheader_command(i == hoist->length ? SPASM_LA : SPASM_STR,
+                    i == hoist->length ? &address : 0, cfg->commands[hoist->start]->source_line);
+
+        if (!command)
+            return ERR_ALLOC;
+
+        if (*last)
+            (*last)->next = command;
+        else
+            *first = command;
+        *last = command;
+    }
+
+    return ERR_SUCCESS;
+}
+
+
+void free_preheaders(Command **first, const uint32_t count)
+{
+    Command *command;
+    Command *next;
+    uint32_t i;
+
+    for (i = 0; i < count; ++i)
+    {
+        for (command = first[i]; command; command = next)
+        {
+            next = command->next;
+            free(command);
+        }
+    }
+}
+
+
+/**
+ * @brief Pass hoisting loop invariant computations into a preheader in
+ *        front of the loop header that stores them to a new variable.
+ */
+Errc hoist_invariants(PassManager *manager, uint32_t *changes, char *summary)
+{
+    const ControlFlowGraph *cfg = &manager->cfg;
+    const LoopForest *forest = &manager->loops;
+    ParserState *parser = manager->parser;
+    LoopStores stores;
+    InvariantValue *stack = 0;
+    Hoist *hoists = 0;
+    Command **first = 0;
+    Command **last = 0;
+    Command *previous;
+    Command *command;
+    Label *label;
+    unsigned char *removed = 0;
+    char name[MAX_SYMBOL_NAME_LENGTH];
+    uint32_t hoist_count = 0;
+    uint32_t removed_count = 0;
+    uint32_t variables = 0;
+    uint32_t loops = 0;
+    uint32_t header;
+    uint32_t b;
+    uint32_t i;
+    Errc result;
+
+    *changes = 0;
+    memset(&stores, 0, sizeof(LoopStores));
+
+    /* Stack positions are only known if every path agrees on the depths */
+    if (!manager->depths.consistent)
+    {
+        sprintf(summary, "(skipped, inconsistent stack depths)");
+        return ERR_SUCCESS;
+    }
+
+    result = collect_loop_stores(manager, &stores);
+    stack = (InvariantValue*)malloc(((uint32_t)manager->depths.max_depth + 1) * sizeof(InvariantValue));
+    hoists = (Hoist*)malloc((cfg->command_count + 1) * sizeof(Hoist));
+    first = (Command**)calloc(forest->loop_count + 1, sizeof(Command*));
+    last = (Command**)calloc(forest->loop_count + 1, sizeof(Command*));
+    removed = (unsigned char*)calloc(cfg->command_count + 1, 1);
+    if (result != ERR_SUCCESS || !stack || !hoists || !first || !last || !removed)
+    {
+        result = ERR_ALLOC;
+        goto done;
+    }
+
+    for (b = 0; b < cfg->block_count; ++b)
+    {
+        if (cfg->blocks[b].reachable && forest->loop_of[b] >= 0)
+            find_invariants(manager, &stores, b, stack, hoists, &hoist_count);
+    }
+
+    /* Preheaders compute every value once, from the commands before they are replaced */
+    for (i = 0; i < hoist_count && result == ERR_SUCCESS; ++i)
+    {
+        if (hoists[i].same >= 0)
+        {
+            hoists[i].temporary = hoists[hoists[i].same].temporary;
+            continue;
+        }
+
+        /* Parsed variables are alphanumeric, so the name can't clash */
+        sprintf(name, "_h%u", variables++);
+        hoists[i].temporary = insert_bss_variable(parser, name, strlen(name), sizeof(uint32_t),
+                cfg->commands[hoists[i].start]->source_line);
+        result = hoists[i].temporary ? append_hoist(cfg, &hoists[i], &first[hoists[i].loop], &last[hoists[i].loop])
+                : ERR_ALLOC;
+    }
+
+    if (result != ERR_SUCCESS)
+        goto done;
+
+    for (i = 0; i < hoist_count; ++i)
+    {
+        command = cfg->commands[hoists[i].start];
+        command->type = SPASM_LA;
+        command->argument.memory_arg = hoists[i].temporary;
+        cfg->commands[hoists[i].start + 1]->type = SPASM_LV;
+        memset(removed + hoists[i].start + 2, 1, hoists[i].length - 2);
+    }
+
+    if (hoist_count)
+        removed_count = remove_commands(manager, removed);
+
+    /* Jumps from outside the loop enter through the preheader */
+    for (b = 0; b < forest->loop_count; ++b)
+    {
+        if (!first[b])
+            continue;
+
+        header = forest->loops[b].header;
+        label = 0;
+        for (i = 0; i < cfg->command_count; ++i)
+        {
+            command = cfg->commands[i];
+            if (removed[i] || !is_jump(command)
+                    || command->argument.label_arg->command != cfg->commands[cfg->blocks[header].first]
+                    || loop_contains(forest, (int32_t)b, cfg->block_of[i]))
+                continue;
+
+            if (!label)
+            {
+                sprintf(name, "_p%u", loops);
+                label = get_or_insert_label(parser, name, strlen(name));
+                if (!label)
+                {
+                    result = ERR_ALLOC;
+                    goto done;
+                }
+                label->command = first[b];
+                first[b]->label = label;
+            }
+
+            command->argument.label_arg = label;
+        }
+        ++loops;
+    }
+
+    /* Preheaders go in front of the first command of the header */
+    for (previous = 0, command = parser->command_first; command; previous = command, command = command->next)
+    {
+        b = command->vaddr;
+        if (command->vaddr >= cfg->command_count || cfg->commands[b] != command)
+            continue;
+
+        for (i = 0; i < forest->loop_count; ++i)
+        {
+            if (!first[i] || cfg->blocks[forest->loops[i].header].first != b)
+                continue;
+
+            last[i]->next = command;
+            if (previous)
+                previous->next = first[i];
+            else
+                parser->command_first = first[i];
+            first[i] = 0;
+        }
+    }
+
+done:
+    if (first)
+        free_preheaders(first, forest->loop_count);
+    cleanup_loop_stores(&stores);
+    free(stack);
+    free(hoists);
+    free(first);
+    free(last);
+    free(removed);
+
+    if (result == ERR_SUCCESS)
+    {
+        *changes = hoist_count + removed_count;
+        sprintf(summary, "(%u values in %u loops, %u commands removed)", hoist_count, loops, removed_count);
+    }
+
+    return result;
+}
+
+
+/**
+ * @brief Replacement of a command found by the value numbering.
+ */
+typedef enum ValueAction
+{
+    VALUE_KEEP,
+    VALUE_REMOVE,
+    VALUE_DUP, /* becomes a DUP of an equal value on the stack */
+    VALUE_CONSTANT, /* becomes an LC of the known constant */
+    VALUE_FORWARD /* removed, the value stored right before is kept on the stack by a DUP 0 in front of the store */
+} ValueAction;
+
+/* Values of the variable table of values that aren't addresses of variables */
+#define VALUE_UNTRACKED -1 /* address of a location that isn't tracked */
+#define VALUE_COMPUTED -2 /* no address of a location */
+
+typedef struct ValueKey ValueKey;
+typedef struct StackValue StackValue;
+typedef struct ValueState ValueState;
+typedef struct ValueNumbering ValueNumbering;
+
+/**
+ * @brief Hash table entry mapping an operation on values to its value.
+ */
+struct ValueKey
+{
+    CommandType type; /* LC, LA, LV from a computed address or an operation */
+    uint32_t left; /* constant of LC, (left) operand value otherwise */
+    uint32_t right; /* right operand value, memory generation of LV */
+    const MemoryLocation *memory; /* location of LA */
+    uint32_t value; /* 0 for an empty entry */
+};
+
+/**
+ * @brief Value on the stack together with the commands computing it.
+ */
+struct StackValue
+{
+    uint32_t value;
+    uint32_t start; /* index of the first command computing the value */
+    int replaceable; /* the commands from start on lie within the block and have no side effects */
+};
+
+/**
+ * @brief Known values on a path through an extended basic block.
+ */
+struct ValueState
+{
+    uint32_t block; /* block to number with this state */
+    uint32_t depth;
+    uint32_t generation; /* value of the memory, changes with every store */
+    StackValue *stack;
+    uint32_t *variables; /* value per tracked variable, 0 if unknown */
+    ValueState *next; /* next pending state */
+};
+
+/**
+ * @brief Value numbering of a program, shared by all paths.
+ */
+struct ValueNumbering
+{
+    const PassManager *manager;
+    ValueKey *keys;
+    uint32_t key_mask; /* key count - 1, the count is a power of two */
+    uint32_t value_count; /* values handed out, value 0 is none */
+    uint32_t *constant; /* per value, the constant of LC values */
+    unsigned char *is_constant; /* per value */
+    int32_t *variable; /* per value, tracked variable of LA values or VALUE_UNTRACKED / VALUE_COMPUTED */
+    unsigned char *action; /* per command, ValueAction */
+    uint32_t *argument; /* per command, distance of VALUE_DUP or constant of VALUE_CONSTANT */
+    ValueState *pending;
+};
+
+
+/**
+ * @brief Hands out a value nothing is known about.
+ */
+uint32_t new_value(ValueNumbering *numbering)
+{
+    const uint32_t value = ++numbering->value_count;
+
+    numbering->is_constant[value] = 0;
+    numbering->variable[value] = VALUE_COMPUTED;
+    return value;
+}
+
+
+/**
+ * @brief Looks up the value of an operation, a new value is handed out
+ *        for operations not seen before.
+ */
+uint32_t lookup_value(ValueNumbering *numbering, const CommandType type,
+        const uint32_t left, const uint32_t right, const MemoryLocation *memory)
+{
+    uint32_t hash = ((uint32_t)type * 31u + left) * 2654435761u ^ right * 40503u;
+    const char *name;
+    ValueKey *key;
+
+    for (name = memory ? memory->name : ""; *name; ++name)
+        hash = hash * 31u + (unsigned char)*name;
+
+    for (key = &numbering->keys[hash & numbering->key_mask]; key->value;
+            key = &numbering->keys[++hash & numbering->key_mask])
+    {
+        if (key->type == type && key->left == left && key->right == right && key->memory == memory)
+            return key->value;
+    }
+
+    key->type = type;
+    key->left = left;
+    key->right = right;
+    key->memory = memory;
+    key->value = new_value(numbering);
+
+    if (type == SPASM_LC)
+    {
+        numbering->is_constant[key->value] = 1;
+        numbering->constant[key->value] = left;
+    }
+    else if (type == SPASM_LA)
+    {
+        numbering->variable[key->value] = tracked_variable(&numbering->manager->liveness, memory);
+        if (numbering->variable[key->value] < 0)
+            numbering->variable[key->value] = VALUE_UNTRACKED;
+    }
+
+    return key->value;
+}
+
+
+/**
+ * @brief Allocates a state for the paths starting at a block.
+ * @param numbering Numbering the state belongs to
+ * @param copy State to copy, 0 for a state without known values
+ * @param block Block to number with the state
+ * @return The state, 0 on allocation failure.
+ */
+ValueState* new_value_state(ValueNumbering *numbering, const ValueState *copy, const uint32_t block)
+{
+    const PassManager *manager = numbering->manager;
+    const uint32_t slots = (uint32_t)manager->depths.max_depth + 1;
+    const uint32_t variables = manager->liveness.variable_count + 1;
+    ValueState *state = (ValueState*)malloc(sizeof(ValueState));
+    uint32_t i;
+
+    if (!state)
+        return 0;
+
+    state->stack = (StackValue*)malloc(slots * sizeof(StackValue));
+    state->variables = (uint32_t*)calloc(variables, sizeof(uint32_t));
+    if (!state->stack || !state->variables)
+    {
+        free(state->stack);
+        free(state->variables);
+        free(state);
+        return 0;
+    }
+
+    state->block = block;
+    state->next = 0;
+    if (copy)
+    {
+        state->depth = copy->depth;
+        state->generation = copy->generation;
+        memcpy(state->stack, copy->stack, slots * sizeof(StackValue));
+        memcpy(state->variables, copy->variables, variables * sizeof(uint32_t));
+        return state;
+    }
+
+    /* Values on the stack at the block entry come from different paths */
+    state->depth = (uint32_t)manager->depths.entry[manager->cfg.blocks[block].first];
+    state->generation = new_value(numbering);
+    for (i = 0; i < state->depth; ++i)
+    {
+        state->stack[i].value = new_value(numbering);
+        state->stack[i].start = 0;
+        state->stack[i].replaceable = 0;
+    }
+
+    return state;
+}
+
+
+void free_value_state(ValueState *state)
+{
+    free(state->stack);
+    free(state->variables);
+    free(state);
+}
+
+
+/**
+ * @brief Replaces a range of commands computing a value that is known
+ *        already by the cheapest command pushing that value.
+ */
+void replace_value(ValueNumbering *numbering, const ValueState *state,
+        const uint32_t value, const uint32_t start, const uint32_t index)
+{
+    const ControlFlowGraph *cfg = &numbering->manager->cfg;
+    const Command *address = start >= 2 ? cfg->commands[start - 2] : 0;
+    ValueAction action = VALUE_KEEP;
+    uint32_t argument = 0;
+    int32_t variable = -1;
+    int32_t position;
+    uint32_t i;
+
+    for (position = (int32_t)state->depth - 1; position >= 0 && state->stack[position].value != value; --position)
+        ;
+
+    if (address && address->type == SPASM_LA && !address->label
+            && cfg->commands[start - 1]->type == SPASM_STR && !cfg->commands[start - 1]->label)
+        variable = tracked_variable(&numbering->manager->liveness, address->argument.memory_arg);
+
+    if (numbering->is_constant[value])
+    {
+        action = VALUE_CONSTANT;
+        argument = numbering->constant[value];
+    }
+    else if (position >= 0)
+    {
+        action = VALUE_DUP;
+        argument = state->depth - 1 - (uint32_t)position;
+    }
+    else if (variable >= 0 && state->variables[variable] == value)
+    {
+        action = VALUE_FORWARD;
+    }
+    else
+    {
+        return;
+    }
+
+    /* Replacements within the range are superseded */
+    for (i = start; i <= index; ++i)
+        numbering->action[i] = VALUE_REMOVE;
+
+    if (action == VALUE_FORWARD)
+    {
+        numbering->action[start] = VALUE_FORWARD;
+        return;
+    }
+
+    numbering->action[index] = (unsigned char)action;
+    numbering->argument[index] = argument;
+}
+
+
+/**
+ * @brief Pushes the value computed by the commands from start to index.
+ */
+void push_value(ValueNumbering *numbering, ValueState *state, const uint32_t value,
+        const uint32_t start, const int replaceable, const uint32_t index)
+{
+    StackValue *top;
+
+    /* Single commands are as cheap as their replacement */
+    if (replaceable && start < index && !numbering->manager->cfg.commands[start]->label)
+        replace_value(numbering, state, value, start, index);
+
+    top = &state->stack[state->depth++];
+    top->value = value;
+    top->start = start;
+    top->replaceable = replaceable;
+}
+
+
+/**
+ * @brief Numbers the values of a block and queues the blocks only
+ *        reached through it with the values known at its end.
+ * @return ERR_SUCCESS on success.
+ */
+Errc number_block(ValueNumbering *numbering, ValueState *state)
+{
+    const ControlFlowGraph *cfg = &numbering->manager->cfg;
+    const Liveness *liveness = &numbering->manager->liveness;
+    const FlowBlock *block = &cfg->blocks[state->block];
+    const Command *command;
+    ValueState *successor;
+    StackValue left;
+    StackValue right;
+    uint32_t barrier = block->first; /* first command that may start a replaced range */
+    uint32_t value;
+    uint32_t i;
+    int32_t variable;
+    int queued = 0;
+    int j;
+
+    for (i = block->first; i <= block->last; ++i)
+    {
+        command = cfg->commands[i];
+        switch (command->type)
+        {
+        case SPASM_LC:
+            value = lookup_value(numbering, SPASM_LC, command->argument.constant_arg, 0, 0);
+            push_value(numbering, state, value, i, 1, i);
+            break;
+        case SPASM_LA:
+            value = lookup_value(numbering, SPASM_LA, 0, 0, command->argument.memory_arg);
+            push_value(numbering, state, value, i, 1, i);
+            break;
+        case SPASM_DUP:
+            value = state->stack[state->depth - 1 - command->argument.constant_arg].value;
+            push_value(numbering, state, value, i, 1, i);
+            break;
+        case SPASM_LV:
+            right = state->stack[--state->depth];
+            variable = numbering->variable[right.value];
+            if (variable >= 0)
+            {
+                if (!state->variables[variable])
+                    state->variables[variable] = new_value(numbering);
+                value = state->variables[variable];
+            }
+            else
+            {
+                /* Loads from computed addresses are equal until the next store */
+                value = lookup_value(numbering, SPASM_LV, right.value, state->generation, 0);
+            }
+            push_value(numbering, state, value, right.start, right.replaceable && right.start >= barrier, i);
+            break;
+        case SPASM_ADD:
+        case SPASM_MUL:
+        case SPASM_AND:
+        case SPASM_EQU:
+        case SPASM_SUB:
+        case SPASM_DIV:
+        case SPASM_LES:
+            right = state->stack[--state->depth];
+            left = state->stack[--state->depth];
+            if (command->type != SPASM_SUB && command->type != SPASM_DIV && command->type != SPASM_LES
+                    && left.value > right.value)
+                value = lookup_value(numbering, command->type, right.value, left.value, 0);
+            else
+                value = lookup_value(numbering, command->type, left.value, right.value, 0);
+            push_value(numbering, state, value, left.start,
+                    left.replaceable && right.replaceable && left.start >= barrier, i);
+            break;
+        case SPASM_NOT:
+            right = state->stack[--state->depth];
+            value = lookup_value(numbering, SPASM_NOT, right.value, 0, 0);
+            push_value(numbering, state, value, right.start, right.replaceable && right.start >= barrier, i);
+            break;
+        case SPASM_STR:
+            right = state->stack[--state->depth];
+            left = state->stack[--state->depth];
+            variable = numbering->variable[right.value];
+            if (variable >= 0)
+                state->variables[variable] = left.value;
+            else if (variable == VALUE_COMPUTED)
+                memset(state->variables, 0, liveness->variable_count * sizeof(uint32_t));
+            state->generation = new_value(numbering);
+            barrier = i + 1;
+            break;
+        case SPASM_RMW:
+            variable = tracked_variable(liveness, command->argument.update_arg->memory);
+            if (variable >= 0)
+                state->variables[variable] = new_value(numbering);
+            state->generation = new_value(numbering);
+            barrier = i + 1;
+            break;
+        case SPASM_CPY:
+        case SPASM_FIL:
+            /* Block commands may store to any variable */
+            state->depth -= (uint32_t)SPASM_STACK_POPS[command->type];
+            memset(state->variables, 0, liveness->variable_count * sizeof(uint32_t));
+            state->generation = new_value(numbering);
+            barrier = i + 1;
+            break;
+        case SPASM_VEC:
+            memset(state->variables, 0, liveness->variable_count * sizeof(uint32_t));
+            state->generation = new_value(numbering);
+            barrier = i + 1;
+            break;
+        default:
+            /* Side effects, REA pushes a value nothing is known about */
+            state->depth -= (uint32_t)SPASM_STACK_POPS[command->type];
+            if (SPASM_STACK_PUSHES[command->type])
+                push_value(numbering, state, new_value(numbering), i, 0, i);
+            barrier = i + 1;
+            break;
+        }
+    }
+
+    for (j = 1; j >= 0; --j)
+    {
+        if (block->successors[j] <= 0 || (j == 1 && block->successors[1] == block->successors[0])
+                || cfg->blocks[block->successors[j]].predecessor_count != 1)
+            continue;
+
+        if (queued)
+        {
+            successor = new_value_state(numbering, state, (uint32_t)block->successors[j]);
+            if (!successor)
+                return ERR_ALLOC;
+        }
+        else
+        {
+            successor = state;
+            successor->block = (uint32_t)block->successors[j];
+            queued = 1;
+        }
+
+        successor->next = numbering->pending;
+        numbering->pending = successor;
+    }
+
+    if (!queued)
+        free_value_state(state);
+
+    return ERR_SUCCESS;
+}
+
+
+/**
+ * @brief Numbers the values of all reachable blocks. Each block without a
+ *        single predecessor starts an extended basic block whose blocks
+ *        inherit the values known at the end of their predecessor.
+ */
+Errc number_values(ValueNumbering *numbering)
+{
+    const PassManager *manager = numbering->manager;
+    const ControlFlowGraph *cfg = &manager->cfg;
+    const FlowBlock *block;
+    ValueState *state;
+    Errc result = ERR_SUCCESS;
+    uint32_t zero;
+    uint32_t b;
+    uint32_t v;
+
+    for (b = 0; b < cfg->block_count && result == ERR_SUCCESS; ++b)
+    {
+        block = &cfg->blocks[b];
+        if (!block->reachable || (b && block->predecessor_count == 1))
+            continue;
+
+        numbering->pending = new_value_state(numbering, 0, b);
+        if (!numbering->pending)
+            return ERR_ALLOC;
+
+        /* BSS variables are zero when the program starts */
+        if (b == 0 && block->predecessor_count == 0)
+        {
+            zero = lookup_value(numbering, SPASM_LC, 0, 0, 0);
+            for (v = 0; v < manager->liveness.variable_count; ++v)
+                numbering->pending->variables[v] = zero;
+        }
+
+        while (numbering->pending && result == ERR_SUCCESS)
+        {
+            state = numbering->pending;
+            numbering->pending = state->next;
+            result = number_block(numbering, state);
+        }
+    }
+
+    while (numbering->pending)
+    {
+        state = numbering->pending;
+        numbering->pending = state->next;
+        free_value_state(state);
+    }
+
+    return result;
+}
+
+
+void cleanup_value_numbering(ValueNumbering *numbering)
+{
+    free(numbering->keys);
+    free(numbering->constant);
+    free(numbering->is_constant);
+    free(numbering->variable);
+    free(numbering->action);
+    free(numbering->argument);
+}
+
+
+/**
+ * @brief Pass replacing loads and expressions whose value is known by the
+ *        constant, a DUP of the value on the stack or, right behind a store
+ *        of the value, a DUP of the value in front of the store.
+ */
+Errc number_values_pass(PassManager *manager, uint32_t *changes, char *summary)
+{
+    const ControlFlowGraph *cfg = &manager->cfg;
+    ParserState *parser = manager->parser;
+    ValueNumbering numbering;
+    Command **stores;
+    Command **copies;
+    Command *previous;
+    Command *command;
+    uint32_t counts[VALUE_FORWARD + 1];
+    uint32_t values;
+    uint32_t keys = 16;
+    uint32_t i;
+    uint32_t k;
+    Errc result;
+
+    *changes = 0;
+
+    /* Stack positions are only known if every path agrees on the depths */
+    if (!manager->depths.consistent)
+    {
+        sprintf(summary, "(skipped, inconsistent stack depths)");
+        return ERR_SUCCESS;
+    }
+
+    while (keys < 2 * cfg->command_count)
+        keys *= 2;
+
+    /* Two new values per command at most and the stack of every extended block */
+    values = 2 * cfg->command_count + cfg->block_count * ((uint32_t)manager->depths.max_depth + 2) + 2;
+
+    memset(&numbering, 0, sizeof(ValueNumbering));
+    numbering.manager = manager;
+    numbering.key_mask = keys - 1;
+    numbering.keys = (ValueKey*)calloc(keys, sizeof(ValueKey));
+    numbering.constant = (uint32_t*)malloc(values * sizeof(uint32_t));
+    numbering.is_constant = (unsigned char*)malloc(values);
+    numbering.variable = (int32_t*)malloc(values * sizeof(int32_t));
+    numbering.action = (unsigned char*)calloc(cfg->command_count + 1, 1);
+    numbering.argument = (uint32_t*)malloc((cfg->command_count + 1) * sizeof(uint32_t));
+    if (!numbering.keys || !numbering.constant || !numbering.is_constant || !numbering.variable
+            || !numbering.action || !numbering.argument)
+    {
+        cleanup_value_numbering(&numbering);
+        return ERR_ALLOC;
+    }
+
+    result = number_values(&numbering);
+    if (result != ERR_SUCCESS)
+    {
+        cleanup_value_numbering(&numbering);
+        return result;
+    }
+
+    memset(counts, 0, sizeof(counts));
+    for (i = 0; i < cfg->command_count; ++i)
+        ++counts[numbering.action[i]];
+
+    stores = (Command**)calloc(counts[VALUE_FORWARD] + 1, sizeof(Command*));
+    copies = (Command**)calloc(counts[VALUE_FORWARD] + 1, sizeof(Command*));
+    for (k = 0; stores && copies && k < counts[VALUE_FORWARD]; ++k)
+    {
+        copies[k] = (Command*)calloc(1, sizeof(Command));
+        if (!copies[k])
+            break;
+    }
+
+    if (!stores || !copies || k < counts[VALUE_FORWARD])
+    {
+        for (k = 0; copies && k < counts[VALUE_FORWARD]; ++k)
+            free(copies[k]);
+        free(stores);
+        free(copies);
+        cleanup_value_numbering(&numbering);
+        return ERR_ALLOC;
+    }
+
+    for (i = 0, k = 0; i < cfg->command_count; ++i)
+    {
+        command = cfg->commands[i];
+        switch (numbering.action[i])
+        {
+        case VALUE_DUP:
+            command->type = SPASM_DUP;
+            command->argument.constant_arg = numbering.argument[i];
+            break;
+        case VALUE_CONSTANT:
+            command->type = SPASM_LC;
+            command->argument.constant_arg = numbering.argument[i];
+            break;
+        case VALUE_FORWARD:
+            stores[k++] = cfg->commands[i - 2];
+            break;
+        default:
+            break;
+        }
+
+        numbering.action[i] = numbering.action[i] == VALUE_REMOVE || numbering.action[i] == VALUE_FORWARD;
+    }
+
+    if (counts[VALUE_REMOVE] || counts[VALUE_FORWARD])
+        *changes = remove_commands(manager, numbering.action);
+
+    /* The stored value stays on the stack for the removed load, stores are in list order */
+    for (previous = 0, command = parser->command_first, k = 0; command && k < counts[VALUE_FORWARD];
+            previous = command, command = command->next)
+    {
+        if (command != stores[k])
+            continue;
+
+        copies[k]->type = SPASM_DUP;
+        copies[k]->argument.constant_arg = 0;
+        copies[k]->source_line = command->source_line;
+        copies[k]->next = command;
+        if (previous)
+            previous->next = copies[k];
+        else
+            parser->command_first = copies[k];
+        ++k;
+    }
+
+    free(stores);
+    free(copies);
+    cleanup_value_numbering(&numbering);
+
+    sprintf(summary, "(%u constants, %u copies, %u forwarded, %u commands removed)",
+            counts[VALUE_CONSTANT], counts[VALUE_DUP], counts[VALUE_FORWARD], *changes);
+
+    return ERR_SUCCESS;
+}
+
+
+/**
+ * @brief Finds the LA pushing the array base of an indexed access.
+ *
+ * The base is the left operand of the ADD, pushed by an LA of the same
+ * block in front of an index expression that leaves a single value and
+ * never reaches into the base. The index may also come first and the LA
+ * directly in front of the ADD. DUPs of the index expression reaching
+ * below the base are marked in dups, they reach one value less far once
+ * the LA is gone.
+ *
+ * @param manager Pass manager with up to date stack depths
+ * @param add Index of the ADD
+ * @param dups Set for DUPs to move, per command index, only written if the base is found
+ * @return Index of the LA, -1 if the ADD doesn't add to an array base.
+ */
+int32_t indexed_base(const PassManager *manager, const uint32_t add, unsigned char *dups)
+{
+    const ControlFlowGraph *cfg = &manager->cfg;
+    const int32_t *entry = manager->depths.entry;
+    const uint32_t first = cfg->blocks[cfg->block_of[add]].first;
+    const int32_t base = entry[add] - 2;
+    const Command *command;
+    int32_t position;
+    uint32_t i;
+
+    if (add == first)
+        return -1;
+
+    if (cfg->commands[add - 1]->type == SPASM_LA)
+        return (int32_t)add - 1;
+
+    /* Closest command in front of the ADD pushing or popping at the depth of the base */
+    for (i = add - 1; i > first && entry[i] - SPASM_STACK_POPS[cfg->commands[i]->type] > base; --i)
+        ;
+
+    if (cfg->commands[i]->type != SPASM_LA || entry[i] != base)
+        return -1;
+
+    for (position = (int32_t)i + 1; position < (int32_t)add; ++position)
+    {
+        command = cfg->commands[position];
+        if (command->type != SPASM_DUP)
+            continue;
+
+        if (entry[position] - 1 - (int32_t)command->argument.constant_arg == base)
+            return -1;
+    }
+
+    for (position = (int32_t)i + 1; position < (int32_t)add; ++position)
+    {
+        command = cfg->commands[position];
+        if (command->type == SPASM_DUP && entry[position] - 1 - (int32_t)command->argument.constant_arg < base)
+            dups[position] = 1;
+    }
+
+    return (int32_t)i;
+}
+
+
+/**
+ * @brief Replaces LA $a / <index> / ADD / LV and LA $a / <index> / ADD / STR
+ *        by <index> / LVX $a and <index> / STX $a, which address the element
+ *        with the scaled index register. ADDs are visited back to front so
+ *        the accesses of an index, e.g. $a[$b[$i]], are fused as well.
+ */
+Errc fuse_indexed(PassManager *manager, uint32_t *changes, char *summary)
+{
+    const ControlFlowGraph *cfg = &manager->cfg;
+    unsigned char *removed;
+    unsigned char *dups;
+    Command *command;
+    Command *access;
+    Command *base;
+    uint32_t loads = 0;
+    uint32_t stores = 0;
+    uint32_t i;
+    uint32_t j;
+    int32_t k;
+
+    *changes = 0;
+
+    if (!manager->depths.consistent)
+    {
+        sprintf(summary, "(skipped, inconsistent stack depths)");
+        return ERR_SUCCESS;
+    }
+
+    removed = (unsigned char*)calloc(cfg->command_count + 1, 1);
+    dups = (unsigned char*)calloc(cfg->command_count + 1, 1);
+    if (!removed || !dups)
+    {
+        free(removed);
+        free(dups);
+        return ERR_ALLOC;
+    }
+
+    for (i = cfg->command_count; i > 0; )
+    {
+        command = cfg->commands[--i];
+        if (command->type != SPASM_ADD || manager->depths.entry[i] == STACK_DEPTH_UNKNOWN
+                || i == cfg->blocks[cfg->block_of[i]].last)
+            continue;
+
+        access = cfg->commands[i + 1];
+        if (access->type != SPASM_LV && access->type != SPASM_STR)
+            continue;
+
+        k = indexed_base(manager, i, dups);
+        if (k < 0)
+            continue;
+
+        for (j = (uint32_t)k + 1; j < i; ++j)
+        {
+            if (dups[j])
+                --cfg->commands[j]->argument.constant_arg;
+            dups[j] = 0;
+        }
+
+        /* The label of the LA moves to the first command of the index */
+        base = cfg->commands[k];
+        if (base->label)
+        {
+            cfg->commands[k + 1]->label = base->label;
+            base->label->command = cfg->commands[k + 1];
+            base->label = 0;
+        }
+
+        command->type = access->type == SPASM_LV ? SPASM_LVX : SPASM_STX;
+        command->argument.memory_arg = base->argument.memory_arg;
+        if (access->type == SPASM_LV)
+            ++loads;
+        else
+            ++stores;
+
+        removed[k] = 1;
+        removed[i + 1] = 1;
+    }
+
+    if (loads || stores)
+        *changes = remove_commands(manager, removed);
+
+    free(removed);
+    free(dups);
+
+    sprintf(summary, "(%u loads, %u stores)", loads, stores);
+
+    return ERR_SUCCESS;
+}
+
+
+/**
+ * @brief Pass running vectorize_loops.
+ */
+Errc run_vectorize(PassManager *manager, uint32_t *changes, char *summary)
+{
+    Errc result = vectorize_loops(manager->parser, changes);
+
+    sprintf(summary, "(%u)", *changes);
+    return result;
+}
+
+
+/**
+ * @brief Pass running fuse_updates.
+ */
+Errc run_fuse(PassManager *manager, uint32_t *changes, char *summary)
+{
+    Errc result = fuse_updates(manager->parser, changes);
+
+    sprintf(summary, "(%u)", *changes);
+    return result;
+}
+
+
+/**
+ * @brief Finds the command popping a value of the stack.
+ * @param manager Pass manager with up to date stack depths
+ * @param index Command pushing the value
+ * @param position Stack depth below the value
+ * @return Index of the first command of the block popping or copying the
+ *         value, the command count if the value outlives the block.
+ */
+uint32_t value_user(const PassManager *manager, const uint32_t index, const int32_t position)
+{
+    const ControlFlowGraph *cfg = &manager->cfg;
+    const int32_t *entry = manager->depths.entry;
+    const Command *command;
+    uint32_t i;
+
+    for (i = index + 1; i <= cfg->blocks[cfg->block_of[index]].last; ++i)
+    {
+        command = cfg->commands[i];
+        if (entry[i] - SPASM_STACK_POPS[command->type] <= position
+                || (command->type == SPASM_DUP && entry[i] - 1 - (int32_t)command->argument.constant_arg == position))
+            return i;
+    }
+
+    return cfg->command_count;
+}
+
+
+/**
+ * @brief Classifies the commands from first to last pushing an index.
+ * @param constant Set if the index is an LC
+ * @param counter Set to the variable if the index is LA $c / LV
+ * @return 1 if the index is a constant or a variable, 0 otherwise.
+ */
+int index_operand(const PassManager *manager, const uint32_t first, const uint32_t last,
+        uint32_t *constant, MemoryLocation **counter)
+{
+    const ControlFlowGraph *cfg = &manager->cfg;
+
+    *counter = 0;
+    if (first == last && cfg->commands[first]->type == SPASM_LC)
+    {
+        *constant = cfg->commands[first]->argument.constant_arg;
+        return 1;
+    }
+
+    if (last == first + 1 && cfg->commands[first]->type == SPASM_LA && cfg->commands[last]->type == SPASM_LV)
+    {
+        *counter = cfg->commands[first]->argument.memory_arg;
+        return 1;
+    }
+
+    return 0;
+}
+
+
+/**
+ * @brief Checks whether a counted loop around a block keeps a variable
+ *        between 0 and words - 1 within the block.
+ *
+ * The loop header has to be LA $c / LV / LC <n> / LES / JIN <exit> with n
+ * at most words, entered from outside the loop behind LC <k> / LA $c / STR
+ * with k >= 0, optionally followed by the VEC of the loop. Inside the loop $c may only be incremented by one right in
+ * front of the jump back to the header, as LA $c / LV / LC 1 / ADD / LA $c
+ * / STR or its fused RMW.
+ */
+int counter_bounded(const PassManager *manager, const uint32_t block, const MemoryLocation *counter,
+        const uint32_t words)
+{
+    const ControlFlowGraph *cfg = &manager->cfg;
+    const LoopForest *forest = &manager->loops;
+    const FlowBlock *header;
+    const FlowBlock *other;
+    Command **commands = cfg->commands;
+    const Command *command;
+    int32_t loop;
+    uint32_t b;
+    uint32_t i;
+    uint32_t p;
+
+    for (loop = forest->loop_of[block]; loop >= 0; loop = forest->loops[loop].parent)
+    {
+        header = &cfg->blocks[forest->loops[loop].header];
+        i = header->first;
+        if (forest->loops[loop].header == block || forest->loops[loop].header == 0 || header->last != i + 4
+                || commands[i]->type != SPASM_LA || commands[i]->argument.memory_arg != counter
+                || commands[i + 1]->type != SPASM_LV || commands[i + 2]->type != SPASM_LC
+                || commands[i + 3]->type != SPASM_LES || commands[i + 4]->type != SPASM_JIN
+                || (int32_t)commands[i + 2]->argument.constant_arg <= 0
+                || commands[i + 2]->argument.constant_arg > words
+                || header->successors[1] < 0 || loop_contains(forest, loop, (uint32_t)header->successors[1]))
+            continue;
+
+        /* Entries start at a non-negative constant */
+        for (p = 0; p < header->predecessor_count; ++p)
+        {
+            b = cfg->predecessors[header->predecessor_offset + p];
+            other = &cfg->blocks[b];
+            if (loop_contains(forest, loop, b))
+                continue;
+
+            /* Vectorized iterations in front of the loop only count further */
+            i = other->last;
+            if (i > other->first && commands[i]->type == SPASM_VEC && commands[i]->argument.vector_arg->counter == counter)
+                --i;
+            if (i < other->first + 2 || commands[i]->type != SPASM_STR
+                    || commands[i - 1]->type != SPASM_LA || commands[i - 1]->argument.memory_arg != counter
+                    || commands[i - 2]->type != SPASM_LC || (int32_t)commands[i - 2]->argument.constant_arg < 0)
+                break;
+        }
+        if (p < header->predecessor_count)
+            continue;
+
+        /* The counter only grows by one right before jumping back */
+        for (b = 0; b < forest->loops[loop].block_count; ++b)
+        {
+            other = &cfg->blocks[forest->blocks[forest->loops[loop].block_offset + b]];
+            for (i = other->first; i <= other->last; ++i)
+            {
+                command = commands[i];
+                if (command->type == SPASM_RMW && command->argument.update_arg->memory == counter)
+                {
+                    if (command->argument.update_arg->operation != SPASM_ADD || command->argument.update_arg->constant != 1
+                            || i + 1 != other->last || commands[i + 1]->type != SPASM_JMP
+                            || other->successors[1] != (int32_t)forest->loops[loop].header)
+                        break;
+                }
+                else if (command->type == SPASM_LA && command->argument.memory_arg == counter
+                        && (i == other->last || commands[i + 1]->type != SPASM_LV))
+                {
+                    if (i + 2 != other->last || i < other->first + 4 || commands[i + 1]->type != SPASM_STR
+                            || commands[i - 1]->type != SPASM_ADD || commands[i - 2]->type != SPASM_LC
+                            || commands[i - 2]->argument.constant_arg != 1 || commands[i - 3]->type != SPASM_LV
+                            || commands[i - 4]->type != SPASM_LA || commands[i - 4]->argument.memory_arg != counter
+                            || commands[i + 2]->type != SPASM_JMP
+                            || other->successors[1] != (int32_t)forest->loops[loop].header)
+                        break;
+                }
+                else if ((command->type == SPASM_VEC && command->argument.vector_arg->counter == counter)
+                        || ((command->type == SPASM_CNT || command->type == SPASM_LVX || command->type == SPASM_STX)
+                                && command->argument.memory_arg == counter))
+                {
+                    break;
+                }
+            }
+            if (i <= other->last)
+                break;
+        }
+        if (b == forest->loops[loop].block_count)
+            return 1;
+    }
+
+    return 0;
+}
+
+
+/**
+ * @brief Checks whether an index stays within an array of the given words.
+ */
+int index_bounded(const PassManager *manager, const uint32_t block, const uint32_t constant,
+        const MemoryLocation *counter, const MemoryLocation *array, const uint32_t words)
+{
+    if (!counter)
+        return constant < words;
+
+    return counter != array && counter->size == sizeof(uint32_t) && counter_bounded(manager, block, counter, words);
+}
+
+
+/**
+ * @brief Finds a memory access whose address may lie outside of the
+ *        variable it is computed from.
+ *
+ * Addresses are LA $x, optionally plus a constant or a loop counter, used
+ * by LV, STR, CPY and FIL with constant counts, or the index of an LVX or
+ * STX. Any other use of an address, e.g. storing or printing it, could
+ * observe the layout as well.
+ *
+ * @param manager Pass manager with up to date stack depths and loops
+ * @return Index of the command computing the address, -1 if all addresses
+ *         stay within their variable.
+ */
+int32_t find_escaping_address(const PassManager *manager)
+{
+    const ControlFlowGraph *cfg = &manager->cfg;
+    const int32_t *entry = manager->depths.entry;
+    Command **commands = cfg->commands;
+    const Command *command;
+    const FlowBlock *block;
+    MemoryLocation *counter;
+    MemoryLocation *memory;
+    uint32_t constant;
+    uint32_t words;
+    uint32_t user;
+    uint32_t count;
+    int32_t position;
+    uint32_t i;
+
+    for (i = 0; i < cfg->command_count; ++i)
+    {
+        command = commands[i];
+        block = &cfg->blocks[cfg->block_of[i]];
+        if (entry[i] == STACK_DEPTH_UNKNOWN)
+            continue;
+
+        if (command->type == SPASM_LVX || command->type == SPASM_STX)
+        {
+            memory = command->argument.memory_arg;
+            if (!((i > block->first && index_operand(manager, i - 1, i - 1, &constant, &counter))
+                    || (i > block->first + 1 && index_operand(manager, i - 2, i - 1, &constant, &counter)))
+                    || !index_bounded(manager, cfg->block_of[i], constant, counter, memory, memory->size / 4))
+                return (int32_t)i;
+            continue;
+        }
+
+        if (command->type != SPASM_LA)
+            continue;
+
+        memory = command->argument.memory_arg;
+        words = memory->size / 4;
+        constant = 0;
+        counter = 0;
+        position = entry[i];
+        user = value_user(manager, i, position);
+
+        if (user < cfg->command_count && commands[user]->type == SPASM_ADD)
+        {
+            /* The index follows the LA or is pushed right in front of it */
+            if (entry[user] == position + 2)
+            {
+                if (user == i + 1 || !index_operand(manager, i + 1, user - 1, &constant, &counter))
+                    return (int32_t)i;
+            }
+            else if (user != i + 1 || !((i > block->first && index_operand(manager, i - 1, i - 1, &constant, &counter))
+                    || (i > block->first + 1 && index_operand(manager, i - 2, i - 1, &constant, &counter))))
+            {
+                return (int32_t)i;
+            }
+
+            position = entry[user] - 2;
+            user = value_user(manager, user, position);
+        }
+
+        if (user == cfg->command_count)
+            return (int32_t)i;
+
+        switch (commands[user]->type)
+        {
+        case SPASM_LV:
+            count = 1;
+            break;
+        case SPASM_STR:
+            count = 1;
+            if (position != entry[user] - 1)
+                return (int32_t)i;
+            break;
+        case SPASM_CPY:
+        case SPASM_FIL:
+            /* A constant count right in front, FIL takes a value instead of a source */
+            if (user == block->first || commands[user - 1]->type != SPASM_LC
+                    || (int32_t)commands[user - 1]->argument.constant_arg < 0
+                    || position == entry[user] - 1
+                    || (commands[user]->type == SPASM_FIL && position != entry[user] - 2))
+                return (int32_t)i;
+            count = commands[user - 1]->argument.constant_arg;
+            break;
+        default:
+            return (int32_t)i;
+        }
+
+        if (count > words || !index_bounded(manager, cfg->block_of[i], constant, counter, memory, words - count + 1))
+            return (int32_t)i;
+    }
+
+    return -1;
+}
+
+
+/**
+ * @brief Pass running layout_data, the commands stay unchanged.
+ */
+Errc run_data_layout(PassManager *manager, uint32_t *changes, char *summary)
+{
+    DataLayout *data = &manager->data;
+    Errc result;
+    int32_t escaping;
+
+    *changes = 0;
+    memset(data, 0, sizeof(DataLayout));
+
+    /* Variables must stay in order when an address may cross into the next */
+    if (!manager->depths.consistent)
+    {
+        sprintf(summary, "(skipped, inconsistent stack depths)");
+        return ERR_SUCCESS;
+    }
+
+    escaping = find_escaping_address(manager);
+    if (escaping >= 0)
+    {
+        sprintf(summary, "(skipped, address of line %u may leave its variable)",
+                manager->cfg.commands[escaping]->source_line);
+        return ERR_SUCCESS;
+    }
+
+    result = layout_data(manager->parser, manager->options.counts, data);
+    sprintf(summary, "(%u scalars in %u lines, %u arrays aligned, %u bytes padding)",
+            data->hot_scalars, data->scalar_lines, data->aligned_arrays, data->padding);
+    return result;
+}
+
+
+/**
+ * @brief Pass running layout_blocks.
+ */
+Errc run_block_layout(PassManager *manager, uint32_t *changes, char *summary)
+{
+    uint32_t moved = 0;
+    Errc result = layout_blocks(manager->parser, manager->options.counts, &moved);
+
+    /* Jumps may change even if no block moved */
+    *changes = 1;
+    sprintf(summary, "(%u moved, profile %.64s)", moved, manager->options.profile_path);
+    return result;
+}
+
+
+/**
+ * @brief Pass running instrument_blocks.
+ */
+Errc run_instrument(PassManager *manager, uint32_t *changes, char *summary)
+{
+    Errc result = instrument_blocks(manager->parser, manager->options.instrument, &manager->profile);
+
+    *changes = manager->profile.block_count;
+    sprintf(summary, "(%u blocks -> %.64s)", manager->profile.block_count, manager->options.instrument);
+    return result;
+}
+
+
+/**
+ * @brief Pass running align_loops.
+ */
+Errc run_align_loops(PassManager *manager, uint32_t *changes, char *summary)
+{
+    const uint32_t alignment = manager->options.alignment ? manager->options.alignment : PASS_DEFAULT_ALIGNMENT;
+    Errc result = align_loops(manager->parser, alignment, changes);
+
+    sprintf(summary, "(%u to %u bytes)", *changes, alignment);
+    return result;
+}
+
+
+const Pass SPASM_PASSES[] = {
+        { "jump-threading", "Threading jumps", 1, ANALYSIS_CFG, 0, 1,
+                STATS_JUMP_THREADING, thread_jumps },
+        { "unreachable", "Removing unreachable code", 1, ANALYSIS_CFG, 0, 1,
+                STATS_UNREACHABLE, remove_unreachable },
+        { "dead-stores", "Removing dead stores", 1, ANALYSIS_STACK_DEPTH | ANALYSIS_LIVENESS, 0, 1,
+                STATS_DEAD_STORES, remove_dead_stores },
+        { "vectorize", "Vectorizing loops", 2, 0, 0, 1,
+                STATS_VECTORIZE, run_vectorize },
+        { "fuse", "Fusing variable updates", 1, 0, 0, 0,
+                STATS_FUSE, run_fuse },
+        { "loop-invariants", "Hoisting loop invariants", 2,
+                ANALYSIS_STACK_DEPTH | ANALYSIS_LIVENESS | ANALYSIS_LOOPS, 0, 1,
+                STATS_LOOP_INVARIANTS, hoist_invariants },
+        { "value-numbering", "Numbering values", 2, ANALYSIS_STACK_DEPTH | ANALYSIS_LIVENESS, 0, 0,
+                STATS_VALUE_NUMBERING, number_values_pass },
+        { "indexed", "Fusing indexed accesses", 1, ANALYSIS_STACK_DEPTH, 0, 0,
+                STATS_INDEXED, fuse_indexed },
+        { "data-layout", "Laying out data", 2, ANALYSIS_STACK_DEPTH | ANALYSIS_LOOPS, ANALYSIS_ALL, 0,
+                STATS_DATA_LAYOUT, run_data_layout },
+        { "block-layout", "Laying out blocks", 0, 0, 0, 0,
+                STATS_BLOCK_LAYOUT, run_block_layout },
+        { "instrument", "Instrumenting blocks", 0, 0, 0, 0,
+                STATS_INSTRUMENT, run_instrument },
+        { "align-loops", "Aligning loops", 2, 0, 0, 0,
+                STATS_ALIGN_LOOPS, run_align_loops }
+};
+
+
+void init_pass_manager(PassManager *manager, ParserState *parser, const PassOptions *options)
+{
+    memset(manager, 0, sizeof(PassManager));
+    manager->parser = parser;
+    manager->options = *options;
+    manager->stats = parser->stats;
+}
+
+
+void cleanup_pass_manager(PassManager *manager)
+{
+    invalidate_analyses(manager, 0);
+}
+
+
+int pass_enabled(const PassManager *manager, const PassId pass)
+{
+    if (manager->options.interpret && !SPASM_PASSES[pass].interpretable)
+        return 0;
+
+    return (manager->options.requested & (1u << pass))
+            || (SPASM_PASSES[pass].level && manager->options.level >= SPASM_PASSES[pass].level);
+}
+
+
+Errc run_passes(PassManager *manager, FILE *progress)
+{
+    char summary[PASS_SUMMARY_LENGTH];
+    const Pass *pass;
+    StatsClock clock;
+    uint32_t changes;
+    Errc result;
+    int i;
+
+    for (i = 0; i < PASS_COUNT; ++i)
+    {
+        if (!pass_enabled(manager, (PassId)i))
+            continue;
+
+        pass = &SPASM_PASSES[i];
+        fprintf(progress, "%s...", pass->description);
+
+        result = require_analyses(manager, pass->requires);
+        if (result == ERR_SUCCESS)
+        {
+            changes = 0;
+            strcpy(summary, "");
+            start_phase(manager->stats, &clock);
+            result = pass->run(manager, &changes, summary);
+            end_phase(manager->stats, pass->phase, &clock);
+        }
+
+        if (result != ERR_SUCCESS)
+        {
+            fprintf(progress, "FAILED\n");
+            manager->failed = pass;
+            return result;
+        }
+
+        if (changes)
+            invalidate_analyses(manager, pass->preserves);
+
+        fprintf(progress, "DONE %s\n", summary);
+    }
+
+    return ERR_SUCCESS;
+}
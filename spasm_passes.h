@@ -0,0 +1,273 @@
+/*
+ * Copyright (C) 2011, Stefan Hacker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#include <stdio.h>
+
+#include "spasm_types.h"
+#include "spasm_instrument.h"
+#include "spasm_datalayout.h"
+#include "spasm_stats.h"
+
+#ifndef SPASM_PASSES_H_
+#define SPASM_PASSES_H_
+
+#define PASS_MAX_LEVEL 2 /* highest -O level */
+#define PASS_DEFAULT_ALIGNMENT 16 /* loop alignment of -O2 */
+#define PASS_SUMMARY_LENGTH 128
+#define STACK_DEPTH_UNKNOWN -1
+
+/**
+ * @brief Analyses computed on demand and cached by the pass manager.
+ *        Values are bits so passes can require and preserve several.
+ */
+typedef enum Analysis
+{
+    ANALYSIS_CFG = 1, /* basic blocks and their successors, @see ControlFlowGraph */
+    ANALYSIS_STACK_DEPTH = 2, /* stack depth in front of every command, needs the CFG */
+    ANALYSIS_LIVENESS = 4, /* live scalar variables per block, needs the CFG */
+    ANALYSIS_LOOPS = 8, /* dominators and natural loops, needs the CFG */
+
+    ANALYSIS_ALL = 15
+} Analysis;
+
+/**
+ * @brief Enumeration of the registered passes, index equals SPASM_PASSES
+ *        and is the order passes run in.
+ */
+typedef enum PassId
+{
+    PASS_JUMP_THREADING,
+    PASS_UNREACHABLE,
+    PASS_DEAD_STORES,
+    PASS_VECTORIZE,
+    PASS_FUSE,
+    PASS_LOOP_INVARIANTS,
+    PASS_VALUE_NUMBERING,
+    PASS_INDEXED,
+    PASS_DATA_LAYOUT,
+    PASS_BLOCK_LAYOUT,
+    PASS_INSTRUMENT,
+    PASS_ALIGN_LOOPS,
+
+    PASS_COUNT
+} PassId;
+
+typedef struct FlowBlock FlowBlock;
+typedef struct ControlFlowGraph ControlFlowGraph;
+typedef struct StackDepths StackDepths;
+typedef struct Liveness Liveness;
+typedef struct NaturalLoop NaturalLoop;
+typedef struct LoopForest LoopForest;
+typedef struct PassOptions PassOptions;
+typedef struct PassManager PassManager;
+typedef struct Pass Pass;
+
+/**
+ * @brief Basic block of the control flow graph. Blocks start at the first
+ *        command, labeled commands and commands following a jump or STP.
+ */
+struct FlowBlock
+{
+    uint32_t first; /* index of the first command */
+    uint32_t last; /* index of the last command */
+    int32_t successors[2]; /* fall through and jump target block, -1 if none */
+    uint32_t predecessor_offset; /* first predecessor in ControlFlowGraph.predecessors */
+    uint32_t predecessor_count;
+    int reachable; /* reachable from the entry block */
+};
+
+/**
+ * @brief Control flow graph of the command list.
+ */
+struct ControlFlowGraph
+{
+    Command **commands; /* commands in list order */
+    uint32_t command_count;
+    uint32_t *block_of; /* block index of every command */
+    FlowBlock *blocks; /* blocks in list order, the entry block first */
+    uint32_t block_count;
+    uint32_t *predecessors; /* predecessor block indexes of all blocks */
+};
+
+/**
+ * @brief Stack depth in front of every command, counted from the program entry.
+ */
+struct StackDepths
+{
+    int32_t *entry; /* per command, STACK_DEPTH_UNKNOWN for unreachable commands */
+    int32_t max_depth;
+    int consistent; /* all paths agree on every depth and no command pops an empty stack */
+};
+
+/**
+ * @brief Live scalar variables at the block boundaries.
+ *
+ * Every 4 byte BSS variable is tracked. LA $x / LV reads and LA $x / STR
+ * writes $x, an LV from a computed address reads every variable and a STR
+ * to a computed address writes none of them. Nothing is live at the end
+ * of the program.
+ */
+struct Liveness
+{
+    MemoryLocation **variables; /* tracked variables, their index is kept in vaddr */
+    uint32_t variable_count;
+    uint32_t words; /* uint32_t words per set */
+    uint32_t *live_in; /* per block set of variables live in front of it */
+    uint32_t *live_out; /* per block set of variables live behind it */
+};
+
+/**
+ * @brief Natural loop of the back edges to a header, i.e. of the jumps and
+ *        fall throughs to a block dominating the block they leave.
+ */
+struct NaturalLoop
+{
+    uint32_t header; /* block dominating all blocks of the loop */
+    int32_t parent; /* innermost enclosing loop, -1 if none */
+    uint32_t block_offset; /* first block of the loop in LoopForest.blocks */
+    uint32_t block_count;
+};
+
+/**
+ * @brief Dominator tree and natural loops of the reachable blocks.
+ */
+struct LoopForest
+{
+    int32_t *idom; /* immediate dominator per block, -1 for the entry and unreachable blocks */
+    NaturalLoop *loops; /* enclosing loops in front of the loops nested in them */
+    uint32_t loop_count;
+    int32_t *loop_of; /* innermost loop per block, -1 if none */
+    uint32_t *blocks; /* blocks of all loops */
+};
+
+/**
+ * @brief Selection and parameters of the passes.
+ */
+struct PassOptions
+{
+    unsigned level; /* -O level, 0 runs requested passes only */
+    unsigned requested; /* bit per PassId run regardless of the level */
+    int interpret; /* only run passes whose output the interpreter runs */
+    const BlockCounts *counts; /* profile of an instrumented build, 0 for none */
+    const char *profile_path; /* path of the profile for messages */
+    char *instrument; /* profile path of instrumented binaries */
+    uint32_t alignment; /* loop alignment in bytes, 0 for PASS_DEFAULT_ALIGNMENT */
+};
+
+/**
+ * @brief Runs passes over a program and caches the analyses they share.
+ */
+struct PassManager
+{
+    ParserState *parser;
+    PassOptions options;
+    SpasmStats *stats; /* Statistics to collect, 0 for none */
+
+    unsigned valid; /* Analysis bits of the cached analyses */
+    ControlFlowGraph cfg;
+    StackDepths depths;
+    Liveness liveness;
+    LoopForest loops;
+
+    DataLayout data; /* Set by PASS_DATA_LAYOUT */
+    BlockProfile profile; /* Set by PASS_INSTRUMENT */
+    const Pass *failed; /* Pass that failed, 0 if none */
+};
+
+/**
+ * @brief Description of a pass.
+ */
+struct Pass
+{
+    const char *name;
+    const char *description; /* progress message */
+    unsigned level; /* lowest -O level running the pass, 0 if it only runs on request */
+    unsigned requires; /* Analysis bits the pass reads */
+    unsigned preserves; /* Analysis bits still valid after the pass changed the program */
+    int interpretable; /* output only contains commands the interpreter runs */
+    StatsPhase phase;
+
+    /**
+     * @brief Runs the pass, the required analyses are up to date.
+     * @param manager Pass manager
+     * @param changes Set to the number of changes, 0 keeps all analyses valid
+     * @param summary Set to a short result for the progress message
+     * @return ERR_SUCCESS on success
+     */
+    Errc (*run)(PassManager *manager, uint32_t *changes, char *summary);
+};
+
+/**
+ * @brief Registered passes, index equals PassId.
+ */
+extern const Pass SPASM_PASSES[];
+
+/**
+ * @brief Index of a tracked variable, -1 if the variable isn't tracked.
+ */
+int32_t tracked_variable(const Liveness *liveness, const MemoryLocation *memory);
+
+/**
+ * @brief Updates a set of live variables from behind to in front of a command.
+ * @param manager Pass manager with the CFG and liveness analyses
+ * @param index Index of the command
+ * @param live Set of live variables to update
+ */
+void command_liveness(const PassManager *manager, const uint32_t index, uint32_t *live);
+
+/**
+ * @brief Checks whether a block belongs to a loop or a loop nested in it.
+ */
+int loop_contains(const LoopForest *forest, const int32_t loop, const uint32_t block);
+
+/**
+ * @brief Prepares a pass manager for a program.
+ * @param manager Manager to initialize
+ * @param parser Program to optimize
+ * @param options Pass selection
+ */
+void init_pass_manager(PassManager *manager, ParserState *parser, const PassOptions *options);
+
+/**
+ * @brief Releases the cached analyses.
+ */
+void cleanup_pass_manager(PassManager *manager);
+
+/**
+ * @brief Checks whether a pass runs with the options of the manager.
+ */
+int pass_enabled(const PassManager *manager, const PassId pass);
+
+/**
+ * @brief Runs the enabled passes in PassId order.
+ *
+ * The analyses a pass requires are computed if they aren't cached. When a
+ * pass changes the program, the analyses it doesn't preserve are dropped.
+ * Analysis time is accounted to STATS_ANALYSES, pass time to the phase of
+ * the pass.
+ *
+ * @param manager Pass manager
+ * @param progress Progress messages are written here
+ * @return ERR_SUCCESS on success, manager->failed is set otherwise.
+ */
+Errc run_passes(PassManager *manager, FILE *progress);
+
+#endif /* SPASM_PASSES_H_ */
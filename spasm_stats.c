@@ -0,0 +1,235 @@
+/*
+ * Copyright (C) 2011, Stefan Hacker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#define _POSIX_C_SOURCE 200112L /* clock_gettime */
+
+#include "spasm_stats.h"
+
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+#include <malloc.h>
+#define SPASM_STATS_HEAP
+#endif
+
+const char *SPASM_STATS_PHASES[] = {
+    "parse",
+    "check",
+    "analyses",
+    "jump_threading",
+    "unreachable",
+    "dead_stores",
+    "vectorize",
+    "fuse",
+    "loop_invariants",
+    "value_numbering",
+    "indexed",
+    "data_layout",
+    "block_layout",
+    "instrument",
+    "align_loops",
+    "emit",
+    "place",
+    "relocate",
+    "write"
+};
+
+
+/**
+ * @brief Returns the given clock in seconds.
+ */
+double clock_seconds(clockid_t id)
+{
+    struct timespec time;
+
+    if (clock_gettime(id, &time) != 0)
+        return 0;
+
+    return (double)time.tv_sec + (double)time.tv_nsec / 1e9;
+}
+
+
+/**
+ * @brief Returns the average of total over count, 0 for no count.
+ */
+double average(const unsigned long total, const unsigned long count)
+{
+    return count ? (double)total / (double)count : 0;
+}
+
+
+void write_json_string(FILE *file, const char *string)
+{
+    fputc('"', file);
+    for (; *string; ++string)
+    {
+        if (*string == '"' || *string == '\\')
+            fputc('\\', file);
+
+        if ((unsigned char)*string < 0x20)
+            fprintf(file, "\\u%04x", (unsigned char)*string);
+        else
+            fputc(*string, file);
+    }
+    fputc('"', file);
+}
+
+
+void init_stats(SpasmStats *stats)
+{
+    memset(stats, 0, sizeof(SpasmStats));
+    stats->threads = 1;
+    stats->file_size = -1;
+    stats->peak_rss = -1;
+}
+
+
+void start_phase(const SpasmStats *stats, StatsClock *clock)
+{
+    if (!stats)
+        return;
+
+    clock->wall = clock_seconds(CLOCK_MONOTONIC);
+    clock->cpu = clock_seconds(CLOCK_PROCESS_CPUTIME_ID);
+}
+
+
+void end_phase(SpasmStats *stats, const StatsPhase phase, const StatsClock *clock)
+{
+    if (!stats)
+        return;
+
+    stats->wall[phase] += clock_seconds(CLOCK_MONOTONIC) - clock->wall;
+    stats->cpu[phase] += clock_seconds(CLOCK_PROCESS_CPUTIME_ID) - clock->cpu;
+    stats->ran[phase] = 1;
+#ifdef SPASM_STATS_HEAP
+    stats->heap[phase] = mallinfo2().uordblks;
+#endif
+}
+
+
+void count_allocation(SpasmStats *stats, const size_t size)
+{
+    if (!stats)
+        return;
+
+    ++stats->allocations;
+    stats->allocated_bytes += size;
+}
+
+
+void finish_stats(SpasmStats *stats)
+{
+    struct rusage usage;
+
+    /* ru_maxrss is in KiB on Linux */
+    if (getrusage(RUSAGE_SELF, &usage) == 0)
+        stats->peak_rss = usage.ru_maxrss;
+}
+
+
+void write_stats(FILE *file, const SpasmStats *stats)
+{
+    double wall = 0;
+    double cpu = 0;
+    int width = (int)strlen("Phase");
+    int i;
+
+    /* The phase column fits the longest phase name */
+    for (i = 0; i < STATS_PHASE_COUNT; ++i)
+    {
+        if ((int)strlen(SPASM_STATS_PHASES[i]) > width)
+            width = (int)strlen(SPASM_STATS_PHASES[i]);
+    }
+
+    fprintf(file, "===STATS===\n");
+    fprintf(file, "%-*s %11s %10s %11s\n", width, "Phase", "wall ms", "cpu ms", "heap KiB");
+    for (i = 0; i < STATS_PHASE_COUNT; ++i)
+    {
+        if (!stats->ran[i])
+            continue;
+
+        fprintf(file, "%-*s %11.3f %10.3f %11.1f\n", width, SPASM_STATS_PHASES[i],
+                stats->wall[i] * 1e3, stats->cpu[i] * 1e3, (double)stats->heap[i] / 1024);
+        wall += stats->wall[i];
+        cpu += stats->cpu[i];
+    }
+    fprintf(file, "%-*s %11.3f %10.3f\n\n", width, "total", wall * 1e3, cpu * 1e3);
+
+    fprintf(file, "Label lookups: %lu (%.2f probes on average)\n",
+            stats->label_lookups, average(stats->label_probes, stats->label_lookups));
+    fprintf(file, "Variable lookups: %lu (%.2f probes on average)\n",
+            stats->variable_lookups, average(stats->variable_probes, stats->variable_lookups));
+    fprintf(file, "Allocations: %lu (%lu bytes)\n", stats->allocations, stats->allocated_bytes);
+    fprintf(file, "Peak RSS: %ld KiB\n\n", stats->peak_rss);
+
+    fprintf(file, "Segments: text %lu, rodata %lu, data %lu, bss %lu bytes\n",
+            (unsigned long)stats->text_size, (unsigned long)stats->rodata_size,
+            (unsigned long)stats->data_size, (unsigned long)stats->bss_size);
+    fprintf(file, "Relocations: %lu\n", (unsigned long)stats->relocations);
+    fprintf(file, "Code generation threads: %lu\n", (unsigned long)stats->threads);
+    if (stats->file_size >= 0)
+        fprintf(file, "Binary: %ld bytes\n", stats->file_size);
+    fprintf(file, "===ENDOFSTATS===\n");
+}
+
+
+void write_stats_json(FILE *file, const SpasmStats *stats, const char *source)
+{
+    const char *separator = "";
+    int i;
+
+    fprintf(file, "{\"source\": ");
+    write_json_string(file, source);
+
+    fprintf(file, ", \"phases\": {");
+    for (i = 0; i < STATS_PHASE_COUNT; ++i)
+    {
+        if (!stats->ran[i])
+            continue;
+
+        fprintf(file, "%s\"%s\": {\"wall\": %.6f, \"cpu\": %.6f, \"heap\": %lu}",
+                separator, SPASM_STATS_PHASES[i], stats->wall[i], stats->cpu[i],
+                (unsigned long)stats->heap[i]);
+        separator = ", ";
+    }
+
+    fprintf(file, "}, \"label_lookups\": %lu, \"label_probes\": %lu, \"label_average_probes\": %.4f",
+            stats->label_lookups, stats->label_probes,
+            average(stats->label_probes, stats->label_lookups));
+    fprintf(file, ", \"variable_lookups\": %lu, \"variable_probes\": %lu, \"variable_average_probes\": %.4f",
+            stats->variable_lookups, stats->variable_probes,
+            average(stats->variable_probes, stats->variable_lookups));
+    fprintf(file, ", \"allocations\": %lu, \"allocated_bytes\": %lu, \"peak_rss_kib\": %ld",
+            stats->allocations, stats->allocated_bytes, stats->peak_rss);
+    fprintf(file, ", \"segments\": {\"text\": %lu, \"rodata\": %lu, \"data\": %lu, \"bss\": %lu}",
+            (unsigned long)stats->text_size, (unsigned long)stats->rodata_size,
+            (unsigned long)stats->data_size, (unsigned long)stats->bss_size);
+    fprintf(file, ", \"relocations\": %lu, \"threads\": %lu, \"file_size\": ",
+            (unsigned long)stats->relocations, (unsigned long)stats->threads);
+    if (stats->file_size >= 0)
+        fprintf(file, "%ld}\n", stats->file_size);
+    else
+        fprintf(file, "null}\n");
+}
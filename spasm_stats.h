@@ -0,0 +1,154 @@
+/*
+ * Copyright (C) 2011, Stefan Hacker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#include <stdio.h>
+#include <stddef.h>
+
+#include "spasm_types.h"
+
+#ifndef SPASM_STATS_H_
+#define SPASM_STATS_H_
+
+/**
+ * @brief Enumeration of the timed compilation phases.
+ */
+typedef enum StatsPhase
+{
+    STATS_PARSE, /* parse_file without the checks */
+    STATS_CHECK, /* check_result */
+    STATS_ANALYSES, /* analyses computed for the passes, @see run_passes */
+    STATS_JUMP_THREADING,
+    STATS_UNREACHABLE,
+    STATS_DEAD_STORES,
+    STATS_VECTORIZE,
+    STATS_FUSE,
+    STATS_LOOP_INVARIANTS,
+    STATS_VALUE_NUMBERING,
+    STATS_INDEXED,
+    STATS_DATA_LAYOUT,
+    STATS_BLOCK_LAYOUT,
+    STATS_INSTRUMENT,
+    STATS_ALIGN_LOOPS,
+    STATS_EMIT, /* emitting the text segment with its relocations */
+    STATS_PLACE, /* placing the segments and memory locations */
+    STATS_RELOCATE, /* applying (and writing) the relocations */
+    STATS_WRITE, /* writing the binary, loading it for --run */
+    STATS_PHASE_COUNT
+} StatsPhase;
+
+/**
+ * @brief Names of the phases in StatsPhase order.
+ */
+extern const char *SPASM_STATS_PHASES[];
+
+typedef struct StatsClock StatsClock;
+
+/**
+ * @brief Start of a timed phase.
+ */
+struct StatsClock
+{
+    double wall; /* seconds on the monotonic clock */
+    double cpu; /* seconds of process cpu time, summed over all threads */
+};
+
+/**
+ * @brief Statistics collected while compiling a program.
+ */
+struct SpasmStats
+{
+    double wall[STATS_PHASE_COUNT]; /* wall time per phase in seconds */
+    double cpu[STATS_PHASE_COUNT]; /* cpu time per phase in seconds */
+    size_t heap[STATS_PHASE_COUNT]; /* heap bytes in use after the phase, 0 if unknown */
+    int ran[STATS_PHASE_COUNT]; /* the phase ran */
+
+    unsigned long label_lookups;
+    unsigned long label_probes; /* labels compared during the lookups */
+    unsigned long variable_lookups;
+    unsigned long variable_probes; /* memory locations compared during the lookups */
+
+    unsigned long allocations; /* allocations of the parser and the writer */
+    unsigned long allocated_bytes;
+
+    size_t text_size;
+    size_t rodata_size;
+    size_t data_size;
+    size_t bss_size;
+    size_t relocations; /* entries of the relocation table */
+    size_t threads; /* threads the code generation was split between */
+    long file_size; /* size of the written binary, -1 if none was written */
+
+    long peak_rss; /* peak resident set size in KiB, -1 if unknown */
+};
+
+/**
+ * @brief Resets the statistics.
+ */
+void init_stats(SpasmStats *stats);
+
+/**
+ * @brief Starts timing a phase.
+ * @param stats Statistics to collect, 0 to do nothing
+ * @param clock Set to the start of the phase
+ */
+void start_phase(const SpasmStats *stats, StatsClock *clock);
+
+/**
+ * @brief Adds the time since start_phase to the given phase.
+ * @param stats Statistics to collect, 0 to do nothing
+ * @param phase Phase to account the time to
+ * @param clock Start of the phase
+ */
+void end_phase(SpasmStats *stats, const StatsPhase phase, const StatsClock *clock);
+
+/**
+ * @brief Counts an allocation of the given size.
+ * @param stats Statistics to collect, 0 to do nothing
+ */
+void count_allocation(SpasmStats *stats, const size_t size);
+
+/**
+ * @brief Samples the peak resident set size of the process.
+ */
+void finish_stats(SpasmStats *stats);
+
+/**
+ * @brief Writes a human readable report.
+ */
+void write_stats(FILE *file, const SpasmStats *stats);
+
+/**
+ * @brief Writes the statistics as a single line JSON object.
+ * @param file File to write to
+ * @param stats Statistics to write
+ * @param source Name of the compiled source file
+ */
+void write_stats_json(FILE *file, const SpasmStats *stats, const char *source);
+
+/**
+ * @brief Writes a quoted JSON string, escaping quotes, backslashes and
+ *        control characters.
+ * @param file File to write to
+ * @param string String to write
+ */
+void write_json_string(FILE *file, const char *string);
+
+#endif /* SPASM_STATS_H_ */
@@ -37,6 +37,8 @@ const char SPASM_MNEMONICS[][MAX_MNEMONIC_LENGTH + 1] = {
         "LC",
         "LV",
         "STR",
+        "CPY",
+        "FIL",
 
         "PRI",
         "REA",
@@ -47,7 +49,18 @@ const char SPASM_MNEMONICS[][MAX_MNEMONIC_LENGTH + 1] = {
         "STP",
 
         "",
-        "DS"
+        "DS",
+        "DD",
+        "DC",
+
+        "VEC",
+        "CNT",
+        "JNZ",
+        "ALN",
+        "RMW",
+        "DUP",
+        "LVX",
+        "STX"
 };
 
 const char SPASM_ERR_STR[][128] = {
@@ -63,5 +76,9 @@ const char SPASM_ERR_STR[][128] = {
         "ERR_CONSTANT_RANGE",
         "ERR_INVALID_MNEMONIC",
         "ERR_NO_COMMANDS",
+        "ERR_JIT",
+        "ERR_RUNTIME",
+        "ERR_PROFILE",
+        "ERR_MODULE",
         "ERR_INTERNAL",
 };
@@ -35,6 +35,9 @@ typedef struct MemoryLocation MemoryLocation;
 typedef struct Label Label;
 typedef struct Command Command;
 typedef struct ParserState ParserState;
+typedef struct VectorLoop VectorLoop;
+typedef struct MemoryUpdate MemoryUpdate;
+typedef struct SpasmStats SpasmStats;
 
 
 /**
@@ -57,6 +60,9 @@ struct MemoryLocation
     unsigned char *content; /* 0 for BSS */
 
     uint32_t vaddr; /* absolute location in virtual memory during execution */
+    uint32_t padding; /* unused bytes in front of this BSS location, set by the data layout */
+    uint32_t accesses; /* weighted access count of the data layout, 0 if not laid out */
+    int imported; /* used by a module but defined by another one, @see link_modules */
 
     MemoryLocation *next;
 };
@@ -107,6 +113,8 @@ typedef enum CommandType
     SPASM_LC,  /* push(constant) */
     SPASM_LV,  /* push(*pop()) */
     SPASM_STR, /* *(pop() * 4) = pop() */
+    SPASM_CPY, /* n=pop(); d=pop(); s=pop(); copy n words from s * 4 to d * 4 in ascending order */
+    SPASM_FIL, /* n=pop(); d=pop(); v=pop(); store v to the n words from d * 4 */
 
     /*
      * IO operations
@@ -125,8 +133,26 @@ typedef enum CommandType
     SPASM_STP, /* exit() */
 
     SPASM_RUNTIME_COMMAND_COUNT,
-    /* Note: Memory allocation (DS) is not a command that is executed during runtime */
-    SPASM_DS
+    /* Note: Memory allocation (DS, DD, DC) is not a command that is executed during runtime */
+    SPASM_DS,
+    SPASM_DD, /* initialized read/write variable */
+    SPASM_DC, /* initialized read-only variable */
+
+    /*
+     * Internal commands. Never created by the parser but inserted
+     * into the command list by optimizations and instrumentation.
+     */
+
+    SPASM_VEC, /* vectorized iterations of the following counted loop (vector_arg) */
+    SPASM_CNT, /* ++*memory_arg, basic block execution counter */
+    SPASM_JNZ, /* a = pop(); if (a != 0) jmp(label_arg->vaddr) */
+    SPASM_ALN, /* nops up to the next constant_arg byte boundary */
+    SPASM_RMW, /* *m = *m <operation> constant in place (update_arg) */
+    SPASM_DUP, /* push(stack[top - constant_arg]), copy of a value on the stack */
+    SPASM_LVX, /* push(*(memory_arg->vaddr + pop() * 4)), indexed LV */
+    SPASM_STX, /* *(memory_arg->vaddr + pop() * 4) = pop(), indexed STR */
+
+    SPASM_COMMAND_TYPE_COUNT
 } CommandType;
 
 
@@ -136,6 +162,18 @@ typedef enum CommandType
 extern const char SPASM_MNEMONICS[][MAX_MNEMONIC_LENGTH + 1];
 
 
+/**
+ * @brief In-place update of a variable with a constant, the fused form of
+ *        LA $m / LV / LC constant / <operation> / LA $m / STR.
+ */
+struct MemoryUpdate
+{
+    MemoryLocation *memory; /* updated variable */
+    CommandType operation; /* SPASM_ADD, SPASM_SUB or SPASM_MUL */
+    uint32_t constant;
+};
+
+
 /**
  * @brief LL-entry for holding a single SPASM application command (e.g. LC 1).
  */
@@ -148,6 +186,8 @@ struct Command
         Label *label_arg;           /* Label argument (e.g. JMP cmds) */
         MemoryLocation *memory_arg; /* Address argument (e.g. LA) */
         uint32_t constant_arg;      /* Constant argument (e.g. LC) */
+        VectorLoop *vector_arg;     /* Vectorized loop description (VEC) */
+        MemoryUpdate *update_arg;   /* Fused variable update (RMW) */
     } argument; /* Argument of this command. Ignored for commands without argument. */
 
     Label *label; /* Label pointing to this command, 0 if none */
@@ -178,6 +218,10 @@ struct ParserState
     Command *command_last;
 
     uint32_t last_line; /* Last source line processed by the parser */
+    int module; /* Undefined labels and variables are imports of a module */
+    int rodata_words; /* rodata holds DC variables, which LA addresses by word */
+
+    SpasmStats *stats; /* Statistics to collect, 0 for none @see spasm_stats.h */
 };
 
 typedef int Errc;
@@ -201,6 +245,10 @@ enum ErrcCode
     ERR_CONSTANT_RANGE,
     ERR_INVALID_MNEMONIC,
     ERR_NO_COMMANDS,
+    ERR_JIT, /* Failed to map memory for an in-process run */
+    ERR_RUNTIME, /* Interpreted program failed */
+    ERR_PROFILE, /* Malformed profile or profile of a different program */
+    ERR_MODULE, /* Malformed module or modules of different architectures */
     ERR_INTERNAL /* Internal spasm failure */
 };
 
@@ -0,0 +1,1200 @@
+/*
+ * Copyright (C) 2011, Stefan Hacker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "spasm_vectorizer.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#define VECTOR_MAX_NODES 256
+#define VECTOR_MAX_STATEMENTS 32
+#define VECTOR_MAX_DEPTH 16
+
+typedef struct VectorNode VectorNode;
+typedef struct VectorStatement VectorStatement;
+typedef struct VectorAnalysis VectorAnalysis;
+
+/**
+ * @brief Enumeration of expression tree node types built from loop bodies.
+ */
+typedef enum VectorNodeType
+{
+    VNODE_CONSTANT,  /* LC */
+    VNODE_ADDRESS,   /* LA */
+    VNODE_SCALAR,    /* LA / LV */
+    VNODE_ELEMENT,   /* LA / LA $i / LV / ADD / LV */
+    VNODE_OPERATION  /* ADD, SUB, MUL, AND */
+} VectorNodeType;
+
+
+/**
+ * @brief Expression tree node.
+ */
+struct VectorNode
+{
+    VectorNodeType type;
+
+    CommandType operation; /* VNODE_OPERATION */
+    uint32_t constant; /* VNODE_CONSTANT */
+    MemoryLocation *memory; /* VNODE_ADDRESS, VNODE_SCALAR and VNODE_ELEMENT */
+
+    VectorNode *left;
+    VectorNode *right;
+};
+
+
+/**
+ * @brief Single STR of a loop body.
+ */
+struct VectorStatement
+{
+    int element; /* 1 for $target[i] = value, 0 for $target = value */
+    MemoryLocation *target;
+    VectorNode *value;
+};
+
+
+/**
+ * @brief Result of analyzing a loop candidate.
+ */
+struct VectorAnalysis
+{
+    VectorNode nodes[VECTOR_MAX_NODES];
+    uint32_t node_count;
+
+    VectorStatement statements[VECTOR_MAX_STATEMENTS];
+    uint32_t statement_count;
+
+    MemoryLocation *counter;
+    uint32_t limit;
+};
+
+
+/**
+ * @brief Allocate a node from the analysis node pool.
+ * @return Node or 0 if the pool is exhausted.
+ */
+VectorNode *vector_node(VectorAnalysis *analysis, const VectorNodeType type)
+{
+    VectorNode *node;
+
+    if (analysis->node_count == VECTOR_MAX_NODES)
+        return 0;
+
+    node = &analysis->nodes[analysis->node_count++];
+    memset(node, 0, sizeof(VectorNode));
+    node->type = type;
+
+    return node;
+}
+
+
+/**
+ * @brief Check whether the node computes the address of $array[i].
+ * @return Accessed array or 0 if the node is no unit-stride access.
+ */
+MemoryLocation *vector_element_of(const VectorAnalysis *analysis, const VectorNode *node)
+{
+    if (node->type != VNODE_OPERATION || node->operation != SPASM_ADD)
+        return 0;
+
+    if (node->left->type == VNODE_ADDRESS
+            && node->right->type == VNODE_SCALAR
+            && node->right->memory == analysis->counter)
+        return node->left->memory;
+
+    if (node->right->type == VNODE_ADDRESS
+            && node->left->type == VNODE_SCALAR
+            && node->left->memory == analysis->counter)
+        return node->right->memory;
+
+    return 0;
+}
+
+
+/**
+ * @brief Count the loads of the given variable in an expression tree.
+ * @param node Tree to search
+ * @param memory Variable to look for
+ * @param element 1 to count $memory[i] loads, 0 to count $memory loads
+ */
+uint32_t vector_count_loads(const VectorNode *node, const MemoryLocation *memory, const int element)
+{
+    switch (node->type)
+    {
+    case VNODE_OPERATION:
+        return vector_count_loads(node->left, memory, element)
+                + vector_count_loads(node->right, memory, element);
+    case VNODE_SCALAR:
+        return !element && node->memory == memory;
+    case VNODE_ELEMENT:
+        return element && node->memory == memory;
+    default:
+        return 0;
+    }
+}
+
+
+/**
+ * @brief Check that an expression tree only consists of vectorizable values.
+ */
+int vector_value_valid(const VectorNode *node)
+{
+    switch (node->type)
+    {
+    case VNODE_OPERATION:
+        return vector_value_valid(node->left) && vector_value_valid(node->right);
+    case VNODE_ADDRESS:
+        return 0;
+    default:
+        return 1;
+    }
+}
+
+
+/**
+ * @brief Number of xmm registers required to evaluate an expression tree.
+ */
+uint32_t vector_registers_needed(const VectorNode *node)
+{
+    uint32_t left;
+    uint32_t right;
+    uint32_t own;
+
+    /* Counters and inductions load their lane steps into a second register */
+    if (node->type == VNODE_SCALAR)
+        return 2;
+
+    if (node->type != VNODE_OPERATION)
+        return 1;
+
+    left = vector_registers_needed(node->left);
+    right = vector_registers_needed(node->right) + 1;
+    own = node->operation == SPASM_MUL ? 4 : 2;
+
+    if (left > own)
+        own = left;
+
+    return right > own ? right : own;
+}
+
+
+/**
+ * @brief Build statements from the stack code between first and end.
+ * @return 1 if every command could be represented.
+ */
+int vector_parse_statements(VectorAnalysis *analysis, const Command *first, const Command *end)
+{
+    VectorNode *stack[VECTOR_MAX_DEPTH];
+    uint32_t depth = 0;
+    const Command *cmd;
+    VectorNode *node;
+    VectorStatement *statement;
+    MemoryLocation *array;
+
+    for (cmd = first; cmd != end; cmd = cmd->next)
+    {
+        if (cmd->label)
+            return 0; /* Loop body must not be entered from elsewhere */
+
+        switch (cmd->type)
+        {
+        case SPASM_NOP:
+            break;
+
+        case SPASM_LC:
+        case SPASM_LA:
+            if (depth == VECTOR_MAX_DEPTH)
+                return 0;
+
+            node = vector_node(analysis, cmd->type == SPASM_LC ? VNODE_CONSTANT : VNODE_ADDRESS);
+            if (!node)
+                return 0;
+
+            if (cmd->type == SPASM_LC)
+                node->constant = cmd->argument.constant_arg;
+            else
+                node->memory = cmd->argument.memory_arg;
+
+            stack[depth++] = node;
+            break;
+
+        case SPASM_LV:
+            if (depth < 1)
+                return 0;
+
+            node = stack[depth - 1];
+            if (node->type == VNODE_ADDRESS)
+            {
+                node->type = VNODE_SCALAR;
+            }
+            else if ((array = vector_element_of(analysis, node)) != 0)
+            {
+                node->type = VNODE_ELEMENT;
+                node->memory = array;
+                node->left = node->right = 0;
+            }
+            else
+            {
+                return 0; /* Computed address */
+            }
+            break;
+
+        case SPASM_ADD:
+        case SPASM_SUB:
+        case SPASM_MUL:
+        case SPASM_AND:
+            if (depth < 2)
+                return 0;
+
+            node = vector_node(analysis, VNODE_OPERATION);
+            if (!node)
+                return 0;
+
+            node->operation = cmd->type;
+            node->left = stack[depth - 2];
+            node->right = stack[depth - 1];
+
+            stack[--depth - 1] = node;
+            break;
+
+        case SPASM_STR:
+            /* Statements must not leave values on the stack */
+            if (depth != 2 || analysis->statement_count == VECTOR_MAX_STATEMENTS)
+                return 0;
+
+            statement = &analysis->statements[analysis->statement_count++];
+            statement->value = stack[0];
+
+            if (stack[1]->type == VNODE_ADDRESS)
+            {
+                statement->element = 0;
+                statement->target = stack[1]->memory;
+            }
+            else if ((array = vector_element_of(analysis, stack[1])) != 0)
+            {
+                statement->element = 1;
+                statement->target = array;
+            }
+            else
+            {
+                return 0;
+            }
+
+            if (!vector_value_valid(statement->value))
+                return 0;
+
+            depth = 0;
+            break;
+
+        default:
+            return 0;
+        }
+    }
+
+    return depth == 0;
+}
+
+
+/**
+ * @brief Return the constant step of an induction update $x = $x + c.
+ * @return 1 if the statement is such an update.
+ */
+int vector_induction_step(const VectorStatement *statement, uint32_t *step)
+{
+    const VectorNode *value = statement->value;
+    const VectorNode *constant;
+
+    if (statement->element || value->type != VNODE_OPERATION || value->operation != SPASM_ADD)
+        return 0;
+
+    if (value->left->type == VNODE_SCALAR && value->left->memory == statement->target)
+        constant = value->right;
+    else if (value->right->type == VNODE_SCALAR && value->right->memory == statement->target)
+        constant = value->left;
+    else
+        return 0;
+
+    if (constant->type != VNODE_CONSTANT)
+        return 0;
+
+    *step = constant->constant;
+    return 1;
+}
+
+
+/**
+ * @brief Return the accumulated expression of a reduction $x = $x +/- expr.
+ * @return Expression or 0 if the statement is no reduction.
+ */
+const VectorNode *vector_reduction_of(const VectorStatement *statement, VectorOpType *type)
+{
+    const VectorNode *value = statement->value;
+    const VectorNode *expression;
+
+    if (statement->element || value->type != VNODE_OPERATION)
+        return 0;
+
+    if (value->left->type == VNODE_SCALAR && value->left->memory == statement->target
+            && (value->operation == SPASM_ADD || value->operation == SPASM_SUB))
+    {
+        expression = value->right;
+        *type = value->operation == SPASM_ADD ? VOP_ACCUMULATE : VOP_DEDUCT;
+    }
+    else if (value->right->type == VNODE_SCALAR && value->right->memory == statement->target
+            && value->operation == SPASM_ADD)
+    {
+        expression = value->left;
+        *type = VOP_ACCUMULATE;
+    }
+    else
+    {
+        return 0;
+    }
+
+    if (vector_count_loads(expression, statement->target, 0) != 0)
+        return 0;
+
+    return expression;
+}
+
+
+/**
+ * @brief Check the dependencies between the statements of an analyzed loop.
+ * @return 1 if the loop can be vectorized.
+ */
+int vector_check_statements(const VectorAnalysis *analysis)
+{
+    const VectorStatement *statement;
+    const VectorStatement *other;
+    const VectorStatement *last;
+    uint32_t i;
+    uint32_t j;
+    uint32_t loads;
+    uint32_t step;
+    VectorOpType type;
+
+    if (analysis->statement_count < 2)
+        return 0;
+
+    /* Last statement has to be the counter increment */
+    last = &analysis->statements[analysis->statement_count - 1];
+    if (last->element || last->target != analysis->counter
+            || !vector_induction_step(last, &step) || step != 1)
+        return 0;
+
+    for (i = 0; i < analysis->statement_count; ++i)
+    {
+        statement = &analysis->statements[i];
+
+        if (statement->element)
+        {
+            /* In-bounds accesses of different arrays can not alias */
+            if (statement->target->size / 4 < analysis->limit
+                    || statement->target == analysis->counter)
+                return 0;
+        }
+        else if (statement != last && statement->target == analysis->counter)
+        {
+            return 0;
+        }
+
+        for (j = 0; j < analysis->statement_count; ++j)
+        {
+            other = &analysis->statements[j];
+
+            /* Every variable is stored by a single statement */
+            if (i != j && other->target == statement->target)
+                return 0;
+
+            if (statement->element)
+            {
+                /* Stored arrays must not be read as scalars */
+                if (vector_count_loads(other->value, statement->target, 0) != 0)
+                    return 0;
+            }
+            else
+            {
+                /* Stored scalars must not be accessed as arrays */
+                if (vector_count_loads(other->value, statement->target, 1) != 0
+                        || (other->element && other->target == statement->target))
+                    return 0;
+            }
+        }
+
+        if (!statement->element && statement != last
+                && !vector_induction_step(statement, &step))
+        {
+            /* Reductions must not be read by any other statement */
+            if (!vector_reduction_of(statement, &type))
+                return 0;
+
+            loads = 0;
+            for (j = 0; j < analysis->statement_count; ++j)
+                loads += vector_count_loads(analysis->statements[j].value, statement->target, 0);
+
+            if (loads != 1)
+                return 0;
+        }
+    }
+
+    /* Loaded arrays have to be in bounds as well */
+    for (i = 0; i < analysis->node_count; ++i)
+    {
+        if (analysis->nodes[i].type == VNODE_ELEMENT
+                && (analysis->nodes[i].memory->size / 4 < analysis->limit
+                        || analysis->nodes[i].memory == analysis->counter))
+            return 0;
+    }
+
+    return 1;
+}
+
+
+/**
+ * @brief Return the command if it is of the given type and can not be jumped to.
+ */
+const Command *vector_expect(const Command *cmd, const CommandType type)
+{
+    if (!cmd || cmd->type != type || cmd->label)
+        return 0;
+
+    return cmd;
+}
+
+
+/**
+ * @brief Analyze the loop starting at the given labeled command.
+ * @return 1 if the loop can be vectorized.
+ */
+int vector_analyze_loop(VectorAnalysis *analysis, const Command *head)
+{
+    const Command *cmd = head;
+    const Command *counter;
+    const Command *limit;
+    const Command *condition;
+    const Command *jump;
+    const Label *exit_label;
+
+    analysis->node_count = 0;
+    analysis->statement_count = 0;
+
+    while (cmd->type == SPASM_NOP)
+    {
+        cmd = cmd->next;
+        if (!cmd || cmd->label)
+            return 0;
+    }
+
+    /* Loop condition: LA $i / LV / LC n / LES / JIN #exit */
+    if (cmd->type != SPASM_LA)
+        return 0;
+
+    counter = cmd;
+    if (!vector_expect(counter->next, SPASM_LV)
+            || !(limit = vector_expect(counter->next->next, SPASM_LC))
+            || !vector_expect(limit->next, SPASM_LES)
+            || !(condition = vector_expect(limit->next->next, SPASM_JIN)))
+        return 0;
+
+    analysis->counter = counter->argument.memory_arg;
+    analysis->limit = limit->argument.constant_arg;
+    if (analysis->limit == 0 || analysis->limit > 0x3fffffff)
+        return 0;
+
+    /* Body ends with the back edge, the loop exit has to follow it */
+    jump = condition->next;
+    while (jump && jump->type != SPASM_JMP)
+        jump = jump->next;
+
+    exit_label = condition->argument.label_arg;
+    if (!jump || jump->argument.label_arg != head->label
+            || !jump->next || exit_label->command != jump->next)
+        return 0;
+
+    return vector_parse_statements(analysis, condition->next, jump)
+            && vector_check_statements(analysis);
+}
+
+
+/**
+ * @brief Return a 16 byte rodata location holding the given lanes.
+ * @return Location or 0 on allocation failure.
+ */
+MemoryLocation *vector_constant(ParserState *parser, const uint32_t lanes[VECTOR_WIDTH])
+{
+    const size_t size = VECTOR_WIDTH * sizeof(uint32_t);
+    MemoryLocation *cur = parser->memory_location_first;
+    uint32_t count = 0;
+
+    while (cur)
+    {
+        if (cur->type == SPASM_RODATA && strncmp(cur->name, "_vec", 4) == 0)
+        {
+            if (memcmp(cur->content, lanes, size) == 0)
+                return cur;
+
+            ++count;
+        }
+        cur = cur->next;
+    }
+
+    cur = (MemoryLocation*)calloc(1, sizeof(MemoryLocation));
+    if (!cur)
+        return 0;
+
+    cur->content = (unsigned char*)malloc(size);
+    if (!cur->content)
+    {
+        free(cur);
+        return 0;
+    }
+
+    /* '_' is no valid symbol character so the name can not clash */
+    sprintf(cur->name, "_vec%u", count);
+    memcpy(cur->content, lanes, size);
+    cur->size = size;
+    cur->type = SPASM_RODATA;
+    cur->source_line = INVALID_LINE;
+
+    if (parser->memory_location_first == 0)
+        parser->memory_location_first = cur;
+    else
+        parser->memory_location_last->next = cur;
+
+    parser->memory_location_last = cur;
+    parser->rodata_used += size;
+
+    return cur;
+}
+
+
+/**
+ * @brief Return the rodata step vector { 0, c, 2c, 3c } + offset.
+ */
+MemoryLocation *vector_step(ParserState *parser, const uint32_t step, const uint32_t offset)
+{
+    uint32_t lanes[VECTOR_WIDTH];
+    uint32_t i;
+
+    for (i = 0; i < VECTOR_WIDTH; ++i)
+        lanes[i] = step * i + offset;
+
+    return vector_constant(parser, lanes);
+}
+
+
+/**
+ * @brief Append an operation to the loop.
+ * @return Appended operation or 0 if the loop is full.
+ */
+VectorOp *vector_op(VectorLoop *loop, const VectorOpType type, const uint32_t depth)
+{
+    VectorOp *op;
+
+    if (loop->op_count == VECTOR_MAX_OPS)
+        return 0;
+
+    op = &loop->ops[loop->op_count++];
+    op->type = type;
+    op->depth = depth;
+
+    return op;
+}
+
+
+
+
+/**
+ * @brief Map an arithmetic command to the corresponding vector operation.
+ */
+VectorOpType vector_operation(const CommandType type)
+{
+    switch (type)
+    {
+    case SPASM_SUB:
+        return VOP_SUB;
+    case SPASM_MUL:
+        return VOP_MUL;
+    case SPASM_AND:
+        return VOP_AND;
+    default:
+        return VOP_ADD;
+    }
+}
+
+
+/**
+ * @brief Generate the operations evaluating an expression tree into xmm[depth].
+ * @param statement Index of the statement the expression belongs to
+ */
+Errc vector_generate_value(ParserState *parser, const VectorAnalysis *analysis, VectorLoop *loop,
+        const VectorNode *node, const uint32_t depth, const uint32_t statement)
+{
+    uint32_t lanes[VECTOR_WIDTH];
+    uint32_t step;
+    uint32_t i;
+    VectorOp *op;
+    Errc result;
+
+    switch (node->type)
+    {
+    case VNODE_OPERATION:
+        result = vector_generate_value(parser, analysis, loop, node->left, depth, statement);
+        if (result != ERR_SUCCESS)
+            return result;
+
+        result = vector_generate_value(parser, analysis, loop, node->right, depth + 1, statement);
+        if (result != ERR_SUCCESS)
+            return result;
+
+        op = vector_op(loop, vector_operation(node->operation), depth);
+        return op ? ERR_SUCCESS : ERR_INTERNAL;
+
+    case VNODE_CONSTANT:
+        op = vector_op(loop, VOP_CONSTANT, depth);
+        if (!op)
+            return ERR_INTERNAL;
+
+        for (i = 0; i < VECTOR_WIDTH; ++i)
+            lanes[i] = node->constant;
+
+        op->memory = vector_constant(parser, lanes);
+        return op->memory ? ERR_SUCCESS : ERR_ALLOC;
+
+    case VNODE_ELEMENT:
+        op = vector_op(loop, VOP_LOAD, depth);
+        if (!op)
+            return ERR_INTERNAL;
+
+        op->memory = node->memory;
+        return ERR_SUCCESS;
+
+    case VNODE_SCALAR:
+        if (node->memory == analysis->counter)
+        {
+            op = vector_op(loop, VOP_COUNTER, depth);
+            if (!op)
+                return ERR_INTERNAL;
+
+            op->memory = node->memory;
+            op->step = vector_step(parser, 1, 0);
+            return op->step ? ERR_SUCCESS : ERR_ALLOC;
+        }
+
+        for (i = 0; i < loop->induction_count; ++i)
+        {
+            if (loop->inductions[i] == node->memory)
+                break;
+        }
+
+        if (i == loop->induction_count)
+        {
+            op = vector_op(loop, VOP_BROADCAST, depth);
+            if (!op)
+                return ERR_INTERNAL;
+
+            op->memory = node->memory;
+            return ERR_SUCCESS;
+        }
+
+        step = loop->induction_steps[i];
+
+        op = vector_op(loop, VOP_INDUCTION, depth);
+        if (!op)
+            return ERR_INTERNAL;
+
+        /* Statements behind the update see the advanced value */
+        for (i = 0; i < statement; ++i)
+        {
+            if (!analysis->statements[i].element && analysis->statements[i].target == node->memory)
+                break;
+        }
+
+        op->memory = node->memory;
+        op->step = vector_step(parser, step, i < statement ? step : 0);
+        return op->step ? ERR_SUCCESS : ERR_ALLOC;
+
+    default:
+        return ERR_INTERNAL;
+    }
+}
+
+
+/**
+ * @brief Assign inductions and reductions and check the register budget.
+ * @return 1 if the analyzed loop fits into a VectorLoop.
+ */
+int vector_plan(const VectorAnalysis *analysis, VectorLoop *loop)
+{
+    const VectorStatement *statement;
+    const VectorNode *value;
+    VectorOpType type;
+    uint32_t registers = 1;
+    uint32_t needed;
+    uint32_t step;
+    uint32_t i;
+
+    memset(loop, 0, sizeof(VectorLoop));
+    loop->counter = analysis->counter;
+    loop->limit = analysis->limit;
+
+    /* Every node and statement yields at most one operation */
+    if (analysis->node_count + analysis->statement_count > VECTOR_MAX_OPS)
+        return 0;
+
+    for (i = 0; i + 1 < analysis->statement_count; ++i)
+    {
+        statement = &analysis->statements[i];
+        value = statement->value;
+
+        if (!statement->element)
+        {
+            if (vector_induction_step(statement, &step))
+            {
+                if (loop->induction_count == VECTOR_MAX_INDUCTIONS)
+                    return 0;
+
+                loop->inductions[loop->induction_count] = statement->target;
+                loop->induction_steps[loop->induction_count++] = step;
+                continue;
+            }
+
+            if (loop->reduction_count == VECTOR_MAX_REDUCTIONS)
+                return 0;
+
+            value = vector_reduction_of(statement, &type);
+            loop->reductions[loop->reduction_count++] = statement->target;
+        }
+
+        needed = vector_registers_needed(value);
+        if (needed > registers)
+            registers = needed;
+    }
+
+    return registers + loop->reduction_count <= VECTOR_REGISTERS;
+}
+
+
+/**
+ * @brief Generate the chunk operations of a planned loop.
+ */
+Errc vector_generate(ParserState *parser, const VectorAnalysis *analysis, VectorLoop *loop)
+{
+    const VectorStatement *statement;
+    const VectorNode *value;
+    VectorOpType type;
+    VectorOp *op;
+    uint32_t step;
+    uint32_t i;
+    uint32_t reduction;
+    Errc result;
+
+    for (i = 0; i + 1 < analysis->statement_count; ++i)
+    {
+        statement = &analysis->statements[i];
+        value = statement->value;
+        type = VOP_STORE;
+
+        if (!statement->element)
+        {
+            if (vector_induction_step(statement, &step))
+                continue;
+
+            value = vector_reduction_of(statement, &type);
+        }
+
+        result = vector_generate_value(parser, analysis, loop, value, 0, i);
+        if (result != ERR_SUCCESS)
+            return result;
+
+        op = vector_op(loop, type, 0);
+        if (!op)
+            return ERR_INTERNAL;
+
+        op->memory = statement->target;
+        for (reduction = 0; reduction < loop->reduction_count; ++reduction)
+        {
+            if (loop->reductions[reduction] == statement->target)
+                op->reduction = reduction;
+        }
+    }
+
+    return ERR_SUCCESS;
+}
+
+
+Errc vectorize_loops(ParserState *parser, uint32_t *vectorized)
+{
+    VectorAnalysis *analysis;
+    VectorLoop *loop;
+    Command *vec;
+    Command *prev = 0;
+    Command *cur = parser->command_first;
+    Errc result = ERR_SUCCESS;
+
+    *vectorized = 0;
+
+    analysis = (VectorAnalysis*)malloc(sizeof(VectorAnalysis));
+    loop = (VectorLoop*)malloc(sizeof(VectorLoop));
+    if (!analysis || !loop)
+    {
+        free(analysis);
+        free(loop);
+        return ERR_ALLOC;
+    }
+
+    while (cur)
+    {
+        if (cur->label && vector_analyze_loop(analysis, cur) && vector_plan(analysis, loop))
+        {
+            vec = (Command*)calloc(1, sizeof(Command));
+            if (!vec)
+            {
+                result = ERR_ALLOC;
+                break;
+            }
+
+            result = vector_generate(parser, analysis, loop);
+            if (result != ERR_SUCCESS)
+            {
+                free(vec);
+                break;
+            }
+
+            /* Loop label stays on the scalar loop which is entered by falling through */
+            vec->type = SPASM_VEC;
+            vec->argument.vector_arg = loop;
+            vec->source_line = cur->source_line;
+            vec->next = cur;
+
+            if (prev)
+                prev->next = vec;
+            else
+                parser->command_first = vec;
+
+            ++*vectorized;
+
+            loop = (VectorLoop*)malloc(sizeof(VectorLoop));
+            if (!loop)
+            {
+                result = ERR_ALLOC;
+                break;
+            }
+        }
+
+        prev = cur;
+        cur = cur->next;
+    }
+
+    free(analysis);
+    free(loop);
+    return result;
+}
+
+
+/**
+ * @brief Append bytes to the buffer if there is one.
+ */
+void vector_emit(unsigned char *buffer, size_t *position, const unsigned char *bytes, const size_t count)
+{
+    if (buffer)
+        memcpy(buffer + *position, bytes, count);
+
+    *position += count;
+}
+
+
+/**
+ * @brief Append a little endian 32 bit value.
+ */
+void vector_emit_uint32(unsigned char *buffer, size_t *position, const uint32_t value)
+{
+    unsigned char bytes[4];
+
+    bytes[0] = value & 0xff;
+    bytes[1] = (value >> 8) & 0xff;
+    bytes[2] = (value >> 16) & 0xff;
+    bytes[3] = (value >> 24) & 0xff;
+
+    vector_emit(buffer, position, bytes, 4);
+}
+
+
+/**
+ * @brief Append an SSE2 instruction with register operands.
+ */
+void vector_emit_sse(unsigned char *buffer, size_t *position, const unsigned char prefix,
+        const unsigned char opcode, const uint32_t reg, const uint32_t rm)
+{
+    unsigned char bytes[4];
+
+    bytes[0] = prefix;
+    bytes[1] = 0x0f;
+    bytes[2] = opcode;
+    bytes[3] = 0xc0 | (reg << 3) | rm;
+
+    vector_emit(buffer, position, bytes, 4);
+}
+
+
+/**
+ * @brief Append an SSE2 instruction with an absolute memory operand.
+ *
+ * The SIB form [disp32] / [disp32 + eax*4] is used as it addresses
+ * absolutely in 32 and 64 bit mode alike.
+ *
+ * @param indexed 1 to address [vaddr + eax*4], 0 to address [vaddr]
+ */
+void vector_emit_sse_memory(unsigned char *buffer, size_t *position, const unsigned char prefix,
+        const unsigned char opcode, const uint32_t reg, const int indexed, const uint32_t vaddr)
+{
+    unsigned char bytes[5];
+
+    bytes[0] = prefix;
+    bytes[1] = 0x0f;
+    bytes[2] = opcode;
+    bytes[3] = 0x04 | (reg << 3);
+    bytes[4] = indexed ? 0x85 : 0x25;
+
+    vector_emit(buffer, position, bytes, 5);
+    vector_emit_uint32(buffer, position, vaddr);
+}
+
+
+/**
+ * @brief Append pshufd xmm[reg], xmm[rm], order.
+ */
+void vector_emit_shuffle(unsigned char *buffer, size_t *position, const uint32_t reg,
+        const uint32_t rm, const unsigned char order)
+{
+    vector_emit_sse(buffer, position, 0x66, 0x70, reg, rm);
+    vector_emit(buffer, position, &order, 1);
+}
+
+
+/**
+ * @brief Append xmm[depth] = { *memory } x4 + *step. No step is added if step is 0.
+ *        Counters are broadcast from eax instead of memory.
+ */
+void vector_emit_broadcast(unsigned char *buffer, size_t *position, const VectorOp *op)
+{
+    unsigned char move_counter[4] = { 0x66, 0x0f, 0x6e, 0xc0 };
+
+    /* The counter lives in eax while the chunks run. movd xmm, eax / movd xmm, [memory] */
+    if (op->type == VOP_COUNTER)
+    {
+        move_counter[3] |= op->depth << 3;
+        vector_emit(buffer, position, move_counter, sizeof(move_counter));
+    }
+    else
+    {
+        vector_emit_sse_memory(buffer, position, 0x66, 0x6e, op->depth, 0, op->memory->vaddr);
+    }
+
+    vector_emit_shuffle(buffer, position, op->depth, op->depth, 0x00);
+
+    /* Rodata vectors may be unaligned, load them with movdqu before paddd */
+    if (op->step)
+    {
+        vector_emit_sse_memory(buffer, position, 0xf3, 0x6f, op->depth + 1, 0, op->step->vaddr);
+        vector_emit_sse(buffer, position, 0x66, 0xfe, op->depth, op->depth + 1);
+    }
+}
+
+
+/**
+ * @brief Append the implementation of a single chunk operation.
+ */
+void vector_emit_op(unsigned char *buffer, size_t *position, const VectorOp *op)
+{
+    const uint32_t depth = op->depth;
+    static const unsigned char shift[] = { 0x66, 0x0f, 0x73, 0xd0, 0x20 };
+    unsigned char bytes[5];
+
+    switch (op->type)
+    {
+    case VOP_LOAD: /* movdqu xmm, [memory + eax*4] */
+        vector_emit_sse_memory(buffer, position, 0xf3, 0x6f, depth, 1, op->memory->vaddr);
+        break;
+    case VOP_CONSTANT: /* movdqu xmm, [memory] */
+        vector_emit_sse_memory(buffer, position, 0xf3, 0x6f, depth, 0, op->memory->vaddr);
+        break;
+    case VOP_BROADCAST:
+    case VOP_INDUCTION:
+    case VOP_COUNTER:
+        vector_emit_broadcast(buffer, position, op);
+        break;
+    case VOP_ADD: /* paddd */
+        vector_emit_sse(buffer, position, 0x66, 0xfe, depth, depth + 1);
+        break;
+    case VOP_SUB: /* psubd */
+        vector_emit_sse(buffer, position, 0x66, 0xfa, depth, depth + 1);
+        break;
+    case VOP_AND: /* pand */
+        vector_emit_sse(buffer, position, 0x66, 0xdb, depth, depth + 1);
+        break;
+    case VOP_MUL:
+        /* pmulld is SSE4.1, multiply even and odd lanes with pmuludq instead */
+        vector_emit_sse(buffer, position, 0x66, 0x6f, depth + 2, depth); /* movdqa */
+        vector_emit_sse(buffer, position, 0x66, 0xf4, depth, depth + 1); /* pmuludq: lanes 0, 2 */
+        vector_emit_sse(buffer, position, 0x66, 0x6f, depth + 3, depth + 1);
+        memcpy(bytes, shift, sizeof(shift));
+        bytes[3] |= depth + 2;
+        vector_emit(buffer, position, bytes, sizeof(shift)); /* psrlq 32 */
+        bytes[3] = shift[3] | (depth + 3);
+        vector_emit(buffer, position, bytes, sizeof(shift));
+        vector_emit_sse(buffer, position, 0x66, 0xf4, depth + 2, depth + 3); /* lanes 1, 3 */
+        vector_emit_shuffle(buffer, position, depth, depth, 0x08);
+        vector_emit_shuffle(buffer, position, depth + 2, depth + 2, 0x08);
+        vector_emit_sse(buffer, position, 0x66, 0x62, depth, depth + 2); /* punpckldq */
+        break;
+    case VOP_STORE: /* movdqu [memory + eax*4], xmm0 */
+        vector_emit_sse_memory(buffer, position, 0xf3, 0x7f, 0, 1, op->memory->vaddr);
+        break;
+    case VOP_ACCUMULATE: /* paddd */
+        vector_emit_sse(buffer, position, 0x66, 0xfe, VECTOR_REGISTERS - 1 - op->reduction, 0);
+        break;
+    case VOP_DEDUCT: /* psubd */
+        vector_emit_sse(buffer, position, 0x66, 0xfa, VECTOR_REGISTERS - 1 - op->reduction, 0);
+        break;
+    }
+}
+
+
+/**
+ * @brief Append the operations of a single chunk followed by the induction updates.
+ */
+void vector_emit_chunk(const VectorLoop *loop, unsigned char *buffer, size_t *position)
+{
+    static const unsigned char add_dword[] = { 0x81, 0x04, 0x25 };
+    static const unsigned char add_counter[] = { 0x83, 0xc0, VECTOR_WIDTH };
+    uint32_t i;
+
+    for (i = 0; i < loop->op_count; ++i)
+        vector_emit_op(buffer, position, &loop->ops[i]);
+
+    /* add dword [x], VECTOR_WIDTH * step */
+    for (i = 0; i < loop->induction_count; ++i)
+    {
+        vector_emit(buffer, position, add_dword, sizeof(add_dword));
+        vector_emit_uint32(buffer, position, loop->inductions[i]->vaddr);
+        vector_emit_uint32(buffer, position, VECTOR_WIDTH * loop->induction_steps[i]);
+    }
+
+    /* add eax, VECTOR_WIDTH */
+    vector_emit(buffer, position, add_counter, sizeof(add_counter));
+}
+
+
+/**
+ * @brief Append the horizontal sums of the reduction registers added to their variables.
+ */
+void vector_emit_reductions(const VectorLoop *loop, unsigned char *buffer, size_t *position)
+{
+    static const unsigned char add_edx[] = { 0x01, 0x14, 0x25 };
+    unsigned char move[4] = { 0x66, 0x0f, 0x7e, 0xc2 };
+    uint32_t reg;
+    uint32_t i;
+
+    for (i = 0; i < loop->reduction_count; ++i)
+    {
+        reg = VECTOR_REGISTERS - 1 - i;
+
+        vector_emit_shuffle(buffer, position, 0, reg, 0x4e);
+        vector_emit_sse(buffer, position, 0x66, 0xfe, reg, 0);
+        vector_emit_shuffle(buffer, position, 0, reg, 0xb1);
+        vector_emit_sse(buffer, position, 0x66, 0xfe, reg, 0);
+
+        /* movd edx, xmm / add [x], edx */
+        move[3] = 0xc2 | (reg << 3);
+        vector_emit(buffer, position, move, sizeof(move));
+        vector_emit(buffer, position, add_edx, sizeof(add_edx));
+        vector_emit_uint32(buffer, position, loop->reductions[i]->vaddr);
+    }
+}
+
+
+size_t write_vector_loop(const VectorLoop *loop, unsigned char *buffer)
+{
+    static const unsigned char load_counter[] = { 0x8b, 0x04, 0x25 };
+    static const unsigned char store_counter[] = { 0x89, 0x04, 0x25 };
+    static const unsigned char check_counter[] = { 0x85, 0xc0, 0x0f, 0x88 };
+    static const unsigned char compare[] = { 0x3d };
+    static const unsigned char branch[] = { 0x0f, 0x8f };
+    static const unsigned char jump[] = { 0xe9 };
+    size_t chunk_size = 0;
+    size_t reductions_size = 0;
+    size_t position = 0;
+    size_t loop_start;
+    size_t finish;
+    size_t done;
+    uint32_t i;
+
+    vector_emit_chunk(loop, 0, &chunk_size);
+    vector_emit_reductions(loop, 0, &reductions_size);
+
+    /* mov eax, [i] / test eax, eax / js done */
+    vector_emit(buffer, &position, load_counter, sizeof(load_counter));
+    vector_emit_uint32(buffer, &position, loop->counter->vaddr);
+    vector_emit(buffer, &position, check_counter, sizeof(check_counter));
+    position += 4;
+
+    /* pxor */
+    for (i = 0; i < loop->reduction_count; ++i)
+    {
+        vector_emit_sse(buffer, &position, 0x66, 0xef,
+                VECTOR_REGISTERS - 1 - i, VECTOR_REGISTERS - 1 - i);
+    }
+
+    /* cmp eax, n - VECTOR_WIDTH / jg finish */
+    loop_start = position;
+    finish = loop_start + sizeof(compare) + 4 + sizeof(branch) + 4 + chunk_size + sizeof(jump) + 4;
+    done = finish + sizeof(store_counter) + 4 + reductions_size;
+
+    if (buffer)
+    {
+        position = sizeof(load_counter) + 4 + sizeof(check_counter);
+        vector_emit_uint32(buffer, &position, (uint32_t)(done - position - 4));
+        position = loop_start;
+    }
+
+    vector_emit(buffer, &position, compare, sizeof(compare));
+    vector_emit_uint32(buffer, &position, loop->limit - VECTOR_WIDTH);
+    vector_emit(buffer, &position, branch, sizeof(branch));
+    vector_emit_uint32(buffer, &position, (uint32_t)(finish - position - 4));
+
+    vector_emit_chunk(loop, buffer, &position);
+
+    /* jmp loop_start */
+    vector_emit(buffer, &position, jump, sizeof(jump));
+    vector_emit_uint32(buffer, &position, (uint32_t)(loop_start - position - 4));
+
+    /* mov [i], eax */
+    vector_emit(buffer, &position, store_counter, sizeof(store_counter));
+    vector_emit_uint32(buffer, &position, loop->counter->vaddr);
+
+    vector_emit_reductions(loop, buffer, &position);
+
+    return position;
+}
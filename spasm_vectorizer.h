@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) 2011, Stefan Hacker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stddef.h>
+
+#include "spasm_types.h"
+
+#ifndef SPASM_VECTORIZER_H_
+#define SPASM_VECTORIZER_H_
+
+#define VECTOR_MAX_OPS 64
+#define VECTOR_MAX_REDUCTIONS 4
+#define VECTOR_MAX_INDUCTIONS 4
+#define VECTOR_REGISTERS 8
+#define VECTOR_WIDTH 4
+
+typedef struct VectorOp VectorOp;
+
+/**
+ * @brief Enumeration of the operations a vectorized loop chunk is made of.
+ *        Operations work on a stack of xmm registers, depth is the index
+ *        of the register the result is placed in.
+ */
+typedef enum VectorOpType
+{
+    VOP_LOAD,       /* xmm[depth] = memory[i .. i+3] */
+    VOP_CONSTANT,   /* xmm[depth] = *memory (rodata vector) */
+    VOP_BROADCAST,  /* xmm[depth] = { *memory } x4 */
+    VOP_COUNTER,    /* xmm[depth] = { i } x4 + *step, uses depth + 1 */
+    VOP_INDUCTION,  /* xmm[depth] = { *memory } x4 + *step, uses depth + 1 */
+
+    VOP_ADD,        /* xmm[depth] = xmm[depth] + xmm[depth + 1] */
+    VOP_SUB,        /* xmm[depth] = xmm[depth] - xmm[depth + 1] */
+    VOP_MUL,        /* xmm[depth] = xmm[depth] * xmm[depth + 1], uses depth + 2/3 */
+    VOP_AND,        /* xmm[depth] = xmm[depth] & xmm[depth + 1] */
+
+    VOP_STORE,      /* memory[i .. i+3] = xmm0 */
+    VOP_ACCUMULATE, /* reduction register += xmm0 */
+    VOP_DEDUCT      /* reduction register -= xmm0 */
+} VectorOpType;
+
+
+/**
+ * @brief Single operation of a vectorized loop chunk.
+ */
+struct VectorOp
+{
+    VectorOpType type;
+    uint32_t depth; /* xmm register the operation works on */
+
+    MemoryLocation *memory; /* array, scalar or rodata vector operand */
+    MemoryLocation *step; /* rodata lane step vector (VOP_COUNTER, VOP_INDUCTION) */
+    uint32_t reduction; /* reduction index (VOP_ACCUMULATE, VOP_DEDUCT) */
+};
+
+
+/**
+ * @brief Description of a counted loop processed VECTOR_WIDTH iterations at a time.
+ *
+ * The vectorized iterations run while counter <= limit - VECTOR_WIDTH and leave
+ * the remaining iterations to the original scalar loop following the VEC command.
+ */
+struct VectorLoop
+{
+    MemoryLocation *counter; /* loop counter variable */
+    uint32_t limit; /* loop runs while counter < limit */
+
+    VectorOp ops[VECTOR_MAX_OPS]; /* operations of a single chunk */
+    uint32_t op_count;
+
+    MemoryLocation *reductions[VECTOR_MAX_REDUCTIONS]; /* kept in xmm7 downwards */
+    uint32_t reduction_count;
+
+    MemoryLocation *inductions[VECTOR_MAX_INDUCTIONS]; /* variables advanced by a constant each iteration */
+    uint32_t induction_steps[VECTOR_MAX_INDUCTIONS];
+    uint32_t induction_count;
+};
+
+
+/**
+ * @brief Replaces counted loops over DS arrays with a VEC command followed by
+ *        the unchanged loop which then only handles the remainder.
+ *
+ * A loop qualifies if it has the form
+ *     #head LA $i / LV / LC n / LES / JIN #exit
+ *           <statements>
+ *           LA $i / LV / LC 1 / ADD / LA $i / STR
+ *           JMP #head
+ *     #exit ...
+ * where every statement is an element store $a[i] = expr, an induction
+ * update $x = $x + c or a reduction $x = $x +/- expr. Expressions may use
+ * ADD, SUB, MUL and AND on elements $a[i], constants, loop invariant
+ * variables and induction variables. Accessed arrays have to hold at least
+ * n elements.
+ *
+ * @note Generated code requires SSE2.
+ * @param parser State to update
+ * @param vectorized Set to the number of vectorized loops
+ * @return ERR_SUCCESS on success
+ */
+Errc vectorize_loops(ParserState *parser, uint32_t *vectorized);
+
+/**
+ * @brief Write the implementation of a vectorized loop.
+ * @param loop Loop to write
+ * @param buffer Buffer to write to. If 0 only the size is determined.
+ * @return Size of the implementation
+ */
+size_t write_vector_loop(const VectorLoop *loop, unsigned char *buffer);
+
+#endif /* SPASM_VECTORIZER_H_ */
@@ -20,8 +20,15 @@
  * DEALINGS IN THE SOFTWARE.
  */
 #include "spasm_writer.h"
+#include "spasm_parser.h"
 #include "spasm_commands.h"
+#include "spasm_commands64.h"
+#include "spasm_vectorizer.h"
+#include "spasm_stats.h"
+#include "spasm_listing.h"
 #include "helpers/elfwrite.h"
+#include "helpers/jit.h"
+#include "helpers/parallel.h"
 
 #include <memory.h>
 #include <assert.h>
@@ -31,13 +38,193 @@
 typedef struct SpasmBuiltins SpasmBuiltins;
 
 /**
- * @brief Structure for passing builtin function virtual addresses
- *        around.
+ * @brief Structure for passing builtin function text offsets around.
  */
 struct SpasmBuiltins
 {
-    uint32_t readint32_vaddr; /* readint32 function vaddr */
-    uint32_t printint32_vaddr; /* printint32 function vaddr */
+    uint32_t readint32_offset; /* readint32 function text offset */
+    uint32_t printint32_offset; /* printint32 function text offset */
+    uint32_t exit_offset; /* STP jump target for in-process runs and profile dumps, 0 to exit the process */
+};
+
+
+/**
+ * @brief Kinds of values patched into the text segment once all addresses are known.
+ */
+typedef enum RelocationType
+{
+    SPASM_RELOC_LABEL,       /* rel32 to the command of label */
+    SPASM_RELOC_TEXT,        /* rel32 to the text offset addend (builtins) */
+    SPASM_RELOC_MEMORY,      /* vaddr of memory + addend */
+    SPASM_RELOC_MEMORY_WORD, /* vaddr / 4 of memory (LA) */
+    SPASM_RELOC_RODATA,      /* rodata segment vaddr + addend (builtin messages) */
+    SPASM_RELOC_BSS,         /* bss segment vaddr + addend (builtin string buffer, host stack slot) */
+    SPASM_RELOC_VECTOR       /* vectorized loop, its code embeds memory vaddrs throughout */
+} RelocationType;
+
+/**
+ * @brief Names of the relocation types, index equals RelocationType.
+ */
+const char SPASM_RELOCATION_NAMES[][12] = {
+        "LABEL", "TEXT", "MEMORY", "MEMORY_WORD", "RODATA", "BSS", "VECTOR" };
+
+
+typedef struct Relocation Relocation;
+
+/**
+ * @brief Single entry of the relocation table.
+ */
+struct Relocation
+{
+    RelocationType type;
+    uint32_t offset; /* text offset of the patched uint32_t, of the code for SPASM_RELOC_VECTOR */
+    union RelocationTarget
+    {
+        const Label *label;
+        const MemoryLocation *memory;
+        const VectorLoop *vector;
+    } target; /* Unused for SPASM_RELOC_TEXT, _RODATA and _BSS */
+    uint32_t addend;
+};
+
+
+typedef struct TextImage TextImage;
+
+/**
+ * @brief Code of (a range of) the text segment emitted at text offsets
+ *        together with the relocations it still needs.
+ */
+struct TextImage
+{
+    unsigned char *code; /* code of the range */
+    size_t size; /* bytes emitted */
+    size_t capacity; /* allocated bytes of code */
+    int owned; /* code is allocated by and grows with this image */
+
+    uint32_t offset; /* text offset of code[0] */
+    uint32_t vaddr; /* vaddr the text segment is emitted for, commands get vaddr + offset */
+
+    Relocation *relocations;
+    size_t relocation_count;
+    size_t relocation_capacity;
+
+    size_t allocations; /* (re)allocations of code and relocations, @see collect_writer_stats */
+    size_t allocated_bytes;
+};
+
+
+typedef struct SegmentBases SegmentBases;
+
+/**
+ * @brief Final segment addresses used by the relocation sweep.
+ */
+struct SegmentBases
+{
+    uint32_t text; /* vaddr of text offset 0 */
+    uint32_t rodata;
+    uint32_t bss;
+};
+
+
+#define MAP_SEGMENT_COUNT 4 /* text, rodata, data and bss */
+
+typedef struct MapSegment MapSegment;
+
+/**
+ * @brief Segment as listed in the map file, @see write_map
+ */
+struct MapSegment
+{
+    const char *name;
+    uint32_t vaddr;
+    size_t size;
+};
+
+
+typedef struct SpasmTarget SpasmTarget;
+typedef struct CommandTable CommandTable;
+
+/**
+ * @brief Description of the binary sequences and the ELF flavor used
+ *        to generate a program for a target architecture.
+ */
+struct SpasmTarget
+{
+    const unsigned char **commands; /* CommandType to command implementation */
+    const size_t *command_sizes; /* CommandType to command implementation size */
+    const size_t *replacement_offsets; /* CommandType to offset of the replaced uint32_t */
+
+    const unsigned char **updates; /* UpdateEncoding to implementation */
+    const size_t *update_sizes; /* UpdateEncoding to implementation size */
+
+    const unsigned char *readint32; /* readint32 builtin implementation */
+    size_t readint32_size;
+    const uint32_t *readint32_offsets; /* prompt, strbuf, strbuf, ofm and nanm address offsets */
+
+    const unsigned char *writeint32; /* writeint32 builtin implementation */
+    size_t writeint32_size;
+    const uint32_t *writeint32_offsets; /* strbuf end - 1 and strbuf end address offsets */
+
+    const unsigned char *jit_enter; /* in-process run entry sequence */
+    size_t jit_enter_size;
+    size_t jit_enter_offset; /* host stack slot address offset */
+
+    const unsigned char *jit_leave; /* in-process run exit sequence */
+    size_t jit_leave_size;
+    size_t jit_leave_offset; /* host stack slot address offset */
+
+    const unsigned char *dump; /* instrumented program exit sequence */
+    size_t dump_size;
+    const uint32_t *dump_offsets; /* path, table, table size, counters and counters size offsets */
+
+    uint32_t base_vaddr; /* Lowest vaddr to load the program to */
+    uint32_t stack_slot; /* Bytes a value takes on the program stack */
+    const char *name; /* Architecture name as given to --arch */
+
+    void (*optimize_alignment)(uint32_t, uint32_t, uint32_t, uint32_t,
+            uint32_t*, uint32_t*, uint32_t*, uint32_t*); /* @see elf_optimize_alignment */
+
+    int (*write)(FILE*, uint32_t, uint32_t,
+            const unsigned char*, size_t,
+            uint32_t, const unsigned char*, size_t,
+            uint32_t, const unsigned char*, size_t,
+            uint32_t, size_t); /* @see elf_write */
+
+    void (*compact_alignment)(uint32_t, uint32_t, uint32_t, uint32_t,
+            uint32_t*, uint32_t*, uint32_t*, uint32_t*); /* @see elf_compact_alignment */
+
+    int (*write_compact)(FILE*, uint32_t, uint32_t,
+            const unsigned char*, size_t,
+            uint32_t, const unsigned char*, size_t,
+            uint32_t, const unsigned char*, size_t,
+            uint32_t, size_t); /* @see elf_write_compact */
+};
+
+
+/**
+ * @brief Commands each thread has to emit at least to make up for starting it.
+ */
+#define SPASM_COMMANDS_PER_THREAD 16384
+
+
+/**
+ * @brief Array of the program commands to split emission and relocation
+ *        of the text segment between threads.
+ */
+struct CommandTable
+{
+    const SpasmTarget *target;
+    Command **commands;
+    size_t count;
+    size_t threads;
+    int position_dependent; /* Contains ALN commands, their size depends on their vaddr,
+                               so the ranges are measured in one serial pass */
+    uint32_t *chunk_offset; /* Per thread size and then text offset of its range */
+    TextImage *images; /* Per thread code and relocations of its range */
+    const SpasmBuiltins *builtins; /* Emission only */
+    unsigned char *text; /* Relocation only, code of the whole text segment */
+    const SegmentBases *bases; /* Relocation only */
+    Errc *results; /* Per thread emission result */
 };
 
 
@@ -51,11 +238,17 @@ const unsigned char *SPASM_COMMANDTYPE_TO_COMMAND[] = {
 
         spasm_la, spasm_lc, spasm_lv, spasm_str,
 
+        spasm_cpy, spasm_fil,
+
         spasm_pri, spasm_rea,
 
         spasm_jmp, spasm_jin, spasm_nop, spasm_stp,
 
-        0, 0 };
+        0, 0, 0, 0,
+
+        0, spasm_cnt, spasm_jnz, 0, 0, spasm_dup,
+
+        spasm_lvx, spasm_stx };
 
 
 /**
@@ -71,14 +264,293 @@ const size_t SPASM_COMMANDTYPE_TO_COMMAND_SIZE[] = {
         sizeof(spasm_la), sizeof(spasm_lc), sizeof(spasm_lv),
         sizeof(spasm_str),
 
+        sizeof(spasm_cpy), sizeof(spasm_fil),
+
         sizeof(spasm_pri), sizeof(spasm_rea),
 
         sizeof(spasm_jmp), sizeof(spasm_jin), sizeof(spasm_nop),
         sizeof(spasm_stp),
 
-        0, 0 };
+        0, 0, 0, 0,
+
+        0, sizeof(spasm_cnt), sizeof(spasm_jnz), 0, 0, sizeof(spasm_dup),
+
+        sizeof(spasm_lvx), sizeof(spasm_stx) };
+
+
+/**
+ * @brief CommandType to x86_64 Command implementation mapper
+ */
+const unsigned char *SPASM64_COMMANDTYPE_TO_COMMAND[] = {
+        spasm64_add, spasm64_mul, spasm64_sub, spasm64_div,
+
+        spasm64_les, spasm64_and, spasm64_equ, spasm64_not,
+
+        spasm64_la, spasm64_lc, spasm64_lv, spasm64_str,
+
+        spasm64_cpy, spasm64_fil,
+
+        spasm64_pri, spasm64_rea,
+
+        spasm64_jmp, spasm64_jin, spasm64_nop, spasm64_stp,
+
+        0, 0, 0, 0,
+
+        0, spasm64_cnt, spasm64_jnz, 0, 0, spasm64_dup,
+
+        spasm64_lvx, spasm64_stx };
+
+
+/**
+ * @brief CommandType to x86_64 implementation size mapper
+ */
+const size_t SPASM64_COMMANDTYPE_TO_COMMAND_SIZE[] = {
+        sizeof(spasm64_add), sizeof(spasm64_mul), sizeof(spasm64_sub),
+        sizeof(spasm64_div),
+
+        sizeof(spasm64_les), sizeof(spasm64_and), sizeof(spasm64_equ),
+        sizeof(spasm64_not),
+
+        sizeof(spasm64_la), sizeof(spasm64_lc), sizeof(spasm64_lv),
+        sizeof(spasm64_str),
+
+        sizeof(spasm64_cpy), sizeof(spasm64_fil),
+
+        sizeof(spasm64_pri), sizeof(spasm64_rea),
+
+        sizeof(spasm64_jmp), sizeof(spasm64_jin), sizeof(spasm64_nop),
+        sizeof(spasm64_stp),
+
+        0, 0, 0, 0,
+
+        0, sizeof(spasm64_cnt), sizeof(spasm64_jnz), 0, 0, sizeof(spasm64_dup),
+
+        sizeof(spasm64_lvx), sizeof(spasm64_stx) };
+
+
+/**
+ * @brief CommandType to offset of the replaced uint32_t in the implementation.
+ *        0 for commands without replacement.
+ */
+const size_t SPASM_COMMANDTYPE_TO_REPLACEMENT_OFFSET[] = {
+        0, 0, 0, 0,
+
+        0, 0, 0, 0,
+
+        1, 1, 0, 0,
+
+        0, 0,
+
+        2, 1,
+
+        1, 5, 0, 0,
+
+        0, 0, 0, 0,
+
+        0, 3, 5, 0, 0, 3,
+
+        4, 5 };
+
+
+/**
+ * @brief CommandType to offset of the replaced uint32_t in the x86_64
+ *        implementation. Only LVX and STX differ from the i386 offsets,
+ *        by their address size prefix.
+ */
+const size_t SPASM64_COMMANDTYPE_TO_REPLACEMENT_OFFSET[] = {
+        0, 0, 0, 0,
+
+        0, 0, 0, 0,
+
+        1, 1, 0, 0,
+
+        0, 0,
+
+        2, 1,
+
+        1, 5, 0, 0,
+
+        0, 0, 0, 0,
+
+        0, 3, 5, 0, 0, 3,
+
+        5, 6 };
+
+
+/**
+ * @brief Encodings of fused variable updates (SPASM_RMW).
+ */
+typedef enum UpdateEncoding
+{
+    SPASM_UPDATE_INC,
+    SPASM_UPDATE_DEC,
+    SPASM_UPDATE_ADD8,
+    SPASM_UPDATE_ADD32,
+    SPASM_UPDATE_SUB8,
+    SPASM_UPDATE_SUB32,
+    SPASM_UPDATE_MUL8,
+    SPASM_UPDATE_MUL32,
+
+    SPASM_UPDATE_ENCODING_COUNT
+} UpdateEncoding;
+
+/* Variable address and immediate offsets of all update encodings on both targets */
+#define SPASM_UPDATE_ADDRESS_OFFSET 3
+#define SPASM_UPDATE_IMMEDIATE_OFFSET 7
+
+
+/**
+ * @brief UpdateEncoding to implementation mapper
+ */
+const unsigned char *SPASM_UPDATE_TO_COMMAND[] = {
+        spasm_rmw_inc, spasm_rmw_dec,
+        spasm_rmw_add8, spasm_rmw_add32,
+        spasm_rmw_sub8, spasm_rmw_sub32,
+        spasm_rmw_mul8, spasm_rmw_mul32 };
+
+
+/**
+ * @brief UpdateEncoding to implementation size mapper
+ */
+const size_t SPASM_UPDATE_TO_COMMAND_SIZE[] = {
+        sizeof(spasm_rmw_inc), sizeof(spasm_rmw_dec),
+        sizeof(spasm_rmw_add8), sizeof(spasm_rmw_add32),
+        sizeof(spasm_rmw_sub8), sizeof(spasm_rmw_sub32),
+        sizeof(spasm_rmw_mul8), sizeof(spasm_rmw_mul32) };
+
+
+/**
+ * @brief UpdateEncoding to x86_64 implementation mapper
+ */
+const unsigned char *SPASM64_UPDATE_TO_COMMAND[] = {
+        spasm64_rmw_inc, spasm64_rmw_dec,
+        spasm64_rmw_add8, spasm64_rmw_add32,
+        spasm64_rmw_sub8, spasm64_rmw_sub32,
+        spasm64_rmw_mul8, spasm64_rmw_mul32 };
+
+
+/**
+ * @brief UpdateEncoding to x86_64 implementation size mapper
+ */
+const size_t SPASM64_UPDATE_TO_COMMAND_SIZE[] = {
+        sizeof(spasm64_rmw_inc), sizeof(spasm64_rmw_dec),
+        sizeof(spasm64_rmw_add8), sizeof(spasm64_rmw_add32),
+        sizeof(spasm64_rmw_sub8), sizeof(spasm64_rmw_sub32),
+        sizeof(spasm64_rmw_mul8), sizeof(spasm64_rmw_mul32) };
+
+
+/**
+ * @brief UpdateEncoding to immediate size, 0 for encodings without immediate.
+ *        Identical for both targets.
+ */
+const size_t SPASM_UPDATE_TO_IMMEDIATE_SIZE[] = {
+        0, 0, 1, 4, 1, 4, 1, 4 };
+
+
+/**
+ * @brief UpdateEncoding to offset of the second variable address the
+ *        imul forms store to, 0 for none. Identical for both targets.
+ */
+const size_t SPASM_UPDATE_TO_STORE_OFFSET[] = {
+        0, 0, 0, 0, 0, 0, 11, 14 };
+
+
+/**
+ * @brief Recommended NOP encodings of 1 to 9 bytes. Identical for both targets.
+ */
+const unsigned char SPASM_NOPS[9][9] = {
+        { 0x90 },
+        { 0x66, 0x90 },
+        { 0x0f, 0x1f, 0x00 },
+        { 0x0f, 0x1f, 0x40, 0x00 },
+        { 0x0f, 0x1f, 0x44, 0x00, 0x00 },
+        { 0x66, 0x0f, 0x1f, 0x44, 0x00, 0x00 },
+        { 0x0f, 0x1f, 0x80, 0x00, 0x00, 0x00, 0x00 },
+        { 0x0f, 0x1f, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00 },
+        { 0x66, 0x0f, 0x1f, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00 } };
+
+
+/**
+ * @brief Offsets of the prompt, strbuf, strbuf, ofm and nanm addresses in spasm_readint32
+ */
+const uint32_t SPASM_READINT32_OFFSETS[5] = { 11, 33, 50, 113, 137 };
+
+/**
+ * @brief Offsets of the strbuf end - 1 and strbuf end addresses in spasm_writeint32
+ */
+const uint32_t SPASM_WRITEINT32_OFFSETS[2] = { 1, 62 };
+
+/**
+ * @brief Offsets of the prompt, strbuf, strbuf, ofm and nanm addresses in spasm64_readint32
+ */
+const uint32_t SPASM64_READINT32_OFFSETS[5] = { 11, 33, 50, 115, 139 };
+
+/**
+ * @brief Offsets of the strbuf end - 1 and strbuf end addresses in spasm64_writeint32
+ */
+const uint32_t SPASM64_WRITEINT32_OFFSETS[2] = { 1, 64 };
+
+/**
+ * @brief Offsets of the path, table, table size, counters and counters size in spasm_dump and spasm64_dump
+ */
+const uint32_t SPASM_DUMP_OFFSETS[5] = { 6, 30, 35, 47, 52 };
+
+
+/**
+ * @brief i386 target description.
+ */
+const SpasmTarget SPASM_TARGET_I386 = {
+        SPASM_COMMANDTYPE_TO_COMMAND,
+        SPASM_COMMANDTYPE_TO_COMMAND_SIZE,
+        SPASM_COMMANDTYPE_TO_REPLACEMENT_OFFSET,
+        SPASM_UPDATE_TO_COMMAND,
+        SPASM_UPDATE_TO_COMMAND_SIZE,
+
+        spasm_readint32, sizeof(spasm_readint32), SPASM_READINT32_OFFSETS,
+        spasm_writeint32, sizeof(spasm_writeint32), SPASM_WRITEINT32_OFFSETS,
+
+        spasm_jit_enter, sizeof(spasm_jit_enter), 6,
+        spasm_jit_leave, sizeof(spasm_jit_leave), 2,
+
+        spasm_dump, sizeof(spasm_dump), SPASM_DUMP_OFFSETS,
+
+        0x08048000,
+        4,
+        "i386",
+        elf_optimize_alignment,
+        elf_write,
+        elf_compact_alignment,
+        elf_write_compact
+};
 
 
+/**
+ * @brief x86_64 target description.
+ */
+const SpasmTarget SPASM_TARGET_X86_64 = {
+        SPASM64_COMMANDTYPE_TO_COMMAND,
+        SPASM64_COMMANDTYPE_TO_COMMAND_SIZE,
+        SPASM64_COMMANDTYPE_TO_REPLACEMENT_OFFSET,
+        SPASM64_UPDATE_TO_COMMAND,
+        SPASM64_UPDATE_TO_COMMAND_SIZE,
+
+        spasm64_readint32, sizeof(spasm64_readint32), SPASM64_READINT32_OFFSETS,
+        spasm64_writeint32, sizeof(spasm64_writeint32), SPASM64_WRITEINT32_OFFSETS,
+
+        spasm64_jit_enter, sizeof(spasm64_jit_enter), 14,
+        spasm64_jit_leave, sizeof(spasm64_jit_leave), 4,
+
+        spasm64_dump, sizeof(spasm64_dump), SPASM_DUMP_OFFSETS,
+
+        0x00400000,
+        8,
+        "x86_64",
+        elf64_optimize_alignment,
+        elf64_write,
+        elf64_compact_alignment,
+        elf64_write_compact
+};
+
 /**
  * @brief Write a command with a single uint32_t replacement.
  * @param command Command implementation to write.
@@ -112,219 +584,677 @@ Errc write_with_single_replacement(
 
 
 /**
- * @brief Write a command wit multiple uint32_t replacements.
- * @param command Command implementation to write.
- * @param command_size command size
- * @param offsets Array of offsets in command at which to perform replacements in ascending order.
- * @param replacements Replacement values for offsets indexes.
- * @param replacement_count Number of offsets/replacements.
- * @param buffer Buffer to write to. Will be advanced by size of command.
- * @return ERR_SUCCESS on success.
+ * @brief Prepares an empty, growing text image.
+ * @param image Image to initialize
+ * @param vaddr vaddr the text segment is emitted for
  */
-Errc write_with_replacements(
-        const unsigned char command[], size_t command_size,
-        const uint32_t offsets[], const uint32_t replacements[], const size_t replacement_count,
-        unsigned char **buffer)
+void init_text_image(TextImage *image, const uint32_t vaddr)
 {
-    size_t i;
-    uint32_t prevoff = 0;
-    uint32_t curoff = 0;
+    memset(image, 0, sizeof(TextImage));
+    image->owned = 1;
+    image->vaddr = vaddr;
+}
+
+
+/**
+ * @brief Releases the memory held by a text image.
+ */
+void cleanup_text_image(TextImage *image)
+{
+    if (image->owned)
+        free(image->code);
+    free(image->relocations);
+    memset(image, 0, sizeof(TextImage));
+}
 
-    for (i = 0; i < replacement_count; ++i)
+
+/**
+ * @brief Appends size bytes to the image.
+ * @param image Image to grow
+ * @param size Number of bytes to append
+ * @return Location of the appended bytes or 0 on allocation failure.
+ */
+unsigned char *reserve_text(TextImage *image, const size_t size)
+{
+    size_t capacity = image->capacity ? image->capacity : 4096;
+    unsigned char *code;
+
+    if (image->size + size > image->capacity)
     {
-        curoff = offsets[i] - prevoff;
+        assert(image->owned);
+
+        while (image->size + size > capacity)
+            capacity *= 2;
 
-        memcpy(*buffer, command, curoff);
-        *buffer += curoff;
-        command += curoff;
+        code = (unsigned char*)realloc(image->code, capacity);
+        if (!code)
+            return 0;
 
-        memcpy(*buffer, &(replacements[i]), sizeof(int32_t));
-        *buffer += sizeof(int32_t);
-        command += sizeof(int32_t);
+        ++image->allocations;
+        image->allocated_bytes += capacity;
 
-        command_size -= curoff + sizeof(int32_t);
-        prevoff = offsets[i] + sizeof(int32_t);
+        image->code = code;
+        image->capacity = capacity;
     }
 
-    memcpy(*buffer, command, command_size);
-    *buffer += command_size;
+    image->size += size;
 
-    return ERR_SUCCESS;
+    return image->code + image->size - size;
 }
 
 
 /**
- * @brief Write the builtin spasm_readint32 command to the given buffer.
- * @param rodata_vaddr_base Base of rodata segment.
- * @param data_vaddr_base Base of data segment.
- * @param buffer Buffer to write to. Will be advanced by size of command.
+ * @brief Appends a relocation to the image.
+ * @param image Image holding the patched code
+ * @param type Type of the relocation
+ * @param position Position of the patched value in the code of the image
+ * @param addend Added to the target address
+ * @return The new relocation for setting its target, 0 on allocation failure.
  */
-Errc write_spasm_readint32(const uint32_t rodata_vaddr_base, const uint32_t data_vaddr_base, unsigned char **buffer)
+Relocation *add_relocation(TextImage *image, const RelocationType type, const size_t position, const uint32_t addend)
 {
-    const uint32_t prompt_rodata_vaddr = rodata_vaddr_base + 0;
-    const uint32_t ofm_rodata_vaddr = rodata_vaddr_base + 42;
-    const uint32_t nanm_rodata_vaddr = rodata_vaddr_base + 2;
-    const uint32_t strbuf_data_vaddr = data_vaddr_base + 0;
+    size_t capacity = image->relocation_capacity ? 2 * image->relocation_capacity : 256;
+    Relocation *relocations;
+    Relocation *relocation;
 
-    const uint32_t offsets[5] = {
-            11,
-            33,
-            50,
-            113,
-            137
-    };
+    if (image->relocation_count == image->relocation_capacity)
+    {
+        relocations = (Relocation*)realloc(image->relocations, capacity * sizeof(Relocation));
+        if (!relocations)
+            return 0;
+
+        ++image->allocations;
+        image->allocated_bytes += capacity * sizeof(Relocation);
+
+        image->relocations = relocations;
+        image->relocation_capacity = capacity;
+    }
 
-    uint32_t replacements[5];
-    replacements[0] = prompt_rodata_vaddr;
-    replacements[1] = strbuf_data_vaddr;
-    replacements[2] = strbuf_data_vaddr;
-    replacements[3] = ofm_rodata_vaddr;
-    replacements[4] = nanm_rodata_vaddr;
+    relocation = &image->relocations[image->relocation_count++];
+    relocation->type = type;
+    relocation->offset = image->offset + position;
+    relocation->target.label = 0;
+    relocation->addend = addend;
 
-    return write_with_replacements(spasm_readint32, sizeof(spasm_readint32), offsets, replacements, 5, buffer);
+    return relocation;
 }
 
 
 /**
- * @brief Write the builtin spasm_writeint32 command to the given buffer.
- * @param data_vaddr_base Base of data segment.
- * @param buffer Buffer to write to. Will be advanced by size of command.
+ * @brief Appends a binary sequence to the image.
+ * @param image Image to append to
+ * @param sequence Sequence to copy
+ * @param size Size of the sequence
+ * @param position Set to the position of the sequence in the code of the image
+ * @return ERR_SUCCESS on success.
  */
-Errc write_spasm_writeint32(const uint32_t data_vaddr_base, unsigned char **buffer)
+Errc emit_sequence(TextImage *image, const unsigned char *sequence, const size_t size, size_t *position)
 {
-    const uint32_t strbuf_data_vaddr = data_vaddr_base + 0;
+    unsigned char *code = reserve_text(image, size);
 
-    const uint32_t offsets[2] = {
-            1,
-            62
-    };
+    if (!code)
+        return ERR_ALLOC;
 
-    uint32_t replacements[2];
-    replacements[0] = strbuf_data_vaddr + 255 - 1;
-    replacements[1] = strbuf_data_vaddr + 255;
+    memcpy(code, sequence, size);
+    *position = code - image->code;
 
-    return write_with_replacements(spasm_writeint32, sizeof(spasm_writeint32), offsets, replacements, 2, buffer);
+    return ERR_SUCCESS;
 }
 
 
 /**
- * @brief Writes the implementation of a given command to the given buffer.
- * @param command Command to write
- * @param buffer Buffer to write to. Will be advanced by command implementation size.
- * @param builtins Builtin function addresses.
- * @param return ERR_SUCCESS on success.
+ * @brief Appends a binary sequence with segment relocations to the image.
+ * @param image Image to append to
+ * @param sequence Sequence to copy
+ * @param size Size of the sequence
+ * @param offsets Offsets of the relocated uint32_t values in the sequence
+ * @param types Relocation type of each value, SPASM_RELOC_RODATA or SPASM_RELOC_BSS
+ * @param addends Addend of each value
+ * @param count Number of relocated values
+ * @return ERR_SUCCESS on success.
  */
-Errc write_command(const Command *command, unsigned char **buffer, const SpasmBuiltins *builtins) {
-    switch (command->type) {
-    case SPASM_REA:
-        return write_with_single_replacement(spasm_rea, sizeof(spasm_rea),
-                1, (uint32_t)((int64_t) builtins->readint32_vaddr - (int64_t) (command->vaddr + 1 + 4)), buffer);
-    case SPASM_PRI:
-        return write_with_single_replacement(spasm_pri, sizeof(spasm_pri),
-                2, (uint32_t)((int64_t) builtins->printint32_vaddr - (int64_t) (command->vaddr + 2 + 4)), buffer);
-    case SPASM_JMP:
-        return write_with_single_replacement(spasm_jmp, sizeof(spasm_jmp),
-                1, (uint32_t)(
-                        (int64_t) command->argument.label_arg->command->vaddr
-                                - (int64_t) (command->vaddr + 1 + 4)), buffer);
-    case SPASM_JIN:
-        return write_with_single_replacement(spasm_jin, sizeof(spasm_jin),
-                5, (uint32_t)(
-                        (int64_t) command->argument.label_arg->command->vaddr
-                                - (int64_t) (command->vaddr + 5 + 4)), buffer);
-    case SPASM_LC:
-        return write_with_single_replacement(spasm_lc, sizeof(spasm_lc),
-                1, command->argument.constant_arg, buffer);
-    case SPASM_LA:
-        assert(command->argument.memory_arg->vaddr % 4 == 0);
-        return write_with_single_replacement(spasm_la, sizeof(spasm_la),
-                1, command->argument.memory_arg->vaddr / 4, buffer);
-    default:
-        memcpy(*buffer, SPASM_COMMANDTYPE_TO_COMMAND[command->type],
-                SPASM_COMMANDTYPE_TO_COMMAND_SIZE[command->type]);
+Errc emit_with_relocations(TextImage *image, const unsigned char *sequence, const size_t size,
+        const uint32_t offsets[], const RelocationType types[], const uint32_t addends[], const size_t count)
+{
+    size_t position;
+    size_t i;
 
-        *buffer += SPASM_COMMANDTYPE_TO_COMMAND_SIZE[command->type];
+    if (emit_sequence(image, sequence, size, &position) != ERR_SUCCESS)
+        return ERR_ALLOC;
 
-        return ERR_SUCCESS;
+    for (i = 0; i < count; ++i)
+    {
+        if (!add_relocation(image, types[i], position + offsets[i], addends[i]))
+            return ERR_ALLOC;
     }
+
+    return ERR_SUCCESS;
 }
 
 
 /**
- * @brief Writes the text segment part of the ParserState into the given buffer.
- * @param parser Parser to write data from.
- * @param buffer Buffer to write implementation to.
- * @param builtins Builtin function addresses.
+ * @brief Appends the builtin spasm_readint32 and spasm_writeint32 functions.
+ * @note The builtins use the spasm_bss_usage bytes in front of the variables as string buffer.
+ * @param target Target to write the builtins for.
+ * @param image Image to append to
  * @return ERR_SUCCESS on success.
  */
-Errc write_text(const ParserState *parser, unsigned char *buffer, const SpasmBuiltins *builtins) {
-    unsigned char *current = buffer;
-    const Command *command = parser->command_first;
-    while (command != 0) {
-        Errc error = write_command(command, &current, builtins);
-        if (error != ERR_SUCCESS)
-            return error;
+Errc emit_builtins(const SpasmTarget *target, TextImage *image)
+{
+    /* prompt, strbuf, strbuf, ofm and nanm */
+    const RelocationType readint32_types[5] = {
+            SPASM_RELOC_RODATA, SPASM_RELOC_BSS, SPASM_RELOC_BSS, SPASM_RELOC_RODATA, SPASM_RELOC_RODATA };
+    const uint32_t readint32_addends[5] = { 0, 0, 0, 42, 2 };
 
-        command = command->next;
-    }
+    /* strbuf end - 1 and strbuf end */
+    const RelocationType writeint32_types[2] = { SPASM_RELOC_BSS, SPASM_RELOC_BSS };
+    const uint32_t writeint32_addends[2] = { 255 - 1, 255 };
 
-    return ERR_SUCCESS;
+    if (emit_with_relocations(image, target->readint32, target->readint32_size,
+            target->readint32_offsets, readint32_types, readint32_addends, 5) != ERR_SUCCESS)
+        return ERR_ALLOC;
+
+    return emit_with_relocations(image, target->writeint32, target->writeint32_size,
+            target->writeint32_offsets, writeint32_types, writeint32_addends, 2);
 }
 
 
 /**
- * @brief Write data/rodata part of ParserState into given buffers.
- * @param parser Parser to write data from.
- * @param data_buffer Buffer to write data memory location initial content to.
- * @param rodata_buffer Buffer to write rodata memory location content to.
+ * @brief Appends the exit sequence of instrumented programs writing the block profile.
+ * @param target Target to write the sequence for.
+ * @param image Image to append to
+ * @param profile Profile to write
  * @return ERR_SUCCESS on success.
  */
-Errc write_xdata(const ParserState *parser, unsigned char *data_buffer,
-        unsigned char *rodata_buffer) {
+Errc emit_profile_dump(const SpasmTarget *target, TextImage *image, const BlockProfile *profile)
+{
+    const uint32_t table_size = profile->table->size;
+    const uint32_t counters_size = profile->block_count * sizeof(uint32_t);
+    Relocation *path;
+    Relocation *table;
+    Relocation *counters;
+    size_t position;
+
+    if (emit_sequence(image, target->dump, target->dump_size, &position) != ERR_SUCCESS)
+        return ERR_ALLOC;
 
-    MemoryLocation *location = parser->memory_location_first;
+    memcpy(image->code + position + target->dump_offsets[2], &table_size, sizeof(table_size));
+    memcpy(image->code + position + target->dump_offsets[4], &counters_size, sizeof(counters_size));
 
-    while (location) {
-        switch (location->type) {
-        case SPASM_RODATA:
-            memcpy(rodata_buffer, location->content, location->size);
-            rodata_buffer += location->size;
-            break;
-        case SPASM_DATA:
-            memcpy(data_buffer, location->content, location->size);
-            data_buffer += location->size;
-            break;
-        default:
-            break;
-        }
-        location = location->next;
-    }
+    path = add_relocation(image, SPASM_RELOC_MEMORY, position + target->dump_offsets[0], 0);
+    table = add_relocation(image, SPASM_RELOC_MEMORY, position + target->dump_offsets[1], 0);
+    counters = add_relocation(image, SPASM_RELOC_MEMORY, position + target->dump_offsets[3], 0);
+    if (!path || !table || !counters)
+        return ERR_ALLOC;
+
+    path->target.memory = profile->path;
+    table->target.memory = profile->table;
+    counters->target.memory = profile->first_counter;
 
     return ERR_SUCCESS;
 }
 
 
 /**
- * @brief Walk given ParserState and set actual virtual addresses of memory and commands.
- * @param parser State
- * @param text_vaddr Base virtual address for text segment.
- * @param bss_vaddr Base virtual address for bss segment.
- * @param rodata_vaddr Base virtual address for rodata segment.
- * @param data_vaddr Base virtual address for data segment.
- * @return Required text segment size.
+ * @brief Calculate a rel32 displacement from the end of a replaced uint32_t.
+ * @param target_vaddr Address to reach.
+ * @param replacement_vaddr Address of the uint32_t holding the displacement.
+ * @return Displacement
  */
-size_t update_parser_state_vaddr_info(ParserState *parser, uint32_t text_vaddr,
-        uint32_t bss_vaddr, uint32_t rodata_vaddr, uint32_t data_vaddr) {
+uint32_t relative_displacement(const uint32_t target_vaddr, const uint32_t replacement_vaddr)
+{
+    return target_vaddr - (replacement_vaddr + sizeof(uint32_t));
+}
 
+
+/**
+ * @brief Writes as few NOP instructions as possible to fill the given size.
+ * @param size Number of bytes to fill
+ * @param buffer Buffer to write to. Will be advanced by size.
+ */
+void write_nops(size_t size, unsigned char **buffer)
+{
+    const size_t longest = sizeof(SPASM_NOPS[0]);
+    size_t length;
+
+    while (size > 0)
+    {
+        length = size < longest ? size : longest;
+        memcpy(*buffer, SPASM_NOPS[length - 1], length);
+        *buffer += length;
+        size -= length;
+    }
+}
+
+
+/**
+ * @brief Selects the shortest encoding of a fused variable update.
+ * @param update Update to encode
+ * @return Encoding to write the update with.
+ */
+UpdateEncoding update_encoding(const MemoryUpdate *update)
+{
+    const int32_t constant = (int32_t)update->constant;
+    const int short_form = constant >= -128 && constant <= 127;
+
+    switch (update->operation)
+    {
+    case SPASM_ADD:
+        if (constant == 1 || constant == -1)
+            return constant == 1 ? SPASM_UPDATE_INC : SPASM_UPDATE_DEC;
+        return short_form ? SPASM_UPDATE_ADD8 : SPASM_UPDATE_ADD32;
+    case SPASM_SUB:
+        if (constant == 1 || constant == -1)
+            return constant == 1 ? SPASM_UPDATE_DEC : SPASM_UPDATE_INC;
+        return short_form ? SPASM_UPDATE_SUB8 : SPASM_UPDATE_SUB32;
+    default:
+        return short_form ? SPASM_UPDATE_MUL8 : SPASM_UPDATE_MUL32;
+    }
+}
+
+
+/**
+ * @brief Size of the implementation of a given command.
+ * @param target Target to write the command for.
+ * @param command Command to determine the size of.
+ * @return Implementation size.
+ */
+size_t command_size(const SpasmTarget *target, const Command *command)
+{
+    if (command->type == SPASM_VEC)
+        return write_vector_loop(command->argument.vector_arg, 0);
+
+    /* Relies on the vaddr of the command being set before its size is requested */
+    if (command->type == SPASM_ALN)
+        return padding_for(command->vaddr, 0, command->argument.constant_arg);
+
+    if (command->type == SPASM_RMW)
+        return target->update_sizes[update_encoding(command->argument.update_arg)];
+
+    return target->command_sizes[command->type];
+}
+
+
+/**
+ * @brief Writes a fused variable update into reserved image code.
+ * @param target Target to write the update for.
+ * @param image Image the code belongs to
+ * @param update Update to write
+ * @param code Reserved code of the update
+ * @return ERR_SUCCESS on success.
+ */
+Errc emit_update(const SpasmTarget *target, TextImage *image, const MemoryUpdate *update, unsigned char *code)
+{
+    const UpdateEncoding encoding = update_encoding(update);
+    const size_t store_offset = SPASM_UPDATE_TO_STORE_OFFSET[encoding];
+    Relocation *relocation;
+
+    memcpy(code, target->updates[encoding], target->update_sizes[encoding]);
+    if (SPASM_UPDATE_TO_IMMEDIATE_SIZE[encoding] == sizeof(uint32_t))
+        memcpy(code + SPASM_UPDATE_IMMEDIATE_OFFSET, &update->constant, sizeof(uint32_t));
+    else if (SPASM_UPDATE_TO_IMMEDIATE_SIZE[encoding])
+        code[SPASM_UPDATE_IMMEDIATE_OFFSET] = (unsigned char)(update->constant & 0xff);
+
+    relocation = add_relocation(image, SPASM_RELOC_MEMORY, code - image->code + SPASM_UPDATE_ADDRESS_OFFSET, 0);
+    if (!relocation)
+        return ERR_ALLOC;
+    relocation->target.memory = update->memory;
+
+    if (store_offset)
+    {
+        relocation = add_relocation(image, SPASM_RELOC_MEMORY, code - image->code + store_offset, 0);
+        if (!relocation)
+            return ERR_ALLOC;
+        relocation->target.memory = update->memory;
+    }
+
+    return ERR_SUCCESS;
+}
+
+
+/**
+ * @brief Appends the implementation of a given command to the image and
+ *        sets the vaddr of the command.
+ * @param target Target to write the command for.
+ * @param image Image to append to
+ * @param command Command to write
+ * @param builtins Builtin function offsets.
+ * @return ERR_SUCCESS on success.
+ */
+Errc emit_command(const SpasmTarget *target, TextImage *image, Command *command, const SpasmBuiltins *builtins) {
+    const unsigned char *implementation = target->commands[command->type];
+    const size_t offset = target->replacement_offsets[command->type];
+    size_t size;
+    unsigned char *code;
+    Relocation *relocation = 0;
+
+    command->vaddr = image->vaddr + image->offset + image->size;
+    size = command_size(target, command);
+
+    code = reserve_text(image, size);
+    if (!code)
+        return ERR_ALLOC;
+
+    switch (command->type) {
+    case SPASM_VEC:
+        /* Written by the relocation sweep once the memory locations are placed */
+        relocation = add_relocation(image, SPASM_RELOC_VECTOR, code - image->code, 0);
+        if (relocation)
+            relocation->target.vector = command->argument.vector_arg;
+        break;
+    case SPASM_ALN:
+        write_nops(size, &code);
+        return ERR_SUCCESS;
+    case SPASM_RMW:
+        return emit_update(target, image, command->argument.update_arg, code);
+    case SPASM_REA:
+        memcpy(code, implementation, size);
+        relocation = add_relocation(image, SPASM_RELOC_TEXT, code - image->code + offset, builtins->readint32_offset);
+        break;
+    case SPASM_PRI:
+        memcpy(code, implementation, size);
+        relocation = add_relocation(image, SPASM_RELOC_TEXT, code - image->code + offset, builtins->printint32_offset);
+        break;
+    case SPASM_JMP:
+    case SPASM_JIN:
+    case SPASM_JNZ:
+        memcpy(code, implementation, size);
+        relocation = add_relocation(image, SPASM_RELOC_LABEL, code - image->code + offset, 0);
+        if (relocation)
+            relocation->target.label = command->argument.label_arg;
+        break;
+    case SPASM_STP:
+        if (!builtins->exit_offset)
+        {
+            memcpy(code, implementation, size);
+            return ERR_SUCCESS;
+        }
+
+        /* jmp exit_offset, padded with nops to keep the command size */
+        assert(size >= target->command_sizes[SPASM_JMP]);
+        memset(code, spasm_nop[0], size);
+        memcpy(code, target->commands[SPASM_JMP], target->command_sizes[SPASM_JMP]);
+        relocation = add_relocation(image, SPASM_RELOC_TEXT,
+                code - image->code + target->replacement_offsets[SPASM_JMP], builtins->exit_offset);
+        break;
+    case SPASM_LC:
+        return write_with_single_replacement(implementation, size, offset,
+                command->argument.constant_arg, &code);
+    case SPASM_DUP:
+        return write_with_single_replacement(implementation, size, offset,
+                command->argument.constant_arg * target->stack_slot, &code);
+    case SPASM_LA:
+    case SPASM_CNT:
+    case SPASM_LVX:
+    case SPASM_STX:
+        memcpy(code, implementation, size);
+        relocation = add_relocation(image, command->type == SPASM_LA ? SPASM_RELOC_MEMORY_WORD : SPASM_RELOC_MEMORY,
+                code - image->code + offset, 0);
+        if (relocation)
+            relocation->target.memory = command->argument.memory_arg;
+        break;
+    default:
+        memcpy(code, implementation, size);
+        return ERR_SUCCESS;
+    }
+
+    return relocation ? ERR_SUCCESS : ERR_ALLOC;
+}
+
+
+/**
+ * @brief Collects the commands of the program for multi-threaded emission.
+ * @param table Table to initialize
+ * @param target Target to write the commands for.
+ * @param parser Parser holding the commands
+ * @param threads Number of threads to use
+ * @return ERR_SUCCESS on success.
+ */
+Errc init_command_table(CommandTable *table, const SpasmTarget *target, const ParserState *parser, size_t threads)
+{
+    Command *command;
+    size_t i = 0;
+
+    memset(table, 0, sizeof(CommandTable));
+    table->target = target;
+    table->threads = threads;
+
+    for (command = parser->command_first; command; command = command->next)
+        ++table->count;
+
+    table->commands = (Command**)malloc((table->count + 1) * sizeof(Command*));
+    table->chunk_offset = (uint32_t*)malloc(threads * sizeof(uint32_t));
+    table->images = (TextImage*)calloc(threads, sizeof(TextImage));
+    table->results = (Errc*)malloc(threads * sizeof(Errc));
+    if (!table->commands || !table->chunk_offset || !table->images || !table->results)
+        return ERR_ALLOC;
+
+    for (command = parser->command_first; command; command = command->next)
+    {
+        table->commands[i++] = command;
+        if (command->type == SPASM_ALN)
+            table->position_dependent = 1;
+    }
+
+    return ERR_SUCCESS;
+}
+
+
+/**
+ * @brief Releases the memory held by a command table.
+ */
+void cleanup_command_table(CommandTable *table)
+{
+    size_t i;
+
+    for (i = 0; table->images && i < table->threads; ++i)
+        cleanup_text_image(&table->images[i]);
+
+    free(table->commands);
+    free(table->chunk_offset);
+    free(table->images);
+    free(table->results);
+    memset(table, 0, sizeof(CommandTable));
+}
+
+
+/**
+ * @brief Returns an initialized command table if more than one thread is requested
+ *        and the program is large enough to keep them busy.
+ *
+ * Threads are only started for every SPASM_COMMANDS_PER_THREAD commands, so
+ * small programs are written on the calling thread.
+ *
+ * @param target Target to write the commands for.
+ * @param parser Parser holding the commands
+ * @param threads Number of threads to use at most
+ * @param table Storage for the table
+ * @return table, or 0 to write the commands on the calling thread.
+ */
+CommandTable *command_table_for(const SpasmTarget *target, const ParserState *parser,
+        size_t threads, CommandTable *table)
+{
+    const Command *command;
+    size_t count = 0;
+
+    for (command = parser->command_first; command && count / SPASM_COMMANDS_PER_THREAD < threads;
+            command = command->next)
+        ++count;
+
+    if (count / SPASM_COMMANDS_PER_THREAD < threads)
+        threads = count / SPASM_COMMANDS_PER_THREAD;
+
+    if (threads <= 1)
+        return 0;
+
+    if (init_command_table(table, target, parser, threads) != ERR_SUCCESS)
+    {
+        /* Fall back to the serial walk */
+        cleanup_command_table(table);
+        return 0;
+    }
+
+    return table;
+}
+
+
+/**
+ * @brief ParallelTask summing up the command sizes of a range.
+ */
+void measure_commands(void *context, size_t index, size_t count)
+{
+    CommandTable *table = (CommandTable*)context;
+    const size_t end = parallel_range_start(table->count, index + 1, count);
+    size_t i;
+    uint32_t size = 0;
+
+    for (i = parallel_range_start(table->count, index, count); i < end; ++i)
+        size += command_size(table->target, table->commands[i]);
+
+    table->chunk_offset[index] = size;
+}
+
+
+/**
+ * @brief Sets the sizes of the ranges of a position dependent table in a
+ *        serial pass, placing every command at its final vaddr so the
+ *        ALN paddings are known.
+ * @param table Table to measure
+ * @param vaddr Virtual address of the first command
+ */
+void measure_commands_serial(CommandTable *table, uint32_t vaddr)
+{
+    size_t i = 0;
+    size_t thread;
+
+    for (thread = 0; thread < table->threads; ++thread)
+    {
+        const size_t end = parallel_range_start(table->count, thread + 1, table->threads);
+        uint32_t size = 0;
+
+        for (; i < end; ++i)
+        {
+            table->commands[i]->vaddr = vaddr + size;
+            size += command_size(table->target, table->commands[i]);
+        }
+
+        table->chunk_offset[thread] = size;
+        vaddr += size;
+    }
+}
+
+
+/**
+ * @brief ParallelTask emitting the commands of a range into the image of the range.
+ */
+void emit_range(void *context, size_t index, size_t count)
+{
+    CommandTable *table = (CommandTable*)context;
+    const size_t end = parallel_range_start(table->count, index + 1, count);
+    size_t i;
+
+    table->results[index] = ERR_SUCCESS;
+    for (i = parallel_range_start(table->count, index, count);
+            i < end && table->results[index] == ERR_SUCCESS; ++i)
+        table->results[index] = emit_command(table->target, &table->images[index],
+                table->commands[i], table->builtins);
+}
+
+
+/**
+ * @brief Appends all commands of the program to the image.
+ *
+ * With a command table the range sizes are summed up by the threads first,
+ * or in one serial pass if ALN paddings make them depend on the addresses.
+ * A prefix sum over them yields the text offset of every range and the
+ * threads then emit their ranges concurrently, each recording its own
+ * relocations.
+ *
+ * @param target Target to write the commands for.
+ * @param parser Parser holding the commands
+ * @param table Table to split the work between threads, 0 to write on the calling thread.
+ * @param image Image to append to
+ * @param builtins Builtin function offsets.
+ * @return ERR_SUCCESS on success.
+ */
+Errc emit_commands(const SpasmTarget *target, const ParserState *parser, CommandTable *table,
+        TextImage *image, const SpasmBuiltins *builtins)
+{
+    Command *command;
+    uint32_t offset = image->offset + image->size;
+    uint32_t size;
+    unsigned char *code;
+    Errc result;
+    size_t i;
+
+    if (!table)
+    {
+        for (command = parser->command_first; command; command = command->next)
+        {
+            result = emit_command(target, image, command, builtins);
+            if (result != ERR_SUCCESS)
+                return result;
+        }
+
+        return ERR_SUCCESS;
+    }
+
+    if (table->position_dependent)
+        measure_commands_serial(table, image->vaddr + offset);
+    else
+        run_parallel(measure_commands, table, table->threads);
+
+    for (i = 0; i < table->threads; ++i)
+    {
+        size = table->chunk_offset[i];
+        table->chunk_offset[i] = offset;
+        offset += size;
+    }
+
+    code = reserve_text(image, offset - (image->offset + image->size));
+    if (!code)
+        return ERR_ALLOC;
+
+    for (i = 0; i < table->threads; ++i)
+    {
+        cleanup_text_image(&table->images[i]);
+        table->images[i].code = code + (table->chunk_offset[i] - table->chunk_offset[0]);
+        table->images[i].capacity = (i + 1 < table->threads ? table->chunk_offset[i + 1] : offset)
+                - table->chunk_offset[i];
+        table->images[i].offset = table->chunk_offset[i];
+        table->images[i].vaddr = image->vaddr;
+    }
+
+    table->builtins = builtins;
+    run_parallel(emit_range, table, table->threads);
+
+    for (i = 0; i < table->threads; ++i)
+    {
+        if (table->results[i] != ERR_SUCCESS)
+            return table->results[i];
+    }
+
+    return ERR_SUCCESS;
+}
+
+
+/**
+ * @brief Sets the virtual addresses of all memory locations in list order,
+ *        leaving the padding of bss locations free in front of them.
+ * @param parser State
+ * @param bss_vaddr Base virtual address for bss segment.
+ * @param rodata_vaddr Base virtual address for rodata segment.
+ * @param data_vaddr Base virtual address for data segment.
+ */
+void place_memory_locations(ParserState *parser, uint32_t bss_vaddr, uint32_t rodata_vaddr, uint32_t data_vaddr)
+{
     MemoryLocation *location = parser->memory_location_first;
-    Command *command = parser->command_first;
-    const uint32_t text_vaddr_first = text_vaddr;
 
     while (location) {
         switch (location->type) {
         case SPASM_BSS:
-            location->vaddr = bss_vaddr;
-            bss_vaddr += location->size;
+            location->vaddr = bss_vaddr + location->padding;
+            bss_vaddr = location->vaddr + location->size;
             break;
         case SPASM_RODATA:
             location->vaddr = rodata_vaddr;
@@ -340,86 +1270,1453 @@ size_t update_parser_state_vaddr_info(ParserState *parser, uint32_t text_vaddr,
 
         location = location->next;
     }
+}
 
-    while (command) {
-        command->vaddr = text_vaddr;
-        text_vaddr += SPASM_COMMANDTYPE_TO_COMMAND_SIZE[command->type];
 
-        command = command->next;
+/**
+ * @brief Returns the value a relocation patches in.
+ * @param relocation Relocation to resolve
+ * @param image Image the relocation belongs to
+ * @param bases Segment addresses
+ */
+uint32_t relocation_value(const Relocation *relocation, const TextImage *image, const SegmentBases *bases)
+{
+    switch (relocation->type) {
+    case SPASM_RELOC_LABEL:
+        return relative_displacement(relocation->target.label->command->vaddr, image->vaddr + relocation->offset);
+    case SPASM_RELOC_TEXT:
+        return relative_displacement(relocation->addend, relocation->offset);
+    case SPASM_RELOC_MEMORY:
+        return relocation->target.memory->vaddr + relocation->addend;
+    case SPASM_RELOC_MEMORY_WORD:
+        assert(relocation->target.memory->vaddr % 4 == 0);
+        return relocation->target.memory->vaddr / 4;
+    case SPASM_RELOC_RODATA:
+        return bases->rodata + relocation->addend;
+    case SPASM_RELOC_BSS:
+        return bases->bss + relocation->addend;
+    default:
+        return 0;
     }
+}
+
+
+/**
+ * @brief Patches the relocations of an image into the text segment.
+ * @param image Image holding the relocations
+ * @param text Code of the whole text segment
+ * @param bases Segment addresses
+ */
+void apply_relocations(const TextImage *image, unsigned char *text, const SegmentBases *bases)
+{
+    const Relocation *relocation = image->relocations;
+    const Relocation *end = relocation + image->relocation_count;
+    uint32_t value;
+
+    for (; relocation != end; ++relocation)
+    {
+        if (relocation->type == SPASM_RELOC_VECTOR)
+        {
+            write_vector_loop(relocation->target.vector, text + relocation->offset);
+            continue;
+        }
 
-    return text_vaddr - text_vaddr_first;
+        value = relocation_value(relocation, image, bases);
+        memcpy(text + relocation->offset, &value, sizeof(value));
+    }
 }
 
 
+/**
+ * @brief ParallelTask patching the relocations of a range.
+ */
+void relocate_range(void *context, size_t index, size_t count)
+{
+    CommandTable *table = (CommandTable*)context;
 
+    (void)count;
+    apply_relocations(&table->images[index], table->text, table->bases);
+}
 
-Errc write_program(ParserState *parser, FILE *file) {
-    uint32_t text_vaddr_base;
-    uint32_t rodata_vaddr_base;
-    uint32_t data_vaddr_base;
-    uint32_t bss_vaddr_base;
 
-    uint32_t entry_vaddr;
+/**
+ * @brief Patches all relocations into the text segment in one sweep.
+ * @param image Image holding the whole text segment
+ * @param table Table holding the relocations of the commands, 0 if the image holds them.
+ * @param bases Segment addresses
+ */
+void relocate_text(const TextImage *image, CommandTable *table, const SegmentBases *bases)
+{
+    assert(image->offset == 0);
 
-    SpasmBuiltins builtins;
+    apply_relocations(image, image->code, bases);
 
-    /* Do a dry run to get text_size */
-    const size_t text_size = update_parser_state_vaddr_info(parser, 0, 0, 0, 0)
-            + sizeof(spasm_readint32) + sizeof(spasm_writeint32);
+    if (table)
+    {
+        table->text = image->code;
+        table->bases = bases;
+        run_parallel(relocate_range, table, table->threads);
+    }
+}
 
-    const size_t rodata_size = parser->rodata_used + sizeof(spasm_rodata);
-    const size_t data_size = parser->data_used;
-    const size_t bss_size = parser->bss_used + spasm_bss_usage;
 
-    unsigned char *text_buffer = malloc(text_size);
-    unsigned char *text_buffer_tmp = text_buffer;
-    unsigned char *rodata_buffer = malloc(rodata_size);
-    unsigned char *data_buffer = malloc(bss_size);
+/**
+ * @brief Writes the relocations of an image in a human readable form.
+ * @param file File to write to
+ * @param image Image holding the relocations
+ * @param bases Segment addresses
+ */
+void write_image_relocations(FILE *file, const TextImage *image, const SegmentBases *bases)
+{
+    const Relocation *relocation = image->relocations;
+    const Relocation *end = relocation + image->relocation_count;
 
-    Errc result = ERR_SUCCESS;
+    for (; relocation != end; ++relocation)
+    {
+        fprintf(file, "0x%x %-11s ", bases->text + relocation->offset,
+                SPASM_RELOCATION_NAMES[relocation->type]);
 
-    if (!text_buffer || !rodata_buffer || (!data_buffer && !parser->data_used))
-        return ERR_ALLOC;
+        switch (relocation->type) {
+        case SPASM_RELOC_LABEL:
+            fprintf(file, "#%s", relocation->target.label->name);
+            break;
+        case SPASM_RELOC_MEMORY:
+        case SPASM_RELOC_MEMORY_WORD:
+            fprintf(file, "$%s", relocation->target.memory->name);
+            break;
+        case SPASM_RELOC_VECTOR:
+            fprintf(file, "$%s (%lu bytes)", relocation->target.vector->counter->name,
+                    (unsigned long)write_vector_loop(relocation->target.vector, 0));
+            break;
+        default:
+            fprintf(file, "+0x%x", relocation->addend);
+            break;
+        }
 
-    elf_optimize_alignment(0x08048000, text_size, rodata_size, data_size,
-            &text_vaddr_base, &rodata_vaddr_base, &data_vaddr_base,
-            &bss_vaddr_base);
+        if (relocation->type != SPASM_RELOC_VECTOR)
+            fprintf(file, " = 0x%x", relocation_value(relocation, image, bases));
 
-    builtins.readint32_vaddr = text_vaddr_base;
-    builtins.printint32_vaddr = text_vaddr_base + sizeof(spasm_readint32);
+        fprintf(file, "\n");
+    }
+}
 
-    entry_vaddr = text_vaddr_base + sizeof(spasm_readint32)
-            + sizeof(spasm_writeint32);
-    /* Do actual update run with optimized address values */
-    update_parser_state_vaddr_info(parser, entry_vaddr, bss_vaddr_base
-            + spasm_bss_usage, rodata_vaddr_base + sizeof(spasm_rodata),
-            data_vaddr_base);
 
+/**
+ * @brief Writes the relocation table of the text segment.
+ * @param file File to write to
+ * @param image Image holding the whole text segment
+ * @param table Table holding the relocations of the commands, 0 if the image holds them.
+ * @param bases Segment addresses
+ */
+void write_relocations(FILE *file, const TextImage *image, const CommandTable *table, const SegmentBases *bases)
+{
+    size_t i;
 
-    write_spasm_readint32(rodata_vaddr_base, data_vaddr_base, &text_buffer_tmp);
-    assert(text_buffer_tmp == text_buffer + sizeof(spasm_readint32));
-    write_spasm_writeint32(data_vaddr_base, &text_buffer_tmp);
-    assert(text_buffer_tmp == text_buffer + sizeof(spasm_readint32) + sizeof(spasm_writeint32));
+    fprintf(file, "===RELOCATIONS===\n");
+    write_image_relocations(file, image, bases);
 
-    result = write_text(parser, text_buffer_tmp, &builtins);
-    if (result != ERR_SUCCESS)
-        goto cleanup;
+    for (i = 0; table && i < table->threads; ++i)
+        write_image_relocations(file, &table->images[i], bases);
 
-    memcpy(rodata_buffer, spasm_rodata, sizeof(spasm_rodata));
+    fprintf(file, "===ENDOFRELOCATIONS===\n");
+}
 
-    result = write_xdata(parser, data_buffer, rodata_buffer + sizeof(spasm_rodata));
-    if (result != ERR_SUCCESS)
-        goto cleanup;
 
-    elf_write(file, entry_vaddr, text_vaddr_base, text_buffer, text_size,
-            rodata_vaddr_base, rodata_buffer, rodata_size, data_vaddr_base,
-            data_buffer, data_size, bss_vaddr_base, bss_size);
+/**
+ * @brief Alignment of the variables of a segment. DD and DC variables are
+ *        word aligned as LA addresses variables by word and segments start
+ *        anywhere. The constants of the passes and the instrumentation in
+ *        .rodata are addressed by byte and stay packed behind the messages.
+ * @param parser Parser holding the memory locations
+ * @param type SPASM_DATA or SPASM_RODATA
+ */
+uint32_t variables_alignment(const ParserState *parser, const enum MemoryLocationType type)
+{
+    return type == SPASM_DATA || parser->rodata_words ? 4 : 1;
+}
 
-    cleanup: free(data_buffer);
-    free(rodata_buffer);
-    free(text_buffer);
 
-    return result;
+/**
+ * @brief Bytes reserved behind the variables of a segment to align them.
+ * @param used Bytes used by the variables of the segment
+ * @param alignment Alignment of the variables, @see variables_alignment
+ */
+size_t variables_slack(const size_t used, const uint32_t alignment)
+{
+    return used ? alignment - 1 : 0;
 }
 
+
+/**
+ * @brief Write data/rodata part of ParserState into given buffers.
+ * @param parser Parser to write data from.
+ * @param data_buffer Buffer to write data memory location initial content to.
+ * @param rodata_buffer Buffer to write rodata memory location content to.
+ * @return ERR_SUCCESS on success.
+ */
+Errc write_xdata(const ParserState *parser, unsigned char *data_buffer,
+        unsigned char *rodata_buffer) {
+
+    MemoryLocation *location = parser->memory_location_first;
+
+    while (location) {
+        switch (location->type) {
+        case SPASM_RODATA:
+            memcpy(rodata_buffer, location->content, location->size);
+            rodata_buffer += location->size;
+            break;
+        case SPASM_DATA:
+            memcpy(data_buffer, location->content, location->size);
+            data_buffer += location->size;
+            break;
+        default:
+            break;
+        }
+        location = location->next;
+    }
+
+    return ERR_SUCCESS;
+}
+
+
+
+
+/**
+ * @brief Returns the address of the text segment, which doesn't depend on the segment sizes.
+ * @param target Target to get the address for.
+ * @param compact Address for the compact layout
+ * @return Text segment vaddr
+ */
+uint32_t text_vaddr(const SpasmTarget *target, const int compact)
+{
+    uint32_t text;
+    uint32_t rodata;
+    uint32_t data;
+    uint32_t bss;
+
+    (compact ? target->compact_alignment : target->optimize_alignment)(target->base_vaddr, 0, 0, 0,
+            &text, &rodata, &data, &bss);
+
+    return text;
+}
+
+
+/**
+ * @brief Adds the segment sizes, relocations and allocations of the writer to the statistics.
+ * @param stats Statistics to collect, 0 to do nothing
+ * @param image Image of the whole text segment
+ * @param table Command table the text segment was emitted with, 0 if none
+ * @param rodata_size Size of the rodata segment
+ * @param data_size Size of the data segment
+ * @param bss_size Size of the bss segment
+ */
+void collect_writer_stats(SpasmStats *stats, const TextImage *image, const CommandTable *table,
+        const size_t rodata_size, const size_t data_size, const size_t bss_size)
+{
+    size_t i;
+
+    if (!stats)
+        return;
+
+    stats->text_size = image->size;
+    stats->rodata_size = rodata_size;
+    stats->data_size = data_size;
+    stats->bss_size = bss_size;
+
+    stats->relocations += image->relocation_count;
+    stats->allocations += image->allocations;
+    stats->allocated_bytes += image->allocated_bytes;
+
+    if (!table)
+        return;
+
+    stats->threads = table->threads;
+
+    /* Commands, chunk offsets, images and results */
+    stats->allocations += 4;
+    stats->allocated_bytes += (table->count + 1) * sizeof(Command*)
+            + table->threads * (sizeof(uint32_t) + sizeof(TextImage) + sizeof(Errc));
+
+    for (i = 0; i < table->threads; ++i)
+    {
+        stats->relocations += table->images[i].relocation_count;
+        stats->allocations += table->images[i].allocations;
+        stats->allocated_bytes += table->images[i].allocated_bytes;
+    }
+}
+
+
+void init_writer_options(WriterOptions *options)
+{
+    memset(options, 0, sizeof(WriterOptions));
+    options->arch = SPASM_ARCH_I386;
+    options->threads = 1;
+}
+
+
+/**
+ * @brief Appends a "name": value member of the map file.
+ * @param listing Listing of the map file
+ * @param name Member name
+ * @param value Member value
+ * @param hex Write the value as an address string instead of a number
+ */
+void map_member(Listing *listing, const char *name, const uint32_t value, const int hex)
+{
+    listing_json_string(listing, name);
+    listing_text(listing, ": ");
+    if (hex)
+    {
+        listing_char(listing, '"');
+        listing_hex(listing, value, 8);
+        listing_char(listing, '"');
+    }
+    else
+    {
+        listing_unsigned(listing, value);
+    }
+}
+
+
+/**
+ * @brief Appends the "line" member of the map file, null for memory
+ *        locations and commands spasm added itself.
+ * @param listing Listing of the map file
+ * @param line Source line or INVALID_LINE
+ */
+void map_line(Listing *listing, const uint32_t line)
+{
+    if (line == INVALID_LINE)
+        listing_text(listing, "\"line\": null");
+    else
+        map_member(listing, "line", line, 0);
+}
+
+
+/**
+ * @brief Appends a symbol of the map file.
+ * @param listing Listing of the map file
+ * @param name Symbol name
+ * @param type Symbol type
+ * @param vaddr Address of the symbol
+ * @param size Size of the symbol in bytes, 0 for labels
+ * @param line Source line of the symbol, INVALID_LINE for builtins and added symbols
+ * @param first No symbol was appended before
+ */
+void map_symbol(Listing *listing, const char *name, const char *type, const uint32_t vaddr,
+        const uint32_t size, const uint32_t line, const int first)
+{
+    listing_text(listing, first ? "\n    {" : ",\n    {");
+    listing_text(listing, "\"name\": ");
+    listing_json_string(listing, name);
+    listing_text(listing, ", \"type\": ");
+    listing_json_string(listing, type);
+    listing_text(listing, ", ");
+    map_member(listing, "vaddr", vaddr, 1);
+    listing_text(listing, ", ");
+    map_member(listing, "size", size, 0);
+    listing_text(listing, ", ");
+    map_line(listing, line);
+    listing_char(listing, '}');
+}
+
+
+/**
+ * @brief Writes the segment layout, the symbols and the address, size
+ *        and source line of every command as JSON.
+ *
+ * Command vaddrs have to be final and the memory locations placed.
+ * @param file File to write the map to
+ * @param target Target the program was generated for
+ * @param parser Parser with updated vaddr information
+ * @param entry_vaddr Address of the first command
+ * @param segments Text, rodata, data and bss segment
+ * @return ERR_SUCCESS or ERR_ALLOC if the listing buffer can't be allocated.
+ */
+Errc write_map(FILE *file, const SpasmTarget *target, const ParserState *parser,
+        const uint32_t entry_vaddr, const MapSegment *segments)
+{
+    static const char *const MEMORY_TYPES[] = { "bss", "data", "rodata" };
+
+    Listing *listing;
+    const MemoryLocation *mem;
+    const Label *lbl;
+    const Command *cmd;
+    size_t i;
+
+    listing = (Listing*)malloc(sizeof(Listing));
+    if (!listing)
+        return ERR_ALLOC;
+
+    init_listing(listing, file);
+
+    listing_text(listing, "{\n  \"version\": 1,\n  \"arch\": ");
+    listing_json_string(listing, target->name);
+    listing_text(listing, ",\n  ");
+    map_member(listing, "entry", entry_vaddr, 1);
+
+    listing_text(listing, ",\n  \"segments\": [");
+    for (i = 0; i < MAP_SEGMENT_COUNT; ++i)
+    {
+        listing_text(listing, i ? ",\n    {" : "\n    {");
+        listing_text(listing, "\"name\": ");
+        listing_json_string(listing, segments[i].name);
+        listing_text(listing, ", ");
+        map_member(listing, "vaddr", segments[i].vaddr, 1);
+        listing_text(listing, ", ");
+        map_member(listing, "size", (uint32_t)segments[i].size, 0);
+        listing_char(listing, '}');
+    }
+
+    listing_text(listing, "\n  ],\n  \"symbols\": [");
+    map_symbol(listing, "spasm_readint32", "builtin", segments[0].vaddr,
+            (uint32_t)target->readint32_size, INVALID_LINE, 1);
+    map_symbol(listing, "spasm_writeint32", "builtin", segments[0].vaddr + (uint32_t)target->readint32_size,
+            (uint32_t)target->writeint32_size, INVALID_LINE, 0);
+
+    for (mem = parser->memory_location_first; mem; mem = mem->next)
+        map_symbol(listing, mem->name, MEMORY_TYPES[mem->type], mem->vaddr, mem->size, mem->source_line, 0);
+
+    for (lbl = parser->label_first; lbl; lbl = lbl->next)
+        map_symbol(listing, lbl->name, "label", lbl->command->vaddr, 0, lbl->command->source_line, 0);
+
+    listing_text(listing, "\n  ],\n  \"commands\": [");
+    for (cmd = parser->command_first; cmd; cmd = cmd->next)
+    {
+        listing_text(listing, cmd == parser->command_first ? "\n    {" : ",\n    {");
+        map_member(listing, "vaddr", cmd->vaddr, 1);
+        listing_text(listing, ", ");
+        map_member(listing, "size", (uint32_t)command_size(target, cmd), 0);
+        listing_text(listing, ", ");
+        map_line(listing, cmd->source_line);
+        listing_text(listing, ", \"command\": ");
+        listing_json_string(listing, SPASM_MNEMONICS[cmd->type]);
+        listing_char(listing, '}');
+    }
+    listing_text(listing, "\n  ]\n}\n");
+
+    flush_listing(listing);
+    free(listing);
+
+    return ERR_SUCCESS;
+}
+
+
+/**
+ * @brief Places the segments behind an emitted text segment, patches the
+ *        relocations and writes the binary.
+ * @param target Target the text segment was emitted for.
+ * @param parser Parser holding the memory locations
+ * @param text Image of the whole text segment, emitted for text_vaddr
+ * @param table Table holding the relocations of the commands, 0 if the image holds them.
+ * @param entry_vaddr Address of the first command
+ * @param file File handle to write executable to.
+ * @param options Options for binary generation.
+ * @param clock Clock of the running emit phase
+ * @return ERR_SUCCESS on success.
+ */
+Errc write_text_image(const SpasmTarget *target, ParserState *parser, const TextImage *text, CommandTable *table,
+        const uint32_t entry_vaddr, FILE *file, const WriterOptions *options, StatsClock *clock)
+{
+    uint32_t text_vaddr_base;
+    uint32_t rodata_vaddr_base;
+    uint32_t data_vaddr_base;
+    uint32_t bss_vaddr_base;
+
+    SegmentBases bases;
+    MapSegment segments[MAP_SEGMENT_COUNT] = { { ".text", 0, 0 }, { ".rodata", 0, 0 }, { ".data", 0, 0 }, { ".bss", 0, 0 } };
+
+    const uint32_t rodata_alignment = variables_alignment(parser, SPASM_RODATA);
+    const uint32_t data_alignment = variables_alignment(parser, SPASM_DATA);
+    const size_t rodata_size = sizeof(spasm_rodata) + parser->rodata_used + variables_slack(parser->rodata_used, rodata_alignment);
+    const size_t data_size = parser->data_used + variables_slack(parser->data_used, data_alignment);
+    const size_t bss_size = parser->bss_used + spasm_bss_usage;
+    size_t rodata_offset;
+    size_t data_offset;
+
+    unsigned char *rodata_buffer = calloc(1, rodata_size);
+    unsigned char *data_buffer = calloc(1, data_size);
+
+    Errc result = ERR_SUCCESS;
+
+    if (!rodata_buffer || (!data_buffer && data_size))
+    {
+        result = ERR_ALLOC;
+        goto cleanup;
+    }
+
+    count_allocation(options->stats, rodata_size);
+    count_allocation(options->stats, data_size);
+
+    end_phase(options->stats, STATS_EMIT, clock);
+    start_phase(options->stats, clock);
+
+    (options->compact ? target->compact_alignment : target->optimize_alignment)(target->base_vaddr,
+            text->size, rodata_size, data_size,
+            &text_vaddr_base, &rodata_vaddr_base, &data_vaddr_base,
+            &bss_vaddr_base);
+    assert(text_vaddr_base == text->vaddr);
+
+    rodata_offset = sizeof(spasm_rodata) + padding_for(rodata_vaddr_base + sizeof(spasm_rodata), 0, rodata_alignment);
+    data_offset = padding_for(data_vaddr_base, 0, data_alignment);
+
+    /* The builtins use the spasm_bss_usage bytes in front of the variables as string buffer */
+    place_memory_locations(parser, bss_vaddr_base + spasm_bss_usage,
+            rodata_vaddr_base + rodata_offset, data_vaddr_base + data_offset);
+
+    end_phase(options->stats, STATS_PLACE, clock);
+    start_phase(options->stats, clock);
+
+    bases.text = text_vaddr_base;
+    bases.rodata = rodata_vaddr_base;
+    bases.bss = bss_vaddr_base;
+    relocate_text(text, table, &bases);
+
+    if (options->relocations)
+        write_relocations(options->relocations, text, table, &bases);
+
+    end_phase(options->stats, STATS_RELOCATE, clock);
+    start_phase(options->stats, clock);
+
+    if (options->map)
+    {
+        segments[0].vaddr = text_vaddr_base;
+        segments[0].size = text->size;
+        segments[1].vaddr = rodata_vaddr_base;
+        segments[1].size = rodata_size;
+        segments[2].vaddr = data_vaddr_base;
+        segments[2].size = data_size;
+        segments[3].vaddr = bss_vaddr_base;
+        segments[3].size = bss_size;
+
+        result = write_map(options->map, target, parser, entry_vaddr, segments);
+        if (result != ERR_SUCCESS)
+            goto cleanup;
+    }
+
+    memcpy(rodata_buffer, spasm_rodata, sizeof(spasm_rodata));
+
+    result = write_xdata(parser, data_buffer + data_offset, rodata_buffer + rodata_offset);
+    if (result != ERR_SUCCESS)
+        goto cleanup;
+
+    if ((options->compact ? target->write_compact : target->write)(file, entry_vaddr, text_vaddr_base, text->code, text->size,
+            rodata_vaddr_base, rodata_buffer, rodata_size, data_vaddr_base,
+            data_buffer, data_size, bss_vaddr_base, bss_size) != 0)
+    {
+        result = ERR_IO;
+        goto cleanup;
+    }
+
+    end_phase(options->stats, STATS_WRITE, clock);
+    collect_writer_stats(options->stats, text, table, rodata_size, data_size, bss_size);
+
+    cleanup: free(data_buffer);
+    free(rodata_buffer);
+
+    return result;
+}
+
+
+Errc write_program(ParserState *parser, FILE *file, const WriterOptions *options) {
+    const SpasmTarget *target = options->arch == SPASM_ARCH_X86_64
+            ? &SPASM_TARGET_X86_64 : &SPASM_TARGET_I386;
+
+    uint32_t entry_vaddr;
+
+    SpasmBuiltins builtins;
+    TextImage text;
+
+    CommandTable table_storage;
+    CommandTable *table = command_table_for(target, parser, options->threads, &table_storage);
+
+    StatsClock clock;
+    Errc result = ERR_SUCCESS;
+
+    /* The text segment address doesn't depend on the segment sizes, so the
+     * code is emitted for its final addresses right away */
+    init_text_image(&text, text_vaddr(target, options->compact));
+    start_phase(options->stats, &clock);
+
+    builtins.readint32_offset = 0;
+    builtins.printint32_offset = target->readint32_size;
+    builtins.exit_offset = 0;
+
+    result = emit_builtins(target, &text);
+    if (result != ERR_SUCCESS)
+        goto cleanup;
+
+    /* Instrumented programs leave through the profile dump */
+    if (options->profile)
+    {
+        builtins.exit_offset = text.size;
+        result = emit_profile_dump(target, &text, options->profile);
+        if (result != ERR_SUCCESS)
+            goto cleanup;
+    }
+
+    entry_vaddr = text.vaddr + text.size;
+
+    result = emit_commands(target, parser, table, &text, &builtins);
+    if (result != ERR_SUCCESS)
+        goto cleanup;
+
+    result = write_text_image(target, parser, &text, table, entry_vaddr, file, options, &clock);
+
+    cleanup: cleanup_text_image(&text);
+    if (table)
+        cleanup_command_table(table);
+
+    return result;
+}
+
+
+/*
+ * Modules
+ *
+ * A module file holds the text of a separately assembled source emitted
+ * for text offset 0, its symbols and the relocations of its text:
+ *
+ *     "SPO" SPASM_MODULE_VERSION
+ *     uint32_t arch, text size, symbol count, relocation count
+ *     text
+ *     symbols: uint32_t kind, defined, value, memory type, name length,
+ *              name, content of defined data and rodata variables
+ *     relocations: uint32_t type, offset, symbol, addend
+ *
+ * The value of a label is its text offset in the module, the value of a
+ * variable its size. Every label and variable is visible to the other
+ * modules. Values are stored in host byte order.
+ */
+
+#define SPASM_MODULE_VERSION 1
+#define SPASM_MODULE_NO_SYMBOL 0xffffffff
+
+/**
+ * @brief Kinds of module symbols.
+ */
+typedef enum ModuleSymbolKind
+{
+    SPASM_SYMBOL_LABEL,
+    SPASM_SYMBOL_VARIABLE
+} ModuleSymbolKind;
+
+
+typedef struct ModuleSymbol ModuleSymbol;
+
+/**
+ * @brief Label or variable defined or used by a module.
+ */
+struct ModuleSymbol
+{
+    uint32_t kind; /* ModuleSymbolKind */
+    uint32_t defined; /* defined by the module, imported otherwise */
+    uint32_t value; /* text offset of labels, size of variables */
+    uint32_t type; /* MemoryLocationType of variables */
+    char name[MAX_SYMBOL_NAME_LENGTH];
+    unsigned char *content; /* initial content of data and rodata variables */
+
+    const ModuleSymbol *definition; /* symbol of the defining module, set by resolve_symbols */
+    uint32_t address; /* linked text offset of defined labels */
+    MemoryLocation *memory; /* linked memory location of defined variables */
+};
+
+
+typedef struct ModuleRelocation ModuleRelocation;
+
+/**
+ * @brief Relocation of a module as stored in the module file.
+ */
+struct ModuleRelocation
+{
+    uint32_t type; /* RelocationType */
+    uint32_t offset; /* text offset of the patched uint32_t in the module */
+    uint32_t symbol; /* index of the target symbol, SPASM_MODULE_NO_SYMBOL for none */
+    uint32_t addend;
+};
+
+
+typedef struct Module Module;
+
+/**
+ * @brief Module read for linking.
+ */
+struct Module
+{
+    uint32_t arch;
+    uint32_t text_size;
+    uint32_t symbol_count;
+    uint32_t relocation_count;
+
+    unsigned char *text;
+    ModuleSymbol *symbols;
+    ModuleRelocation *relocations;
+
+    uint32_t base; /* linked text offset of the module text */
+};
+
+
+typedef struct SymbolIndex SymbolIndex;
+
+/**
+ * @brief Maps a label or memory location to its module symbol index.
+ */
+struct SymbolIndex
+{
+    const void *pointer;
+    uint32_t index;
+};
+
+
+/**
+ * @brief qsort and bsearch comparator ordering symbol indexes by pointer.
+ */
+int compare_symbol_indexes(const void *a, const void *b)
+{
+    const size_t first = (size_t)((const SymbolIndex*)a)->pointer;
+    const size_t second = (size_t)((const SymbolIndex*)b)->pointer;
+
+    return first < second ? -1 : first > second;
+}
+
+
+/**
+ * @brief Writes an uint32_t to a module file.
+ * @return 1 on success.
+ */
+int write_module_value(FILE *file, const uint32_t value)
+{
+    return fwrite(&value, sizeof(value), 1, file) == 1;
+}
+
+
+/**
+ * @brief Writes a symbol to a module file.
+ * @return 1 on success.
+ */
+int write_module_symbol(FILE *file, const ModuleSymbolKind kind, const int defined, const uint32_t value,
+        const MemoryLocation *memory, const char *name)
+{
+    const uint32_t length = (uint32_t)strlen(name);
+    int written = write_module_value(file, kind)
+            && write_module_value(file, defined)
+            && write_module_value(file, value)
+            && write_module_value(file, memory ? memory->type : SPASM_BSS)
+            && write_module_value(file, length)
+            && fwrite(name, 1, length, file) == length;
+
+    if (written && memory && defined && memory->type != SPASM_BSS)
+        written = fwrite(memory->content, 1, memory->size, file) == memory->size;
+
+    return written;
+}
+
+
+/**
+ * @brief Writes the relocations of a module text image.
+ * @param file Module file
+ * @param image Text image of the module
+ * @param index Symbol indexes of the labels and memory locations sorted by pointer
+ * @param symbol_count Number of symbol indexes
+ * @return ERR_SUCCESS on success.
+ */
+Errc write_module_relocations(FILE *file, const TextImage *image, const SymbolIndex *index, const size_t symbol_count)
+{
+    const Relocation *relocation = image->relocations;
+    const Relocation *end = relocation + image->relocation_count;
+    const SymbolIndex *found;
+    SymbolIndex key;
+
+    for (; relocation != end; ++relocation)
+    {
+        switch (relocation->type) {
+        case SPASM_RELOC_LABEL:
+            key.pointer = relocation->target.label;
+            break;
+        case SPASM_RELOC_MEMORY:
+        case SPASM_RELOC_MEMORY_WORD:
+            key.pointer = relocation->target.memory;
+            break;
+        case SPASM_RELOC_TEXT:
+            key.pointer = 0;
+            break;
+        default:
+            /* Segment relocations only appear in the builtins which the link step emits */
+            return ERR_MODULE;
+        }
+
+        found = key.pointer ? (const SymbolIndex*)bsearch(&key, index, symbol_count,
+                sizeof(SymbolIndex), compare_symbol_indexes) : 0;
+        if (key.pointer && !found)
+            return ERR_INTERNAL;
+
+        if (!write_module_value(file, relocation->type)
+                || !write_module_value(file, relocation->offset)
+                || !write_module_value(file, found ? found->index : SPASM_MODULE_NO_SYMBOL)
+                || !write_module_value(file, relocation->addend))
+            return ERR_IO;
+    }
+
+    return ERR_SUCCESS;
+}
+
+
+Errc write_module(ParserState *parser, FILE *file, const WriterOptions *options)
+{
+    const SpasmTarget *target = options->arch == SPASM_ARCH_X86_64
+            ? &SPASM_TARGET_X86_64 : &SPASM_TARGET_I386;
+    const char magic[4] = { 'S', 'P', 'O', SPASM_MODULE_VERSION };
+
+    SpasmBuiltins builtins;
+    TextImage text;
+    SymbolIndex *index = 0;
+    size_t symbol_count = 0;
+    Command *command;
+    Label *label;
+    MemoryLocation *memory;
+    Errc result;
+    int written;
+
+    /* Linked text offsets are unknown, so commands may not depend on their vaddr */
+    for (command = parser->command_first; command; command = command->next)
+    {
+        if (command->type == SPASM_ALN || command->type == SPASM_VEC)
+            return ERR_MODULE;
+    }
+
+    for (label = parser->label_first; label; label = label->next)
+        ++symbol_count;
+    for (memory = parser->memory_location_first; memory; memory = memory->next)
+        ++symbol_count;
+
+    index = (SymbolIndex*)malloc((symbol_count + 1) * sizeof(SymbolIndex));
+    if (!index)
+        return ERR_ALLOC;
+
+    symbol_count = 0;
+    for (label = parser->label_first; label; label = label->next, ++symbol_count)
+    {
+        index[symbol_count].pointer = label;
+        index[symbol_count].index = (uint32_t)symbol_count;
+    }
+    for (memory = parser->memory_location_first; memory; memory = memory->next, ++symbol_count)
+    {
+        index[symbol_count].pointer = memory;
+        index[symbol_count].index = (uint32_t)symbol_count;
+    }
+    qsort(index, symbol_count, sizeof(SymbolIndex), compare_symbol_indexes);
+
+    /* The link step puts the builtins at the same offsets in front of the modules */
+    builtins.readint32_offset = 0;
+    builtins.printint32_offset = target->readint32_size;
+    builtins.exit_offset = 0;
+
+    init_text_image(&text, 0);
+    result = emit_commands(target, parser, 0, &text, &builtins);
+    if (result != ERR_SUCCESS)
+        goto cleanup;
+
+    written = fwrite(magic, 1, sizeof(magic), file) == sizeof(magic)
+            && write_module_value(file, options->arch)
+            && write_module_value(file, (uint32_t)text.size)
+            && write_module_value(file, (uint32_t)symbol_count)
+            && write_module_value(file, (uint32_t)text.relocation_count)
+            && fwrite(text.code, 1, text.size, file) == text.size;
+
+    /* Commands were emitted for vaddr 0, so their vaddr is their text offset */
+    for (label = parser->label_first; written && label; label = label->next)
+        written = write_module_symbol(file, SPASM_SYMBOL_LABEL, label->command != 0,
+                label->command ? label->command->vaddr : 0, 0, label->name);
+
+    for (memory = parser->memory_location_first; written && memory; memory = memory->next)
+        written = write_module_symbol(file, SPASM_SYMBOL_VARIABLE, !memory->imported,
+                memory->size, memory, memory->name);
+
+    result = written ? write_module_relocations(file, &text, index, symbol_count) : ERR_IO;
+
+    cleanup: cleanup_text_image(&text);
+    free(index);
+
+    return result;
+}
+
+
+/**
+ * @brief Reads an uint32_t from a module file.
+ * @return 1 on success.
+ */
+int read_module_value(FILE *file, uint32_t *value)
+{
+    return fread(value, sizeof(*value), 1, file) == 1;
+}
+
+
+/**
+ * @brief Releases the memory held by a module.
+ */
+void cleanup_module(Module *module)
+{
+    uint32_t i;
+
+    for (i = 0; module->symbols && i < module->symbol_count; ++i)
+        free(module->symbols[i].content);
+
+    free(module->text);
+    free(module->symbols);
+    free(module->relocations);
+    memset(module, 0, sizeof(Module));
+}
+
+
+/**
+ * @brief Reads and validates a module written by write_module.
+ * @param file Module file
+ * @param module Module to fill, has to be released with cleanup_module
+ * @return ERR_SUCCESS on success, ERR_MODULE for malformed modules.
+ */
+Errc read_module(FILE *file, Module *module)
+{
+    char magic[4];
+    ModuleSymbol *symbol;
+    ModuleRelocation *relocation;
+    uint32_t length;
+    uint32_t i;
+
+    memset(module, 0, sizeof(Module));
+
+    if (fread(magic, 1, sizeof(magic), file) != sizeof(magic)
+            || memcmp(magic, "SPO", 3) != 0 || magic[3] != SPASM_MODULE_VERSION
+            || !read_module_value(file, &module->arch)
+            || !read_module_value(file, &module->text_size)
+            || !read_module_value(file, &module->symbol_count)
+            || !read_module_value(file, &module->relocation_count)
+            || module->arch > SPASM_ARCH_X86_64)
+        return ERR_MODULE;
+
+    module->text = (unsigned char*)malloc(module->text_size + 1);
+    module->symbols = (ModuleSymbol*)calloc(module->symbol_count + 1, sizeof(ModuleSymbol));
+    module->relocations = (ModuleRelocation*)malloc((module->relocation_count + 1) * sizeof(ModuleRelocation));
+    if (!module->text || !module->symbols || !module->relocations)
+        return ERR_ALLOC;
+
+    if (fread(module->text, 1, module->text_size, file) != module->text_size)
+        return ERR_MODULE;
+
+    for (i = 0; i < module->symbol_count; ++i)
+    {
+        symbol = &module->symbols[i];
+        if (!read_module_value(file, &symbol->kind)
+                || !read_module_value(file, &symbol->defined)
+                || !read_module_value(file, &symbol->value)
+                || !read_module_value(file, &symbol->type)
+                || !read_module_value(file, &length)
+                || symbol->kind > SPASM_SYMBOL_VARIABLE || symbol->type > SPASM_RODATA
+                || length == 0 || length >= MAX_SYMBOL_NAME_LENGTH
+                || fread(symbol->name, 1, length, file) != length)
+            return ERR_MODULE;
+
+        if (symbol->kind == SPASM_SYMBOL_LABEL && symbol->defined && symbol->value >= module->text_size)
+            return ERR_MODULE;
+
+        if (symbol->kind == SPASM_SYMBOL_VARIABLE && symbol->defined && symbol->type != SPASM_BSS)
+        {
+            symbol->content = (unsigned char*)malloc(symbol->value + 1);
+            if (!symbol->content)
+                return ERR_ALLOC;
+
+            if (fread(symbol->content, 1, symbol->value, file) != symbol->value)
+                return ERR_MODULE;
+        }
+    }
+
+    for (i = 0; i < module->relocation_count; ++i)
+    {
+        relocation = &module->relocations[i];
+        if (!read_module_value(file, &relocation->type)
+                || !read_module_value(file, &relocation->offset)
+                || !read_module_value(file, &relocation->symbol)
+                || !read_module_value(file, &relocation->addend)
+                || module->text_size < sizeof(uint32_t)
+                || relocation->offset > module->text_size - sizeof(uint32_t))
+            return ERR_MODULE;
+
+        /* Labels and variables are referenced through symbols of the matching kind */
+        switch (relocation->type) {
+        case SPASM_RELOC_TEXT:
+            break;
+        case SPASM_RELOC_LABEL:
+        case SPASM_RELOC_MEMORY:
+        case SPASM_RELOC_MEMORY_WORD:
+            if (relocation->symbol >= module->symbol_count
+                    || module->symbols[relocation->symbol].kind
+                        != (relocation->type == SPASM_RELOC_LABEL ? SPASM_SYMBOL_LABEL : SPASM_SYMBOL_VARIABLE))
+                return ERR_MODULE;
+            break;
+        default:
+            return ERR_MODULE;
+        }
+    }
+
+    return ERR_SUCCESS;
+}
+
+
+/**
+ * @brief Returns whether two module symbols name the same label or variable.
+ */
+int same_module_symbol(const ModuleSymbol *first, const ModuleSymbol *second)
+{
+    return first->kind == second->kind && strcmp(first->name, second->name) == 0;
+}
+
+
+/**
+ * @brief qsort comparator grouping symbols by kind and name, definitions first.
+ */
+int compare_module_symbols(const void *a, const void *b)
+{
+    const ModuleSymbol *first = *(const ModuleSymbol* const*)a;
+    const ModuleSymbol *second = *(const ModuleSymbol* const*)b;
+    int order;
+
+    if (first->kind != second->kind)
+        return first->kind < second->kind ? -1 : 1;
+
+    order = strcmp(first->name, second->name);
+    if (order != 0)
+        return order;
+
+    return (int)second->defined - (int)first->defined;
+}
+
+
+/**
+ * @brief Points every symbol of the modules at the single module symbol defining it.
+ * @param modules Modules to resolve
+ * @param count Number of modules
+ * @param symbol Set to the name of an undefined or redefined symbol
+ * @return ERR_SUCCESS on success, ERR_UNDEFINED_* or ERR_*_REDEFINITION otherwise.
+ */
+Errc resolve_symbols(Module *modules, const size_t count, char *symbol)
+{
+    ModuleSymbol **symbols;
+    size_t symbol_count = 0;
+    size_t first;
+    size_t i;
+    uint32_t j;
+    Errc result = ERR_SUCCESS;
+
+    for (i = 0; i < count; ++i)
+        symbol_count += modules[i].symbol_count;
+
+    symbols = (ModuleSymbol**)malloc((symbol_count + 1) * sizeof(ModuleSymbol*));
+    if (!symbols)
+        return ERR_ALLOC;
+
+    symbol_count = 0;
+    for (i = 0; i < count; ++i)
+    {
+        for (j = 0; j < modules[i].symbol_count; ++j)
+            symbols[symbol_count++] = &modules[i].symbols[j];
+    }
+
+    /* Symbols of the same name are adjacent with the definitions in front */
+    qsort(symbols, symbol_count, sizeof(ModuleSymbol*), compare_module_symbols);
+
+    for (first = 0; first < symbol_count && result == ERR_SUCCESS; first = i)
+    {
+        for (i = first; i < symbol_count && same_module_symbol(symbols[first], symbols[i]); ++i)
+            symbols[i]->definition = symbols[first];
+
+        if (!symbols[first]->defined)
+            result = symbols[first]->kind == SPASM_SYMBOL_LABEL ? ERR_UNDEFINED_LABEL : ERR_UNDEFINED_VARIABLE;
+        else if (first + 1 < i && symbols[first + 1]->defined)
+            result = symbols[first]->kind == SPASM_SYMBOL_LABEL ? ERR_LABEL_REDEFINITION : ERR_VARIABLE_REDEFINITION;
+
+        if (result != ERR_SUCCESS)
+            strcpy(symbol, symbols[first]->name);
+    }
+
+    free(symbols);
+    return result;
+}
+
+
+/**
+ * @brief Adds the variables defined by a module to the memory locations of the linked program.
+ * @param program State holding the memory locations of the linked program
+ * @param module Module defining the variables
+ * @return ERR_SUCCESS on success.
+ */
+Errc add_module_variables(ParserState *program, Module *module)
+{
+    ModuleSymbol *symbol;
+    MemoryLocation *memory;
+    uint32_t i;
+
+    for (i = 0; i < module->symbol_count; ++i)
+    {
+        symbol = &module->symbols[i];
+        if (symbol->kind != SPASM_SYMBOL_VARIABLE || !symbol->defined)
+            continue;
+
+        memory = insert_bss_variable(program, symbol->name, strlen(symbol->name), symbol->value, INVALID_LINE);
+        if (!memory)
+            return ERR_ALLOC;
+
+        /* Initialized variables move to their segment, taking over the content */
+        if (symbol->type != SPASM_BSS)
+        {
+            program->bss_used -= symbol->value;
+            if (symbol->type == SPASM_DATA)
+            {
+                program->data_used += symbol->value;
+            }
+            else
+            {
+                program->rodata_used += symbol->value;
+                program->rodata_words = 1;
+            }
+
+            memory->type = symbol->type == SPASM_DATA ? SPASM_DATA : SPASM_RODATA;
+            memory->content = symbol->content;
+            symbol->content = 0;
+        }
+
+        symbol->memory = memory;
+    }
+
+    return ERR_SUCCESS;
+}
+
+
+Errc link_modules(FILE **files, const size_t count, FILE *file, const WriterOptions *options, char *symbol)
+{
+    Module *modules = (Module*)calloc(count + 1, sizeof(Module));
+    const SpasmTarget *target = &SPASM_TARGET_I386;
+    const ModuleSymbol *definition;
+    const ModuleRelocation *relocation;
+    Relocation *linked;
+    ParserState program;
+    TextImage text;
+    StatsClock clock;
+    uint32_t entry_vaddr;
+    uint32_t position;
+    unsigned char *code;
+    size_t i;
+    uint32_t j;
+    Errc result = ERR_SUCCESS;
+
+    init_parser(&program);
+    init_text_image(&text, 0);
+    if (!modules)
+        return ERR_ALLOC;
+
+    for (i = 0; i < count && result == ERR_SUCCESS; ++i)
+    {
+        result = read_module(files[i], &modules[i]);
+        if (result == ERR_SUCCESS && modules[i].arch != modules[0].arch)
+            result = ERR_MODULE;
+    }
+
+    if (result == ERR_SUCCESS)
+        result = resolve_symbols(modules, count, symbol);
+    if (result != ERR_SUCCESS)
+        goto cleanup;
+
+    if (modules[0].arch == SPASM_ARCH_X86_64)
+        target = &SPASM_TARGET_X86_64;
+
+    text.vaddr = text_vaddr(target, options->compact);
+    start_phase(options->stats, &clock);
+
+    result = emit_builtins(target, &text);
+    if (result != ERR_SUCCESS)
+        goto cleanup;
+
+    entry_vaddr = text.vaddr + text.size;
+
+    /* The module texts follow each other in link order, so the program starts with the first one */
+    for (i = 0; i < count && result == ERR_SUCCESS; ++i)
+    {
+        modules[i].base = (uint32_t)text.size;
+        code = reserve_text(&text, modules[i].text_size);
+        if (!code)
+        {
+            result = ERR_ALLOC;
+            break;
+        }
+        memcpy(code, modules[i].text, modules[i].text_size);
+
+        for (j = 0; j < modules[i].symbol_count; ++j)
+        {
+            if (modules[i].symbols[j].kind == SPASM_SYMBOL_LABEL && modules[i].symbols[j].defined)
+                modules[i].symbols[j].address = modules[i].base + modules[i].symbols[j].value;
+        }
+
+        result = add_module_variables(&program, &modules[i]);
+    }
+
+    /* Jumps between modules become plain text relocations */
+    for (i = 0; i < count && result == ERR_SUCCESS; ++i)
+    {
+        for (j = 0; j < modules[i].relocation_count; ++j)
+        {
+            relocation = &modules[i].relocations[j];
+            position = modules[i].base + relocation->offset;
+            definition = relocation->symbol == SPASM_MODULE_NO_SYMBOL
+                    ? 0 : modules[i].symbols[relocation->symbol].definition;
+
+            switch (relocation->type) {
+            case SPASM_RELOC_LABEL:
+                linked = add_relocation(&text, SPASM_RELOC_TEXT, position, definition->address);
+                break;
+            case SPASM_RELOC_TEXT:
+                linked = add_relocation(&text, SPASM_RELOC_TEXT, position, relocation->addend);
+                break;
+            default:
+                linked = add_relocation(&text, (RelocationType)relocation->type, position, relocation->addend);
+                if (linked)
+                    linked->target.memory = definition->memory;
+                break;
+            }
+
+            if (!linked)
+            {
+                result = ERR_ALLOC;
+                break;
+            }
+        }
+    }
+
+    if (result == ERR_SUCCESS)
+        result = write_text_image(target, &program, &text, 0, entry_vaddr, file, options, &clock);
+
+    cleanup: for (i = 0; i < count; ++i)
+        cleanup_module(&modules[i]);
+    free(modules);
+    cleanup_text_image(&text);
+    cleanup_parser(&program);
+
+    return result;
+}
+
+
+/**
+ * @brief Adds the builtins and every labeled code region to a perf map.
+ * @param map Perf map to write to
+ * @param target Target the program was generated for
+ * @param parser Parser with updated vaddr information
+ * @param text_vaddr Base of the text segment
+ * @param text_end End of the code
+ */
+void write_perf_map(FILE *map, const SpasmTarget *target, const ParserState *parser,
+        const uint32_t text_vaddr, const uint32_t text_end)
+{
+    const Command *command = parser->command_first;
+    const char *name = "spasm_main";
+    uint32_t start = command->vaddr;
+
+    jit_add_perf_symbol(map, text_vaddr, target->readint32_size, "spasm_readint32");
+    jit_add_perf_symbol(map, text_vaddr + target->readint32_size, target->writeint32_size, "spasm_writeint32");
+
+    for (; command; command = command->next)
+    {
+        if (!command->label || command->vaddr == start)
+        {
+            if (command->label)
+                name = command->label->name;
+            continue;
+        }
+
+        jit_add_perf_symbol(map, start, command->vaddr - start, name);
+        start = command->vaddr;
+        name = command->label->name;
+    }
+
+    jit_add_perf_symbol(map, start, text_end - start, name);
+}
+
+
+Errc run_program(ParserState *parser, const WriterOptions *options, int *exit_code) {
+#if defined(__x86_64__)
+    const SpasmTarget *target = &SPASM_TARGET_X86_64;
+#else
+    const SpasmTarget *target = &SPASM_TARGET_I386;
+#endif
+
+    /* The segments are page aligned, so only the builtin messages need padding */
+    const size_t rodata_offset = sizeof(spasm_rodata)
+            + padding_for(sizeof(spasm_rodata), 0, variables_alignment(parser, SPASM_RODATA));
+    const size_t rodata_size = rodata_offset + parser->rodata_used;
+    const size_t data_size = parser->data_used;
+    const size_t bss_size = spasm_bss_usage + parser->bss_used + 2 * sizeof(uint64_t);
+    /* Aligned slot behind the variables, the bss segment is page aligned */
+    const uint32_t host_stack_offset = (spasm_bss_usage + parser->bss_used + 7) & ~(uint32_t)7;
+
+    const RelocationType host_stack_type = SPASM_RELOC_BSS;
+    const uint32_t enter_offset = target->jit_enter_offset;
+    const uint32_t leave_offset = target->jit_leave_offset;
+
+    CommandTable table_storage;
+    CommandTable *table = command_table_for(target, parser, options->threads, &table_storage);
+
+    size_t text_pages;
+    size_t rodata_pages;
+    size_t data_pages;
+    size_t memory_size = 0;
+
+    unsigned char *memory = 0;
+    uint32_t entry_offset;
+    size_t position;
+    Relocation *relocation;
+    Command *command;
+    SpasmBuiltins builtins;
+    SegmentBases bases;
+    MapSegment segments[MAP_SEGMENT_COUNT] = { { ".text", 0, 0 }, { ".rodata", 0, 0 }, { ".data", 0, 0 }, { ".bss", 0, 0 } };
+    TextImage text;
+    StatsClock clock;
+    FILE *map;
+    Errc result;
+
+    /* The mapping is page aligned, so emitting for vaddr 0 keeps the ALN
+     * command sizes. Command vaddrs are moved to the mapping afterwards. */
+    init_text_image(&text, 0);
+    start_phase(options->stats, &clock);
+
+    result = emit_builtins(target, &text);
+    if (result != ERR_SUCCESS)
+        goto cleanup;
+
+    /* STP jumps to the exit sequence in front of the program */
+    builtins.readint32_offset = 0;
+    builtins.printint32_offset = target->readint32_size;
+    builtins.exit_offset = text.size;
+    result = emit_with_relocations(&text, target->jit_leave, target->jit_leave_size,
+            &leave_offset, &host_stack_type, &host_stack_offset, 1);
+    if (result != ERR_SUCCESS)
+        goto cleanup;
+
+    entry_offset = text.size;
+    result = emit_with_relocations(&text, target->jit_enter, target->jit_enter_size,
+            &enter_offset, &host_stack_type, &host_stack_offset, 1);
+    if (result != ERR_SUCCESS)
+        goto cleanup;
+
+    result = emit_commands(target, parser, table, &text, &builtins);
+    if (result != ERR_SUCCESS)
+        goto cleanup;
+
+    /* Programs running past their last command return to the host as well */
+    result = emit_sequence(&text, target->commands[SPASM_JMP], target->command_sizes[SPASM_JMP], &position);
+    if (result != ERR_SUCCESS)
+        goto cleanup;
+
+    relocation = add_relocation(&text, SPASM_RELOC_TEXT,
+            position + target->replacement_offsets[SPASM_JMP], builtins.exit_offset);
+    if (!relocation)
+    {
+        result = ERR_ALLOC;
+        goto cleanup;
+    }
+
+    end_phase(options->stats, STATS_EMIT, &clock);
+    start_phase(options->stats, &clock);
+
+    /* Segments are placed on separate pages to protect them individually */
+    text_pages = page_after(text.size);
+    rodata_pages = page_after(rodata_size);
+    data_pages = page_after(data_size);
+    memory_size = text_pages + rodata_pages + data_pages + page_after(bss_size);
+
+    memory = jit_alloc(memory_size);
+    if (!memory)
+    {
+        result = ERR_JIT;
+        goto cleanup;
+    }
+
+    /* All addresses are encoded as 32 bit values, sign extended on x86_64 */
+    if ((size_t)memory > 0x7fffffff - memory_size)
+    {
+        result = ERR_JIT;
+        goto cleanup;
+    }
+
+    bases.text = (uint32_t)(size_t)memory;
+    bases.rodata = bases.text + text_pages;
+    bases.bss = bases.rodata + rodata_pages + data_pages;
+
+    place_memory_locations(parser, bases.bss + spasm_bss_usage,
+            bases.rodata + rodata_offset, bases.rodata + rodata_pages);
+
+    end_phase(options->stats, STATS_PLACE, &clock);
+    start_phase(options->stats, &clock);
+
+    relocate_text(&text, table, &bases);
+
+    if (options->relocations)
+        write_relocations(options->relocations, &text, table, &bases);
+
+    end_phase(options->stats, STATS_RELOCATE, &clock);
+    start_phase(options->stats, &clock);
+
+    for (command = parser->command_first; command; command = command->next)
+        command->vaddr += bases.text;
+
+    memcpy(memory, text.code, text.size);
+    memcpy(memory + text_pages, spasm_rodata, sizeof(spasm_rodata));
+
+    result = write_xdata(parser, memory + text_pages + rodata_pages,
+            memory + text_pages + rodata_offset);
+    if (result != ERR_SUCCESS)
+        goto cleanup;
+
+    if (jit_protect(memory, text_pages, 1) != 0
+            || jit_protect(memory + text_pages, rodata_pages, 0) != 0)
+    {
+        result = ERR_JIT;
+        goto cleanup;
+    }
+
+    if (options->map)
+    {
+        segments[0].vaddr = bases.text;
+        segments[0].size = text.size;
+        segments[1].vaddr = bases.rodata;
+        segments[1].size = rodata_size;
+        segments[2].vaddr = bases.rodata + rodata_pages;
+        segments[2].size = data_size;
+        segments[3].vaddr = bases.bss;
+        segments[3].size = bss_size;
+
+        result = write_map(options->map, target, parser, bases.text + entry_offset, segments);
+        if (result != ERR_SUCCESS)
+            goto cleanup;
+    }
+
+    if (options->perf_map)
+    {
+        map = jit_open_perf_map();
+        if (map)
+        {
+            write_perf_map(map, target, parser, bases.text, bases.text + text.size);
+            fclose(map);
+        }
+    }
+
+    end_phase(options->stats, STATS_WRITE, &clock);
+    collect_writer_stats(options->stats, &text, table, rodata_size, data_size, bss_size);
+
+    /* The builtins write to the file descriptors directly */
+    fflush(stdout);
+    *exit_code = jit_call(memory + entry_offset);
+
+    cleanup: if (memory)
+        jit_free(memory, memory_size);
+    cleanup_text_image(&text);
+    if (table)
+        cleanup_command_table(table);
+
+    return result;
+}
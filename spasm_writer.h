@@ -23,16 +23,93 @@
 #include <stdio.h>
 
 #include "spasm_types.h"
+#include "spasm_instrument.h"
 
 #ifndef SPASM_WRITER_H_
 #define SPASM_WRITER_H_
 
+/**
+ * @brief Enumeration of supported target architectures.
+ */
+typedef enum SpasmArch
+{
+    SPASM_ARCH_I386,  /* ELF32 binary using int 80h syscalls */
+    SPASM_ARCH_X86_64 /* ELF64 binary using the syscall instruction */
+} SpasmArch;
+
+typedef struct WriterOptions WriterOptions;
+
+/**
+ * @brief Options controlling binary generation.
+ */
+struct WriterOptions
+{
+    SpasmArch arch; /* Target architecture */
+    int perf_map; /* Write a perf map for programs run in-process */
+    const BlockProfile *profile; /* Write the block profile at STP, @see instrument_blocks */
+    size_t threads; /* Number of threads writing and relocating the commands */
+    FILE *relocations; /* Write the relocation table to this file, 0 for none */
+    FILE *map; /* Write the symbol and command address map to this file, 0 for none */
+    int compact; /* Two segments and no section headers, @see elf_write_compact */
+    SpasmStats *stats; /* Collect statistics of the writer phases, 0 for none */
+};
+
+/**
+ * @brief Sets the given options to their defaults.
+ * @param options WriterOptions to initialize
+ */
+void init_writer_options(WriterOptions *options);
+
 /**
  * @brief Writes the program contained in the ParserState as an elf binary
  *        into the given file.
  * @param file File handle to write executable to.
+ * @param options Options for binary generation.
+ * @return ERRC_SUCCESS in case of success.
+ */
+Errc write_program(ParserState *parser, FILE *file, const WriterOptions *options);
+
+/**
+ * @brief Writes the program contained in the ParserState as a module for link_modules.
+ *
+ * The module holds the text emitted for text offset 0, every label and
+ * variable of the program and the relocations still to be resolved.
+ * Undefined labels and variables of a parser in module mode are left to
+ * the other modules.
+ *
+ * @param parser Program to write, mustn't contain ALN or VEC commands.
+ * @param file File handle to write the module to.
+ * @param options Options for code generation, only the architecture is used.
+ * @return ERR_SUCCESS in case of success, ERR_MODULE for position dependent code.
+ */
+Errc write_module(ParserState *parser, FILE *file, const WriterOptions *options);
+
+/**
+ * @brief Links modules written by write_module into an elf binary.
+ *
+ * The texts of the modules follow the builtins in the given order and the
+ * program starts at the first command of the first module. Labels and
+ * variables of all modules share one namespace.
+ *
+ * @param files Module files
+ * @param count Number of modules
+ * @param file File handle to write executable to.
+ * @param options Options for binary generation, the architecture is the one of the modules.
+ * @param symbol Set to the name of an undefined or redefined label or variable,
+ *        MAX_SYMBOL_NAME_LENGTH bytes.
+ * @return ERRC_SUCCESS in case of success.
+ */
+Errc link_modules(FILE **files, const size_t count, FILE *file, const WriterOptions *options, char *symbol);
+
+/**
+ * @brief Generates the program contained in the ParserState into executable
+ *        memory of the calling process and runs it. STP returns to the caller.
+ * @note Code is generated for the host architecture, options->arch is ignored.
+ * @param parser Program to run.
+ * @param options Options for code generation.
+ * @param exit_code Set to the exit code of the program.
  * @return ERRC_SUCCESS in case of success.
  */
-Errc write_program(ParserState *parser, FILE *file);
+Errc run_program(ParserState *parser, const WriterOptions *options, int *exit_code);
 
 #endif /* SPASM_WRITER_H_ */
@@ -0,0 +1,1148 @@
+/*
+ * Copyright (C) 2011, Stefan Hacker <dd0t@users.sourceforge.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#define _GNU_SOURCE /* mkdtemp */
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <math.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+
+#define VALIDATE_MAX_VARIANTS 32
+#define VALIDATE_MAX_INPUTS 16
+#define VALIDATE_MAX_ARGS 64 /* spasm arguments including the flags of a variant */
+#define VALIDATE_NAME_LENGTH 256
+#define VALIDATE_DEFAULT_TIMEOUT 10 /* seconds a single run may take */
+#define VALIDATE_DEFAULT_TESTS 400 /* runs the minimizer may spend per mismatch */
+
+#define RANDOM_SCALARS 6 /* at most this many scalar variables */
+#define RANDOM_ARRAY 16 /* words of the array, loops run at most this often */
+#define RANDOM_LOOPS 3 /* at most this many loops */
+#define RANDOM_DEPTH 3 /* expression nesting */
+
+
+/**
+ * @brief Outcome of comparing a variant against the reference.
+ */
+typedef enum Verdict
+{
+    VERDICT_SAME,
+    VERDICT_SKIPPED, /* the reference failed to build or timed out */
+    VERDICT_ASSEMBLY, /* only the variant failed to build */
+    VERDICT_TIMEOUT, /* only the variant timed out */
+    VERDICT_EXIT, /* exit codes differ */
+    VERDICT_OUTPUT /* stdout differs */
+} Verdict;
+
+const char VERDICT_NAMES[][16] = {
+        "ok", "skipped", "assembly", "timeout", "exit code", "output" };
+
+
+typedef struct ValidateRun ValidateRun;
+
+/**
+ * @brief Result of building and running a program once.
+ */
+struct ValidateRun
+{
+    int assembled; /* spasm succeeded */
+    int timed_out;
+    int exit_code; /* 128 + signal if killed */
+    double seconds; /* wall time of the run (including code generation for --run) */
+    char *output; /* stdout of the run */
+    size_t output_size;
+};
+
+
+typedef struct ValidateOptions ValidateOptions;
+
+/**
+ * @brief Options of the harness.
+ */
+struct ValidateOptions
+{
+    const char *spasm; /* spasm binary */
+    const char *inputs[VALIDATE_MAX_INPUTS]; /* stdin vectors of every program */
+    size_t input_count;
+    const char *variants[VALIDATE_MAX_VARIANTS];
+    size_t variant_count;
+    const char *reproducers; /* directory for minimized mismatches */
+    unsigned random; /* number of random programs */
+    uint32_t seed;
+    unsigned timeout;
+    unsigned tests; /* minimizer budget */
+    char work[VALIDATE_NAME_LENGTH]; /* temporary directory */
+};
+
+
+typedef struct Generator Generator;
+
+/**
+ * @brief State of the random program generator.
+ */
+struct Generator
+{
+    FILE *out;
+    uint32_t state;
+    unsigned scalars;
+    unsigned loops; /* loops emitted so far */
+    unsigned labels;
+    int counter; /* counter of the enclosing loop, -1 outside of loops */
+};
+
+
+/**
+ * @brief Wall clock in seconds.
+ */
+double now(void)
+{
+    struct timespec time;
+
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (double)time.tv_sec + (double)time.tv_nsec / 1e9;
+}
+
+
+/**
+ * @brief Exit code of a waited for child, 128 + signal if it was killed.
+ */
+int exit_code_of(const int status)
+{
+    if (WIFEXITED(status))
+        return WEXITSTATUS(status);
+
+    return WIFSIGNALED(status) ? 128 + WTERMSIG(status) : -1;
+}
+
+
+/**
+ * @brief Splits the space separated flags of a variant into argv.
+ * @return Number of arguments added.
+ */
+size_t split_flags(char *flags, char **argv, size_t argc)
+{
+    size_t added = 0;
+    char *flag;
+
+    for (flag = strtok(flags, " "); flag && argc + added < VALIDATE_MAX_ARGS; flag = strtok(0, " "))
+        argv[argc + added++] = flag;
+
+    return added;
+}
+
+
+/**
+ * @brief Runs argv with the given stdin and stdout files, stderr is discarded.
+ * @param argv Program and arguments
+ * @param input File to use as stdin, 0 for /dev/null
+ * @param output File receiving stdout, 0 for /dev/null
+ * @param timeout Seconds before the child is killed, 0 for none
+ * @param seconds Set to the wall time of the child, may be 0
+ * @return Exit code of the child, 128 + signal if killed, -1 if it couldn't be started.
+ */
+int spawn(char **argv, const char *input, const char *output, const unsigned timeout, double *seconds)
+{
+    double start = now();
+    int status = 0;
+    int input_fd;
+    int output_fd;
+    pid_t pid;
+
+    pid = fork();
+    if (pid < 0)
+        return -1;
+
+    if (pid == 0)
+    {
+        input_fd = open(input ? input : "/dev/null", O_RDONLY);
+        output_fd = output ? open(output, O_WRONLY | O_CREAT | O_TRUNC, 0644)
+                           : open("/dev/null", O_WRONLY);
+        dup2(input_fd, STDIN_FILENO);
+        dup2(output_fd, STDOUT_FILENO);
+        close(STDERR_FILENO);
+        open("/dev/null", O_WRONLY);
+
+        /* Pending alarms survive exec and stop runaway programs */
+        alarm(timeout);
+        execv(argv[0], argv);
+        _exit(127);
+    }
+
+    if (waitpid(pid, &status, 0) != pid)
+        return -1;
+
+    if (seconds)
+        *seconds = now() - start;
+
+    return exit_code_of(status);
+}
+
+
+/**
+ * @brief Reads a whole file.
+ * @param path File to read
+ * @param size Set to the number of bytes read
+ * @return Contents (zero terminated) or 0 on failure, to be freed by the caller.
+ */
+char *read_file(const char *path, size_t *size)
+{
+    FILE *file = fopen(path, "rb");
+    char *contents = 0;
+    char *grown;
+    size_t capacity = 0;
+    size_t read;
+
+    *size = 0;
+    if (!file)
+        return 0;
+
+    do
+    {
+        capacity = capacity ? 2 * capacity : 4096;
+        grown = (char*)realloc(contents, capacity + 1);
+        if (!grown)
+        {
+            free(contents);
+            fclose(file);
+            return 0;
+        }
+
+        contents = grown;
+        read = fread(contents + *size, 1, capacity - *size, file);
+        *size += read;
+    }
+    while (*size == capacity);
+
+    contents[*size] = 0;
+    fclose(file);
+
+    return contents;
+}
+
+
+/**
+ * @brief Copies a file.
+ * @return Non-zero on success.
+ */
+int copy_file(const char *source, const char *target)
+{
+    FILE *file;
+    char *contents;
+    size_t size;
+    int written = 0;
+
+    contents = read_file(source, &size);
+    if (!contents)
+        return 0;
+
+    file = fopen(target, "wb");
+    if (file)
+    {
+        written = fwrite(contents, 1, size, file) == size;
+        written &= fclose(file) == 0;
+    }
+
+    free(contents);
+
+    return written;
+}
+
+
+/**
+ * @brief Builds a program with the flags of a variant and runs it.
+ *
+ * Variants starting with --run or --interpret are executed by spasm
+ * directly, all others are assembled into a binary first. Variants starting
+ * with --module build a module and link it alone into the binary.
+ *
+ * @param options Harness options
+ * @param source Program to build
+ * @param variant Space separated spasm flags, "" for the plain template path
+ * @param input File to use as stdin
+ * @param run Set to the result, run->output has to be freed by the caller
+ */
+void run_variant(const ValidateOptions *options, const char *source, const char *variant,
+        const char *input, ValidateRun *run)
+{
+    char flags[VALIDATE_NAME_LENGTH];
+    char target[VALIDATE_NAME_LENGTH + 16];
+    char output[VALIDATE_NAME_LENGTH + 16];
+    char module[VALIDATE_NAME_LENGTH + 16];
+    char *argv[VALIDATE_MAX_ARGS + 4];
+    char *tokens[VALIDATE_MAX_ARGS];
+    size_t argc = 0;
+    size_t count;
+    size_t i;
+    int in_process = strncmp(variant, "--run", 5) == 0 || strncmp(variant, "--interpret", 11) == 0;
+    int linked = strncmp(variant, "--module", 8) == 0;
+
+    memset(run, 0, sizeof(ValidateRun));
+    strncpy(flags, variant, sizeof(flags) - 1);
+    flags[sizeof(flags) - 1] = 0;
+    sprintf(target, "%s/binary", options->work);
+    sprintf(output, "%s/output", options->work);
+    sprintf(module, "%s/module.spo", options->work);
+
+    argv[argc++] = (char*)options->spasm;
+    if (in_process)
+    {
+        /* spasm --run <source> [flags], the mode comes first */
+        count = split_flags(flags, tokens, 0);
+        argv[argc++] = tokens[0];
+        argv[argc++] = (char*)source;
+        for (i = 1; i < count; ++i)
+            argv[argc++] = tokens[i];
+        argv[argc] = 0;
+    }
+    else
+    {
+        argv[argc++] = (char*)source;
+        argv[argc++] = linked ? module : target;
+        argc += split_flags(flags, argv, argc);
+        argv[argc] = 0;
+
+        run->assembled = spawn(argv, 0, 0, options->timeout, 0) == 0;
+        if (run->assembled && linked)
+        {
+            /* spasm link <module> -o <target> */
+            argv[1] = "link";
+            argv[2] = module;
+            argv[3] = "-o";
+            argv[4] = target;
+            argv[5] = 0;
+            run->assembled = spawn(argv, 0, 0, options->timeout, 0) == 0;
+            unlink(module);
+        }
+        if (!run->assembled)
+            return;
+
+        argv[0] = target;
+        argv[1] = 0;
+    }
+
+    run->exit_code = spawn(argv, input, output, options->timeout, &run->seconds);
+    run->timed_out = run->exit_code == 128 + SIGALRM;
+    run->assembled = 1;
+    run->output = read_file(output, &run->output_size);
+
+    unlink(target);
+    unlink(output);
+}
+
+
+/**
+ * @brief Compares a run of a variant against the reference run.
+ */
+Verdict compare_runs(const ValidateRun *reference, const ValidateRun *variant)
+{
+    if (!reference->assembled || reference->timed_out || !reference->output)
+        return VERDICT_SKIPPED;
+
+    if (!variant->assembled)
+        return VERDICT_ASSEMBLY;
+
+    if (variant->timed_out)
+        return VERDICT_TIMEOUT;
+
+    if (!variant->output || variant->output_size != reference->output_size
+            || memcmp(variant->output, reference->output, reference->output_size) != 0)
+        return VERDICT_OUTPUT;
+
+    return variant->exit_code == reference->exit_code ? VERDICT_SAME : VERDICT_EXIT;
+}
+
+
+/**
+ * @brief Builds and runs a program through the template path and a variant.
+ * @param options Harness options
+ * @param source Program to check
+ * @param variant Space separated spasm flags
+ * @param input File to use as stdin
+ * @return Verdict of the comparison.
+ */
+Verdict check_program(const ValidateOptions *options, const char *source, const char *variant, const char *input)
+{
+    ValidateRun reference;
+    ValidateRun run;
+    Verdict verdict;
+
+    run_variant(options, source, "", input, &reference);
+    run_variant(options, source, variant, input, &run);
+    verdict = compare_runs(&reference, &run);
+
+    free(reference.output);
+    free(run.output);
+
+    return verdict;
+}
+
+
+/**
+ * @brief Writes the lines of a program, leaving out a range.
+ * @return Non-zero on success.
+ */
+int write_lines(const char *path, char **lines, const size_t count, const size_t skip, const size_t skip_count)
+{
+    FILE *file = fopen(path, "w");
+    size_t i;
+
+    if (!file)
+        return 0;
+
+    for (i = 0; i < count; ++i)
+    {
+        if (i < skip || i >= skip + skip_count)
+            fprintf(file, "%s\n", lines[i]);
+    }
+
+    return fclose(file) == 0;
+}
+
+
+/**
+ * @brief Shrinks a program to the lines needed to reproduce a verdict.
+ *
+ * Chunks of lines are removed as long as the variant still differs from
+ * the template path in the same way, halving the chunk size down to
+ * single lines. Candidates that no longer assemble or that time out
+ * with the template path are rejected by compare_runs.
+ *
+ * @param options Harness options, options->tests bounds the runs
+ * @param lines Lines of the program, compacted to the remaining lines
+ * @param count Number of lines
+ * @param variant Space separated spasm flags
+ * @param input File to use as stdin
+ * @param verdict Verdict to reproduce
+ * @return Number of remaining lines.
+ */
+size_t minimize(const ValidateOptions *options, char **lines, size_t count,
+        const char *variant, const char *input, const Verdict verdict)
+{
+    char candidate[VALIDATE_NAME_LENGTH + 16];
+    size_t chunk = count / 2 ? count / 2 : 1;
+    size_t start;
+    size_t length;
+    unsigned tests = 0;
+    int removed;
+
+    sprintf(candidate, "%s/candidate.spasm", options->work);
+
+    while (chunk > 0 && tests < options->tests)
+    {
+        removed = 0;
+        for (start = 0; start < count && tests < options->tests; )
+        {
+            length = count - start < chunk ? count - start : chunk;
+
+            ++tests;
+            if (write_lines(candidate, lines, count, start, length)
+                    && check_program(options, candidate, variant, input) == verdict)
+            {
+                memmove(lines + start, lines + start + length, (count - start - length) * sizeof(char*));
+                count -= length;
+                removed = 1;
+            }
+            else
+            {
+                start += length;
+            }
+        }
+
+        /* Single lines are retried until none can be removed */
+        if (chunk > 1 || !removed)
+            chunk /= 2;
+    }
+
+    unlink(candidate);
+
+    return count;
+}
+
+
+/**
+ * @brief Minimizes a mismatching program and stores it in the reproducer directory.
+ * @param options Harness options
+ * @param source Mismatching program
+ * @param name Name of the program
+ * @param variant Index of the mismatching variant
+ * @param input File used as stdin
+ * @param verdict Kind of mismatch
+ * @param path Set to the path of the reproducer
+ * @return Lines of the reproducer, 0 on failure.
+ */
+size_t save_reproducer(const ValidateOptions *options, const char *source, const char *name,
+        const size_t variant, const char *input, const Verdict verdict, char *path)
+{
+    char **lines;
+    char *contents;
+    char *line;
+    size_t size;
+    size_t count = 0;
+    FILE *file;
+    size_t i;
+
+    contents = read_file(source, &size);
+    if (!contents)
+        return 0;
+
+    lines = (char**)malloc((size + 1) * sizeof(char*));
+    if (!lines)
+    {
+        free(contents);
+        return 0;
+    }
+
+    for (line = strtok(contents, "\n"); line; line = strtok(0, "\n"))
+        lines[count++] = line;
+
+    count = minimize(options, lines, count, options->variants[variant], input, verdict);
+
+    mkdir(options->reproducers, 0755);
+    sprintf(path, "%s/%s.%lu.min.spasm", options->reproducers, name, (unsigned long)variant);
+    file = fopen(path, "w");
+    if (file)
+    {
+        fprintf(file, "; %s differs from the template path (%s) with input %s\n",
+                options->variants[variant], VERDICT_NAMES[verdict], input);
+        for (i = 0; i < count; ++i)
+            fprintf(file, "%s\n", lines[i]);
+        fclose(file);
+    }
+
+    free(lines);
+    free(contents);
+
+    return file ? count : 0;
+}
+
+
+/**
+ * @brief xorshift32, the generator must not depend on the C library to
+ *        reproduce programs from a seed everywhere.
+ */
+uint32_t random_below(Generator *generator, const uint32_t limit)
+{
+    generator->state ^= generator->state << 13;
+    generator->state ^= generator->state >> 17;
+    generator->state ^= generator->state << 5;
+
+    return generator->state % limit;
+}
+
+
+/**
+ * @brief Writes commands pushing an array index below RANDOM_ARRAY.
+ */
+void generate_index(Generator *generator)
+{
+    if (generator->counter >= 0 && random_below(generator, 2))
+        fprintf(generator->out, "LA $i%d\nLV\n", generator->counter);
+    else
+        fprintf(generator->out, "LC %u\n", random_below(generator, RANDOM_ARRAY));
+}
+
+
+/**
+ * @brief Writes commands pushing a single value without trapping.
+ */
+void generate_expression(Generator *generator, const unsigned depth)
+{
+    const char operations[][4] = { "ADD", "SUB", "MUL", "AND", "LES", "EQU" };
+    uint32_t choice;
+
+    switch (random_below(generator, depth ? 10 : 3))
+    {
+    case 0:
+        /* Mostly small constants, sometimes ones that overflow or are read */
+        choice = random_below(generator, 8);
+        if (choice)
+            fprintf(generator->out, "LC %u\n", choice > 2
+                    ? random_below(generator, 100) : random_below(generator, 0x7fffffff));
+        else
+            fprintf(generator->out, "REA\n");
+        break;
+    case 1:
+        fprintf(generator->out, "LA $v%u\nLV\n", random_below(generator, generator->scalars));
+        break;
+    case 2:
+        fprintf(generator->out, "LA $%s\n", random_below(generator, 3) ? "arr" : "tab");
+        generate_index(generator);
+        fprintf(generator->out, "ADD\nLV\n");
+        break;
+    case 3:
+        generate_expression(generator, depth - 1);
+        fprintf(generator->out, "NOT\n");
+        break;
+    case 4:
+        /* idiv takes the dividend as unsigned, divisors above 1 keep the quotient in range */
+        generate_expression(generator, depth - 1);
+        fprintf(generator->out, "LC %u\nDIV\n", 2 + random_below(generator, 8));
+        break;
+    default:
+        generate_expression(generator, depth - 1);
+        generate_expression(generator, depth - 1);
+        fprintf(generator->out, "%s\n", operations[random_below(generator, 6)]);
+        break;
+    }
+}
+
+
+void generate_statement(Generator *generator, const unsigned depth);
+
+/**
+ * @brief Writes an expression of the form accepted by the vectorizer.
+ */
+void generate_vector_expression(Generator *generator, const unsigned depth)
+{
+    const char operations[][4] = { "ADD", "SUB", "MUL", "AND" };
+
+    switch (random_below(generator, depth ? 5 : 3))
+    {
+    case 0:
+        fprintf(generator->out, "LA $arr\nLA $i%d\nLV\nADD\nLV\n", generator->counter);
+        break;
+    case 1:
+        fprintf(generator->out, "LC %u\n", random_below(generator, 100));
+        break;
+    case 2:
+        fprintf(generator->out, "LA $v%u\nLV\n", random_below(generator, generator->scalars));
+        break;
+    default:
+        generate_vector_expression(generator, depth - 1);
+        generate_vector_expression(generator, depth - 1);
+        fprintf(generator->out, "%s\n", operations[random_below(generator, 4)]);
+        break;
+    }
+}
+
+
+/**
+ * @brief Writes a loop made of element stores, inductions and reductions
+ *        @see vectorize_loops
+ */
+void generate_vector_loop(Generator *generator)
+{
+    const int outer = generator->counter;
+    const unsigned loop = generator->loops++;
+    unsigned statements = 1 + random_below(generator, 3);
+    unsigned scalar;
+
+    fprintf(generator->out, "LC %u\nLA $i%u\nSTR\n#head%u LA $i%u\nLV\nLC %u\nLES\nJIN #end%u\n",
+            random_below(generator, 3), loop, loop, loop, 4 + random_below(generator, RANDOM_ARRAY - 3), loop);
+
+    generator->counter = (int)loop;
+    while (statements--)
+    {
+        scalar = random_below(generator, generator->scalars);
+        switch (random_below(generator, 3))
+        {
+        case 0:
+            generate_vector_expression(generator, 2);
+            fprintf(generator->out, "LA $arr\nLA $i%u\nLV\nADD\nSTR\n", loop);
+            break;
+        case 1:
+            fprintf(generator->out, "LA $v%u\nLV\nLC %u\nADD\nLA $v%u\nSTR\n",
+                    scalar, random_below(generator, 10), scalar);
+            break;
+        default:
+            fprintf(generator->out, "LA $v%u\nLV\n", scalar);
+            generate_vector_expression(generator, 2);
+            fprintf(generator->out, "%s\nLA $v%u\nSTR\n", random_below(generator, 2) ? "ADD" : "SUB", scalar);
+            break;
+        }
+    }
+    generator->counter = outer;
+
+    fprintf(generator->out, "LA $i%u\nLV\nLC 1\nADD\nLA $i%u\nSTR\nJMP #head%u\n#end%u NOP\n",
+            loop, loop, loop, loop);
+}
+
+/**
+ * @brief Writes a counted loop over at most RANDOM_ARRAY iterations.
+ */
+void generate_loop(Generator *generator, const unsigned depth)
+{
+    const int outer = generator->counter;
+    const unsigned loop = generator->loops++;
+    unsigned statements = 1 + random_below(generator, 4);
+
+    fprintf(generator->out, "LC 0\nLA $i%u\nSTR\n#head%u LA $i%u\nLV\nLC %u\nLES\nJIN #end%u\n",
+            loop, loop, loop, 1 + random_below(generator, RANDOM_ARRAY), loop);
+
+    generator->counter = (int)loop;
+    while (statements--)
+        generate_statement(generator, depth + 1);
+    generator->counter = outer;
+
+    fprintf(generator->out, "LA $i%u\nLV\nLC 1\nADD\nLA $i%u\nSTR\nJMP #head%u\n#end%u NOP\n",
+            loop, loop, loop, loop);
+}
+
+
+/**
+ * @brief Writes a CPY or FIL within $arr, at least half of the copies
+ *        overlap with the source in front of or behind the destination
+ *        unless they copy from $tab.
+ */
+void generate_block(Generator *generator)
+{
+    const uint32_t count = 1 + random_below(generator, RANDOM_ARRAY / 2);
+    const uint32_t target = random_below(generator, RANDOM_ARRAY - count + 1);
+    uint32_t first;
+    uint32_t last;
+    uint32_t source;
+
+    if (random_below(generator, 3) == 0)
+    {
+        generate_expression(generator, RANDOM_DEPTH - 1);
+        fprintf(generator->out, "LA $arr\nLC %u\nADD\nLC %u\nFIL\n", target, count);
+    }
+    else
+    {
+        first = 0;
+        last = RANDOM_ARRAY - count;
+        if (random_below(generator, 2))
+        {
+            first = target + 1 > count ? target + 1 - count : 0;
+            last = target + count - 1 < last ? target + count - 1 : last;
+        }
+        source = first + random_below(generator, last - first + 1);
+        fprintf(generator->out, "LA $%s\nLC %u\nADD\nLA $arr\nLC %u\nADD\nLC %u\nCPY\n",
+                random_below(generator, 4) ? "arr" : "tab", source, target, count);
+    }
+}
+
+
+/**
+ * @brief Writes a stack balanced statement.
+ */
+void generate_statement(Generator *generator, const unsigned depth)
+{
+    const char updates[][4] = { "ADD", "SUB", "MUL" };
+    unsigned scalar = random_below(generator, generator->scalars);
+    unsigned label;
+    unsigned statements;
+
+    switch (random_below(generator, 11))
+    {
+    case 0:
+    case 1:
+    case 2:
+        generate_expression(generator, RANDOM_DEPTH);
+        fprintf(generator->out, "LA $v%u\nSTR\n", scalar);
+        break;
+    case 3:
+        generate_expression(generator, RANDOM_DEPTH);
+        fprintf(generator->out, "LA $arr\n");
+        generate_index(generator);
+        fprintf(generator->out, "ADD\nSTR\n");
+        break;
+    case 4:
+        /* In-place updates in both operand orders */
+        if (random_below(generator, 2))
+            fprintf(generator->out, "LA $v%u\nLV\nLC %u\n%s\n", scalar,
+                    random_below(generator, 200), updates[random_below(generator, 3)]);
+        else
+            fprintf(generator->out, "LC %u\nLA $v%u\nLV\n%s\n",
+                    random_below(generator, 200), scalar, updates[2 * random_below(generator, 2)]);
+        fprintf(generator->out, "LA $v%u\nSTR\n", scalar);
+        break;
+    case 5:
+        generate_expression(generator, RANDOM_DEPTH);
+        fprintf(generator->out, "PRI\n");
+        break;
+    case 9:
+        generate_block(generator);
+        break;
+    case 6:
+    case 7:
+        if (depth < 2)
+        {
+            label = generator->labels++;
+            generate_expression(generator, RANDOM_DEPTH - 1);
+            fprintf(generator->out, "JIN #else%u\n", label);
+            for (statements = 1 + random_below(generator, 3); statements; --statements)
+                generate_statement(generator, depth + 1);
+            fprintf(generator->out, "#else%u NOP\n", label);
+            break;
+        }
+        /* fall through */
+    case 8:
+        if (depth < 2 && generator->loops < RANDOM_LOOPS)
+        {
+            generate_vector_loop(generator);
+            break;
+        }
+        /* fall through */
+    default:
+        if (depth < 2 && generator->loops < RANDOM_LOOPS)
+            generate_loop(generator, depth);
+        else
+            fprintf(generator->out, "LA $v%u\nLV\nPRI\n", scalar);
+        break;
+    }
+}
+
+
+/**
+ * @brief Writes a random stack balanced program that terminates and can't trap.
+ * @param path File to write
+ * @param input File to write the line read by REA to
+ * @param seed Seed of the program, the same seed yields the same program
+ * @return Non-zero on success.
+ */
+int generate_program(const char *path, const char *input, const uint32_t seed)
+{
+    Generator generator;
+    int initialized[RANDOM_SCALARS];
+    unsigned statements;
+    unsigned i;
+    FILE *file;
+
+    memset(&generator, 0, sizeof(Generator));
+    generator.out = fopen(path, "w");
+    generator.state = seed ? seed : 0x9e3779b9;
+    generator.counter = -1;
+    if (!generator.out)
+        return 0;
+
+    /* Mix the seed so neighbouring seeds start differently */
+    for (i = 0; i < 8; ++i)
+        random_below(&generator, 2);
+
+    generator.scalars = 1 + random_below(&generator, RANDOM_SCALARS);
+    fprintf(generator.out, "; random program, seed %lu\n", (unsigned long)seed);
+    /* Scalars are zeroed and stored or initialized with DD, sometimes with a
+     * second word from a repeated DD */
+    for (i = 0; i < generator.scalars; ++i)
+    {
+        initialized[i] = random_below(&generator, 2);
+        if (!initialized[i])
+            fprintf(generator.out, "DS $v%u 1\n", i);
+        else if (random_below(&generator, 3))
+            fprintf(generator.out, "DD $v%u %u\n", i, random_below(&generator, 1000));
+        else
+            fprintf(generator.out, "DD $v%u %u\nDD $v%u %u\n", i, random_below(&generator, 1000),
+                    i, random_below(&generator, 1000));
+    }
+    for (i = 0; i < RANDOM_LOOPS; ++i)
+        fprintf(generator.out, "DS $i%u 1\n", i);
+
+    /* A read only table between the DS variables, split over two DC */
+    for (i = 0; i < RANDOM_ARRAY; ++i)
+        fprintf(generator.out, "%s%u%s", i % (RANDOM_ARRAY / 2) ? " " : "DC $tab ", random_below(&generator, 1000),
+                (i + 1) % (RANDOM_ARRAY / 2) ? "" : "\n");
+    fprintf(generator.out, "DS $arr %u\n", RANDOM_ARRAY);
+
+    for (i = 0; i < generator.scalars; ++i)
+    {
+        if (!initialized[i])
+            fprintf(generator.out, "LC %u\nLA $v%u\nSTR\n", random_below(&generator, 1000), i);
+    }
+
+    for (statements = 4 + random_below(&generator, 12); statements; --statements)
+        generate_statement(&generator, 0);
+
+    for (i = 0; i < generator.scalars; ++i)
+        fprintf(generator.out, "LA $v%u\nLV\nPRI\n", i);
+    for (i = 0; i < RANDOM_ARRAY; ++i)
+        fprintf(generator.out, "LA $arr\nLC %u\nADD\nLV\nPRI\n", i);
+    fprintf(generator.out, "STP\n");
+
+    if (fclose(generator.out) != 0)
+        return 0;
+
+    /* readint32 reparses the buffer at the end of input, every REA reads this line */
+    file = fopen(input, "w");
+    if (!file)
+        return 0;
+    fprintf(file, "%s%u\n", random_below(&generator, 2) ? "-" : "", random_below(&generator, 1000));
+
+    return fclose(file) == 0;
+}
+
+
+/**
+ * @brief Variants checked if none are given: every faster code path alone
+ *        and all of them combined, and every target and binary layout.
+ */
+const char *VALIDATE_DEFAULT_VARIANTS[] = {
+        "--vectorize", "--fuse", "--indexed", "--loop-invariants", "--value-numbering", "--data-layout",
+        "--align-loops", "--threads=4",
+        "--vectorize --fuse --indexed --data-layout --align-loops --threads=4",
+        "-O1", "-O2", "--module", "--compact", "--arch=x86_64", "--arch=x86_64 --compact",
+        "--run", "--run --vectorize --fuse --indexed --data-layout --align-loops", "--run --loop-invariants",
+        "--run --value-numbering", "--run -O2", "--interpret --loop-invariants", 0 };
+
+
+typedef struct VariantSummary VariantSummary;
+
+/**
+ * @brief Results of a variant over all programs.
+ */
+struct VariantSummary
+{
+    unsigned checked;
+    unsigned mismatches;
+    unsigned skipped;
+    unsigned timed; /* checks with a runtime ratio */
+    double log_ratio; /* sum of the logarithms of the runtime ratios */
+};
+
+
+/**
+ * @brief Checks a program with one input against every variant.
+ * @param options Harness options
+ * @param source Program to check
+ * @param name Name of the program in the report
+ * @param input File to use as stdin
+ * @param summaries Per variant results to update
+ */
+void validate_program(const ValidateOptions *options, const char *source, const char *name,
+        const char *input, VariantSummary *summaries)
+{
+    char path[2 * VALIDATE_NAME_LENGTH];
+    ValidateRun reference;
+    ValidateRun run;
+    Verdict verdict;
+    size_t lines;
+    size_t v;
+
+    run_variant(options, source, "", input, &reference);
+
+    for (v = 0; v < options->variant_count; ++v)
+    {
+        run_variant(options, source, options->variants[v], input, &run);
+        verdict = compare_runs(&reference, &run);
+
+        printf("%-24s %-16s %-40s ", name, input, options->variants[v]);
+        if (verdict == VERDICT_SAME)
+        {
+            ++summaries[v].checked;
+            if (reference.seconds > 0 && run.seconds > 0)
+            {
+                ++summaries[v].timed;
+                summaries[v].log_ratio += log(run.seconds / reference.seconds);
+            }
+            printf("ok  %.3fx\n", reference.seconds > 0 ? run.seconds / reference.seconds : 0.0);
+        }
+        else if (verdict == VERDICT_SKIPPED)
+        {
+            ++summaries[v].skipped;
+            printf("skipped (template path %s)\n", reference.assembled ? "timed out" : "failed to assemble");
+        }
+        else
+        {
+            ++summaries[v].checked;
+            ++summaries[v].mismatches;
+            printf("MISMATCH (%s)\n", VERDICT_NAMES[verdict]);
+            fflush(stdout);
+
+            lines = save_reproducer(options, source, name, v, input, verdict, path);
+            if (lines)
+                printf("    reproducer: %s (%lu lines)\n", path, (unsigned long)lines);
+        }
+        fflush(stdout);
+
+        free(run.output);
+    }
+
+    free(reference.output);
+}
+
+
+/**
+ * @brief Total number of mismatches of all variants.
+ */
+unsigned count_mismatches(const VariantSummary *summaries, const size_t count)
+{
+    unsigned mismatches = 0;
+    size_t i;
+
+    for (i = 0; i < count; ++i)
+        mismatches += summaries[i].mismatches;
+
+    return mismatches;
+}
+
+
+void print_usage(const char *name)
+{
+    fprintf(stderr, "Usage:\n"
+           "    %s [--spasm=<binary>] [--input=<file>]... [--variant=<spasm flags>]...\n"
+           "        [--random=<n>] [--seed=<n>] [--timeout=<seconds>] [--tests=<n>]\n"
+           "        [--reproducers=<directory>] [<source>...]\n",
+           name);
+}
+
+
+int main(int argn, char **argv)
+{
+    ValidateOptions options;
+    VariantSummary *summaries;
+    char source[VALIDATE_NAME_LENGTH + 32];
+    char name[VALIDATE_NAME_LENGTH];
+    char input[VALIDATE_NAME_LENGTH + 32];
+    char path[2 * VALIDATE_NAME_LENGTH];
+    const char **sources;
+    const char *base;
+    size_t source_count = 0;
+    size_t length;
+    size_t i;
+    size_t j;
+    unsigned mismatches;
+    unsigned before;
+
+    memset(&options, 0, sizeof(ValidateOptions));
+    options.spasm = "./spasm";
+    options.reproducers = "validate-failures";
+    options.seed = 1;
+    options.timeout = VALIDATE_DEFAULT_TIMEOUT;
+    options.tests = VALIDATE_DEFAULT_TESTS;
+
+    sources = (const char**)malloc(argn * sizeof(const char*));
+    if (!sources)
+        return EXIT_FAILURE;
+
+    for (i = 1; i < (size_t)argn; ++i)
+    {
+        if (strncmp(argv[i], "--spasm=", 8) == 0)
+            options.spasm = argv[i] + 8;
+        else if (strncmp(argv[i], "--input=", 8) == 0 && options.input_count < VALIDATE_MAX_INPUTS)
+            options.inputs[options.input_count++] = argv[i] + 8;
+        else if (strncmp(argv[i], "--variant=", 10) == 0 && options.variant_count < VALIDATE_MAX_VARIANTS)
+            options.variants[options.variant_count++] = argv[i] + 10;
+        else if (strncmp(argv[i], "--random=", 9) == 0)
+            options.random = (unsigned)strtoul(argv[i] + 9, 0, 10);
+        else if (strncmp(argv[i], "--seed=", 7) == 0)
+            options.seed = (uint32_t)strtoul(argv[i] + 7, 0, 10);
+        else if (strncmp(argv[i], "--timeout=", 10) == 0)
+            options.timeout = (unsigned)strtoul(argv[i] + 10, 0, 10);
+        else if (strncmp(argv[i], "--tests=", 8) == 0)
+            options.tests = (unsigned)strtoul(argv[i] + 8, 0, 10);
+        else if (strncmp(argv[i], "--reproducers=", 14) == 0)
+            options.reproducers = argv[i] + 14;
+        else if (strncmp(argv[i], "--", 2) != 0)
+            sources[source_count++] = argv[i];
+        else
+            break;
+    }
+
+    if (i < (size_t)argn || (!source_count && !options.random) || !options.timeout)
+    {
+        print_usage(argv[0]);
+        free(sources);
+        return EXIT_FAILURE;
+    }
+
+    if (!options.variant_count)
+    {
+        for (i = 0; VALIDATE_DEFAULT_VARIANTS[i]; ++i)
+            options.variants[options.variant_count++] = VALIDATE_DEFAULT_VARIANTS[i];
+    }
+
+    if (!options.input_count)
+        options.inputs[options.input_count++] = "/dev/null";
+
+    summaries = (VariantSummary*)calloc(options.variant_count, sizeof(VariantSummary));
+    strcpy(options.work, "/tmp/spasm_validate_XXXXXX");
+    if (!summaries || !mkdtemp(options.work))
+    {
+        fprintf(stderr, "Failed to create a temporary directory\n");
+        free(sources);
+        free(summaries);
+        return EXIT_FAILURE;
+    }
+
+    for (i = 0; i < source_count; ++i)
+    {
+        base = strrchr(sources[i], '/');
+        strncpy(name, base ? base + 1 : sources[i], sizeof(name) - 1);
+        name[sizeof(name) - 1] = 0;
+        length = strlen(name);
+        if (length > 6 && strcmp(name + length - 6, ".spasm") == 0)
+            name[length - 6] = 0;
+
+        /* Programs are also run with <name>.in if present */
+        length = strlen(sources[i]);
+        if (length > 6 && length < sizeof(input) - 3 && strcmp(sources[i] + length - 6, ".spasm") == 0)
+        {
+            memcpy(input, sources[i], length - 6);
+            strcpy(input + length - 6, ".in");
+            if (access(input, R_OK) == 0)
+                validate_program(&options, sources[i], name, input, summaries);
+        }
+
+        for (j = 0; j < options.input_count; ++j)
+            validate_program(&options, sources[i], name, options.inputs[j], summaries);
+    }
+
+    for (i = 0; i < options.random; ++i)
+    {
+        sprintf(source, "%s/random.spasm", options.work);
+        sprintf(input, "%s/random.in", options.work);
+        sprintf(name, "random-%lu", (unsigned long)(options.seed + i));
+        if (!generate_program(source, input, options.seed + (uint32_t)i))
+            continue;
+
+        /* Random programs only read their own input */
+        before = count_mismatches(summaries, options.variant_count);
+        validate_program(&options, source, name, input, summaries);
+
+        /* Keep the generated program and its input next to its reproducers */
+        if (count_mismatches(summaries, options.variant_count) > before)
+        {
+            sprintf(path, "%s/%s.spasm", options.reproducers, name);
+            if (copy_file(source, path))
+                printf("    program: %s\n", path);
+            sprintf(path, "%s/%s.in", options.reproducers, name);
+            copy_file(input, path);
+        }
+        unlink(source);
+        unlink(input);
+    }
+
+    printf("\n%-56s %8s %10s %8s %14s\n", "Variant", "checked", "mismatches", "skipped", "runtime ratio");
+    for (i = 0; i < options.variant_count; ++i)
+    {
+        printf("%-56s %8u %10u %8u ", options.variants[i], summaries[i].checked,
+                summaries[i].mismatches, summaries[i].skipped);
+        if (summaries[i].timed)
+            printf("%13.3fx\n", exp(summaries[i].log_ratio / summaries[i].timed));
+        else
+            printf("%14s\n", "-");
+    }
+
+    mismatches = count_mismatches(summaries, options.variant_count);
+    rmdir(options.work);
+    free(sources);
+    free(summaries);
+
+    return mismatches ? EXIT_FAILURE : EXIT_SUCCESS;
+}